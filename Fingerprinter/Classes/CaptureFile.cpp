@@ -0,0 +1,436 @@
+/*
+ *  CaptureFile.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "CaptureFile.h"
+#include "SensorCodec.h"
+#include <string.h>
+#include <zlib.h>
+
+// -----------------------------------------------------------------------------
+// CONSTANTS
+#define COMPRESSION_LEVEL 1 // fastest; sensor data is flushed from a background thread but often
+#define WRITE_BUFFER_BYTES (256*1024)
+
+
+// -----------------------------------------------------------------------------
+// WRITER
+
+CaptureWriter::CaptureWriter( const char* filename, double clockOffset ) : offset(0){
+	pthread_mutex_init( &lock, NULL );
+	file = fopen( filename, "wb" );
+	if( !file ){
+		fprintf( stderr, "Error: could not open capture file %s\n", filename );
+		return;
+	}
+	setvbuf( file, NULL, _IOFBF, WRITE_BUFFER_BYTES );
+	CaptureFileHeader header;
+	memset( &header, 0, sizeof(header) );
+	memcpy( header.magic, CAPTURE_MAGIC, 4 );
+	header.version = CAPTURE_VERSION;
+	header.clockOffset = clockOffset;
+	writeBytes( &header, sizeof(header) );
+	fflush( file );
+}
+
+CaptureWriter::~CaptureWriter(){
+	close();
+	pthread_mutex_destroy( &lock );
+}
+
+bool CaptureWriter::isOpen(){
+	return file != NULL;
+}
+
+bool CaptureWriter::writeBytes( const void* data, unsigned int bytes ){
+	if( bytes == 0 ) return true;
+	if( fwrite( data, bytes, 1, file ) != 1 ){
+		fprintf( stderr, "Error: capture file write failed\n" );
+		return false;
+	}
+	offset += bytes;
+	return true;
+}
+
+unsigned int CaptureWriter::addStream( const char* name, SensorLogRecordType type, unsigned int recordSize,
+									   bool compress ){
+	CaptureStreamInfo info;
+	memset( &info, 0, sizeof(info) );
+	info.recordType = type;
+	info.recordSize = recordSize;
+	info.flags = 0;
+	if( compress ){
+		info.flags |= CAPTURE_COMPRESSED;
+		if( recordSize > 0 && sensorCodecSupports( type, recordSize ) ) info.flags |= CAPTURE_ENCODED;
+	}
+	strncpy( info.name, name, CAPTURE_NAME_LENGTH );
+
+	pthread_mutex_lock( &lock );
+	unsigned int streamId = streams.size();
+	streams.push_back( info );
+	if( file ){
+		CaptureChunkHeader chunk;
+		memset( &chunk, 0, sizeof(chunk) );
+		chunk.type = CaptureChunkStream;
+		chunk.streamId = streamId;
+		chunk.rawBytes = chunk.storedBytes = sizeof(info);
+		writeBytes( &chunk, sizeof(chunk) );
+		writeBytes( &info, sizeof(info) );
+		fflush( file );
+	}
+	pthread_mutex_unlock( &lock );
+	return streamId;
+}
+
+void CaptureWriter::writeChunk( CaptureChunkType type, unsigned int streamId, unsigned int recordCount,
+							    double startTime, double endTime, const void* payload, unsigned int bytes,
+							    const void* payload2, unsigned int bytes2 ){
+	if( !file ) return;
+	CaptureChunkHeader chunk;
+	memset( &chunk, 0, sizeof(chunk) );
+	chunk.type = type;
+	chunk.streamId = streamId;
+	chunk.recordCount = recordCount;
+	chunk.startTime = startTime;
+	chunk.endTime = endTime;
+	chunk.rawBytes = chunk.storedBytes = bytes + bytes2;
+
+	// encode records if requested, keeping the result only if it is smaller
+	if( type == CaptureChunkRecords && ( streams[streamId].flags & CAPTURE_ENCODED ) &&
+	    sensorCodecEncode( (SensorLogRecordType)streams[streamId].recordType, streams[streamId].recordSize,
+	                       payload, recordCount, encoded ) &&
+	    encoded.size() < bytes ){
+		chunk.flags |= CAPTURE_ENCODED;
+		payload = &encoded[0];
+		bytes = encoded.size();
+		chunk.rawBytes = chunk.storedBytes = bytes;
+	}
+
+	// compress if requested, keeping the result only if it is smaller
+	if( streams[streamId].flags & CAPTURE_COMPRESSED ){
+		z_stream z;
+		memset( &z, 0, sizeof(z) );
+		if( deflateInit( &z, COMPRESSION_LEVEL ) == Z_OK ){
+			buffer.resize( deflateBound( &z, chunk.rawBytes ) );
+			z.next_out = &buffer[0];
+			z.avail_out = buffer.size();
+			z.next_in = (Bytef*)payload;
+			z.avail_in = bytes;
+			int status = deflate( &z, payload2? Z_NO_FLUSH : Z_FINISH );
+			if( payload2 && status == Z_OK ){
+				z.next_in = (Bytef*)payload2;
+				z.avail_in = bytes2;
+				status = deflate( &z, Z_FINISH );
+			}
+			if( status == Z_STREAM_END && z.total_out < chunk.rawBytes ){
+				chunk.flags |= CAPTURE_COMPRESSED;
+				chunk.storedBytes = z.total_out;
+			}
+			deflateEnd( &z );
+		}
+	}
+
+	CaptureIndexEntry entry;
+	entry.offset = offset;
+	entry.startTime = startTime;
+	entry.endTime = endTime;
+	entry.streamId = streamId;
+	entry.recordCount = recordCount;
+
+	bool ok = writeBytes( &chunk, sizeof(chunk) );
+	if( chunk.flags & CAPTURE_COMPRESSED ){
+		ok = ok && writeBytes( &buffer[0], chunk.storedBytes );
+	}else{
+		ok = ok && writeBytes( payload, bytes ) && writeBytes( payload2, bytes2 );
+	}
+	// flush each chunk, so that a crash loses as little as possible
+	fflush( file );
+	if( ok ) index.push_back( entry );
+}
+
+void CaptureWriter::writeRecords( unsigned int streamId, const void* records, unsigned int bytes ){
+	pthread_mutex_lock( &lock );
+	if( streamId < streams.size() && streams[streamId].recordSize > 0 ){
+		unsigned int recordSize = streams[streamId].recordSize;
+		unsigned int count = bytes / recordSize;
+		if( count > 0 ){
+			// every record starts with its timestamp
+			const unsigned char* r = (const unsigned char*)records;
+			double startTime, endTime;
+			memcpy( &startTime, r, sizeof(double) );
+			memcpy( &endTime, r + (count-1)*recordSize, sizeof(double) );
+			writeChunk( CaptureChunkRecords, streamId, count, startTime, endTime, records, count*recordSize );
+		}
+	}
+	pthread_mutex_unlock( &lock );
+}
+
+void CaptureWriter::writeBlob( unsigned int streamId, double timestamp, const void* data, unsigned int length ){
+	CaptureBlobHeader blob;
+	memset( &blob, 0, sizeof(blob) );
+	blob.timestamp = timestamp;
+	blob.length = length;
+	pthread_mutex_lock( &lock );
+	if( streamId < streams.size() && streams[streamId].recordSize == 0 ){
+		writeChunk( CaptureChunkBlob, streamId, 1, timestamp, timestamp, &blob, sizeof(blob), data, length );
+	}
+	pthread_mutex_unlock( &lock );
+}
+
+void CaptureWriter::close(){
+	pthread_mutex_lock( &lock );
+	if( file ){
+		// index chunk, which is never compressed
+		uint64_t indexOffset = offset;
+		uint32_t numStreams = streams.size();
+		CaptureChunkHeader chunk;
+		memset( &chunk, 0, sizeof(chunk) );
+		chunk.type = CaptureChunkIndex;
+		chunk.recordCount = index.size();
+		chunk.rawBytes = chunk.storedBytes = sizeof(numStreams) + numStreams*sizeof(CaptureStreamInfo)
+		                                     + index.size()*sizeof(CaptureIndexEntry);
+		writeBytes( &chunk, sizeof(chunk) );
+		writeBytes( &numStreams, sizeof(numStreams) );
+		if( numStreams ) writeBytes( &streams[0], numStreams*sizeof(CaptureStreamInfo) );
+		if( index.size() ) writeBytes( &index[0], index.size()*sizeof(CaptureIndexEntry) );
+
+		CaptureTrailer trailer;
+		memset( &trailer, 0, sizeof(trailer) );
+		trailer.indexOffset = indexOffset;
+		memcpy( trailer.magic, CAPTURE_INDEX_MAGIC, 4 );
+		writeBytes( &trailer, sizeof(trailer) );
+		fclose( file );
+		file = NULL;
+	}
+	pthread_mutex_unlock( &lock );
+}
+
+
+// -----------------------------------------------------------------------------
+// READER
+
+CaptureReader::CaptureReader( const char* filename ) : valid(false){
+	file = fopen( filename, "rb" );
+	if( !file ) return;
+	if( fread( &header, sizeof(header), 1, file ) != 1 ||
+	    memcmp( header.magic, CAPTURE_MAGIC, 4 ) != 0 ||
+	    header.version < 1 || header.version > CAPTURE_VERSION ){
+		return;
+	}
+	valid = true;
+	if( !loadIndex() ){
+		// file was not closed cleanly
+		scanChunks();
+	}
+}
+
+CaptureReader::~CaptureReader(){
+	if( file ) fclose( file );
+}
+
+bool CaptureReader::isOpen(){
+	return valid;
+}
+
+double CaptureReader::getClockOffset(){
+	return header.clockOffset;
+}
+
+unsigned int CaptureReader::getNumStreams(){
+	return streams.size();
+}
+
+const CaptureStreamInfo& CaptureReader::getStream( unsigned int streamId ){
+	return streams[streamId];
+}
+
+int CaptureReader::findStream( const char* name ){
+	for( unsigned int i=0; i<streams.size(); ++i ){
+		if( strncmp( streams[i].name, name, CAPTURE_NAME_LENGTH ) == 0 ) return i;
+	}
+	return -1;
+}
+
+const std::vector<CaptureIndexEntry>& CaptureReader::getIndex(){
+	return index;
+}
+
+bool CaptureReader::loadIndex(){
+	CaptureTrailer trailer;
+	if( fseeko( file, -(off_t)sizeof(trailer), SEEK_END ) != 0 ||
+	    fread( &trailer, sizeof(trailer), 1, file ) != 1 ||
+	    memcmp( trailer.magic, CAPTURE_INDEX_MAGIC, 4 ) != 0 ){
+		return false;
+	}
+	CaptureChunkHeader chunk;
+	if( !readPayload( trailer.indexOffset, &chunk, payload ) ||
+	    chunk.type != CaptureChunkIndex || payload.size() < sizeof(uint32_t) ){
+		return false;
+	}
+	uint32_t numStreams;
+	memcpy( &numStreams, &payload[0], sizeof(numStreams) );
+	unsigned int indexStart = sizeof(numStreams) + numStreams*sizeof(CaptureStreamInfo);
+	if( payload.size() != indexStart + chunk.recordCount*sizeof(CaptureIndexEntry) ){
+		return false;
+	}
+	streams.resize( numStreams );
+	index.resize( chunk.recordCount );
+	if( numStreams ) memcpy( &streams[0], &payload[sizeof(numStreams)], numStreams*sizeof(CaptureStreamInfo) );
+	if( chunk.recordCount ) memcpy( &index[0], &payload[indexStart], chunk.recordCount*sizeof(CaptureIndexEntry) );
+	return true;
+}
+
+void CaptureReader::scanChunks(){
+	streams.clear();
+	index.clear();
+	uint64_t offset = sizeof(header);
+	CaptureChunkHeader chunk;
+	while( fseeko( file, offset, SEEK_SET ) == 0 && fread( &chunk, sizeof(chunk), 1, file ) == 1 ){
+		uint64_t next = offset + sizeof(chunk) + chunk.storedBytes;
+		if( chunk.type == CaptureChunkStream ){
+			CaptureStreamInfo info;
+			if( chunk.storedBytes != sizeof(info) || fread( &info, sizeof(info), 1, file ) != 1 ) break;
+			if( chunk.streamId != streams.size() ) break; // corrupt
+			streams.push_back( info );
+		}else if( chunk.type == CaptureChunkRecords || chunk.type == CaptureChunkBlob ){
+			// make sure the whole chunk made it to disk
+			if( fseeko( file, next-1, SEEK_SET ) != 0 || fgetc( file ) == EOF ) break;
+			CaptureIndexEntry entry;
+			entry.offset = offset;
+			entry.startTime = chunk.startTime;
+			entry.endTime = chunk.endTime;
+			entry.streamId = chunk.streamId;
+			entry.recordCount = chunk.recordCount;
+			index.push_back( entry );
+		}else if( chunk.type != CaptureChunkIndex ){
+			break; // corrupt
+		}
+		offset = next;
+	}
+}
+
+bool CaptureReader::readPayload( uint64_t offset, CaptureChunkHeader* chunk, std::vector<unsigned char>& out ){
+	if( fseeko( file, offset, SEEK_SET ) != 0 || fread( chunk, sizeof(*chunk), 1, file ) != 1 ){
+		return false;
+	}
+	// encoded records are first read (and uncompressed) into another buffer
+	bool isEncoded = ( chunk->flags & CAPTURE_ENCODED ) != 0;
+	std::vector<unsigned char>& raw = isEncoded? encoded : out;
+	raw.resize( chunk->rawBytes );
+	if( chunk->rawBytes > 0 ){
+		if( !( chunk->flags & CAPTURE_COMPRESSED ) ){
+			if( fread( &raw[0], chunk->rawBytes, 1, file ) != 1 ) return false;
+		}else{
+			stored.resize( chunk->storedBytes );
+			if( chunk->storedBytes == 0 || fread( &stored[0], chunk->storedBytes, 1, file ) != 1 ) return false;
+			uLongf rawBytes = chunk->rawBytes;
+			if( uncompress( &raw[0], &rawBytes, &stored[0], chunk->storedBytes ) != Z_OK ||
+			    rawBytes != chunk->rawBytes ){
+				return false;
+			}
+		}
+	}
+	if( !isEncoded ) return true;
+
+	if( chunk->type != CaptureChunkRecords || chunk->streamId >= streams.size() ) return false;
+	const CaptureStreamInfo& info = streams[chunk->streamId];
+	out.resize( chunk->recordCount * info.recordSize );
+	return chunk->recordCount > 0 &&
+	       sensorCodecDecode( (SensorLogRecordType)info.recordType, info.recordSize, &raw[0], raw.size(),
+	                          &out[0], chunk->recordCount );
+}
+
+unsigned int CaptureReader::read( unsigned int streamId, double start, double end,
+								  CaptureCallback callback, void* context ){
+	if( streamId >= streams.size() ) return 0;
+	unsigned int recordSize = streams[streamId].recordSize;
+	unsigned int count = 0;
+	for( unsigned int i=0; i<index.size(); ++i ){
+		const CaptureIndexEntry& e = index[i];
+		// skip other streams and chunks outside of the range without reading them
+		if( e.streamId != streamId || e.endTime < start || e.startTime > end ) continue;
+		CaptureChunkHeader chunk;
+		if( !readPayload( e.offset, &chunk, payload ) ){
+			fprintf( stderr, "Error: could not read capture chunk at %llu\n", (unsigned long long)e.offset );
+			continue;
+		}
+		if( chunk.type == CaptureChunkBlob ){
+			CaptureBlobHeader blob;
+			if( payload.size() < sizeof(blob) ) continue;
+			memcpy( &blob, &payload[0], sizeof(blob) );
+			if( blob.length > payload.size() - sizeof(blob) ) continue;
+			callback( blob.timestamp, &payload[sizeof(blob)], blob.length, context );
+			++count;
+		}else if( chunk.type == CaptureChunkRecords && recordSize > 0 ){
+			for( unsigned int j=0; j+recordSize<=payload.size(); j+=recordSize ){
+				double t;
+				memcpy( &t, &payload[j], sizeof(t) );
+				if( t < start || t > end ) continue;
+				callback( t, &payload[j], recordSize, context );
+				++count;
+			}
+		}
+	}
+	return count;
+}
+
+
+// -----------------------------------------------------------------------------
+// CURSOR
+
+CaptureCursor::CaptureCursor( CaptureReader* myReader, unsigned int myStreamId, double myStart ) :
+reader(myReader), streamId(myStreamId), start(myStart), indexPos(0), pos(0){
+	chunk.type = 0; // nothing loaded
+}
+
+bool CaptureCursor::loadChunk(){
+	const std::vector<CaptureIndexEntry>& index = reader->index;
+	while( indexPos < index.size() ){
+		const CaptureIndexEntry& e = index[indexPos++];
+		// skip chunks of other streams, and chunks which end before the start time
+		if( e.streamId != streamId || e.endTime < start ) continue;
+		if( !reader->readPayload( e.offset, &chunk, payload ) ){
+			fprintf( stderr, "Error: could not read capture chunk at %llu\n", (unsigned long long)e.offset );
+			continue;
+		}
+		pos = 0;
+		return true;
+	}
+	return false;
+}
+
+bool CaptureCursor::next( const void** data, unsigned int* length, double* timestamp ){
+	if( streamId >= reader->streams.size() ) return false;
+	unsigned int recordSize = reader->streams[streamId].recordSize;
+	while( true ){
+		if( chunk.type == CaptureChunkBlob && pos == 0 ){
+			CaptureBlobHeader blob;
+			pos = payload.size(); // one blob per chunk
+			if( payload.size() >= sizeof(blob) ){
+				memcpy( &blob, &payload[0], sizeof(blob) );
+				if( blob.timestamp >= start && blob.length <= payload.size() - sizeof(blob) ){
+					*data = &payload[sizeof(blob)];
+					*length = blob.length;
+					*timestamp = blob.timestamp;
+					return true;
+				}
+			}
+		}else if( chunk.type == CaptureChunkRecords && recordSize > 0 ){
+			while( pos + recordSize <= payload.size() ){
+				double t;
+				memcpy( &t, &payload[pos], sizeof(t) );
+				*data = &payload[pos];
+				pos += recordSize;
+				if( t < start ) continue;
+				*length = recordSize;
+				*timestamp = t;
+				return true;
+			}
+		}
+		if( !loadChunk() ) return false;
+	}
+}
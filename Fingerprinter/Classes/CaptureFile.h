@@ -0,0 +1,204 @@
+/*
+ *  CaptureFile.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * A single file holding every sensor stream of a capture session.  The file
+ * is a CaptureFileHeader followed by chunks.  Each chunk has a header giving
+ * its stream, time span and size, so a reader can skip any chunk it does not
+ * need.  Stream chunks declare the streams; data chunks carry either a block
+ * of fixed-size records (as in SensorLog.h) or a single variable-size blob
+ * such as a JPEG image.  Records of motion and spectrum streams may be
+ * delta encoded (see SensorCodec.h), and data chunk payloads may be zlib
+ * compressed.
+ *
+ * When the file is closed an index of all data chunks is appended, followed
+ * by a CaptureTrailer pointing to it.  If a capture was cut short the reader
+ * rebuilds the index by walking the chunk headers.
+ *
+ * Every record and blob starts with a double timestamp on the monotonic
+ * clock of SensorLogService::now(), which is shared by all streams.
+ */
+
+#ifndef CAPTURE_FILE_H
+#define CAPTURE_FILE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "SensorLog.h"
+
+#define CAPTURE_MAGIC "BPCF"
+#define CAPTURE_INDEX_MAGIC "BPCI"
+#define CAPTURE_VERSION 2 // version 1 files, which have no encoded chunks, are also read
+#define CAPTURE_NAME_LENGTH 31
+
+/* start of every capture file */
+struct CaptureFileHeader{
+	char magic[4]; // CAPTURE_MAGIC
+	uint32_t version;
+	double clockOffset; // add to a timestamp to get seconds since the NSDate reference date
+};
+
+typedef enum{
+	CaptureChunkStream = 1, // payload is a CaptureStreamInfo
+	CaptureChunkRecords,    // payload is recordCount fixed-size records
+	CaptureChunkBlob,       // payload is a CaptureBlobHeader followed by the blob
+	CaptureChunkIndex       // payload is a uint32_t stream count, that many CaptureStreamInfos
+	                        // and then one CaptureIndexEntry per data chunk
+} CaptureChunkType;
+
+// chunk flags
+#define CAPTURE_COMPRESSED 1 // payload is zlib compressed
+#define CAPTURE_ENCODED 2    // records are encoded with sensorCodecEncode, before any compression
+
+struct CaptureChunkHeader{
+	uint32_t type;        // a CaptureChunkType
+	uint32_t streamId;
+	uint32_t flags;
+	uint32_t recordCount;
+	double startTime;     // timestamp of the first record
+	double endTime;       // timestamp of the last record
+	uint32_t rawBytes;    // payload size, uncompressed but still encoded
+	uint32_t storedBytes; // payload size in the file
+};
+
+/* declaration of one stream */
+struct CaptureStreamInfo{
+	uint32_t recordType; // a SensorLogRecordType
+	uint32_t recordSize; // bytes per record, or 0 for a stream of blobs
+	uint32_t flags;      // CAPTURE_COMPRESSED and CAPTURE_ENCODED if data chunks should be
+	char name[CAPTURE_NAME_LENGTH+1];
+};
+
+struct CaptureBlobHeader{
+	double timestamp;
+	uint32_t length; // bytes of blob data which follow
+	uint32_t reserved;
+};
+
+struct CaptureIndexEntry{
+	uint64_t offset; // of the chunk header
+	double startTime;
+	double endTime;
+	uint32_t streamId;
+	uint32_t recordCount;
+};
+
+/* last bytes of a cleanly closed file */
+struct CaptureTrailer{
+	uint64_t indexOffset; // of the index chunk header
+	char magic[4]; // CAPTURE_INDEX_MAGIC
+	uint32_t reserved;
+};
+
+
+/* Writes a capture file.  All methods may be called from any thread. */
+class CaptureWriter{
+public:
+	/* creates (or truncates) the file */
+	CaptureWriter( const char* filename, double clockOffset );
+	/* closes the file, if not already closed */
+	~CaptureWriter();
+	bool isOpen();
+	/**
+	 * Declares a new stream.
+	 * @param recordSize is the size of each record, or 0 for a stream of blobs.
+	 * @param compress is true if the stream's data should be compressed, and also encoded if
+	 *   sensorCodecSupports() the record type.
+	 * @return the new stream's id.
+	 */
+	unsigned int addStream( const char* name, SensorLogRecordType type, unsigned int recordSize, bool compress );
+	/* writes a chunk of whole records for a fixed-size stream */
+	void writeRecords( unsigned int streamId, const void* records, unsigned int bytes );
+	/* writes one blob to a stream of blobs */
+	void writeBlob( unsigned int streamId, double timestamp, const void* data, unsigned int length );
+	/* writes the index and closes the file */
+	void close();
+
+private:
+	/* writes one chunk and indexes it; caller must hold lock */
+	void writeChunk( CaptureChunkType type, unsigned int streamId, unsigned int recordCount,
+					 double startTime, double endTime, const void* payload, unsigned int bytes,
+					 const void* payload2=NULL, unsigned int bytes2=0 );
+	bool writeBytes( const void* data, unsigned int bytes );
+
+	FILE* file;
+	uint64_t offset; // current end of file
+	pthread_mutex_t lock;
+	std::vector<CaptureStreamInfo> streams;
+	std::vector<CaptureIndexEntry> index;
+	std::vector<unsigned char> buffer; // for compression
+	std::vector<unsigned char> encoded; // for encoding
+};
+
+
+class CaptureCursor;
+
+/* function called by CaptureReader::read for each record or blob */
+typedef void (*CaptureCallback)( double timestamp, const void* data, unsigned int length, void* context );
+
+/* Reads a capture file. */
+class CaptureReader{
+public:
+	CaptureReader( const char* filename );
+	~CaptureReader();
+	/* true if the file has a valid header */
+	bool isOpen();
+	double getClockOffset();
+	unsigned int getNumStreams();
+	const CaptureStreamInfo& getStream( unsigned int streamId );
+	/* @return the id of the stream with this name, or -1 if there is none */
+	int findStream( const char* name );
+	/* data chunks of all streams, in file order */
+	const std::vector<CaptureIndexEntry>& getIndex();
+	/**
+	 * Calls callback for every record (or blob) of a stream with a timestamp in [start,end],
+	 * in file order.  Only the chunks which overlap the range are read.
+	 * For record streams, data points to one record of getStream(streamId).recordSize bytes.
+	 * @return the number of records passed to callback.
+	 */
+	unsigned int read( unsigned int streamId, double start, double end, CaptureCallback callback, void* context );
+
+private:
+	friend class CaptureCursor;
+	bool loadIndex(); // from the trailer, returns false if it is missing
+	void scanChunks(); // rebuilds the stream list and index from the chunk headers
+	bool readPayload( uint64_t offset, CaptureChunkHeader* header, std::vector<unsigned char>& payload );
+
+	FILE* file;
+	CaptureFileHeader header;
+	bool valid;
+	std::vector<CaptureStreamInfo> streams;
+	std::vector<CaptureIndexEntry> index;
+	std::vector<unsigned char> stored, payload, encoded; // reused read buffers
+};
+
+
+/* Iterates over the records of one stream, in file order, holding only one
+ * chunk in memory at a time.  Many cursors may share a reader. */
+class CaptureCursor{
+public:
+	/* starts at the first record of the stream with a timestamp of at least start */
+	CaptureCursor( CaptureReader* reader, unsigned int streamId, double start );
+	/**
+	 * Advances to the next record (or blob).
+	 * @return false at the end of the stream.  Otherwise data, length and timestamp
+	 *   describe the record, and data stays valid until the next call.
+	 */
+	bool next( const void** data, unsigned int* length, double* timestamp );
+private:
+	bool loadChunk(); // loads the next chunk of the stream, returns false at the end
+
+	CaptureReader* reader;
+	unsigned int streamId;
+	double start;
+	unsigned int indexPos; // next index entry to consider
+	std::vector<unsigned char> payload; // current chunk
+	CaptureChunkHeader chunk;
+	unsigned int pos; // of next record in payload
+};
+
+#endif // CAPTURE_FILE_H
@@ -0,0 +1,105 @@
+/*
+ *  ChangeDetector.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "ChangeDetector.h"
+#include "SimdVector.h"
+#include <string.h>
+
+ChangeDetector::ChangeDetector( unsigned int myBins ) :
+numBins(myBins), paddedBins( (myBins+3) & ~3u ), column( paddedBins ), mean( paddedBins ), variance( paddedBins ),
+changes(0), stabilizations(0), callback(NULL), callbackContext(NULL){
+	reset();
+}
+
+void ChangeDetector::reset(){
+	for( unsigned int k=0; k<paddedBins; ++k ){
+		column[k] = mean[k] = variance[k] = 0;
+	}
+	columns = 0;
+	divergence = 0;
+	stable = false;
+	quietColumns = 0;
+	restart();
+}
+
+void ChangeDetector::restart(){
+	learned = 0;
+	cusum = 0;
+}
+
+void ChangeDetector::setEventCallback( EnvironmentEventCallback newCallback, void* context ){
+	this->callback = newCallback;
+	this->callbackContext = context;
+}
+
+void ChangeDetector::getStatus( EnvironmentStatus* status ) const{
+	status->stable = stable;
+	status->changes = changes;
+	status->stabilizations = stabilizations;
+}
+
+float ChangeDetector::getDivergence() const{
+	return divergence;
+}
+
+void ChangeDetector::addColumn( const float* newColumn ){
+	// clamp, so that -inf and NaN levels count as CHANGE_MIN_DB
+	for( unsigned int k=0; k<numBins; ++k ){
+		float x = newColumn[k];
+		column[k] = ( x > CHANGE_MIN_DB )? x : CHANGE_MIN_DB;
+	}
+	++columns;
+	if( learned == 0 ){
+		// the first column after a restart is the reference; the variances are kept
+		memcpy( &mean[0], &column[0], sizeof(float) * paddedBins );
+		learned = 1;
+		return;
+	}
+
+	// Divergence from the reference, then the reference updated with the column.  The
+	// weight is 1/n while it is young, as for a plain mean, then 1/CHANGE_ADAPT_COLUMNS.
+	// The padding bins are all zero, so they add nothing.
+	float w = 1.0f / ( ( learned+1 < CHANGE_ADAPT_COLUMNS )? learned+1 : CHANGE_ADAPT_COLUMNS );
+	const Float4 weight = f4_splat( w ), keep = f4_splat( 1.0f - w );
+	const Float4 minVariance = f4_splat( CHANGE_MIN_VARIANCE ), clip = f4_splat( CHANGE_CLIP );
+	Float4 sum = f4_zero();
+	for( unsigned int k=0; k<paddedBins; k+=4 ){
+		Float4 x = f4_load( &column[k] );
+		Float4 m = f4_load( &mean[k] );
+		Float4 v = f4_load( &variance[k] );
+		Float4 d = f4_sub( x, m );
+		Float4 d2 = f4_mul( d, d );
+		Float4 z = f4_min( f4_mul( d2, f4_recip( f4_max( v, minVariance ) ) ), clip );
+		sum = f4_add( sum, z );
+		f4_store( &mean[k], f4_madd( m, d, weight ) );
+		f4_store( &variance[k], f4_mul( keep, f4_madd( v, d2, weight ) ) );
+	}
+	divergence = f4_sum( sum ) / numBins;
+	++learned;
+	if( learned <= CHANGE_WARMUP_COLUMNS ) return; // the reference is too young to judge by
+
+	bool quiet = divergence < 1 + CHANGE_DRIFT;
+	cusum += divergence - ( 1 + CHANGE_DRIFT );
+	if( cusum < 0 ) cusum = 0;
+	if( cusum > CHANGE_THRESHOLD ){
+		// a new environment: start learning it from the next column
+		stable = false;
+		quietColumns = 0;
+		++changes;
+		restart();
+		if( callback ) callback( ENVIRONMENT_CHANGED, columns, callbackContext );
+		return;
+	}
+	if( stable ) return;
+	quietColumns = quiet? quietColumns+1 : 0;
+	if( quietColumns >= CHANGE_STABLE_COLUMNS ){
+		stable = true;
+		++stabilizations;
+		if( callback ) callback( ENVIRONMENT_STABLE, columns, callbackContext );
+	}
+}
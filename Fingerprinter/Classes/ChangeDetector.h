@@ -0,0 +1,96 @@
+/*
+ *  ChangeDetector.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Online detection of a change of acoustic environment, eg. walking into
+ * another room, from the stream of spectrogram columns, so that database
+ * queries can be made when the environment changes rather than on a timer.
+ *
+ * Each bin keeps an exponentially weighted mean and variance of its level,
+ * with a time constant of CHANGE_ADAPT_COLUMNS.  A column's divergence is the
+ * mean over the bins of its squared deviation from the mean, in units of the
+ * variance and clipped at CHANGE_CLIP so that a few loud bins cannot dominate.
+ * It is about 1 while the environment is unchanged.  A one-sided CUSUM sums the
+ * divergence's excess over 1 + CHANGE_DRIFT, and when the sum passes
+ * CHANGE_THRESHOLD an "environment changed" event is emitted.  A loud column
+ * adds at most CHANGE_CLIP - 1 - CHANGE_DRIFT, so a door slamming, which spans
+ * one or two columns, stays below the threshold, while a change of room passes
+ * it within three columns.  After a change the means and variances are learned again from
+ * the new columns, as plain averages at first; changes are not looked for
+ * during the first CHANGE_WARMUP_COLUMNS, and once CHANGE_STABLE_COLUMNS
+ * consecutive columns after that have had divergences below 1 + CHANGE_DRIFT,
+ * an "environment stable" event is emitted, 2 s after the change at the
+ * least.  The detector starts out unstable, as if it had just seen a change.
+ *
+ * addColumn() never blocks or allocates, so it runs in the audio callback.
+ * Other threads poll getStatus(), whose event counts only increase, so that
+ * no event is missed between polls.  The bins are processed four at a time
+ * with the vectors of SimdVector.h.
+ */
+
+#ifndef CHANGE_DETECTOR_H
+#define CHANGE_DETECTOR_H
+
+#include <vector>
+
+#define CHANGE_ADAPT_COLUMNS 50   // time constant of the reference level, 5 s of columns
+#define CHANGE_CLIP 9.0f          // largest deviation counted for a bin, in variances (3 sigma)
+#define CHANGE_DRIFT 1.0f         // divergence above 1 which the CUSUM ignores
+#define CHANGE_THRESHOLD 20.0f    // CUSUM sum which signals a change, 0.3 s of clipped columns
+#define CHANGE_WARMUP_COLUMNS 10  // columns learned after a restart before changes are looked for, 1 s
+#define CHANGE_STABLE_COLUMNS 10  // quiet columns after the warmup before the environment is called stable
+#define CHANGE_MIN_DB -50.0f      // levels are clamped up to this, eg. -inf for digital silence
+#define CHANGE_MIN_VARIANCE 0.25f // in dB^2, so that steady bins do not make every column a change
+
+/* the detector's state and event counts, as polled by other threads */
+struct EnvironmentStatus{
+	bool stable;                  // between a stable event and the next change
+	unsigned int changes;         // "environment changed" events so far
+	unsigned int stabilizations;  // "environment stable" events so far
+};
+
+enum EnvironmentEvent{ ENVIRONMENT_CHANGED, ENVIRONMENT_STABLE };
+
+/* function called from addColumn() for each event, eg. by the tester */
+typedef void (*EnvironmentEventCallback)( EnvironmentEvent event, unsigned long long column, void* context );
+
+class ChangeDetector{
+public:
+	/* @param numBins is the length of each spectrogram column */
+	ChangeDetector( unsigned int numBins );
+	/* adds a spectrogram column in dB, possibly emitting an event */
+	void addColumn( const float* column );
+	/* copies the current status; may be called from any thread */
+	void getStatus( EnvironmentStatus* status ) const;
+	/* the last column's divergence, which is about 1 in an unchanged environment */
+	float getDivergence() const;
+	/* sets a function to be called on the adding thread for each event, or NULL */
+	void setEventCallback( EnvironmentEventCallback callback, void* context );
+	/* forgets everything, as at construction, except the event counts */
+	void reset();
+
+private:
+	/* restarts the reference from the next column, after a change or a reset */
+	void restart();
+
+	unsigned int numBins;
+	unsigned int paddedBins;   // numBins rounded up to a multiple of four
+	std::vector<float> column; // the clamped column, padded with zeros
+	std::vector<float> mean;   // reference level of each bin
+	std::vector<float> variance;
+	unsigned int learned;      // columns in the reference since the last restart
+	float cusum;
+	float divergence;
+	unsigned int quietColumns; // consecutive columns below the drift, while unstable
+	unsigned long long columns; // added so far
+
+	volatile bool stable;
+	volatile unsigned int changes;
+	volatile unsigned int stabilizations;
+	EnvironmentEventCallback callback;
+	void* callbackContext;
+};
+
+#endif // CHANGE_DETECTOR_H
@@ -0,0 +1,71 @@
+/*
+ *  Coalesce.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * FingerprintDB's merging of near-duplicate entries, in plain C++ so that the
+ * tester and its check run the same clustering as the app.  Like the scan
+ * engine (FingerprintScan.h) it knows nothing about DBEntry: items are
+ * numbered, each with a group (room) id, and the caller supplies the distance
+ * between two items and the merge of one into another.
+ *
+ * Items are visited in the caller's order, normally oldest first.  Each one
+ * is merged into the nearest representative of its group within epsilon, or
+ * else becomes a representative itself.  A representative's fingerprint moves
+ * as items are merged into it, so later distances are to the merged
+ * fingerprint.
+ */
+
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <vector>
+
+/**
+ * Clusters the items greedily, calling merge( item, representative ) for each
+ * item which is folded into a representative.
+ * @param distance( a, b ) is the distance between items a and b, as they are after earlier merges.
+ * @param representativeOf if not NULL, receives each item's representative, or the item itself.
+ * @return the number of items merged
+ */
+template<class Distance, class Merge>
+inline unsigned int coalesceGroups( unsigned int numItems, const unsigned int* groups, unsigned int numGroups,
+									float epsilon, const Distance& distance, Merge& merge,
+									unsigned int* representativeOf = NULL ){
+	std::vector< std::vector<unsigned int> > representatives( numGroups );
+	unsigned int numMerged = 0;
+	for( unsigned int i=0; i<numItems; ++i ){
+		std::vector<unsigned int>& reps = representatives[groups[i]];
+		unsigned int nearest = i;
+		float nearestDist = epsilon;
+		for( unsigned int r=0; r<reps.size(); ++r ){
+			float d = distance( i, reps[r] );
+			if( d <= nearestDist ){
+				nearestDist = d;
+				nearest = reps[r];
+			}
+		}
+		if( nearest != i ){
+			merge( i, nearest );
+			++numMerged;
+		}else{
+			reps.push_back( i );
+		}
+		if( representativeOf ) representativeOf[i] = nearest;
+	}
+	return numMerged;
+}
+
+/* Folds a fingerprint of entryCount observations into one of repCount observations, leaving their
+ * count-weighted mean in representative. */
+inline void mergeFingerprints( float* representative, unsigned int repCount,
+							   const float* entry, unsigned int entryCount, unsigned int len ){
+	float wRep = (float)repCount / ( repCount + entryCount );
+	float wEntry = 1.0f - wRep;
+	for( unsigned int k=0; k<len; ++k ){
+		representative[k] = wRep * representative[k] + wEntry * entry[k];
+	}
+}
+
+#endif // COALESCE_H
@@ -0,0 +1,296 @@
+/*
+ *  DistanceMetrics.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Distance functors for comparing Fingerprints.  Each functor is templated on
+ * how it learns the fingerprint length: StaticLength<N> fixes it at compile
+ * time so that the loop can be fully unrolled, DynamicLength reads it at run
+ * time.  All of the loops are written with the 4-lane vectors of SimdVector.h,
+ * so each metric gets its own fused SIMD kernel.
+ *
+ * Every functor has the same constructor signature, (length, weights), so
+ * that callers can select among them with a template template parameter.
+ * Only WeightedL2Distance uses the weights.
+ *
+ * Functors also provide lowerBound(), a cheap bound computed from the
+ * precomputed FingerprintStats of the two fingerprints.  hasLowerBound is false
+ * for metrics whose bound is always zero, so scans can skip checking it.
+ */
+
+#ifndef DISTANCE_METRICS_H
+#define DISTANCE_METRICS_H
+
+#include <math.h>
+#include <string.h>
+#include "SimdVector.h"
+#include "FingerprintStats.h"
+
+/* Fingerprinter::fpLength for the default specRes and freqCutoff.  Scans over
+ * fingerprints of this length use the StaticLength instantiations. */
+#define FP_STATIC_LENGTH 325
+
+// types of distance used to compare two fingerprints
+typedef enum{
+	AcousticMetricL2,          // Euclidean distance, the original metric
+	AcousticMetricL1,          // sum of absolute differences
+	AcousticMetricCosine,      // one minus the cosine of the angle between fingerprints
+	AcousticMetricCorrelation, // one minus the Pearson correlation of the fingerprints
+	AcousticMetricWeightedL2   // Euclidean distance with a weight for each frequency bin
+} AcousticMetric;
+
+
+/* The names of the metrics which need no weights, as the tester's options and
+ * the app's acousticMetric option give them: l2, l1, cosine and correlation.
+ * @return false if the name is not one of them */
+inline bool parseAcousticMetric( const char* name, AcousticMetric* metric ){
+	if( !strcmp( name, "l2" ) ) *metric = AcousticMetricL2;
+	else if( !strcmp( name, "l1" ) ) *metric = AcousticMetricL1;
+	else if( !strcmp( name, "cosine" ) ) *metric = AcousticMetricCosine;
+	else if( !strcmp( name, "correlation" ) ) *metric = AcousticMetricCorrelation;
+	else return false;
+	return true;
+}
+
+inline const char* acousticMetricName( AcousticMetric metric ){
+	switch( metric ){
+		case AcousticMetricL1: return "l1";
+		case AcousticMetricCosine: return "cosine";
+		case AcousticMetricCorrelation: return "correlation";
+		case AcousticMetricWeightedL2: return "weighted-l2";
+		case AcousticMetricL2:
+		default: return "l2";
+	}
+}
+
+
+/* fingerprint length known at compile time */
+template<unsigned int N>
+struct StaticLength{
+	StaticLength( unsigned int ){}
+	inline unsigned int operator()() const { return N; }
+};
+
+/* fingerprint length known only at run time */
+struct DynamicLength{
+	DynamicLength( unsigned int length ) : n(length){}
+	inline unsigned int operator()() const { return n; }
+	unsigned int n;
+};
+
+
+template<class Length = DynamicLength>
+struct L2Distance{
+	L2Distance( unsigned int length, const float* weights=0 ) : len(length){}
+	inline float operator()( const float* a, const float* b ) const{
+		const unsigned int n = len();
+		Float4 acc0 = f4_zero(), acc1 = f4_zero();
+		unsigned int i=0;
+		for( ; i+8<=n; i+=8 ){
+			Float4 d0 = f4_sub( f4_load(a+i), f4_load(b+i) );
+			Float4 d1 = f4_sub( f4_load(a+i+4), f4_load(b+i+4) );
+			acc0 = f4_madd( acc0, d0, d0 );
+			acc1 = f4_madd( acc1, d1, d1 );
+		}
+		for( ; i+4<=n; i+=4 ){
+			Float4 d0 = f4_sub( f4_load(a+i), f4_load(b+i) );
+			acc0 = f4_madd( acc0, d0, d0 );
+		}
+		float sum = f4_sum( f4_add( acc0, acc1 ) );
+		for( ; i<n; ++i ){
+			float d = a[i]-b[i];
+			sum += d*d;
+		}
+		return sqrtf( sum );
+	}
+	static const bool hasLowerBound = true;
+	inline float lowerBound( const FingerprintStats& a, const FingerprintStats& b ) const{
+		return l2LowerBound( a, b );
+	}
+	Length len;
+};
+
+
+template<class Length = DynamicLength>
+struct L1Distance{
+	L1Distance( unsigned int length, const float* weights=0 ) : len(length){}
+	inline float operator()( const float* a, const float* b ) const{
+		const unsigned int n = len();
+		Float4 acc0 = f4_zero(), acc1 = f4_zero();
+		unsigned int i=0;
+		for( ; i+8<=n; i+=8 ){
+			acc0 = f4_add( acc0, f4_abs( f4_sub( f4_load(a+i), f4_load(b+i) ) ) );
+			acc1 = f4_add( acc1, f4_abs( f4_sub( f4_load(a+i+4), f4_load(b+i+4) ) ) );
+		}
+		for( ; i+4<=n; i+=4 ){
+			acc0 = f4_add( acc0, f4_abs( f4_sub( f4_load(a+i), f4_load(b+i) ) ) );
+		}
+		float sum = f4_sum( f4_add( acc0, acc1 ) );
+		for( ; i<n; ++i ){
+			sum += fabsf( a[i]-b[i] );
+		}
+		return sum;
+	}
+	static const bool hasLowerBound = true;
+	inline float lowerBound( const FingerprintStats& a, const FingerprintStats& b ) const{
+		return l1LowerBound( a, b, len() );
+	}
+	Length len;
+};
+
+
+template<class Length = DynamicLength>
+struct CosineDistance{
+	CosineDistance( unsigned int length, const float* weights=0 ) : len(length){}
+	inline float operator()( const float* a, const float* b ) const{
+		const unsigned int n = len();
+		Float4 ab = f4_zero(), aa = f4_zero(), bb = f4_zero();
+		unsigned int i=0;
+		for( ; i+4<=n; i+=4 ){
+			Float4 va = f4_load(a+i), vb = f4_load(b+i);
+			ab = f4_madd( ab, va, vb );
+			aa = f4_madd( aa, va, va );
+			bb = f4_madd( bb, vb, vb );
+		}
+		float sab = f4_sum(ab), saa = f4_sum(aa), sbb = f4_sum(bb);
+		for( ; i<n; ++i ){
+			sab += a[i]*b[i];
+			saa += a[i]*a[i];
+			sbb += b[i]*b[i];
+		}
+		if( saa <= 0 || sbb <= 0 ) return 1.0f; // undefined angle, treat as orthogonal
+		return 1.0f - sab / sqrtf( saa*sbb );
+	}
+	static const bool hasLowerBound = false;
+	inline float lowerBound( const FingerprintStats& a, const FingerprintStats& b ) const{ return 0.0f; }
+	Length len;
+};
+
+
+template<class Length = DynamicLength>
+struct CorrelationDistance{
+	CorrelationDistance( unsigned int length, const float* weights=0 ) : len(length){}
+	inline float operator()( const float* a, const float* b ) const{
+		const unsigned int n = len();
+		Float4 sa = f4_zero(), sb = f4_zero(), ab = f4_zero(), aa = f4_zero(), bb = f4_zero();
+		unsigned int i=0;
+		for( ; i+4<=n; i+=4 ){
+			Float4 va = f4_load(a+i), vb = f4_load(b+i);
+			sa = f4_add( sa, va );
+			sb = f4_add( sb, vb );
+			ab = f4_madd( ab, va, vb );
+			aa = f4_madd( aa, va, va );
+			bb = f4_madd( bb, vb, vb );
+		}
+		double ssa = f4_sum(sa), ssb = f4_sum(sb), sab = f4_sum(ab), saa = f4_sum(aa), sbb = f4_sum(bb);
+		for( ; i<n; ++i ){
+			ssa += a[i];
+			ssb += b[i];
+			sab += a[i]*b[i];
+			saa += a[i]*a[i];
+			sbb += b[i]*b[i];
+		}
+		// finish in double precision, the differences below cancel heavily for dB-scale values
+		double cov = n*sab - ssa*ssb;
+		double varProduct = (n*saa - ssa*ssa) * (n*sbb - ssb*ssb);
+		if( varProduct <= 0 ) return 1.0f; // a constant fingerprint is uncorrelated with anything
+		return (float)( 1.0 - cov / sqrt( varProduct ) );
+	}
+	static const bool hasLowerBound = false;
+	inline float lowerBound( const FingerprintStats& a, const FingerprintStats& b ) const{ return 0.0f; }
+	Length len;
+};
+
+
+template<class Length = DynamicLength>
+struct WeightedL2Distance{
+	/* weights must be an array of length floats which outlives the functor */
+	WeightedL2Distance( unsigned int length, const float* weights ) : len(length), w(weights){}
+	inline float operator()( const float* a, const float* b ) const{
+		const unsigned int n = len();
+		Float4 acc0 = f4_zero(), acc1 = f4_zero();
+		unsigned int i=0;
+		for( ; i+8<=n; i+=8 ){
+			Float4 d0 = f4_sub( f4_load(a+i), f4_load(b+i) );
+			Float4 d1 = f4_sub( f4_load(a+i+4), f4_load(b+i+4) );
+			acc0 = f4_madd( acc0, f4_mul( d0, d0 ), f4_load(w+i) );
+			acc1 = f4_madd( acc1, f4_mul( d1, d1 ), f4_load(w+i+4) );
+		}
+		for( ; i+4<=n; i+=4 ){
+			Float4 d0 = f4_sub( f4_load(a+i), f4_load(b+i) );
+			acc0 = f4_madd( acc0, f4_mul( d0, d0 ), f4_load(w+i) );
+		}
+		float sum = f4_sum( f4_add( acc0, acc1 ) );
+		for( ; i<n; ++i ){
+			float d = a[i]-b[i];
+			sum += w[i]*d*d;
+		}
+		return sqrtf( sum );
+	}
+	static const bool hasLowerBound = false;
+	inline float lowerBound( const FingerprintStats& a, const FingerprintStats& b ) const{ return 0.0f; }
+	Length len;
+	const float* w;
+};
+
+
+/* Ignores the fingerprints entirely.  Used when only non-acoustic information
+ * (eg. physical distance) should be scored. */
+template<class Length = DynamicLength>
+struct NullDistance{
+	NullDistance( unsigned int length, const float* weights=0 ){}
+	inline float operator()( const float* a, const float* b ) const{ return 0.0f; }
+	static const bool hasLowerBound = false;
+	inline float lowerBound( const FingerprintStats& a, const FingerprintStats& b ) const{ return 0.0f; }
+};
+
+
+/* Runs a functor over one instantiated Metric, chosen at run time.  The default
+ * fingerprint length gets the StaticLength instantiation.  This is how run-time
+ * metric choices become a single switch rather than an indirect call per entry:
+ * op must provide "template<class M> void operator()( const M& metric ) const". */
+template<template<class> class Metric, class Op>
+inline void withMetricLength( unsigned int length, const float* weights, const Op& op ){
+	if( length == FP_STATIC_LENGTH ){
+		op( Metric< StaticLength<FP_STATIC_LENGTH> >( length, weights ) );
+	}else{
+		op( Metric<DynamicLength>( length, weights ) );
+	}
+}
+
+template<class Op>
+inline void withMetric( AcousticMetric metric, unsigned int length, const float* weights, const Op& op ){
+	switch( metric ){
+		case AcousticMetricL1:
+			withMetricLength<L1Distance>( length, weights, op ); break;
+		case AcousticMetricCosine:
+			withMetricLength<CosineDistance>( length, weights, op ); break;
+		case AcousticMetricCorrelation:
+			withMetricLength<CorrelationDistance>( length, weights, op ); break;
+		case AcousticMetricWeightedL2:
+			withMetricLength<WeightedL2Distance>( length, weights, op ); break;
+		case AcousticMetricL2:
+		default:
+			withMetricLength<L2Distance>( length, weights, op ); break;
+	}
+}
+
+/* helper for acousticDistance(), below */
+struct PairDistanceOp{
+	PairDistanceOp( const float* A, const float* B, float* Result ) : a(A), b(B), result(Result){}
+	template<class M> void operator()( const M& metric ) const { *result = metric( a, b ); }
+	const float* a;
+	const float* b;
+	float* result;
+};
+
+/* distance between a single pair of fingerprints */
+inline float acousticDistance( AcousticMetric metric, unsigned int length, const float* weights,
+							   const float* a, const float* b ){
+	float result;
+	withMetric( metric, length, weights, PairDistanceOp( a, b, &result ) );
+	return result;
+}
+
+#endif // DISTANCE_METRICS_H
@@ -0,0 +1,159 @@
+/*
+ *  FastMath.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Approximate log2, log10, exp2, exp and pow on the 4-lane vectors of
+ * SimdVector.h, for the dB conversions which otherwise call libm once per
+ * element.  log2 splits off the float's exponent and evaluates the Cephes logf
+ * polynomial on a mantissa centred on 1; exp2 rounds off the integer part,
+ * evaluates the Cephes exp2f polynomial on the rest, and builds 2^n from its
+ * bits.  The FAST_*_ERROR bounds below are the largest errors found against
+ * double precision libm by mathbench, which checks them over the dB range of
+ * the spectrogram and beyond.
+ *
+ * Special values follow libm where it is cheap: log of 0 is -inf, of a
+ * negative number NaN, of +inf +inf; NaN propagates.  exp2 flushes results
+ * below the smallest normal float to 0 and overflows to +inf from x > 127.5, a
+ * little before libm does.  Denormal inputs to log2 are handled unless the FPU
+ * flushes them to zero, as ARMv7 NEON does, in which case they count as 0.
+ * Everything is inline; there is no .cpp file.
+ */
+
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+#include "SimdVector.h"
+#include <math.h>
+#include <float.h>
+
+/* largest error of f4_log2 and f4_log10 for normal floats: absolute for results within
+ * [-1,1], and relative beyond, where the float's own rounding dominates */
+#define FAST_LOG2_ERROR 2.5e-7
+#define FAST_LOG10_ERROR 2.5e-7
+/* largest absolute error of fastDecibels, in dB, for powers from 1e-30 to 1e30; about one
+ * float ulp at 300 dB */
+#define FAST_DECIBELS_ERROR 5.0e-5
+/* largest relative error of f4_exp2, for -126 <= x <= 127 */
+#define FAST_EXP2_ERROR 2.5e-7
+/* largest relative error of f4_exp, f4_pow and fastFromDecibels, for results from 1e-30 to
+ * 1e30.  It is mostly the rounding of the argument to exp2, which grows with its size */
+#define FAST_EXP_ERROR 1.0e-5
+
+/* log2(x) for each lane */
+static inline Float4 f4_log2( Float4 x ){
+	// scale denormals up by 2^25 so that their mantissa is normalized
+	Float4 tiny = f4_lt( x, f4_splat( FLT_MIN ) );
+	Float4 y = f4_select( tiny, f4_mul( x, f4_splat( 33554432.0f ) ), x );
+	Int4 bits = f4_as_i4( y );
+	Float4 e = i4_to_f4( i4_sub( i4_shr( bits, 23 ), i4_splat( 127 ) ) );
+	e = f4_sub( e, f4_select( tiny, f4_splat( 25.0f ), f4_zero() ) );
+	// mantissa in [1,2), then halved if above sqrt(2) so that it is close to 1
+	Float4 m = i4_as_f4( i4_or( i4_and( bits, i4_splat( 0x007FFFFF ) ), i4_splat( 0x3F800000 ) ) );
+	Float4 big = f4_lt( f4_splat( (float)M_SQRT2 ), m );
+	m = f4_select( big, f4_mul( m, f4_splat( 0.5f ) ), m );
+	e = f4_add( e, f4_select( big, f4_splat( 1.0f ), f4_zero() ) );
+
+	// ln(1+t) = t - t^2/2 + t^3 P(t)
+	Float4 t = f4_sub( m, f4_splat( 1.0f ) );
+	Float4 p = f4_splat( 7.0376836292E-2f );
+	p = f4_madd( f4_splat( -1.1514610310E-1f ), p, t );
+	p = f4_madd( f4_splat( 1.1676998740E-1f ), p, t );
+	p = f4_madd( f4_splat( -1.2420140846E-1f ), p, t );
+	p = f4_madd( f4_splat( 1.4249322787E-1f ), p, t );
+	p = f4_madd( f4_splat( -1.6668057665E-1f ), p, t );
+	p = f4_madd( f4_splat( 2.0000714765E-1f ), p, t );
+	p = f4_madd( f4_splat( -2.4999993993E-1f ), p, t );
+	p = f4_madd( f4_splat( 3.3333331174E-1f ), p, t );
+	Float4 t2 = f4_mul( t, t );
+	Float4 ln = f4_madd( f4_madd( t, t2, f4_splat( -0.5f ) ), f4_mul( t, t2 ), p );
+	Float4 r = f4_madd( e, ln, f4_splat( (float)M_LOG2E ) );
+
+	// special values: zero, negative, NaN and infinity
+	r = f4_select( f4_lt( f4_zero(), x ), r, f4_splat( -INFINITY ) );
+	r = f4_select( f4_lt( x, f4_zero() ), f4_splat( NAN ), r );
+	r = f4_select( f4_eq( x, x ), r, x );
+	r = f4_select( f4_lt( f4_splat( FLT_MAX ), x ), x, r );
+	return r;
+}
+
+/* log10(x) for each lane */
+static inline Float4 f4_log10( Float4 x ){
+	return f4_mul( f4_log2( x ), f4_splat( 0.30102999566f ) );
+}
+
+/* 2^x for each lane */
+static inline Float4 f4_exp2( Float4 x ){
+	// 2^x = 2^n * 2^f, with n an integer and f in [-0.5,0.5]
+	Float4 c = f4_min( f4_max( x, f4_splat( -127.0f ) ), f4_splat( 128.0f ) );
+	Float4 h = f4_add( c, f4_splat( 0.5f ) );
+	Float4 n = i4_to_f4( f4_to_i4( h ) ); // rounds towards zero...
+	n = f4_sub( n, f4_select( f4_lt( h, n ), f4_splat( 1.0f ), f4_zero() ) ); // ...so floor it
+	Float4 f = f4_sub( c, n );
+
+	// 2^f = 1 + f P(f)
+	Float4 p = f4_splat( 1.535336188319500E-4f );
+	p = f4_madd( f4_splat( 1.339887440266574E-3f ), p, f );
+	p = f4_madd( f4_splat( 9.618437357674640E-3f ), p, f );
+	p = f4_madd( f4_splat( 5.550332471162809E-2f ), p, f );
+	p = f4_madd( f4_splat( 2.402264791363012E-1f ), p, f );
+	p = f4_madd( f4_splat( 6.931472028550421E-1f ), p, f );
+	p = f4_madd( f4_splat( 1.0f ), p, f );
+
+	// 2^n from its exponent bits: n = -127 gives 0, and n = 128 gives +inf
+	Float4 scale = i4_as_f4( i4_shl( i4_add( f4_to_i4( n ), i4_splat( 127 ) ), 23 ) );
+	Float4 r = f4_mul( p, scale );
+	return f4_select( f4_eq( x, x ), r, x ); // NaN
+}
+
+/* e^x for each lane */
+static inline Float4 f4_exp( Float4 x ){
+	return f4_exp2( f4_mul( x, f4_splat( (float)M_LOG2E ) ) );
+}
+
+/* x^y for each lane, for x > 0, or x = 0 and y > 0 */
+static inline Float4 f4_pow( Float4 x, Float4 y ){
+	return f4_exp2( f4_mul( y, f4_log2( x ) ) );
+}
+
+/* out[i] = 10*log10( in[i] / reference ), as vDSP_vdbcon with its power flag.  in and out
+ * may be the same array. */
+static inline void fastDecibels( const float* in, float* out, unsigned int n, float reference ){
+	const float dbPerOctave = 3.0102999566f; // 10*log10(2)
+	Float4 offset = f4_log2( f4_splat( reference ) );
+	unsigned int i = 0;
+	for( ; i+4 <= n; i+=4 ){
+		Float4 l = f4_sub( f4_log2( f4_load( in+i ) ), offset );
+		f4_store( out+i, f4_mul( l, f4_splat( dbPerOctave ) ) );
+	}
+	if( i < n ){
+		// the tail, padded with ones
+		float tmp[4] = { 1, 1, 1, 1 };
+		for( unsigned int j=i; j<n; ++j ) tmp[j-i] = in[j];
+		Float4 l = f4_sub( f4_log2( f4_load( tmp ) ), offset );
+		f4_store( tmp, f4_mul( l, f4_splat( dbPerOctave ) ) );
+		for( unsigned int j=i; j<n; ++j ) out[j] = tmp[j-i];
+	}
+}
+
+/* out[i] = reference * 10^( in[i] / 10 ), the inverse of fastDecibels, eg. to average
+ * spectra in power rather than in dB.  in and out may be the same array. */
+static inline void fastFromDecibels( const float* in, float* out, unsigned int n, float reference ){
+	const float octavesPerDb = 0.33219280949f; // 1/(10*log10(2))
+	Float4 offset = f4_log2( f4_splat( reference ) );
+	unsigned int i = 0;
+	for( ; i+4 <= n; i+=4 ){
+		Float4 l = f4_madd( offset, f4_load( in+i ), f4_splat( octavesPerDb ) );
+		f4_store( out+i, f4_exp2( l ) );
+	}
+	if( i < n ){
+		float tmp[4] = { 0, 0, 0, 0 };
+		for( unsigned int j=i; j<n; ++j ) tmp[j-i] = in[j];
+		Float4 l = f4_madd( offset, f4_load( tmp ), f4_splat( octavesPerDb ) );
+		f4_store( tmp, f4_exp2( l ) );
+		for( unsigned int j=i; j<n; ++j ) out[j] = tmp[j-i];
+	}
+}
+
+#endif // FAST_MATH_H
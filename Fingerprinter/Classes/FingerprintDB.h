@@ -9,10 +9,17 @@
 
 #import <vector>
 #import <string>
+#import <utility> // for pair
+#import <climits> // for LLONG_MIN and LLONG_MAX
 #import <Foundation/Foundation.h>
 #import <CoreLocation/CoreLocation.h> // for CLLocation and physical_distance
+#import "DistanceMetrics.h" // for AcousticMetric
+#import "FingerprintStats.h"
+#import "Metrics.h"
+#import "TimeIndex.h"
 
 using std::vector;
+using std::pair;
 
 #pragma mark -
 #pragma mark helper classes
@@ -25,6 +32,9 @@ using std::vector;
 	NSString* room;
 	float* fingerprint;
 	CLLocation* location; // estimated GPS location of this observed fingerprint
+	unsigned int count; // number of near-duplicate observations coalesced into this entry (1 if none)
+	unsigned int roomId; // FingerprintDB's number for the (building, room) pair, set when the entry is cached
+	FingerprintStats stats; // summary of fingerprint, for normalization and pruning.  See updateStats.
 };
 @property (nonatomic) long long timestamp;
 @property (nonatomic,retain) NSUUID* uuid;
@@ -32,7 +42,11 @@ using std::vector;
 @property (nonatomic,retain) NSString* room;
 @property (nonatomic) float* fingerprint;
 @property (nonatomic,retain) CLLocation* location;
+@property (nonatomic) unsigned int count;
+@property (nonatomic) unsigned int roomId;
 -(NSString*)description;
+/* recompute stats from fingerprint.  Must be called whenever the fingerprint is changed. */
+-(void)updateStats;
 @end
 
 
@@ -56,6 +70,28 @@ typedef enum{
 	DistanceMetricCombined
 } DistanceMetric;
 
+// how per-observation room scores are combined in ensemble (multi-fingerprint) queries
+typedef enum{
+	EnsembleAggregationMean, // average over observations of the room's closest-entry distance
+	EnsembleAggregationBest  // best-of-N: minimum over observations
+} EnsembleAggregation;
+
+// inclusive range of DBEntry timestamps (seconds since 1970) used to restrict queries
+typedef struct{
+	long long start;
+	long long end;
+} TimeRange;
+static const TimeRange TimeRangeAll = { LLONG_MIN, LLONG_MAX };
+
+// summary of a near-duplicate coalescing pass
+typedef struct{
+	unsigned int entriesBefore;
+	unsigned int entriesAfter;
+	unsigned int probes;        // number of fingerprints re-queried to compare rankings, 0 if not compared
+	unsigned int top1Unchanged; // number of probes whose best-matching room did not change
+	float meanTopKOverlap;      // average fraction of the top-k rooms shared before and after
+} CoalesceReport;
+
 
 #pragma mark -
 #pragma mark FingerprintDB
@@ -67,6 +103,23 @@ typedef enum{
 	unsigned int len; // length of the Fingerprint vectors
 	NSMutableArray* cache; // NSMutableArray* of DBEntry* : a list of recently seen fingerprints from the remote database
 	bool useRemoteDB; // toggle use of remote (Internet) database vs. just using the local cache
+	// every cache entry by timestamp.  Maintained on insert and delete.
+	TimeIndex<DBEntry*>* timeIndex;
+	// "building\troom" -> NSNumber room id, for every room cached since the cache was last cleared.
+	// Ids are dense and never reused, so queries can index per-room results by them.
+	NSMutableDictionary* roomIds;
+	unsigned int numRoomIds;
+	long long expiryTime; // entries older than this are ignored when loading the DB file
+	unsigned int numExpiredInFile; // number of expired entries still present in the DB file
+	unsigned int numUnsavedMerges; // coalesced inserts made in the cache but not yet in the DB file
+	AcousticMetric acousticMetric; // how fingerprints are compared, for both acoustic and combined queries.  Not AcousticMetricWeightedL2.
+	float coalesceDistance; // inserts this close to an entry from the same room are merged into it.  0 disables.
+	// diagnostics, shared with the tools; see Metrics.h
+	MetricCounter* queryCount;
+	MetricHistogram* queryTime; // microseconds per cache query
+	MetricHistogram* queryCandidates; // entries scanned per cache query
+	MetricCounter* insertCount;
+	MetricGauge* entryCount; // entries in the cache
 	
 	// buffers for intermediate values, so that we don't have to allocate in functions.
 	float* buf1 __attribute__ ((aligned (16))); // aligned for SIMD
@@ -80,6 +133,8 @@ typedef enum{
 
 @property (nonatomic) bool useRemoteDB;
 @property (nonatomic) unsigned int len;
+@property (nonatomic) float coalesceDistance;
+@property (nonatomic) AcousticMetric acousticMetric;
 @property (retain) NSMutableArray* cache;
 @property (nonatomic) float* buf1;
 @property (retain) NSMutableDictionary* httpConnectionData; 
@@ -105,8 +160,54 @@ typedef enum{
 						  numMatches:(unsigned int)numMatches /* desired number of results. NOTE: may return fewer if DB is small, possibly zero. */
 							location:(CLLocation*)location /* optional estimate of the current GPS location; if unneeded, set to NULL_GPS */
 					  distanceMetric:(DistanceMetric)distance;
+/* As above, but only entries with timestamps in the given range are considered.  
+ * The range is checked using the time index, before any distances are computed. */
+-(unsigned int) queryCacheForMatches:(NSMutableArray*)result
+						 observation:(const float[])observation
+						  numMatches:(unsigned int)numMatches
+							location:(CLLocation*)location
+					  distanceMetric:(DistanceMetric)distance
+						   timeRange:(TimeRange)range;
+
+/* Ensemble version of the above asynchronous query, using a short sequence of recent observations
+   rather than a single noisy one.  The remote DB only understands single observations, so in
+   that case just the last observation is sent. */
+-(void) startQueryWithObservations:(const float* const[])observations /* numObservations Fingerprints, oldest first */
+				   numObservations:(unsigned int)numObservations
+						numMatches:(unsigned int)numMatches
+						  location:(CLLocation*)location
+					distanceMetric:(DistanceMetric)distance
+					   aggregation:(EnsembleAggregation)aggregation
+					  resultTarget:(id) target
+						  selector:(SEL) selector;
+
+/* Query the DB using several observations at once.  Each room's score for an observation is the
+ * distance to its closest entry, and these per-observation scores are then aggregated.  All of the 
+ * observations are scored in a single pass over the cache, so the cost grows with the number of
+ * distance evaluations only, not with the number of cache scans.
+ * returns the number of matches.
+ */
+-(unsigned int) queryCacheForMatches:(NSMutableArray*)result /* the output */
+						observations:(const float* const[])observations /* numObservations Fingerprints, oldest first */
+					 numObservations:(unsigned int)numObservations
+						  numMatches:(unsigned int)numMatches
+							location:(CLLocation*)location
+					  distanceMetric:(DistanceMetric)distance
+						 aggregation:(EnsembleAggregation)aggregation;
+/* As above, but only entries with timestamps in the given range are considered. */
+-(unsigned int) queryCacheForMatches:(NSMutableArray*)result
+						observations:(const float* const[])observations
+					 numObservations:(unsigned int)numObservations
+						  numMatches:(unsigned int)numMatches
+							location:(CLLocation*)location
+					  distanceMetric:(DistanceMetric)distance
+						 aggregation:(EnsembleAggregation)aggregation
+						   timeRange:(TimeRange)range;
 
 /* Add a given Fingerprint to the DB.  We do this when the returned matches are poor (or if there are no matches).
+ * A new entry is appended to the DB file.  An insert coalesced into an existing entry changes that
+ * entry's line, so these are saved in batches by rewriting the file once they number an eighth of
+ * the entries; call saveIfDirty before the app may be killed.
  * @return the uuid string for the new room. */
 -(NSString*) insertFingerprint:(const float[])observation /* the new Fingerprint */
 					  building:(NSString*)building      
@@ -124,12 +225,38 @@ typedef enum{
 -(bool) getEntries:(vector<DBEntry*>&) result /* the output */
 		  fromRoom:(const NSString*)room
 		inBuilding:(const NSString*)building;
+
+/* Query the DB for all fingerprints with timestamps in the given range, oldest first. */
+-(bool) getEntries:(vector<DBEntry*>&) result /* the output */
+	   inTimeRange:(TimeRange)range;
+
+/* Query the DB for the newest fingerprint from each room, newest first. */
+-(bool) getNewestEntries:(vector<DBEntry*>&) result; /* the output */
+
+/* Delete all entries with timestamps older than the given time.  Rather than rewriting
+ * the DB file, the expiry time is recorded and old entries are skipped when loading; the file 
+ * is only compacted once expired entries outnumber live ones.
+ * @return the number of entries removed. */
+-(unsigned int) expireEntriesOlderThan:(long long)time;
+
+/* Merge near-duplicate entries: within each room, entries whose acoustic distance to a 
+ * representative entry is at most epsilon are folded into it, leaving the count-weighted 
+ * mean fingerprint, the sum of the counts and the newest timestamp.  
+ * If report is not NULL it is filled in; when compareRankings is set this also re-runs
+ * a sample of the original fingerprints as queries to show how ranked results changed.
+ * The clustering is Coalesce.h's, which "tester coalesce" also runs on database files.
+ * @return the number of entries removed. */
+-(unsigned int) coalesceEntriesWithin:(float)epsilon
+							   report:(CoalesceReport*)report
+					  compareRankings:(bool)compareRankings;
 				  
 	
 	/* load cache from file.  Returns false if there is some error. */
 -(bool) loadCache;
 -(bool) loadCacheFromString:( const NSString* )content;
 -(bool) saveCache;
+/* saves the cache if coalesced inserts have not been written to the DB file yet */
+-(bool) saveIfDirty;
 -(void) clearCache;
 
 
@@ -141,8 +268,20 @@ typedef enum{
 	
 /* get filename for persistent storage */
 -(NSString*) getDBFilename;	
+/* get filename for the persistent expiry time */
+-(NSString*) getExpiryFilename;
 
-/* calculates the distance between two Fingerprints */
+/* fold one entry's observations into another */
+-(void) mergeEntry:(DBEntry*)entry into:(DBEntry*)representative;
+
+/* add and remove entries from the time index */
+-(void) addToTimeIndex:(DBEntry*)entry;
+-(void) removeFromTimeIndex:(DBEntry*)entry;
+
+/* removes the given entries from the cache, but not the time index, in one pass over the cache */
+-(void) removeFromCache:(vector<DBEntry*>&)entries;
+
+/* calculates the distance between two Fingerprints, using acousticMetric */
 -(float) signalDistanceFrom:(const float[])A to:(const float[])B;
 // distance using linear combination of signal and physical (GPS) distance
 // note that this metric is not symmetrical, ie dist(a,b)!=dist(b,a)
@@ -163,4 +302,7 @@ typedef enum{
 /* adds the passed entry to the local cache, if it is not already present there */
 -(void) addToCache:(DBEntry*)newEntry;
 
+/* sets entry.roomId, assigning the next id if its room has not been cached before */
+-(void) assignRoomId:(DBEntry*)entry;
+
 @end;
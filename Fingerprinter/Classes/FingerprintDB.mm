@@ -10,6 +10,7 @@
 #include "FingerprintDB.h"
 #import <Accelerate/Accelerate.h> // for vector operations and FFT
 #include <stdlib.h> // for random()
+#include <float.h> // for FLT_MAX
 #import <algorithm> // for partial_sort
 #import <utility> // for pair
 
@@ -17,6 +18,8 @@
 #include <fstream>
 
 #import "Fingerprinter.h" // for fpLength
+#import "FingerprintScan.h"
+#import "Coalesce.h"
 @implementation DBEntry;
 @synthesize timestamp;
 @synthesize uuid;
@@ -24,10 +27,14 @@
 @synthesize room;
 @synthesize fingerprint;
 @synthesize location;
+@synthesize count;
+@synthesize roomId;
 -(id) init{
 	self = [super init];
+	count = 1;
 	fingerprint = new float[Fingerprinter::fpLength];
 	memset( fingerprint, 0.0, sizeof(float)*Fingerprinter::fpLength );
+	[self updateStats];
 	return self;
 }
 -(void) dealloc{
@@ -37,6 +44,9 @@
 -(NSString*)description{
 	return [NSString stringWithFormat:@"(%@) %@ : %@ %@",self.uuid,self.building,self.room,[self.location description]];
 }
+-(void)updateStats{
+	stats.compute( fingerprint, Fingerprinter::fpLength );
+}
 @end
 
 @implementation Match;
@@ -57,17 +67,80 @@
 
 using std::vector;
 using std::pair;
-using std::make_pair;
 using std::min;
+using std::max;
 using std::sort;
+using std::partial_sort;
+
+
+// constants for linear combination of signal and physical distance
+static const float combinationK=0.75; // metric combination factor
+// we also use the min/max expected distance between tags from same room
+// these constants were determined experimentally
+static const float maxPhysDist=93; 
+static const float minPhysDist=0;
+static const float minSigDist=0;
+
+// scan engine score which uses only the physical distance to each row
+struct PhysicalScore{
+	PhysicalScore( const float* physicalDistances ) : physDist(physicalDistances){}
+	inline float operator()( unsigned int row, float sigDist ) const { return physDist[row]; }
+	const float* physDist;
+};
+
+// scan engine score which blends signal and physical distance, as in combinedDistanceFrom
+struct CombinedScore{
+	CombinedScore( const float* physicalDistances, const float* signalScales ) 
+	: physDist(physicalDistances), sigScale(signalScales){}
+	inline float operator()( unsigned int row, float sigDist ) const {
+		return combinationK * (sigDist-minSigDist) * sigScale[row] +
+				(1-combinationK) * (physDist[row]-minPhysDist)/(maxPhysDist-minPhysDist);
+	}
+	const float* physDist;
+	const float* sigScale; // 1/(maxSigDist-minSigDist) for each row
+};
+
+// distance between two entries, for coalesceGroups
+struct EntryDistance{
+	EntryDistance( FingerprintDB* d, const vector<DBEntry*>& e ) : db(d), entries(e){}
+	inline float operator()( unsigned int a, unsigned int b ) const {
+		return [db signalDistanceFrom:entries[a].fingerprint to:entries[b].fingerprint];
+	}
+	FingerprintDB* db;
+	const vector<DBEntry*>& entries;
+};
+
+// merges one entry into another for coalesceGroups, collecting the merged entries
+struct EntryMerge{
+	EntryMerge( FingerprintDB* d, const vector<DBEntry*>& e ) : db(d), entries(e){}
+	inline void operator()( unsigned int entry, unsigned int representative ){
+		[db mergeEntry:entries[entry] into:entries[representative]];
+		removed.push_back( entries[entry] );
+	}
+	FingerprintDB* db;
+	const vector<DBEntry*>& entries;
+	vector<DBEntry*> removed;
+};
 
+// room id of an entry, for TimeIndex::newest
+struct EntryRoom{
+	inline unsigned int operator()( DBEntry* e ) const { return e->roomId; }
+};
+
+
+// coalesced inserts are saved once they number 1/MERGE_SAVE_FRACTION of the entries, so that
+// the DB file is rewritten a bounded number of times per entry
+#define MERGE_SAVE_FRACTION 8
 
 const NSString* DBFilename = @"db.txt";
+const NSString* ExpiryFilename = @"db_expiry.txt";
 
 @implementation FingerprintDB;
 
 @synthesize useRemoteDB;
 @synthesize len;
+@synthesize coalesceDistance;
+@synthesize acousticMetric;
 @synthesize cache;
 @synthesize buf1;
 @synthesize httpConnectionData;
@@ -80,6 +153,25 @@ const NSString* DBFilename = @"db.txt";
 	len = fpLength;
 	buf1 = new float[fpLength];
 	cache = [[NSMutableArray alloc] init];
+	timeIndex = new TimeIndex<DBEntry*>();
+	roomIds = [[NSMutableDictionary alloc] init];
+	numRoomIds = 0;
+	numExpiredInFile = 0;
+	numUnsavedMerges = 0;
+	coalesceDistance = 0; // disabled by default
+	acousticMetric = AcousticMetricL2;
+	MetricsRegistry* metrics = MetricsRegistry::shared();
+	queryCount = metrics->counter( "database_queries_total", "Fingerprints matched against the database" );
+	queryTime = metrics->histogram( "database_query_us", "Microseconds per database query" );
+	queryCandidates = metrics->histogram( "database_query_entries", "Database entries scanned per query" );
+	insertCount = metrics->counter( "database_inserts_total", "Fingerprints inserted into the database" );
+	entryCount = metrics->gauge( "database_entries", "Entries in the database" );
+	// read the expiry time, if any, before loading entries
+	expiryTime = LLONG_MIN;
+	NSString* expiryContent = [NSString stringWithContentsOfFile:[self getExpiryFilename] usedEncoding:nil error:nil];
+	if( expiryContent ){
+		expiryTime = [expiryContent longLongValue];
+	}
 	if( ![self loadCache] ){
 		NSLog(@"Error loading cache");
 	}
@@ -89,16 +181,23 @@ const NSString* DBFilename = @"db.txt";
 
 
 -(void)dealloc{
+	[self saveIfDirty];
 	delete[] buf1;
+	delete timeIndex;
+	[roomIds release];
 	[httpConnectionData release];
 	
 	[super dealloc];
 }
 
 
-// comparison used in sort below
-bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
-	return ( A.first < B.first );
+-(unsigned int) queryCacheForMatches:(NSMutableArray*)result
+						 observation:(const float[])observation
+						  numMatches:(unsigned int)numMatches
+							location:(CLLocation*)location
+					  distanceMetric:(DistanceMetric)distanceMetric{
+	return [self queryCacheForMatches:result observation:observation numMatches:numMatches
+							 location:location distanceMetric:distanceMetric timeRange:TimeRangeAll];
 }
 
 
@@ -106,56 +205,142 @@ bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
 						 observation:(const float[])observation  /* observed Fingerprint we want to match */
 						  numMatches:(unsigned int)numMatches /* desired number of results. NOTE: may return fewer if DB is small, possibly zero. */
 							location:(CLLocation*)location /* optional estimate of the current GPS location; if unneeded, set to NULL_GPS */
-					  distanceMetric:(DistanceMetric)distanceMetric{
-	// calculate distances to all entries in DB cache
-    pair<float,int> *distances = new pair<float,int>[cache.count]; // first element of pair is distance, second is index
-	for( unsigned int i=0; i<[cache count]; ++i ){
-		DBEntry* cacheI = (DBEntry*)[cache objectAtIndex:i];
-		// if using acoustic or combined criterion then acoustic distance is primary sorting key
-		if( distanceMetric == DistanceMetricAcoustic ){
-			distances[i] = make_pair( [self signalDistanceFrom:observation to:cacheI.fingerprint], i );
-		}else if( distanceMetric == DistanceMetricPhysical ){ // use physical distance
-			distances[i] = make_pair( [location distanceFromLocation:cacheI.location], i );			
-		}else{ // distanceMetric == DistanceMetricCombined
-			distances[i] = make_pair( [self combinedDistanceFrom:cacheI.fingerprint 
-														 withLoc:cacheI.location 
-															  to:observation
-														 withLoc:location ], i );			
-		}
+					  distanceMetric:(DistanceMetric)distanceMetric
+						   timeRange:(TimeRange)range{
+	// a single observation is just an ensemble of one
+	const float* observations[1] = { observation };
+	return [self queryCacheForMatches:result observations:observations numObservations:1
+						   numMatches:numMatches location:location distanceMetric:distanceMetric
+						  aggregation:EnsembleAggregationBest timeRange:range];
+}
+
+
+-(unsigned int) queryCacheForMatches:(NSMutableArray*)result
+						observations:(const float* const[])observations
+					 numObservations:(unsigned int)numObservations
+						  numMatches:(unsigned int)numMatches
+							location:(CLLocation*)location
+					  distanceMetric:(DistanceMetric)distanceMetric
+						 aggregation:(EnsembleAggregation)aggregation{
+	return [self queryCacheForMatches:result observations:observations numObservations:numObservations
+						   numMatches:numMatches location:location distanceMetric:distanceMetric
+						  aggregation:aggregation timeRange:TimeRangeAll];
+}
+
+
+-(unsigned int) queryCacheForMatches:(NSMutableArray*)result /* the output */
+						observations:(const float* const[])observations /* numObservations Fingerprints, oldest first */
+					 numObservations:(unsigned int)numObservations
+						  numMatches:(unsigned int)numMatches
+							location:(CLLocation*)location
+					  distanceMetric:(DistanceMetric)distanceMetric
+						 aggregation:(EnsembleAggregation)aggregation
+						   timeRange:(TimeRange)range{
+	if( numObservations == 0 ) return 0;
+	MetricTimer timer( queryTime );
+	queryCount->add( numObservations );
+	// select candidates by timestamp before doing any distance calculations
+	vector<DBEntry*> candidates;
+	[self getEntries:candidates inTimeRange:range];
+	unsigned int numRows = candidates.size();
+	queryCandidates->record( numRows );
+	if( numRows == 0 ) return 0;
+
+	// gather fingerprints, their precomputed stats and room ids for the scan engine.
+	// The candidates may come from only some of the rooms, so their ids are renumbered densely.
+	vector<const float*> rows( numRows );
+	vector<const FingerprintStats*> rowStats( numRows );
+	vector<unsigned int> rowRooms( numRows );
+	vector<int> roomSlot( numRoomIds, -1 ); // room id -> index in this query's per-room results
+	unsigned int numRooms = 0;
+	for( unsigned int i=0; i<numRows; ++i ){
+		DBEntry* e = candidates[i];
+		rows[i] = e.fingerprint;
+		rowStats[i] = &(e->stats);
+		int& slot = roomSlot[e->roomId];
+		if( slot < 0 ) slot = numRooms++;
+		rowRooms[i] = slot;
+	}
+
+	// per-room accumulators, filled in during a single pass over the candidates.
+	//  roomScores[r*numObservations+j] is the distance from observation j to room r's closest entry.
+	//  roomBestRow[r] is room r's entry closest to any observation.
+	vector<float> roomScores( numRooms*numObservations, FLT_MAX );
+	vector<float> roomBest( numRooms, FLT_MAX );
+	vector<unsigned int> roomBestRow( numRooms, 0 );
+	// observation stats let the scan skip entries whose distance bound can't beat their room's best
+	vector<FingerprintStats> observationStats( numObservations );
+	for( unsigned int j=0; j<numObservations; ++j ){
+		observationStats[j].compute( observations[j], len );
 	}
-	// sort distances
-	sort(distances+0, distances+[cache count], smaller_by_first );
-	int k=0;
-	for( unsigned int i=0; i<[cache count]; ++i ){
-		// add only rooms which are not already represented in results
-		DBEntry* e = [cache objectAtIndex:distances[i].second];
-		bool unique=true;
-		for( Match* oldMatch in result ){
-			if( [oldMatch.entry.building isEqualToString:e->building] && 
-			    [oldMatch.entry.room isEqualToString:e->room] ){
-				unique=false;
-				break;
+	GroupScan scan;
+	scan.queries = observations;
+	scan.numQueries = numObservations;
+	scan.rows = &rows[0];
+	scan.groups = &rowRooms[0];
+	scan.numRows = numRows;
+	scan.queryStats = &observationStats[0];
+	scan.rowStats = &rowStats[0];
+	scan.queryRows = NULL;
+	scan.groupScores = &roomScores[0];
+	scan.groupBestScore = &roomBest[0];
+	scan.groupBestRow = &roomBestRow[0];
+	if( distanceMetric == DistanceMetricAcoustic ){
+		scanGroupMinima( acousticMetric, len, NULL, IdentityScore(), scan );
+	}else{
+		// physical distance does not depend on the observed fingerprint, so calculate it just once
+		vector<float> physDist( numRows );
+		for( unsigned int i=0; i<numRows; ++i ){
+			physDist[i] = [location distanceFromLocation:candidates[i].location];
+		}
+		if( distanceMetric == DistanceMetricPhysical ){
+			scanGroupMinima( NullDistance<>( len ), PhysicalScore( &physDist[0] ), scan );
+		}else{ // distanceMetric == DistanceMetricCombined
+			// acoustic normalization, as in combinedDistanceFrom, using each entry's precomputed minimum.
+			// Where that is not positive the score does not grow with the distance, so the row's
+			// bound is useless and it is scored in full.
+			vector<float> sigScale( numRows );
+			vector<const FingerprintStats*> combinedStats( rowStats );
+			for( unsigned int i=0; i<numRows; ++i ){
+				sigScale[i] = combinedSignalScale( *rowStats[i], minSigDist );
+				if( !combinedScaleIsMonotonic( *rowStats[i], minSigDist ) ) combinedStats[i] = NULL;
 			}
+			scan.rowStats = &combinedStats[0];
+			scanGroupMinima( acousticMetric, len, NULL, 
+							 CombinedScore( &physDist[0], &sigScale[0] ), scan );
 		}
-		if(unique){
-			Match* m = [[Match alloc] init];
-			m.entry = [cache objectAtIndex:distances[i].second];
-			m.confidence = -(distances[i].first); //TODO: scale between 0 and 1
-			m.distance = distances[i].first;
-			[result addObject:m];
-			[m release];
-			if( ++k >= numMatches ){
-				return k;
+	}
+
+	// aggregate each room's per-observation scores
+	vector<float> aggregate( numRooms );
+	for( unsigned int r=0; r<numRooms; ++r ){
+		const float* scores = &roomScores[r*numObservations];
+		float score = scores[0];
+		for( unsigned int j=1; j<numObservations; ++j ){
+			if( aggregation == EnsembleAggregationBest ){
+				score = min( score, scores[j] );
+			}else{ // aggregation == EnsembleAggregationMean
+				score += scores[j];
 			}
 		}
+		if( aggregation == EnsembleAggregationMean ) score /= numObservations;
+		aggregate[r] = score;
+	}
+	// rooms are already unique, so we only have to pick the best numMatches of them
+	vector<unsigned int> ranking( min( numMatches, numRooms ) );
+	unsigned int k = selectTopK( &aggregate[0], numRooms, ranking.size(), &ranking[0] );
+	for( unsigned int i=0; i<k; ++i ){
+		Match* m = [[Match alloc] init];
+		m.entry = candidates[roomBestRow[ranking[i]]];
+		m.confidence = -(aggregate[ranking[i]]); //TODO: scale between 0 and 1
+		m.distance = aggregate[ranking[i]];
+		[result addObject:m];
+		[m release];
 	}
-    delete[] distances;
 	return k;
 }
 
 
-
-
 -(NSUUID*) insertFingerprint:(const float[])observation
 					  building:(NSString*)newBuilding      
 						  room:(NSString*)newRoom /* name for the new room */
@@ -169,7 +354,9 @@ bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
 	newEntry.fingerprint = new float[len];
 	newEntry.location = [location copy];
 	memcpy( newEntry.fingerprint, observation, sizeof(float)*len );
+	[newEntry updateStats];
     newEntry.uuid = [NSUUID UUID];
+	insertCount->add();
 	
 	// remote insert
 	if( self.useRemoteDB ){
@@ -180,6 +367,33 @@ bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
 	}
 	// cache insert
 	else{
+		// if enabled, fold near-duplicates of an existing entry from the same room into that entry
+		if( coalesceDistance > 0 ){
+			vector<DBEntry*> roomEntries;
+			[self getEntries:roomEntries fromRoom:newRoom inBuilding:newBuilding];
+			DBEntry* nearest = nil;
+			float nearestDist = coalesceDistance;
+			for( unsigned int i=0; i<roomEntries.size(); ++i ){
+				float d = [self signalDistanceFrom:observation to:roomEntries[i].fingerprint];
+				if( d <= nearestDist ){
+					nearestDist = d;
+					nearest = roomEntries[i];
+				}
+			}
+			if( nearest ){
+				[self removeFromTimeIndex:nearest];
+				[self mergeEntry:newEntry into:nearest];
+				[self addToTimeIndex:nearest];
+				// an existing line changed, so the DB file must be rewritten, but only
+				// once enough merges have built up
+				numUnsavedMerges++;
+				if( numUnsavedMerges * MERGE_SAVE_FRACTION >= [cache count] ){
+					[self saveCache];
+				}
+				[newEntry release];
+				return nearest.uuid;
+			}
+		}
 		[self addToCache:newEntry];
 		
 		// save new line in DB file
@@ -275,11 +489,26 @@ bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
 		}
 	}
 	if( !duplicate ){
+		[self assignRoomId:newEntry];
 		[cache addObject:newEntry];
+		[self addToTimeIndex:newEntry];
+		entryCount->set( [cache count] );
 	}
 }
 
 
+-(void) assignRoomId:(DBEntry*)entry{
+	NSString* key = [[NSString alloc] initWithFormat:@"%@\t%@", entry.building, entry.room];
+	NSNumber* roomId = [roomIds objectForKey:key];
+	if( !roomId ){
+		roomId = [NSNumber numberWithUnsignedInt:numRoomIds++];
+		[roomIds setObject:roomId forKey:key];
+	}
+	[key release];
+	entry.roomId = [roomId unsignedIntValue];
+}
+
+
 -(void) startQueryWithObservation:(const float[])obs  /* observed Fingerprint we want to match */
 					   numMatches:(unsigned int)numMatches /* desired number of results. NOTE: may return fewer if DB is small, possibly zero. */
 						 location:(CLLocation*)loc /* optional estimate of the current GPS location; if unneeded, set to NULL_GPS */
@@ -311,18 +540,36 @@ bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
 }
 
 
--(float) signalDistanceFrom:(const float[])A to:(const float[])B{
-	// vector subtraction
-	vDSP_vsub( A, 1, B, 1, buf1, 1, len );
+-(void) startQueryWithObservations:(const float* const[])obs /* numObservations Fingerprints, oldest first */
+				   numObservations:(unsigned int)numObservations
+						numMatches:(unsigned int)numMatches
+						  location:(CLLocation*)loc
+					distanceMetric:(DistanceMetric)distance
+					   aggregation:(EnsembleAggregation)aggregation
+					  resultTarget:(id) target
+						  selector:(SEL) selector{
+	// remote DB and degenerate ensembles use the single-observation query
+	if( self.useRemoteDB || numObservations <= 1 ){
+		if( numObservations == 0 ) return;
+		[self startQueryWithObservation:obs[numObservations-1] numMatches:numMatches location:loc
+						 distanceMetric:distance resultTarget:target selector:selector];
+		return;
+	}
+	self.callbackTarget = target;
+	self.callbackSelector = selector;
 	
-	// square vector elements
-	vDSP_vsq( buf1, 1, buf1, 1, len );
+	// synchronous cache query
+	NSMutableArray* matches = [[NSMutableArray alloc] init];
+	[self queryCacheForMatches:matches observations:obs numObservations:numObservations
+					numMatches:numMatches location:loc distanceMetric:distance aggregation:aggregation];
+	// notify client that matches are ready
+	[callbackTarget performSelector:callbackSelector withObject:matches];
+	[matches release];
+}
 
-	// sum vector elements
-	float result;
-	vDSP_sve( buf1, 1, &result, len );
-	
-	return sqrt(result);
+
+-(float) signalDistanceFrom:(const float[])A to:(const float[])B{
+	return acousticDistance( acousticMetric, len, NULL, A, B );
 }
 
 
@@ -332,21 +579,14 @@ bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
 					  withLoc:(const CLLocation*)locB{
 	float sigDist = [self signalDistanceFrom:A to:B];
 	float physDist = [locA distanceFromLocation:locB];
-	// constants for linear combination
-	const float K=0.75; // metric combination factor
-	// we also use the min/max expected distance between tags from same room
-	// these constants were determined experimentally
-	const float maxPhysDist=93; 
-	const float minPhysDist=0;
 	// find the normalization constant for acoustic distances
 	//  As shortcut, just use 0 and 3*min(A)
-	float minSigDist=0;
 	float maxSigDist;
 	vDSP_minv( A, 1, &maxSigDist, len );
 	maxSigDist *= 3;
 
-	return K * (sigDist-minSigDist)/(maxSigDist-minSigDist) +
-			(1-K) * (physDist-minPhysDist)/(maxPhysDist-minPhysDist);
+	return combinationK * (sigDist-minSigDist)/(maxSigDist-minSigDist) +
+			(1-combinationK) * (physDist-minPhysDist)/(maxPhysDist-minPhysDist);
 }
 
 
@@ -368,6 +608,13 @@ bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
 }
 
 
+-(NSString*)getExpiryFilename{
+	NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
+	NSString *documentsDirectory = [paths objectAtIndex:0];
+	return [NSString stringWithFormat:@"%@/%@", documentsDirectory, ExpiryFilename];
+}
+
+
 -(void) appendEntry:(const DBEntry*)entry
 		   toString:(NSMutableString*)outputBuffer{
 	[outputBuffer appendFormat:@"%@\t%lld\t", 
@@ -390,6 +637,10 @@ bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
 			[outputBuffer appendFormat:@"\t%.4g", entry.fingerprint[j] ];
 		}
 	}
+	// coalesced entries record their observation count after the fingerprint
+	if( entry.count > 1 ){
+		[outputBuffer appendFormat:@"\t#%u", entry.count ];
+	}
 	// newline at end
 	[outputBuffer appendString:@"\n"];	
 }
@@ -410,11 +661,19 @@ bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
 				   error:nil];
 
     [content release];
+	numExpiredInFile = 0; // file now contains only live entries
+	numUnsavedMerges = 0;
     return true;
     // TODO file access error handling
 }
 
 
+-(bool) saveIfDirty{
+	if( numUnsavedMerges == 0 ) return true;
+	return [self saveCache];
+}
+
+
 -(bool) loadCache{
 	// test that DB file exists
 	bool loadedDefault = false;
@@ -485,11 +744,26 @@ bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
 		for( int j=0; j<len; j++ ){
 			[floatScanner scanFloat:&(newEntry.fingerprint[j]) ];
 		}
+		[newEntry updateStats];
+		// optional observation count of a coalesced entry
+		if( [floatScanner scanString:@"#" intoString:nil] ){
+			int tmpCount;
+			if( [floatScanner scanInt:&tmpCount] && tmpCount > 1 ) newEntry.count = tmpCount;
+		}
 		
-		// add it to the DB
-		[cache addObject:newEntry];
+		// add it to the DB, unless it has expired
+		if( newEntry.timestamp < expiryTime ){
+			numExpiredInFile++;
+		}else{
+			[self assignRoomId:newEntry];
+			[cache addObject:newEntry];
+			timeIndex->append( newEntry.timestamp, newEntry );
+		}
 		[newEntry release];
 	}
+	// entries are loaded in file order, so sort the time index once at the end
+	timeIndex->sort();
+	entryCount->set( [cache count] );
     NSLog(@"loaded %lu database cache entries", (unsigned long)[cache count]);
 	return true; // TODO: handle improper file format errors and return false
 }
@@ -498,10 +772,19 @@ bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
 -(void) clearCache{
 	// clear database
 	[cache removeAllObjects];
+	timeIndex->clear();
+	[roomIds removeAllObjects];
+	numRoomIds = 0;
+	entryCount->set( 0 );
+	expiryTime = LLONG_MIN;
+	numExpiredInFile = 0;
+	numUnsavedMerges = 0;
 
 	// erase the persistent store
 	[[NSFileManager defaultManager] removeItemAtPath:[self getDBFilename]
 											   error:nil];
+	[[NSFileManager defaultManager] removeItemAtPath:[self getExpiryFilename]
+											   error:nil];
 }
 
 
@@ -575,7 +858,11 @@ bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
 	
 	// remove elements
 	if( didSomething ){
+		for( DBEntry* e in entriesToRemove ){
+			[self removeFromTimeIndex:e];
+		}
 		[cache removeObjectsInArray:entriesToRemove];	
+		entryCount->set( [cache count] );
 	
 		// if DB was modified then resave it
 		[self saveCache];
@@ -583,6 +870,163 @@ bool smaller_by_first( pair<float,int> A, pair<float,int> B ){
 	[entriesToRemove release];
 }
 
+-(bool) getEntries:(vector<DBEntry*>&) result /* the output */
+	   inTimeRange:(TimeRange)range{
+	return timeIndex->range( range.start, range.end, result ) > 0;
+}
+
+-(bool) getNewestEntries:(vector<DBEntry*>&) result{
+	return timeIndex->newest( EntryRoom(), numRoomIds, result ) > 0;
+}
+
+-(unsigned int) expireEntriesOlderThan:(long long)time{
+	// the expired entries are a prefix of the time index
+	vector<DBEntry*> entriesToRemove;
+	unsigned int numExpired = timeIndex->expire( time, entriesToRemove );
+	if( numExpired == 0 ) return 0;
+	[self removeFromCache:entriesToRemove];
+	entryCount->set( [cache count] );
+	
+	// record the expiry time instead of rewriting the DB file
+	if( time > expiryTime ){
+		expiryTime = time;
+		[[NSString stringWithFormat:@"%lld\n", expiryTime] writeToFile:[self getExpiryFilename]
+															  atomically:YES
+																encoding:NSUTF8StringEncoding
+																   error:nil];
+	}
+	numExpiredInFile += numExpired;
+	// compact the DB file once it is mostly dead entries
+	if( numExpiredInFile > [cache count] ){
+		[self saveCache];
+	}
+	return numExpired;
+}
+
+-(void) mergeEntry:(DBEntry*)entry into:(DBEntry*)rep{
+	mergeFingerprints( rep.fingerprint, rep.count, entry.fingerprint, entry.count, len );
+	[rep updateStats];
+	rep.count = rep.count + entry.count;
+	if( entry.timestamp > rep.timestamp ) rep.timestamp = entry.timestamp;
+}
+
+-(unsigned int) coalesceEntriesWithin:(float)epsilon
+							   report:(CoalesceReport*)report
+					  compareRankings:(bool)compareRankings{
+	const unsigned int maxProbes = 200; // bounds the cost of the ranking comparison
+	const unsigned int k = 5; // size of ranked lists compared
+	unsigned int entriesBefore = [cache count];
+	
+	// before merging, save a sample of fingerprints to probe with, and their ranked rooms
+	vector<float*> probes;
+	vector< vector<NSString*> > rankingsBefore;
+	if( report && compareRankings && entriesBefore > 0 ){
+		unsigned int step = (entriesBefore + maxProbes - 1) / maxProbes;
+		for( unsigned int i=0; i<entriesBefore; i+=step ){
+			float* probe = new float[len];
+			memcpy( probe, ((DBEntry*)[cache objectAtIndex:i]).fingerprint, sizeof(float)*len );
+			probes.push_back( probe );
+		}
+	}
+	for( unsigned int i=0; i<probes.size(); ++i ){
+		NSMutableArray* matches = [[NSMutableArray alloc] init];
+		[self queryCacheForMatches:matches observation:probes[i] numMatches:k
+						  location:nil distanceMetric:DistanceMetricAcoustic];
+		vector<NSString*> rooms;
+		for( Match* m in matches ){
+			rooms.push_back( [[NSString alloc] initWithFormat:@"%@\t%@", m.entry.building, m.entry.room] );
+		}
+		rankingsBefore.push_back( rooms );
+		[matches release];
+	}
+	
+	// greedily cluster each room's entries, oldest first, around representatives
+	vector<DBEntry*> entries;
+	timeIndex->range( LLONG_MIN, LLONG_MAX, entries );
+	vector<unsigned int> rooms( entries.size() );
+	for( unsigned int i=0; i<entries.size(); ++i ){
+		rooms[i] = entries[i]->roomId;
+	}
+	EntryMerge merge( self, entries );
+	unsigned int numRemoved = coalesceGroups( entries.size(), entries.empty()? NULL : &rooms[0], numRoomIds,
+											  epsilon, EntryDistance( self, entries ), merge );
+	if( numRemoved > 0 ){
+		[self removeFromCache:merge.removed];
+		entryCount->set( [cache count] );
+		// representatives' timestamps may have changed, so rebuild the time index
+		timeIndex->clear();
+		for( DBEntry* e in cache ){
+			timeIndex->append( e.timestamp, e );
+		}
+		timeIndex->sort();
+		[self saveCache];
+	}
+	
+	if( report ){
+		report->entriesBefore = entriesBefore;
+		report->entriesAfter = [cache count];
+		report->probes = probes.size();
+		report->top1Unchanged = 0;
+		report->meanTopKOverlap = 0;
+		// re-run the probes and compare with the old rankings
+		for( unsigned int i=0; i<probes.size(); ++i ){
+			NSMutableArray* matches = [[NSMutableArray alloc] init];
+			[self queryCacheForMatches:matches observation:probes[i] numMatches:k
+							  location:nil distanceMetric:DistanceMetricAcoustic];
+			const vector<NSString*>& before = rankingsBefore[i];
+			unsigned int shared = 0, rank = 0;
+			for( Match* m in matches ){
+				NSString* key = [NSString stringWithFormat:@"%@\t%@", m.entry.building, m.entry.room];
+				if( rank == 0 && !before.empty() && [before[0] isEqualToString:key] ) report->top1Unchanged++;
+				for( unsigned int j=0; j<before.size(); ++j ){
+					if( [before[j] isEqualToString:key] ){
+						shared++;
+						break;
+					}
+				}
+				rank++;
+			}
+			unsigned int listLen = max( (unsigned int)before.size(), rank );
+			report->meanTopKOverlap += (listLen > 0)? (float)shared / listLen : 1.0f;
+			[matches release];
+		}
+		if( !probes.empty() ) report->meanTopKOverlap /= probes.size();
+		NSLog(@"coalesced %u database entries into %u; top-1 unchanged for %u of %u probes, mean top-%u overlap %.3f",
+			  report->entriesBefore, report->entriesAfter, report->top1Unchanged, report->probes, k, report->meanTopKOverlap);
+	}
+	
+	// cleanup
+	for( unsigned int i=0; i<probes.size(); ++i ){
+		delete[] probes[i];
+		for( unsigned int j=0; j<rankingsBefore[i].size(); ++j ){
+			[rankingsBefore[i][j] release];
+		}
+	}
+	return numRemoved;
+}
+
+-(void) addToTimeIndex:(DBEntry*)entry{
+	timeIndex->insert( entry.timestamp, entry );
+}
+
+-(void) removeFromCache:(vector<DBEntry*>&)entries{
+	// removeObjectsInArray: would search the whole cache for each entry, so instead
+	// find their positions in one pass, looking them up in the sorted pointers
+	sort( entries.begin(), entries.end() );
+	NSMutableIndexSet* indexes = [[NSMutableIndexSet alloc] init];
+	NSUInteger i = 0;
+	for( DBEntry* e in cache ){
+		if( std::binary_search( entries.begin(), entries.end(), e ) ) [indexes addIndex:i];
+		++i;
+	}
+	[cache removeObjectsAtIndexes:indexes];
+	[indexes release];
+}
+
+-(void) removeFromTimeIndex:(DBEntry*)entry{
+	timeIndex->remove( entry.timestamp, entry );
+}
+
 #pragma mark -
 #pragma mark URLRequestDelegate methods
 
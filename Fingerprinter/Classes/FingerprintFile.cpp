@@ -0,0 +1,181 @@
+/*
+ *  FingerprintFile.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "FingerprintFile.h"
+#include <limits.h> // for LLONG_MIN
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Returns the tab-terminated field starting at *p, terminating it and advancing *p
+ * past the tab, or NULL if there are no more fields. */
+static char* nextField( char** p ){
+	if( !*p ) return NULL;
+	char* field = *p;
+	char* tab = strchr( field, '\t' );
+	if( tab ){
+		*tab = '\0';
+		*p = tab+1;
+	}else{
+		*p = NULL;
+	}
+	return field;
+}
+
+/* parses a whole field as a number */
+static bool parseDouble( const char* field, double* value ){
+	char* end;
+	if( !field ) return false;
+	*value = strtod( field, &end );
+	return end != field && *end == '\0';
+}
+
+bool parseFingerprintEntry( char* line, FingerprintEntry& entry ){
+	char* p = line;
+	char* field = nextField( &p );
+	if( !field || !*field ) return false;
+	entry.uuid = field;
+	double timestamp;
+	if( !parseDouble( nextField( &p ), &timestamp ) ) return false;
+	entry.timestamp = (long long)timestamp;
+	if( !parseDouble( nextField( &p ), &entry.latitude ) ||
+	    !parseDouble( nextField( &p ), &entry.longitude ) ||
+	    !parseDouble( nextField( &p ), &entry.altitude ) ||
+	    !parseDouble( nextField( &p ), &entry.horizontalAccuracy ) ||
+	    !parseDouble( nextField( &p ), &entry.verticalAccuracy ) ) return false;
+	if( !( field = nextField( &p ) ) ) return false;
+	entry.building = field;
+	if( !( field = nextField( &p ) ) ) return false;
+	entry.room = field;
+
+	entry.fingerprint.clear();
+	entry.count = 1;
+	while( ( field = nextField( &p ) ) ){
+		if( field[0] == '#' ){
+			// the optional observation count ends the line
+			int count = atoi( field+1 );
+			if( count > 1 ) entry.count = count;
+			break;
+		}
+		char* end;
+		float value = strtof( field, &end );
+		if( end == field ) return false;
+		entry.fingerprint.push_back( value );
+	}
+	return true;
+}
+
+
+FingerprintFileReader::FingerprintFileReader( FILE* f ) :
+file(f), buf(NULL), bufSize(0), numMalformed(0), expiryTime(LLONG_MIN), numExpired(0){
+	MetricsRegistry* metrics = MetricsRegistry::shared();
+	entriesRead = metrics->counter( "database_entries_read_total", "Entries read from database files" );
+	malformedLines = metrics->counter( "database_malformed_lines_total", "Lines of database files which could not be parsed" );
+}
+
+FingerprintFileReader::~FingerprintFileReader(){
+	free( buf );
+}
+
+bool FingerprintFileReader::next( FingerprintEntry& entry, std::string* line ){
+	ssize_t length;
+	while( ( length = getline( &buf, &bufSize, file ) ) >= 0 ){
+		// strip the line ending
+		while( length > 0 && ( buf[length-1] == '\n' || buf[length-1] == '\r' ) ) buf[--length] = '\0';
+		if( length == 0 ) continue;
+		if( line ) line->assign( buf, length );
+		if( parseFingerprintEntry( buf, entry ) ){
+			entriesRead->add();
+			if( entry.timestamp < expiryTime ){
+				++numExpired;
+				continue;
+			}
+			return true;
+		}
+		++numMalformed;
+		malformedLines->add();
+	}
+	return false;
+}
+
+unsigned int FingerprintFileReader::getNumMalformed() const{
+	return numMalformed;
+}
+
+void FingerprintFileReader::setExpiryTime( long long time ){
+	expiryTime = time;
+}
+
+unsigned int FingerprintFileReader::getNumExpired() const{
+	return numExpired;
+}
+
+
+bool writeFingerprintEntry( FILE* file, const FingerprintEntry& entry ){
+	fprintf( file, "%s\t%lld\t", entry.uuid.c_str(), entry.timestamp );
+	fprintf( file, "%.7f\t%.7f\t%.2f\t%.2f\t%.2f\t", entry.latitude, entry.longitude, entry.altitude,
+			 entry.horizontalAccuracy, entry.verticalAccuracy );
+	fprintf( file, "%s\t%s", entry.building.c_str(), entry.room.c_str() );
+	for( unsigned int j=0; j<entry.fingerprint.size(); ++j ){
+		float value = entry.fingerprint[j];
+		// no "nan" in the database file, as in FingerprintDB
+		if( value != value ) fprintf( file, "\t0" );
+		else fprintf( file, "\t%.4g", value );
+	}
+	if( entry.count > 1 ) fprintf( file, "\t#%u", entry.count );
+	return fprintf( file, "\n" ) > 0 && !ferror( file );
+}
+
+
+std::string expiryFilename( const std::string& dbFilename ){
+	size_t n = dbFilename.size();
+	if( n >= 4 && dbFilename.compare( n-4, 4, ".txt" ) == 0 ) return dbFilename.substr( 0, n-4 ) + "_expiry.txt";
+	return dbFilename + "_expiry";
+}
+
+long long readExpiryTime( const char* filename ){
+	FILE* file = fopen( filename, "r" );
+	if( !file ) return LLONG_MIN;
+	long long time;
+	if( fscanf( file, "%lld", &time ) != 1 ) time = LLONG_MIN;
+	fclose( file );
+	return time;
+}
+
+bool writeExpiryTime( const char* filename, long long time ){
+	// write a new file and rename it over the old one, as FingerprintDB's atomic write does
+	std::string tmpFilename = std::string( filename ) + ".tmp";
+	FILE* file = fopen( tmpFilename.c_str(), "w" );
+	if( !file ) return false;
+	fprintf( file, "%lld\n", time );
+	if( fclose( file ) || rename( tmpFilename.c_str(), filename ) ){
+		unlink( tmpFilename.c_str() );
+		return false;
+	}
+	return true;
+}
+
+
+std::string newUUIDString(){
+	unsigned char b[16];
+	FILE* urandom = fopen( "/dev/urandom", "rb" );
+	if( !urandom || fread( b, 1, sizeof(b), urandom ) != sizeof(b) ){
+		static bool seeded = false;
+		if( !seeded ) srandom( time( NULL ) ^ getpid() );
+		seeded = true;
+		for( unsigned int i=0; i<sizeof(b); ++i ) b[i] = random();
+	}
+	if( urandom ) fclose( urandom );
+	b[6] = ( b[6] & 0x0f ) | 0x40; // version 4
+	b[8] = ( b[8] & 0x3f ) | 0x80; // RFC 4122 variant
+	char str[37];
+	snprintf( str, sizeof(str), "%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",
+			  b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15] );
+	return str;
+}
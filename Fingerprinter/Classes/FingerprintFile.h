@@ -0,0 +1,85 @@
+/*
+ *  FingerprintFile.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Reads and writes the text database files of FingerprintDB (db.txt) in
+ * plain C++, for tools which run away from the phone.  Each line is one
+ * entry, with tab-separated fields:
+ *   uuid, timestamp (seconds since 1970), latitude, longitude, altitude,
+ *   horizontal accuracy, vertical accuracy, building, room,
+ *   the fingerprint values, and "#count" if the entry was coalesced.
+ * Entries are read one at a time, so files of any size can be streamed.
+ * Entries read and lines skipped are counted in the database metrics (see
+ * Metrics.h).
+ *
+ * FingerprintDB expires old entries without rewriting the database file, by
+ * recording the expiry time in a second file beside it (db_expiry.txt beside
+ * db.txt), as one number of seconds since 1970.  Readers given that time skip
+ * the older entries.
+ */
+
+#ifndef FINGERPRINT_FILE_H
+#define FINGERPRINT_FILE_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "Metrics.h"
+
+/* one line of a database file */
+struct FingerprintEntry{
+	std::string uuid;
+	long long timestamp;
+	double latitude, longitude, altitude;
+	double horizontalAccuracy, verticalAccuracy; // negative if the location is unknown
+	std::string building;
+	std::string room;
+	std::vector<float> fingerprint;
+	unsigned int count; // observations coalesced into this entry, 1 if it was not
+};
+
+class FingerprintFileReader{
+public:
+	/* reads from an already-open file, which the caller closes */
+	FingerprintFileReader( FILE* file );
+	~FingerprintFileReader();
+	/**
+	 * Reads the next entry, skipping blank and malformed lines.
+	 * @param line if not NULL, receives the line as read, without its newline.
+	 * @return false at the end of the file.
+	 */
+	bool next( FingerprintEntry& entry, std::string* line = NULL );
+	/* number of lines skipped because they could not be parsed */
+	unsigned int getNumMalformed() const;
+	/* skips entries older than time from now on, as FingerprintDB does when loading */
+	void setExpiryTime( long long time );
+	/* number of entries skipped because they had expired */
+	unsigned int getNumExpired() const;
+
+private:
+	FILE* file;
+	char* buf; // from getline()
+	size_t bufSize;
+	unsigned int numMalformed;
+	long long expiryTime;
+	unsigned int numExpired;
+	MetricCounter* entriesRead;
+	MetricCounter* malformedLines;
+};
+
+/* Parses one line, which must not include its newline.  @return false if it is malformed. */
+bool parseFingerprintEntry( char* line, FingerprintEntry& entry );
+/* Writes an entry as one line, in the format of FingerprintDB.  @return false on a write error. */
+bool writeFingerprintEntry( FILE* file, const FingerprintEntry& entry );
+/* the expiry file of a database file: "db_expiry.txt" for "db.txt", otherwise the name with "_expiry" appended */
+std::string expiryFilename( const std::string& dbFilename );
+/* the time recorded in an expiry file, or LLONG_MIN if there is none */
+long long readExpiryTime( const char* filename );
+/* records the time in an expiry file, replacing it atomically.  @return false on a write error. */
+bool writeExpiryTime( const char* filename, long long time );
+/* a new random (version 4) UUID string, in upper case as NSUUID writes them */
+std::string newUUIDString();
+
+#endif // FINGERPRINT_FILE_H
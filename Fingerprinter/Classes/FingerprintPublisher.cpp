@@ -0,0 +1,58 @@
+/*
+ *  FingerprintPublisher.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "FingerprintPublisher.h"
+#include "Spectrogram.h"
+#include "ChangeDetector.h"
+#include <string.h>
+
+FingerprintPublisher::FingerprintPublisher( Spectrogram* s, ChangeDetector* c ) :
+spectrogram(s), changeDetector(c), sequence(0), numColumns(0), forgetRequest(0){
+	// readers must always have a fingerprint to copy, so start with one of zeros
+	fingerprint = new float[spectrogram->freqBins];
+	memset( fingerprint, 0, sizeof(float)*spectrogram->freqBins );
+}
+
+FingerprintPublisher::~FingerprintPublisher(){
+	delete[] fingerprint;
+}
+
+void FingerprintPublisher::addColumn( const float* column ){
+	unsigned int request = __sync_lock_test_and_set( &forgetRequest, 0 );
+	if( request ) spectrogram->forget( request-1 );
+	spectrogram->update( column );
+	changeDetector->addColumn( column );
+
+	// only this thread writes, so sequence can be advanced without an atomic add
+	sequence = sequence + 1;
+	__sync_synchronize(); // mark the copy as being written before writing it
+	spectrogram->getSummary( fingerprint );
+	numColumns = numColumns + 1;
+	__sync_synchronize(); // finish the copy before marking it written
+	sequence = sequence + 1;
+}
+
+const float* FingerprintPublisher::getLatest() const{
+	return fingerprint;
+}
+
+unsigned long long FingerprintPublisher::getFingerprint( float* outBuf ) const{
+	while( true ){
+		unsigned int before = sequence;
+		__sync_synchronize(); // read sequence before the copy
+		if( before & 1 ) continue; // being written
+		memcpy( outBuf, fingerprint, sizeof(float)*spectrogram->freqBins );
+		unsigned long long columns = numColumns;
+		__sync_synchronize(); // finish reading the copy before checking sequence again
+		if( sequence == before ) return columns;
+	}
+}
+
+void FingerprintPublisher::forgetHistory( unsigned int keepColumns ){
+	__sync_lock_test_and_set( &forgetRequest, keepColumns+1 );
+}
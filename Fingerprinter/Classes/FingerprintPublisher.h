@@ -0,0 +1,61 @@
+/*
+ *  FingerprintPublisher.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Takes each spectrogram column from the audio thread to the Spectrogram and
+ * ChangeDetector, and hands the resulting fingerprint to other threads without
+ * a lock, so that the audio thread never waits on a reader.  This is the part of
+ * Fingerprinter's audio callback after the column is computed, and
+ * SpectrumAnalyzer drives the same code, so that the real-time check of the
+ * tools (see RealtimeCheck.h) covers it.
+ *
+ * addColumn() is called on the audio thread only.  After updating the
+ * spectrogram it copies the summary into a buffer guarded by a sequence
+ * counter, which is odd while the copy is being written; getFingerprint()
+ * copies the buffer out and tries again if the counter was odd or changed
+ * meanwhile.  Columns come ten times a second and the copy takes microseconds,
+ * so readers hardly ever retry, and the writer never waits.
+ *
+ * forgetHistory() does not touch the spectrogram either: it leaves a request
+ * which the next addColumn() carries out before adding its column.
+ */
+
+#ifndef FINGERPRINT_PUBLISHER_H
+#define FINGERPRINT_PUBLISHER_H
+
+class Spectrogram;
+class ChangeDetector;
+
+class FingerprintPublisher{
+public:
+	/* spectrogram and changeDetector belong to the caller, and are only written
+	 * by addColumn() from now on */
+	FingerprintPublisher( Spectrogram* spectrogram, ChangeDetector* changeDetector );
+	~FingerprintPublisher();
+	/* on the audio thread: adds a column of spectrogram->freqBins values in dB and
+	 * publishes the new fingerprint */
+	void addColumn( const float* column );
+	/* on the audio thread: the fingerprint published by the last addColumn() */
+	const float* getLatest() const;
+	/**
+	 * On any thread: copies the latest fingerprint, of spectrogram->freqBins values.
+	 * @return the number of columns added when it was published.
+	 */
+	unsigned long long getFingerprint( float* outBuf ) const;
+	/* On any thread: keeps only the newest keepColumns columns in the history, as
+	 * of the next column; see Spectrogram::forget().  A later request replaces an
+	 * earlier one which has not been carried out yet. */
+	void forgetHistory( unsigned int keepColumns );
+
+private:
+	Spectrogram* spectrogram;
+	ChangeDetector* changeDetector;
+	float* fingerprint;             // the published fingerprint
+	volatile unsigned int sequence; // odd while fingerprint is being written
+	volatile unsigned long long numColumns;
+	volatile unsigned int forgetRequest; // keepColumns+1 of the pending request, or zero
+};
+
+#endif // FINGERPRINT_PUBLISHER_H
@@ -0,0 +1,127 @@
+/*
+ *  FingerprintScan.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * The scan and top-k engine behind database queries.  It is plain C++ over
+ * arrays of fingerprint pointers, so it knows nothing about DBEntry; callers
+ * pass a group (room) id for each row.  Scans are templated on a distance
+ * functor from DistanceMetrics.h and on a Score functor which may adjust each
+ * row's acoustic distance, eg. to blend in physical distance.
+ *
+ * When FingerprintStats are supplied for the queries and rows, the metric's
+ * lower bound is checked before each full distance computation, and rows which
+ * cannot improve their group's score are skipped.  This relies on every Score
+ * functor being non-decreasing in the distance; a row for which it is not
+ * should be given NULL stats, so that it is always scored in full.
+ */
+
+#ifndef FINGERPRINT_SCAN_H
+#define FINGERPRINT_SCAN_H
+
+#include "DistanceMetrics.h"
+
+/* Score functors map (row index, acoustic distance) to the row's final score.
+ * They must be non-decreasing in the distance. */
+struct IdentityScore{
+	inline float operator()( unsigned int row, float distance ) const { return distance; }
+};
+
+/* Inputs and outputs of a group minima scan. */
+struct GroupScan{
+	const float* const* queries; // query fingerprints
+	unsigned int numQueries;
+	const float* const* rows;    // database fingerprints
+	const unsigned int* groups;  // group id of each row, less than numGroups
+	unsigned int numRows;
+	/* optional precomputed statistics for pruning, or NULL to compute every distance */
+	const FingerprintStats* queryStats;           // one per query
+	const FingerprintStats* const* rowStats;      // one per row, NULL for a row which must not be pruned
+	/* optional row of each query which is left out of that query's scores, eg. for
+	 * leave-one-out evaluation with the queries taken from the rows, or NULL */
+	const unsigned int* queryRows;
+	/* outputs, which the caller must initialize (eg. to FLT_MAX):
+	 * groupScores[g*numQueries+j] is the best score of group g for query j,
+	 * groupBestScore[g] is the best score of group g for any query, and
+	 * groupBestRow[g] is the row which achieved groupBestScore[g]. */
+	float* groupScores;
+	float* groupBestScore;
+	unsigned int* groupBestRow;
+};
+
+/* Lower bounds are shrunk by this factor so that float rounding in the bound
+ * can never prune a row whose true distance would have won. */
+#define SCAN_BOUND_SLACK (0.9999f)
+
+/* Scores every row against every query in one pass over the rows, keeping
+ * each group's minimum score per query.
+ * @return the number of full distance computations performed */
+template<class Metric, class Score>
+inline unsigned int scanGroupMinima( const Metric& metric, const Score& score, const GroupScan& s ){
+	const bool prune = Metric::hasLowerBound && s.queryStats && s.rowStats;
+	unsigned int evaluations = 0;
+	for( unsigned int i=0; i<s.numRows; ++i ){
+		const float* row = s.rows[i];
+		unsigned int g = s.groups[i];
+		float* scores = s.groupScores + g*s.numQueries;
+		for( unsigned int j=0; j<s.numQueries; ++j ){
+			if( s.queryRows && s.queryRows[j] == i ) continue;
+			// the group's best score can only be improved if this row's bound is below it
+			if( prune && s.rowStats[i] &&
+			    score( i, SCAN_BOUND_SLACK * metric.lowerBound( s.queryStats[j], *s.rowStats[i] ) ) >= scores[j] ){
+				continue;
+			}
+			float d = score( i, metric( s.queries[j], row ) );
+			++evaluations;
+			if( d < scores[j] ) scores[j] = d;
+			if( d < s.groupBestScore[g] ){
+				s.groupBestScore[g] = d;
+				s.groupBestRow[g] = i;
+			}
+		}
+	}
+	return evaluations;
+}
+
+/* helper for the run-time metric version of scanGroupMinima, below */
+template<class Score>
+struct GroupScanOp{
+	GroupScanOp( const Score& Sc, const GroupScan& S, unsigned int* E ) : score(Sc), s(S), evaluations(E){}
+	template<class M> void operator()( const M& metric ) const { *evaluations = scanGroupMinima( metric, score, s ); }
+	const Score& score;
+	const GroupScan& s;
+	unsigned int* evaluations;
+};
+
+/* As above, with the metric chosen at run time.  The choice is made once per scan. */
+template<class Score>
+inline unsigned int scanGroupMinima( AcousticMetric metric, unsigned int length, const float* weights,
+									 const Score& score, const GroupScan& s ){
+	unsigned int evaluations;
+	withMetric( metric, length, weights, GroupScanOp<Score>( score, s, &evaluations ) );
+	return evaluations;
+}
+
+/* Finds the k smallest of n scores.  Their indices are written to outIndices
+ * in increasing order of score, and the number found, min(k,n), is returned.
+ * k is expected to be small, so a sorted insertion buffer beats a heap. */
+inline unsigned int selectTopK( const float* scores, unsigned int n, unsigned int k, unsigned int* outIndices ){
+	unsigned int found = 0;
+	if( k == 0 ) return 0;
+	for( unsigned int i=0; i<n; ++i ){
+		float s = scores[i];
+		// most scores lose to the current k-th best, so check that first
+		if( found == k && !( s < scores[outIndices[k-1]] ) ) continue;
+		unsigned int pos = ( found < k )? found++ : k-1;
+		// shift worse entries right to make room, keeping ties in index order
+		while( pos > 0 && s < scores[outIndices[pos-1]] ){
+			outIndices[pos] = outIndices[pos-1];
+			--pos;
+		}
+		outIndices[pos] = i;
+	}
+	return found;
+}
+
+#endif // FINGERPRINT_SCAN_H
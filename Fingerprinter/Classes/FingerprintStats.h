@@ -0,0 +1,79 @@
+/*
+ *  FingerprintStats.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Summary statistics of a fingerprint, computed once when it enters the
+ * database rather than on every comparison.  They provide the normalization
+ * constant of the combined metric and cheap lower bounds on distances, which
+ * let scans skip entries that cannot improve a result.
+ */
+
+#ifndef FINGERPRINT_STATS_H
+#define FINGERPRINT_STATS_H
+
+#include <math.h>
+
+/* number of contiguous blocks of frequency bins with their own partial norm */
+#define FP_STATS_BLOCKS 8
+
+struct FingerprintStats{
+	float norm; // L2 norm
+	float min;  // smallest element
+	float mean;
+	float blockNorms[FP_STATS_BLOCKS]; // L2 norm of each block of bins
+
+	/* fills in all of the statistics for the fingerprint fp of length len */
+	void compute( const float* fp, unsigned int len ){
+		unsigned int blockLen = ( len + FP_STATS_BLOCKS - 1 ) / FP_STATS_BLOCKS;
+		double sum = 0, sumSq = 0;
+		min = ( len > 0 )? fp[0] : 0.0f;
+		for( unsigned int b=0; b<FP_STATS_BLOCKS; ++b ){
+			double blockSq = 0;
+			unsigned int end = ( (b+1)*blockLen < len )? (b+1)*blockLen : len;
+			for( unsigned int i=b*blockLen; i<end; ++i ){
+				sum += fp[i];
+				blockSq += fp[i]*fp[i];
+				if( fp[i] < min ) min = fp[i];
+			}
+			blockNorms[b] = sqrt( blockSq );
+			sumSq += blockSq;
+		}
+		norm = sqrt( sumSq );
+		mean = ( len > 0 )? sum / len : 0.0f;
+	}
+};
+
+/* The combined metric's scale of a row's acoustic distance, 1/(maxSigDist-minSigDist), where
+ * maxSigDist is taken as 3 times the row's smallest element.  A row whose smallest element is
+ * zero or negative, as dB values may be, gets an infinite or negative scale, under which its
+ * score does not grow with the distance; see combinedScaleIsMonotonic(). */
+inline float combinedSignalScale( const FingerprintStats& row, float minSigDist ){
+	return 1.0f / ( 3*row.min - minSigDist );
+}
+
+/* true if the row's combined score grows with its acoustic distance, so that a lower bound
+ * on the distance also bounds the score and the row may be pruned */
+inline bool combinedScaleIsMonotonic( const FingerprintStats& row, float minSigDist ){
+	return 3*row.min - minSigDist > 0;
+}
+
+/* Lower bound on the L2 distance between two fingerprints: by the triangle
+ * inequality each block contributes at least the difference of its norms. */
+inline float l2LowerBound( const FingerprintStats& a, const FingerprintStats& b ){
+	float sum = 0;
+	for( unsigned int i=0; i<FP_STATS_BLOCKS; ++i ){
+		float d = a.blockNorms[i] - b.blockNorms[i];
+		sum += d*d;
+	}
+	return sqrtf( sum );
+}
+
+/* Lower bound on the L1 distance between two fingerprints of length len:
+ * the sum of absolute differences is at least the absolute difference of sums. */
+inline float l1LowerBound( const FingerprintStats& a, const FingerprintStats& b, unsigned int len ){
+	return fabsf( a.mean - b.mean ) * len;
+}
+
+#endif // FINGERPRINT_STATS_H
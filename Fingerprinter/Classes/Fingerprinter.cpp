@@ -7,6 +7,7 @@
  */
 
 #include "Fingerprinter.h"
+#include "RealtimeCheck.h"
 
 #include <stdlib.h> // for random()
 #include "CAXException.h" // for Core Audio exception handling
@@ -20,6 +21,7 @@
 #if !TARGET_OS_IPHONE
 #import <CoreAudio/AudioHardware.h>
 #endif
+#include <mach/mach_time.h> // for converting audio timestamps
 
 using namespace std;
 
@@ -44,10 +46,8 @@ const unsigned int Fingerprinter::fpLength = Fingerprinter::specRes * Fingerprin
 typedef struct{
 	AudioUnit rioUnit;
 	// the following are for RIO listener
-	Spectrogram* spectrogram;
-	Fingerprint fingerprint;
+	FingerprintPublisher* publisher; // takes the columns to the spectrogram, without a lock
 	FFTSetup fftsetup;
-	pthread_mutex_t* lock; // fingerprint lock
 	// signal processing buffers
 	float* A __attribute__ ((aligned (16))); // scratch // aligned for SIMD
 	float* hamm __attribute__ ((aligned (16))); // hamming window
@@ -58,6 +58,22 @@ typedef struct{
 	int startIndex; // index of next window to be analyzed
 	unsigned int fbLen; // number of frames (floats) in frameBuffer
 	DSPSplitComplex compl_buf;	
+	// the following are for recording and logging
+	SegmentedWavWriter* volatile* recorder; // points to Fingerprinter::recorder
+	SpectrumLogger* volatile* spectrumLogger; // points to Fingerprinter::spectrumLogger
+	short* pcm; // 16-bit copy of up to specRes samples
+	double hostTicksToSeconds; // for AudioTimeStamp.mHostTime
+	// the following are for the fixed-point signal processing
+	volatile bool* fixedPoint; // points to Fingerprinter::fixedPoint
+	bool accFixedPoint; // the path which the current column has been accumulated with
+	FixedPointSpectrum* fixedSpectrum;
+	int32_t* fixedBuffer; // the samples as delivered, in 8.24 fixed point; used instead of frameBuffer on the fixed-point path
+	// the following are for diagnostics, which must not print from the audio thread
+	MetricHistogram* callbackTime;
+	MetricCounter* columnCount;
+	MetricCounter* invalidSpectra;
+	MetricCounter* renderErrors;
+	MetricCounter* longBuffers;
 } CallbackData;
 
 
@@ -76,22 +92,21 @@ static OSStatus callback( 	 void						*inRefCon, /* the user-specified state dat
 							 UInt32 					inBusNumber, 
 							 UInt32 					inNumberFrames, 
 							 AudioBufferList 			*ioData ){	
+	REALTIME_SCOPE();
 	int windowFrames = Fingerprinter::specRes;
-	if( inNumberFrames > windowFrames ){
-		fprintf(stderr, "Error: buffer is too small.\n");		
-	}
 	
 	// cast our data structure
 	CallbackData* cd = (CallbackData*)inRefCon;
-	// retreive audio samples
-	try{
-		XThrowIfError( AudioUnitRender(cd->rioUnit, ioActionFlags, inTimeStamp, 
-									   kInputBus, inNumberFrames, ioData), "Callback: AudioUnitRender" );
+	MetricTimer timer( cd->callbackTime );
+	if( inNumberFrames > windowFrames ){
+		cd->longBuffers->add(); // more than a window per buffer; see the TODO above
 	}
-	catch (CAXException &e) {
-		char buf[256];
-		fprintf(stderr, "Error: %s (%s)\n", e.mOperation, e.FormatError(buf));
-		return 1;
+	// retreive audio samples
+	OSStatus err = AudioUnitRender( cd->rioUnit, ioActionFlags, inTimeStamp, 
+									kInputBus, inNumberFrames, ioData );
+	if( err ){
+		cd->renderErrors->add();
+		return err;
 	}
 	SInt32 *data_ptr = (SInt32 *)(ioData->mBuffers[0].mData);
 	
@@ -101,20 +116,71 @@ static OSStatus callback( 	 void						*inRefCon, /* the user-specified state dat
 	// setup FFT
 	UInt32 log2FFTLength = log2f( Fingerprinter::specRes );
 
+	// if the signal processing path was switched, start the column again with the new one.
+	// The samples buffered so far are in the other path's buffer, so start that again too.
+	bool fixedPoint = *(cd->fixedPoint);
+	if( fixedPoint != cd->accFixedPoint ){
+		float zerof=0.0f;
+		vDSP_vfill( &zerof, cd->acc, 1, Fingerprinter::fpLength );
+		cd->fixedSpectrum->clear();
+		cd->accCount = 0;
+		cd->accFixedPoint = fixedPoint;
+		cd->fbIndex = 0;
+		cd->startIndex = 0;
+	}
+
 	// If there is no space left in the buffer for the current frame, 
 	// left-shift the right-half of the buffer to overwrite the old data.
 	// After the new data is added there will be enough data left to
 	// build a full window.  Also, there will not be a full window of old data.
 	if( cd->fbIndex >= cd->fbLen - inNumberFrames ){
 		// left-shift right half of buffer
-		memcpy(cd->frameBuffer + cd->fbLen/2, cd->frameBuffer, sizeof(float)*cd->fbLen/2);
+		if( fixedPoint ){
+			memcpy(cd->fixedBuffer, cd->fixedBuffer + cd->fbLen/2, sizeof(int32_t)*cd->fbLen/2);
+		}else{
+			memcpy(cd->frameBuffer, cd->frameBuffer + cd->fbLen/2, sizeof(float)*cd->fbLen/2);
+		}
 		// adjust buffer index to reflect shift
 		cd->fbIndex -= cd->fbLen/2;
 		cd->startIndex -= cd->fbLen/2;
 	}
 	
-	// convert integers to floats, while copying into frameBuffer
-	vDSP_vflt32( (int*)data_ptr, 1, cd->frameBuffer + cd->fbIndex, 1, inNumberFrames );		
+	if( fixedPoint ){
+		// the integer pipeline takes the 8.24 samples as they are
+		memcpy( cd->fixedBuffer + cd->fbIndex, data_ptr, sizeof(int32_t)*inNumberFrames );
+	}else{
+		// convert integers to floats, while copying into frameBuffer
+		vDSP_vflt32( (int*)data_ptr, 1, cd->frameBuffer + cd->fbIndex, 1, inNumberFrames );		
+	}
+	
+	// time of the first new sample
+	double timestamp = 0;
+	if( inTimeStamp->mFlags & kAudioTimeStampHostTimeValid ){
+		timestamp = inTimeStamp->mHostTime * cd->hostTicksToSeconds;
+	}
+	
+	// pass the samples on to the recorder, if any, converted from 8.24 fixed point to 16 bits
+	SegmentedWavWriter* recorder = *(cd->recorder);
+	if( recorder ){
+		float scale = 1.0f / (1<<9);
+		float lo = -32768.0f, hi = 32767.0f;
+		for( unsigned int done=0; done<inNumberFrames; done+=Fingerprinter::specRes ){
+			unsigned int n = inNumberFrames - done;
+			if( n > Fingerprinter::specRes ) n = Fingerprinter::specRes;
+			if( fixedPoint ){
+				const int32_t* x = cd->fixedBuffer + cd->fbIndex + done;
+				for( unsigned int i=0; i<n; ++i ){
+					int32_t v = x[i] >> 9;
+					cd->pcm[i] = v < -32768 ? -32768 : ( v > 32767 ? 32767 : v );
+				}
+			}else{
+				vDSP_vsmul( cd->frameBuffer + cd->fbIndex + done, 1, &scale, cd->A, 1, n );
+				vDSP_vclip( cd->A, 1, &lo, &hi, cd->A, 1, n );
+				vDSP_vfix16( cd->A, 1, cd->pcm, 1, n );
+			}
+			recorder->push( cd->pcm, n, timestamp + (double)done / Fingerprinter::sampleRate );
+		}
+	}
 	
 	
 	// increment frame buffer index
@@ -130,46 +196,55 @@ static OSStatus callback( 	 void						*inRefCon, /* the user-specified state dat
 	// loop over as many overlapping windows as are present in the buffer.
 	int stepSize = floor(Fingerprinter::windowOffset * Fingerprinter::sampleRate);
 	for( ; cd->startIndex <= cd->fbIndex-windowFrames; cd->startIndex+=stepSize ){
-		// copy the window into buffer A, where signal processing will occur
-		memcpy( cd->A, cd->frameBuffer+cd->startIndex, sizeof(float)*Fingerprinter::specRes );
-		
-		// apply Hamming window
-		vDSP_vmul(cd->A, 1, cd->hamm, 1, cd->A, 1, Fingerprinter::specRes); //apply
-		
-		// take fft 	
-		// ctoz and ztoc are needed to convert from "split" and "interleaved" complex formats
-		// see vDSP documentation for details.
-		vDSP_ctoz((COMPLEX*) cd->A, 2, &(cd->compl_buf), 1, Fingerprinter::specRes);
-		vDSP_fft_zip( cd->fftsetup, &(cd->compl_buf), 1, log2FFTLength, kFFTDirection_Forward );
-		///vDSP_ztoc(&compl_buf, 1, (COMPLEX*) A, 2, inNumberFrames/2); // convert back
-		
-		// use vDSP_zaspec to get power spectrum
-		vDSP_zaspec( &(cd->compl_buf), cd->A, Fingerprinter::specRes );
-						
-		// store results in accumulator
-		vDSP_vadd(cd->A, 1, cd->acc, 1, cd->acc, 1, Fingerprinter::fpLength);
+		if( fixedPoint ){
+			// window, FFT and power, added to the fixed-point accumulator
+			cd->fixedSpectrum->addWindow( cd->fixedBuffer+cd->startIndex );
+		}else{
+			// copy the window into buffer A, where signal processing will occur
+			memcpy( cd->A, cd->frameBuffer+cd->startIndex, sizeof(float)*Fingerprinter::specRes );
+			
+			// apply Hamming window
+			vDSP_vmul(cd->A, 1, cd->hamm, 1, cd->A, 1, Fingerprinter::specRes); //apply
+			
+			// take fft 	
+			// ctoz and ztoc are needed to convert from "split" and "interleaved" complex formats
+			// see vDSP documentation for details.
+			vDSP_ctoz((COMPLEX*) cd->A, 2, &(cd->compl_buf), 1, Fingerprinter::specRes);
+			vDSP_fft_zip( cd->fftsetup, &(cd->compl_buf), 1, log2FFTLength, kFFTDirection_Forward );
+			///vDSP_ztoc(&compl_buf, 1, (COMPLEX*) A, 2, inNumberFrames/2); // convert back
+			
+			// use vDSP_zaspec to get power spectrum
+			vDSP_zaspec( &(cd->compl_buf), cd->A, Fingerprinter::specRes );
+							
+			// store results in accumulator
+			vDSP_vadd(cd->A, 1, cd->acc, 1, cd->acc, 1, Fingerprinter::fpLength);
+		}
 		
 		if ( ++cd->accCount >= Fingerprinter::accumulationNum ){
-			if( pthread_mutex_lock( cd->lock ) ) printf( "lock failed!\n" );
-
 			// convert to dB
-			float reference=1.0f * Fingerprinter::accumulationNum; //divide by number of summed spectra
-			vDSP_vdbcon( cd->acc, 1, &reference, cd->acc, 1, Fingerprinter::fpLength, 1 ); // 1 for power, not amplitude			
+			if( fixedPoint ){
+				cd->fixedSpectrum->getDecibels( cd->acc ); // also clears its accumulator
+			}else{
+				float reference=1.0f * Fingerprinter::accumulationNum; //divide by number of summed spectra
+				vDSP_vdbcon( cd->acc, 1, &reference, cd->acc, 1, Fingerprinter::fpLength, 1 ); // 1 for power, not amplitude			
+			}
 			
 			// As a precation, test that spectrum is valid
 			if( !(cd->acc[0] >= 0 || cd->acc[0] <= 0 ) ){ // is NaN
-				printf( "spectrum is NaN\n" );
-				pthread_mutex_unlock( cd->lock );
-				return 0;
+				cd->invalidSpectra->add();
+			}else{
+				// save in spectrogram and publish the new fingerprint; readers never hold us up
+				cd->publisher->addColumn( cd->acc );
+				cd->columnCount->add();
+				
+				// log the column, timestamped at the end of the window
+				SpectrumLogger* logger = *(cd->spectrumLogger);
+				if( logger ){
+					int windowEnd = cd->startIndex + windowFrames - ( cd->fbIndex - (int)inNumberFrames );
+					logger->addColumn( cd->acc, cd->publisher->getLatest(), timestamp + (double)windowEnd / Fingerprinter::sampleRate );
+				}
 			}
 			
-			// save in spectrogram
-			cd->spectrogram->update( cd->acc );
-			
-			// update fingerprint from spectrogram summary
-			cd->spectrogram->getSummary( cd->fingerprint );
-			pthread_mutex_unlock( cd->lock );
-			
 			// clear accumulator
 			float zerof=0.0f;
 			vDSP_vfill( &zerof, cd->acc, 1, Fingerprinter::fpLength );
@@ -273,11 +348,9 @@ int Fingerprinter::setupRemoteIO( AURenderCallbackStruct inRenderProc, CAStreamB
 		// first, collect all the data pointers the callback function will need
 		CallbackData* callbackData = new CallbackData;
 		callbackData->rioUnit = this->rioUnit;
-		callbackData->spectrogram = &(this->spectrogram);
-		callbackData->fingerprint = this->fingerprint;
+		callbackData->publisher = &(this->publisher);
 		UInt32 log2FFTLength = log2f( Fingerprinter::specRes );
 		callbackData->fftsetup = vDSP_create_fftsetup( log2FFTLength, kFFTRadix2 ); // this only needs to be created once
-		callbackData->lock = &(this->lock);
 		// allocate buffers for signal processing
 		callbackData->A = new float[2*Fingerprinter::specRes];
 		callbackData->accCount=0;
@@ -293,6 +366,22 @@ int Fingerprinter::setupRemoteIO( AURenderCallbackStruct inRenderProc, CAStreamB
 		callbackData->compl_buf.imagp = new float[Fingerprinter::specRes];
 		callbackData->fbIndex = 0;
 		callbackData->startIndex = 0;
+		callbackData->recorder = &(this->recorder);
+		callbackData->spectrumLogger = &(this->spectrumLogger);
+		callbackData->pcm = new short[Fingerprinter::specRes];
+		mach_timebase_info_data_t timebase;
+		mach_timebase_info( &timebase );
+		callbackData->hostTicksToSeconds = 1e-9 * timebase.numer / timebase.denom;
+		callbackData->fixedPoint = &(this->fixedPoint);
+		callbackData->accFixedPoint = this->fixedPoint;
+		callbackData->fixedSpectrum = new FixedPointSpectrum( Fingerprinter::specRes, Fingerprinter::fpLength );
+		callbackData->fixedBuffer = new int32_t[callbackData->fbLen];
+		MetricsRegistry* metrics = MetricsRegistry::shared();
+		callbackData->callbackTime = metrics->histogram( "fingerprinter_callback_us", "Microseconds spent in the audio callback" );
+		callbackData->columnCount = metrics->counter( "fingerprinter_columns_total", "Spectrogram columns computed from the audio" );
+		callbackData->invalidSpectra = metrics->counter( "fingerprinter_invalid_spectra_total", "Spectrogram columns dropped for being NaN" );
+		callbackData->renderErrors = metrics->counter( "fingerprinter_render_errors_total", "Audio buffers which AudioUnitRender failed to deliver" );
+		callbackData->longBuffers = metrics->counter( "fingerprinter_long_buffers_total", "Audio buffers longer than an FFT window" );
 		
 		
 		// set the callback fcn
@@ -347,16 +436,18 @@ int Fingerprinter::setupRemoteIO( AURenderCallbackStruct inRenderProc, CAStreamB
 
 /* Constructor initializes the audio system */
 Fingerprinter::Fingerprinter() :
-spectrogram( Fingerprinter::fpLength, Fingerprinter::historyCount ){
+// eager summary: the plot timer reads a fingerprint for every column, too often for the lazy engine to pay
+spectrogram( Fingerprinter::fpLength, Fingerprinter::historyCount ),
+changeDetector( Fingerprinter::fpLength ),
+publisher( &spectrogram, &changeDetector ){
 	this->unitIsRunning = false;
+	this->recorder = NULL;
+	this->spectrumLogger = NULL;
+	this->fixedPoint = FINGERPRINTER_FIXED_POINT;
 	
-	// plotter must always have a FP available to plot, so init one here.
-	this->fingerprint = new float[Fingerprinter::fpLength];
-	for( unsigned int i=0; i<Fingerprinter::fpLength; ++i ){
-		this->fingerprint[i] = 0;
-	}
-	// initialize fingerprint lock
-	if( pthread_mutex_init( &lock, NULL ) ) printf( "mutex init failed!\n" );
+	// the publisher starts with a fingerprint of zeros, so the plotter always has one to plot
+	MetricsRegistry* metrics = MetricsRegistry::shared();
+	this->fingerprintCount = metrics->counter( "fingerprinter_fingerprints_total", "Fingerprints read from the spectrogram" );
 
 	// INITIALIZE AUDIO
 	try {			
@@ -392,11 +483,52 @@ spectrogram( Fingerprinter::fpLength, Fingerprinter::historyCount ){
 }	
 
 
+void Fingerprinter::setRecorder( SegmentedWavWriter* newRecorder ){
+	this->recorder = newRecorder;
+}
+
+
+void Fingerprinter::setSpectrumLogger( SpectrumLogger* logger ){
+	if( logger && Fingerprinter::fpLength != SPECTRUM_BINS ){
+		fprintf( stderr, "Error: spectrum records hold %u bins, not %u\n", SPECTRUM_BINS, Fingerprinter::fpLength );
+		return;
+	}
+	this->spectrumLogger = logger;
+}
+
+
+void Fingerprinter::setFixedPoint( bool useFixedPoint ){
+	this->fixedPoint = useFixedPoint;
+}
+
+
+bool Fingerprinter::isFixedPoint() const{
+	return this->fixedPoint;
+}
+
+
+void Fingerprinter::getEnvironmentStatus( EnvironmentStatus* status ) const{
+	changeDetector.getStatus( status );
+}
+
+
+void Fingerprinter::forgetHistory( unsigned int keepColumns ){
+	publisher.forgetHistory( keepColumns );
+}
+
+
+bool Fingerprinter::addMotion( const MotionRecord* record ){
+	if( !motionGate.addMotion( record ) ) return false;
+	forgetHistory( motionGate.getStillColumns( Fingerprinter::windowOffset * Fingerprinter::accumulationNum ) );
+	return true;
+}
+
+
 bool Fingerprinter::getFingerprint( Fingerprint outBuf ){
 	if( this->unitIsRunning ){ // TODO: return false if less then a full window has been recorded.
-		if( pthread_mutex_lock( &lock ) ) printf( "lock failed!\n" );
-		memcpy( outBuf, this->fingerprint, sizeof(float)*Fingerprinter::fpLength );
-		pthread_mutex_unlock( &lock );
+		// a copy of the fingerprint the callback published with its last column
+		publisher.getFingerprint( outBuf );
+		fingerprintCount->add();
 		return true;
 	}
 	else return false;
@@ -408,7 +540,6 @@ bool Fingerprinter::getFingerprint( Fingerprint outBuf ){
 Fingerprinter::~Fingerprinter(){
 	AudioUnitUninitialize(rioUnit);
 	AudioComponentInstanceDispose(rioUnit);
-	pthread_mutex_destroy(&lock);
 	/*
 	//TODO: stop audio and clean up callback buffers
 	delete[] callbackData->A;
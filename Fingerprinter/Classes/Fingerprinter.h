@@ -13,9 +13,14 @@
 #import <AudioToolbox/AudioToolbox.h>
 #import <CoreAudio/CoreAudioTypes.h>
 #import "CAStreamBasicDescription.h"
-#include <pthread.h> // for mutex
-
 #import "Spectrogram.h"
+#include "WavWriter.h"
+#include "SpectrumLog.h"
+#include "FixedPointSpectrum.h"
+#include "ChangeDetector.h"
+#include "FingerprintPublisher.h"
+#include "MotionGate.h"
+#include "Metrics.h"
 
 // DATA TYPES
 /* Fingerprint is a summary of room ambient noise; essentially the power spectrum of the ambient noise */
@@ -41,10 +46,40 @@ public:
 	/* makes a copy of the current fingerprint value at the specified pointer.
 	 * outputFingerprint should be a float[] of length Fingerprinter::fpLength, to be filled by this function 
 	 * return value is true if successful.  Will fail if startRecording() has 
-	 * not been called or there is not yet enough data.
+	 * not been called or there is not yet enough data.  This never holds up the
+	 * audio callback; see FingerprintPublisher.
 	 */
 	bool getFingerprint( Fingerprint outputFingerprint );
 	
+	/* Sends a copy of the input audio, as 16-bit samples, to recorder, which should already have been
+	 * started.  Pass NULL to stop.  Stop recording before closing a recorder which has been set. */
+	void setRecorder( SegmentedWavWriter* recorder );
+	
+	/* Passes every spectrogram column and the fingerprint at that time to logger, or stops if it
+	 * is NULL.  As with setRecorder(), stop recording before deleting a logger which has been set. */
+	void setSpectrumLogger( SpectrumLogger* logger );
+	
+	/* Chooses the integer signal processing of FixedPointSpectrum, which may save power on
+	 * devices with slow floating point, or the vDSP float path.  The default is
+	 * FINGERPRINTER_FIXED_POINT.  Switching while recording restarts the current column. */
+	void setFixedPoint( bool fixedPoint );
+	bool isFixedPoint() const;
+	
+	/* copies the status of the ChangeDetector, which watches the spectrogram for changes of
+	 * room.  Poll it and query when the count of changes or stabilizations goes up. */
+	void getEnvironmentStatus( EnvironmentStatus* status ) const;
+	
+	/* keeps only the newest keepColumns spectrogram columns in the history, so that the
+	 * fingerprint describes them alone.  The audio callback does this before its next
+	 * column; see FingerprintPublisher::forgetHistory(). */
+	void forgetHistory( unsigned int keepColumns );
+	
+	/* Passes a CoreMotion sample to a MotionGate, and when the user has settled after
+	 * walking, cuts the history down to the audio heard since stopping, so that the
+	 * fingerprint converges on the new room in a second or two rather than ten.  Call it
+	 * from one thread, eg. the motion handler's queue.  @return true if the history was cut. */
+	bool addMotion( const MotionRecord* record );
+	
 	/* Destructor.  Cleans up. */
 	~Fingerprinter();
 
@@ -60,8 +95,8 @@ public:
 
 private:	
 	/* private data members */
-	Fingerprint			fingerprint;
-	pthread_mutex_t		lock; // for mutually exclusive access to fingerprint
+	MotionGate			motionGate;
+	MetricCounter*		fingerprintCount; // see Metrics.h
 	
 public: // the following must be public for audio callback function to access them
 	AudioUnit					rioUnit;
@@ -69,7 +104,12 @@ public: // the following must be public for audio callback function to access th
 	AURenderCallbackStruct		inputProc;
 	CAStreamBasicDescription	thruFormat;
 	Float64						hwSampleRate;
+	SegmentedWavWriter* volatile	recorder; // or NULL
+	SpectrumLogger* volatile	spectrumLogger; // or NULL
+	volatile bool				fixedPoint; // true to use FixedPointSpectrum
 
 	// the following is public ony for convenient access to its enableLogging function.
 	Spectrogram			spectrogram;
+	ChangeDetector		changeDetector; // fed each spectrogram column by the callback
+	FingerprintPublisher	publisher; // of spectrogram and changeDetector; declared after them
 };
\ No newline at end of file
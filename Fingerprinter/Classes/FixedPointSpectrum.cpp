@@ -0,0 +1,182 @@
+/*
+ *  FixedPointSpectrum.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "FixedPointSpectrum.h"
+#include <math.h>
+
+#define FFT_BITS 28          // FFT values are kept below 2^FFT_BITS before each stage
+#define TWIDDLE_BITS 30      // Q30 twiddle factors
+#define WINDOW_BITS 30       // Q30 Hamming window, precise enough not to spread a loud tone's leakage
+#define POWER_SHIFT 4        // a window's power is shifted down this far before it is summed
+#define LOG2_TABLE_BITS 8    // mantissa bits which index the log2 table
+#define DB_PER_OCTAVE_Q24 50504453 // 10*log10(2) in Q24
+
+/* log2(1 + i/2^LOG2_TABLE_BITS) in Q16, for i up to and including 2^LOG2_TABLE_BITS */
+static int32_t log2Table[(1<<LOG2_TABLE_BITS) + 1];
+static bool log2TableReady = false;
+
+/* position of the highest set bit of x, which must not be zero */
+static inline int highestBit( uint64_t x ){
+	return 63 - __builtin_clzll( x );
+}
+
+/* log2(x) in Q16, for x > 0, interpolating the table with the next 16 bits of the mantissa */
+static int64_t log2Q16( uint64_t x ){
+	int m = highestBit( x );
+	uint64_t y = x << (63-m); // the mantissa, with its leading one in the top bit
+	unsigned int i = (unsigned int)( y >> (63-LOG2_TABLE_BITS) ) & ( (1<<LOG2_TABLE_BITS) - 1 );
+	int64_t frac = (int64_t)( ( y >> (63-LOG2_TABLE_BITS-16) ) & 0xffff );
+	int64_t lo = log2Table[i], hi = log2Table[i+1];
+	return ( (int64_t)m << 16 ) + lo + ( ( ( hi - lo ) * frac ) >> 16 );
+}
+
+/* |x|, which fits in 32 bits even for the most negative x */
+static inline uint32_t magnitude( int32_t x ){
+	return ( x < 0 )? 0u - (uint32_t)x : (uint32_t)x;
+}
+
+/* x divided by 2^shift, rounding, or multiplied by 2^-shift if shift is negative */
+static inline int32_t scaleProduct( int64_t x, int shift ){
+	if( shift > 0 ) return (int32_t)( ( x + ( (int64_t)1 << (shift-1) ) ) >> shift );
+	return (int32_t)( x * ( (int64_t)1 << -shift ) );
+}
+
+/* shifts every value right by shift bits, rounding */
+static void shiftRight( int32_t* x, unsigned int n, int shift ){
+	int32_t half = 1 << (shift-1);
+	for( unsigned int i=0; i<n; ++i ) x[i] = ( x[i] + half ) >> shift;
+}
+
+FixedPointSpectrum::FixedPointSpectrum( unsigned int myLength, unsigned int myBins ) :
+fftLength(myLength), numBins(myBins), hamm( myLength ), cosTable( myLength/2 ), sinTable( myLength/2 ),
+bitReverse( myLength ), re( myLength ), im( myLength ), acc( myBins ){
+	const unsigned int n = fftLength;
+	for( unsigned int i=0; i<n; ++i ){
+		hamm[i] = (int32_t)lrint( ( 0.54 - 0.46 * cos( 2*M_PI*i / n ) ) * (1<<WINDOW_BITS) );
+	}
+	for( unsigned int k=0; k<n/2; ++k ){
+		cosTable[k] = (int32_t)lrint( cos( 2*M_PI*k / n ) * (1<<TWIDDLE_BITS) );
+		sinTable[k] = (int32_t)lrint( -sin( 2*M_PI*k / n ) * (1<<TWIDDLE_BITS) );
+	}
+	unsigned int bits = 0;
+	while( (1u<<bits) < n ) ++bits;
+	for( unsigned int i=0; i<n; ++i ){
+		unsigned int r = 0;
+		for( unsigned int b=0; b<bits; ++b ){
+			if( i & (1u<<b) ) r |= 1u << (bits-1-b);
+		}
+		bitReverse[i] = r;
+	}
+	if( !log2TableReady ){
+		for( unsigned int i=0; i<=(1<<LOG2_TABLE_BITS); ++i ){
+			log2Table[i] = (int32_t)lrint( log2( 1.0 + (double)i / (1<<LOG2_TABLE_BITS) ) * 65536 );
+		}
+		log2TableReady = true;
+	}
+	clear();
+}
+
+void FixedPointSpectrum::clear(){
+	for( unsigned int k=0; k<numBins; ++k ) acc[k] = 0;
+	accExponent = 0;
+	count = 0;
+}
+
+unsigned int FixedPointSpectrum::getCount() const{
+	return count;
+}
+
+int FixedPointSpectrum::fft(){
+	const unsigned int n = fftLength;
+	int32_t* xr = &re[0];
+	int32_t* xi = &im[0];
+	int exponent = 0;
+
+	// iterative decimation in time, as SpectrumAnalyzer::fft.  A butterfly can grow its
+	// inputs by at most 1+sqrt(2), so outputs stay below 2^(FFT_BITS+2)
+	for( unsigned int half=1; half<n; half*=2 ){
+		unsigned int stride = n / (2*half); // twiddle table step
+		uint32_t bits = 0; // the OR of the magnitudes has the same highest bit as the largest
+		for( unsigned int base=0; base<n; base+=2*half ){
+			for( unsigned int k=0; k<half; ++k ){
+				int64_t wr = cosTable[k*stride], wi = sinTable[k*stride];
+				unsigned int a = base+k, b = a+half;
+				int32_t tr = (int32_t)( ( wr*xr[b] - wi*xi[b] + (1<<(TWIDDLE_BITS-1)) ) >> TWIDDLE_BITS );
+				int32_t ti = (int32_t)( ( wr*xi[b] + wi*xr[b] + (1<<(TWIDDLE_BITS-1)) ) >> TWIDDLE_BITS );
+				xr[b] = xr[a] - tr;
+				xi[b] = xi[a] - ti;
+				xr[a] += tr;
+				xi[a] += ti;
+				bits |= magnitude( xr[a] ) | magnitude( xi[a] ) | magnitude( xr[b] ) | magnitude( xi[b] );
+			}
+		}
+		// rescale the block for the next stage, if it has one
+		if( 2*half < n && bits >> FFT_BITS ){
+			int shift = highestBit( bits ) - (FFT_BITS-1);
+			shiftRight( xr, n, shift );
+			shiftRight( xi, n, shift );
+			exponent += shift;
+		}
+	}
+	return exponent;
+}
+
+void FixedPointSpectrum::addWindow( const int32_t* window ){
+	const unsigned int n = fftLength;
+	// Windowed samples are packed as complex pairs into the first half of the buffer,
+	// in bit-reversed order for the FFT.  They are scaled so that the largest has
+	// FFT_BITS-1 bits, keeping the fraction of the products for quiet windows.
+	for( unsigned int i=0; i<n; ++i ){
+		re[i] = im[i] = 0;
+	}
+	uint32_t bits = 0;
+	for( unsigned int i=0; i<n; ++i ) bits |= magnitude( window[i] );
+	int exponent = 0; // the spectrum is re and im times 2^exponent
+	if( bits ){
+		int shift = highestBit( bits ) + WINDOW_BITS - (FFT_BITS-1);
+		for( unsigned int i=0; i<n/2; ++i ){
+			unsigned int j = bitReverse[i];
+			re[j] = scaleProduct( (int64_t)window[2*i] * hamm[2*i], shift );
+			im[j] = scaleProduct( (int64_t)window[2*i+1] * hamm[2*i+1], shift );
+		}
+		exponent = shift - WINDOW_BITS + fft();
+	}
+	// the power is re^2+im^2 times 2^(2*exponent); shifted down by POWER_SHIFT, it is
+	// times 2^exponent as set here
+	exponent = 2*exponent + POWER_SHIFT;
+
+	// align the sum and this window's power to the larger exponent, then add
+	if( count == 0 ){
+		accExponent = exponent;
+	}else if( exponent > accExponent ){
+		int shift = exponent - accExponent;
+		for( unsigned int k=0; k<numBins; ++k ) acc[k] = ( shift < 64 )? acc[k] >> shift : 0;
+		accExponent = exponent;
+	}
+	int shift = POWER_SHIFT + accExponent - exponent;
+	for( unsigned int k=0; k<numBins; ++k ){
+		uint64_t power = (uint64_t)( (int64_t)re[k]*re[k] + (int64_t)im[k]*im[k] );
+		if( shift < 64 ) acc[k] += power >> shift;
+	}
+	++count;
+}
+
+void FixedPointSpectrum::getDecibels( float* outBuf ){
+	// 10*log10( acc * 2^accExponent / count ), from log2 in Q16
+	int64_t offset = (int64_t)accExponent * 65536 - ( count > 0? log2Q16( count ) : 0 );
+	for( unsigned int k=0; k<numBins; ++k ){
+		if( acc[k] == 0 ){
+			outBuf[k] = -INFINITY; // as log10(0)
+			continue;
+		}
+		int64_t l = log2Q16( acc[k] ) + offset;
+		int64_t db = ( l * DB_PER_OCTAVE_Q24 ) >> 24; // Q16
+		outBuf[k] = db / 65536.0f;
+	}
+	clear();
+}
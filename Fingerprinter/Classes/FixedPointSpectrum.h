@@ -0,0 +1,73 @@
+/*
+ *  FixedPointSpectrum.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * An all-integer version of the callback's per-window signal processing, for
+ * devices where integer arithmetic is cheaper than floating point.  It takes
+ * the 8.24 fixed-point samples as RemoteIO delivers them, and
+ *  - applies a Q30 Hamming window,
+ *  - packs the windowed samples as complex pairs, as vDSP_ctoz does, and takes
+ *    a radix-2 block-floating-point FFT on 32-bit values with Q30 twiddle
+ *    factors: before each stage every value is shifted by the same amount to
+ *    keep it below 2^28, and the shifts are counted in a block exponent,
+ *  - sums the power of the low bins over several windows in 64-bit integers,
+ *    aligning the windows' exponents,
+ *  - and converts the sum to dB with a log2 table, so that only the final dB
+ *    values are floats, for the spectrogram.
+ * The results match the float path's (vDSP_vdbcon with the number of summed
+ * spectra as reference) to within FIXED_POINT_TOLERANCE_DB; `tester compare`
+ * checks this on recordings.
+ *
+ * Which path Fingerprinter and SpectrumAnalyzer use is chosen at run time,
+ * with setFixedPoint(); FINGERPRINTER_FIXED_POINT chooses the default at build
+ * time, eg. with -DFINGERPRINTER_FIXED_POINT=1.
+ */
+
+#ifndef FIXED_POINT_SPECTRUM_H
+#define FIXED_POINT_SPECTRUM_H
+
+#include <stdint.h>
+#include <vector>
+
+#ifndef FINGERPRINTER_FIXED_POINT
+#define FINGERPRINTER_FIXED_POINT 0
+#endif
+
+/* largest difference, in dB, from the float path's spectrogram values */
+#define FIXED_POINT_TOLERANCE_DB 0.01
+
+class FixedPointSpectrum{
+public:
+	/**
+	 * @param fftLength is the number of samples in each window, a power of two.
+	 * @param numBins is the number of low frequency bins to keep.
+	 */
+	FixedPointSpectrum( unsigned int fftLength, unsigned int numBins );
+	/* adds the power spectrum of fftLength 8.24 fixed-point samples to the sum */
+	void addWindow( const int32_t* window );
+	/* fills outBuf with numBins values, the mean of the summed spectra in dB, and clears the sum */
+	void getDecibels( float* outBuf );
+	/* number of windows summed since the last getDecibels() or clear() */
+	unsigned int getCount() const;
+	void clear();
+
+private:
+	/* in-place block-floating-point FFT of re and im, which are in bit-reversed order and
+	 * below 2^27; returns the number of bits by which the results were shifted down */
+	int fft();
+
+	unsigned int fftLength;
+	unsigned int numBins;
+	std::vector<int32_t> hamm;       // Q30 Hamming window, as vDSP_hamm_window
+	std::vector<int32_t> cosTable;   // Q30 twiddle factors, cos and -sin of 2*pi*k/fftLength
+	std::vector<int32_t> sinTable;
+	std::vector<unsigned int> bitReverse;
+	std::vector<int32_t> re, im;     // FFT buffer
+	std::vector<uint64_t> acc;       // summed power
+	int accExponent;                 // the summed power is acc times 2^accExponent
+	unsigned int count;
+};
+
+#endif // FIXED_POINT_SPECTRUM_H
@@ -0,0 +1,485 @@
+/*
+ *  Metrics.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "Metrics.h"
+#include <math.h>
+#include <new> // for placement new
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h> // for posix_memalign
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+#define REPORTER_POLL_US 100000    // longest the reporter's thread waits before checking for stop()
+#define REQUEST_BYTES 2048         // longest HTTP request header read
+#define REQUEST_TIMEOUT_S 1        // seconds a scraper may take to send its request
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+static const char* quantileNames[] = { "p50", "p90", "p99", "p999" };
+#define NUM_QUANTILES 4
+
+uint64_t metricsMicroseconds(){
+#ifdef __APPLE__
+	static mach_timebase_info_data_t timebase;
+	if( timebase.denom == 0 ) mach_timebase_info( &timebase );
+	return mach_absolute_time() * timebase.numer / timebase.denom / 1000;
+#else
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+MetricsFormat metricsFormatOf( const char* filename ){
+	size_t n = strlen( filename );
+	return ( n >= 5 && !strcmp( filename+n-5, ".json" ) )? MetricsJson : MetricsText;
+}
+
+/* the calling thread's shard.  Thread ids are addresses or counters, so they are mixed
+ * by a multiplicative hash, and the top bits taken. */
+static inline unsigned int threadShard(){
+	uint64_t id = (uint64_t)(uintptr_t)pthread_self();
+	return (unsigned int)( ( id * 0x9E3779B97F4A7C15ULL ) >> 32 ) & (METRICS_SHARDS-1);
+}
+
+/* appends printf-style formatted text */
+static void appendf( std::string& out, const char* format, ... ){
+	char buf[1024];
+	va_list args;
+	va_start( args, format );
+	int n = vsnprintf( buf, sizeof(buf), format, args );
+	va_end( args );
+	if( n > 0 ) out.append( buf, ( n < (int)sizeof(buf) )? n : sizeof(buf)-1 );
+}
+
+/* appends a JSON number, or null for the infinities and NaN which JSON cannot hold */
+static void appendJsonNumber( std::string& out, double value ){
+	if( isfinite( value ) ) appendf( out, "%.17g", value );
+	else out += "null";
+}
+
+
+// -----------------------------------------------------------------------------
+// COUNTER
+
+MetricCounter::MetricCounter(){
+	for( unsigned int i=0; i<METRICS_SHARDS; ++i ) shards[i].value = 0;
+}
+
+void MetricCounter::add( uint64_t n ){
+	__sync_fetch_and_add( &shards[threadShard()].value, n );
+}
+
+uint64_t MetricCounter::get() const{
+	uint64_t sum = 0;
+	for( unsigned int i=0; i<METRICS_SHARDS; ++i ) sum += shards[i].value;
+	return sum;
+}
+
+
+// -----------------------------------------------------------------------------
+// GAUGE
+
+MetricGauge::MetricGauge() : bits(0){} // the bits of 0.0
+
+void MetricGauge::set( double value ){
+	uint64_t b;
+	memcpy( &b, &value, sizeof(b) );
+	__sync_lock_test_and_set( &bits, b );
+}
+
+double MetricGauge::get() const{
+	// an add of nothing reads all 64 bits at once, even on 32-bit processors
+	uint64_t b = __sync_fetch_and_add( const_cast<volatile uint64_t*>( &bits ), 0 );
+	double value;
+	memcpy( &value, &b, sizeof(value) );
+	return value;
+}
+
+
+// -----------------------------------------------------------------------------
+// HISTOGRAM
+
+MetricHistogram::MetricHistogram(){
+	void* mem = NULL;
+	if( posix_memalign( &mem, METRICS_LINE_BYTES, sizeof(uint64_t) * METRICS_SHARDS * SHARD_WORDS ) ) mem = NULL;
+	shards = (volatile uint64_t*)mem;
+	if( shards ) memset( mem, 0, sizeof(uint64_t) * METRICS_SHARDS * SHARD_WORDS );
+}
+
+MetricHistogram::~MetricHistogram(){
+	free( (void*)shards );
+}
+
+unsigned int MetricHistogram::bucketOf( uint64_t value ){
+	const uint64_t subBuckets = 1 << METRICS_SUB_BUCKET_BITS;
+	if( value < subBuckets ) return (unsigned int)value;
+	if( value >> METRICS_MAX_VALUE_BITS ) return METRICS_BUCKETS-1;
+	// the position of the leading one picks the power of two, and the bits after it the bucket within it
+	unsigned int exponent = 63 - __builtin_clzll( value );
+	unsigned int shift = exponent - METRICS_SUB_BUCKET_BITS;
+	return (unsigned int)( subBuckets * (shift+1) + ( ( value >> shift ) - subBuckets ) );
+}
+
+uint64_t MetricHistogram::bucketMax( unsigned int bucket ){
+	const uint64_t subBuckets = 1 << METRICS_SUB_BUCKET_BITS;
+	if( bucket < subBuckets ) return bucket;
+	unsigned int shift = bucket / subBuckets - 1;
+	uint64_t lowest = ( subBuckets + bucket % subBuckets ) << shift;
+	return lowest + ( (uint64_t)1 << shift ) - 1;
+}
+
+void MetricHistogram::record( uint64_t value ){
+	if( !shards ) return;
+	volatile uint64_t* s = shards + threadShard() * SHARD_WORDS;
+	__sync_fetch_and_add( &s[BUCKETS + bucketOf( value )], 1 );
+	__sync_fetch_and_add( &s[SUM], value );
+	uint64_t old = s[MAX];
+	while( value > old ){
+		uint64_t seen = __sync_val_compare_and_swap( &s[MAX], old, value );
+		if( seen == old ) break;
+		old = seen;
+	}
+}
+
+void MetricHistogram::getSnapshot( HistogramSnapshot* snapshot ) const{
+	snapshot->count = snapshot->sum = snapshot->max = 0;
+	snapshot->buckets.assign( METRICS_BUCKETS, 0 );
+	if( !shards ) return;
+	for( unsigned int i=0; i<METRICS_SHARDS; ++i ){
+		const volatile uint64_t* s = shards + i * SHARD_WORDS;
+		snapshot->sum += s[SUM];
+		if( s[MAX] > snapshot->max ) snapshot->max = s[MAX];
+		for( unsigned int b=0; b<METRICS_BUCKETS; ++b ){
+			snapshot->buckets[b] += s[BUCKETS + b];
+		}
+	}
+	for( unsigned int b=0; b<METRICS_BUCKETS; ++b ) snapshot->count += snapshot->buckets[b];
+}
+
+uint64_t HistogramSnapshot::percentile( double fraction ) const{
+	if( count == 0 ) return 0;
+	uint64_t rank = (uint64_t)ceil( fraction * count );
+	if( rank < 1 ) rank = 1;
+	uint64_t seen = 0;
+	for( unsigned int b=0; b<buckets.size(); ++b ){
+		seen += buckets[b];
+		if( seen >= rank ){
+			uint64_t value = MetricHistogram::bucketMax( b );
+			return ( value < max )? value : max;
+		}
+	}
+	return max;
+}
+
+
+// -----------------------------------------------------------------------------
+// REGISTRY
+
+static MetricsRegistry* sharedRegistry = NULL;
+static pthread_once_t sharedOnce = PTHREAD_ONCE_INIT;
+
+MetricsRegistry::MetricsRegistry(){
+	pthread_mutex_init( &lock, NULL );
+}
+
+void MetricsRegistry::createShared(){
+	sharedRegistry = new MetricsRegistry();
+}
+
+MetricsRegistry* MetricsRegistry::shared(){
+	pthread_once( &sharedOnce, createShared );
+	return sharedRegistry;
+}
+
+void* MetricsRegistry::newMetric( MetricType type ){
+	switch( type ){
+		case CounterMetric:{
+			// aligned, so that each shard has a cache line to itself
+			void* mem = NULL;
+			if( posix_memalign( &mem, METRICS_LINE_BYTES, sizeof(MetricCounter) ) ) return new MetricCounter();
+			return new (mem) MetricCounter();
+		}
+		case GaugeMetric: return new MetricGauge();
+		default: return new MetricHistogram();
+	}
+}
+
+void* MetricsRegistry::find( const char* name, const char* help, MetricType type ){
+	pthread_mutex_lock( &lock );
+	void* metric = NULL;
+	for( unsigned int i=0; i<entries.size() && !metric; ++i ){
+		if( entries[i].name != name ) continue;
+		if( entries[i].type == type ){
+			metric = entries[i].metric;
+		}else{
+			// the caller still gets a metric, but it is not exported
+			fprintf( stderr, "Error: metric %s is already registered with another type\n", name );
+			metric = newMetric( type );
+		}
+	}
+	if( !metric ){
+		Entry e;
+		e.name = name;
+		e.help = help;
+		e.type = type;
+		e.metric = metric = newMetric( type );
+		entries.push_back( e );
+	}
+	pthread_mutex_unlock( &lock );
+	return metric;
+}
+
+MetricCounter* MetricsRegistry::counter( const char* name, const char* help ){
+	return (MetricCounter*)find( name, help, CounterMetric );
+}
+
+MetricGauge* MetricsRegistry::gauge( const char* name, const char* help ){
+	return (MetricGauge*)find( name, help, GaugeMetric );
+}
+
+MetricHistogram* MetricsRegistry::histogram( const char* name, const char* help ){
+	return (MetricHistogram*)find( name, help, HistogramMetric );
+}
+
+void MetricsRegistry::format( std::string& out, MetricsFormat format ){
+	// copy the list, so that metrics registered meanwhile do not wait for the snapshot
+	pthread_mutex_lock( &lock );
+	std::vector<Entry> list( entries );
+	pthread_mutex_unlock( &lock );
+
+	HistogramSnapshot h;
+	if( format == MetricsText ){
+		for( unsigned int i=0; i<list.size(); ++i ){
+			const Entry& e = list[i];
+			const char* name = e.name.c_str();
+			appendf( out, "# HELP %s %s\n", name, e.help.c_str() );
+			if( e.type == CounterMetric ){
+				appendf( out, "# TYPE %s counter\n%s %llu\n", name, name,
+						 (unsigned long long)((MetricCounter*)e.metric)->get() );
+			}else if( e.type == GaugeMetric ){
+				appendf( out, "# TYPE %s gauge\n%s %.17g\n", name, name, ((MetricGauge*)e.metric)->get() );
+			}else{
+				((MetricHistogram*)e.metric)->getSnapshot( &h );
+				appendf( out, "# TYPE %s summary\n", name );
+				for( unsigned int q=0; q<NUM_QUANTILES; ++q ){
+					appendf( out, "%s{quantile=\"%g\"} %llu\n", name, quantiles[q],
+							 (unsigned long long)h.percentile( quantiles[q] ) );
+				}
+				appendf( out, "%s_sum %llu\n%s_count %llu\n", name, (unsigned long long)h.sum,
+						 name, (unsigned long long)h.count );
+				appendf( out, "# TYPE %s_max gauge\n%s_max %llu\n", name, name, (unsigned long long)h.max );
+			}
+		}
+		return;
+	}
+
+	// JSON: the wall-clock time, then an object of each kind of metric, keyed by name
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	appendf( out, "{\"timestamp\":%.3f", tv.tv_sec + 1e-6*tv.tv_usec );
+	static const char* sections[] = { "counters", "gauges", "histograms" };
+	static const MetricType types[] = { CounterMetric, GaugeMetric, HistogramMetric };
+	for( unsigned int s=0; s<3; ++s ){
+		appendf( out, ",\n\"%s\":{", sections[s] );
+		bool first = true;
+		for( unsigned int i=0; i<list.size(); ++i ){
+			const Entry& e = list[i];
+			if( e.type != types[s] ) continue;
+			appendf( out, "%s\n \"%s\":", first? "" : ",", e.name.c_str() );
+			first = false;
+			if( e.type == CounterMetric ){
+				appendf( out, "%llu", (unsigned long long)((MetricCounter*)e.metric)->get() );
+			}else if( e.type == GaugeMetric ){
+				appendJsonNumber( out, ((MetricGauge*)e.metric)->get() );
+			}else{
+				((MetricHistogram*)e.metric)->getSnapshot( &h );
+				appendf( out, "{\"count\":%llu,\"sum\":%llu,\"max\":%llu", (unsigned long long)h.count,
+						 (unsigned long long)h.sum, (unsigned long long)h.max );
+				for( unsigned int q=0; q<NUM_QUANTILES; ++q ){
+					appendf( out, ",\"%s\":%llu", quantileNames[q], (unsigned long long)h.percentile( quantiles[q] ) );
+				}
+				out += "}";
+			}
+		}
+		out += "}";
+	}
+	out += "}\n";
+}
+
+bool MetricsRegistry::writeFile( const char* filename, MetricsFormat format ){
+	std::string content;
+	this->format( content, format );
+	// write beside it and rename, so that readers never see half a snapshot
+	std::string temp = std::string( filename ) + ".tmp";
+	FILE* f = fopen( temp.c_str(), "w" );
+	if( !f ){
+		fprintf( stderr, "Error: cannot write metrics to %s\n", temp.c_str() );
+		return false;
+	}
+	bool ok = ( fwrite( content.data(), 1, content.size(), f ) == content.size() );
+	ok = ( fclose( f ) == 0 ) && ok;
+	if( !ok || rename( temp.c_str(), filename ) ){
+		fprintf( stderr, "Error: cannot write metrics to %s\n", filename );
+		unlink( temp.c_str() );
+		return false;
+	}
+	return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// REPORTER
+
+MetricsReporter::MetricsReporter( MetricsRegistry* myRegistry ) :
+registry(myRegistry), interval(0), port(0), listenFd(-1), stopping(false), threadRunning(false){}
+
+MetricsReporter::~MetricsReporter(){
+	stop();
+}
+
+void MetricsReporter::setSnapshotFile( const char* newFilename, double intervalSeconds ){
+	filename = newFilename;
+	interval = intervalSeconds;
+}
+
+void MetricsReporter::setScrapePort( unsigned short newPort ){
+	port = newPort;
+}
+
+bool MetricsReporter::start(){
+	if( threadRunning ) return true;
+	if( port ){
+		listenFd = socket( AF_INET, SOCK_STREAM, 0 );
+		int one = 1;
+		setsockopt( listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+		struct sockaddr_in addr;
+		memset( &addr, 0, sizeof(addr) );
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons( port );
+		addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK ); // never reachable from the network
+		if( listenFd < 0 || bind( listenFd, (struct sockaddr*)&addr, sizeof(addr) ) || listen( listenFd, 4 ) ){
+			fprintf( stderr, "Error: cannot serve metrics on port %u\n", port );
+			if( listenFd >= 0 ) close( listenFd );
+			listenFd = -1;
+			return false;
+		}
+	}
+	stopping = false;
+	if( pthread_create( &thread, NULL, threadMain, this ) ){
+		fprintf( stderr, "Error: could not start metrics thread\n" );
+		return false;
+	}
+	threadRunning = true;
+	return true;
+}
+
+void MetricsReporter::stop(){
+	if( threadRunning ){
+		stopping = true;
+		pthread_join( thread, NULL );
+		threadRunning = false;
+		if( !filename.empty() ) registry->writeFile( filename.c_str(), metricsFormatOf( filename.c_str() ) );
+	}
+	if( listenFd >= 0 ) close( listenFd );
+	listenFd = -1;
+}
+
+void* MetricsReporter::threadMain( void* arg ){
+	MetricsReporter* THIS = (MetricsReporter*)arg;
+	const bool snapshots = !THIS->filename.empty() && THIS->interval > 0;
+	const MetricsFormat format = metricsFormatOf( THIS->filename.c_str() );
+	uint64_t next = metricsMicroseconds() + (uint64_t)( THIS->interval * 1e6 );
+	while( !THIS->stopping ){
+		// wait for a scraper, or just sleep, until the next snapshot or stop()
+		uint64_t now = metricsMicroseconds();
+		uint64_t wait = REPORTER_POLL_US;
+		if( snapshots && next > now && next - now < wait ) wait = next - now;
+		if( snapshots && next <= now ) wait = 0;
+		struct timeval tv;
+		tv.tv_sec = wait / 1000000;
+		tv.tv_usec = wait % 1000000;
+		fd_set fds;
+		FD_ZERO( &fds );
+		if( THIS->listenFd >= 0 ) FD_SET( THIS->listenFd, &fds );
+		int ready = select( THIS->listenFd + 1, &fds, NULL, NULL, &tv );
+		if( ready > 0 && THIS->listenFd >= 0 && FD_ISSET( THIS->listenFd, &fds ) ) THIS->serve();
+
+		if( snapshots && metricsMicroseconds() >= next ){
+			THIS->registry->writeFile( THIS->filename.c_str(), format );
+			next += (uint64_t)( THIS->interval * 1e6 );
+			// after a stall, carry on from now rather than catching up
+			if( next < metricsMicroseconds() ) next = metricsMicroseconds() + (uint64_t)( THIS->interval * 1e6 );
+		}
+	}
+	return NULL;
+}
+
+void MetricsReporter::serve(){
+	int fd = accept( listenFd, NULL, NULL );
+	if( fd < 0 ) return;
+	struct timeval timeout = { REQUEST_TIMEOUT_S, 0 };
+	setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout) );
+	setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout) );
+#ifdef SO_NOSIGPIPE
+	int one = 1;
+	setsockopt( fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one) );
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+	// read the request header; only its first line matters
+	char request[REQUEST_BYTES+1];
+	unsigned int length = 0;
+	while( length < REQUEST_BYTES ){
+		ssize_t n = recv( fd, request+length, REQUEST_BYTES-length, 0 );
+		if( n <= 0 ) break;
+		length += n;
+		request[length] = '\0';
+		if( strstr( request, "\r\n\r\n" ) || strstr( request, "\n\n" ) ) break;
+	}
+	request[length] = '\0';
+	char path[256] = "";
+	bool get = ( sscanf( request, "GET %255s", path ) == 1 );
+	char* query = strchr( path, '?' );
+	if( query ) *query = '\0';
+
+	std::string body, response;
+	const char* status = "200 OK";
+	const char* type = "text/plain; version=0.0.4";
+	if( get && ( !strcmp( path, "/metrics" ) || !strcmp( path, "/" ) ) ){
+		registry->format( body, MetricsText );
+	}else if( get && !strcmp( path, "/metrics.json" ) ){
+		registry->format( body, MetricsJson );
+		type = "application/json";
+	}else{
+		status = get? "404 Not Found" : "405 Method Not Allowed";
+		type = "text/plain";
+		body = "try /metrics or /metrics.json\n";
+	}
+	appendf( response, "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+			 status, type, (unsigned long)body.size() );
+	response += body;
+	for( size_t sent = 0; sent < response.size(); ){
+		ssize_t n = send( fd, response.data()+sent, response.size()-sent, MSG_NOSIGNAL );
+		if( n <= 0 ) break;
+		sent += n;
+	}
+	close( fd );
+}
@@ -0,0 +1,189 @@
+/*
+ *  Metrics.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Counters, gauges and histograms which the pipeline, the database and the
+ * sensor logs report through, so that devices and the command-line tools can
+ * be watched the same way.  Metrics are registered by name in the process's
+ * MetricsRegistry, once, away from any real-time thread, and the returned
+ * pointer is kept; they are never freed.  Registering a name again returns
+ * the same metric, so every instance of a class shares its metrics.
+ *
+ * Recording never locks, allocates or makes a system call, so it may be done
+ * from the audio callback.  Counters and histograms are split into
+ * METRICS_SHARDS cache-line-aligned shards, chosen by a hash of the calling
+ * thread, so that threads rarely contend for a line; shards are only summed
+ * when a snapshot is taken.  Histograms have HDR-style log-linear buckets:
+ * values below 2^METRICS_SUB_BUCKET_BITS are exact, and above that every power
+ * of two is cut into 2^METRICS_SUB_BUCKET_BITS buckets, so a percentile is
+ * within about 3% of the true value over the whole range.  Timings are in
+ * microseconds, from metricsMicroseconds().
+ *
+ * Snapshots are in the Prometheus text format (histograms as summaries, with
+ * quantiles 0.5, 0.9, 0.99 and 0.999) or as one JSON object.  A
+ * MetricsReporter writes them to a file periodically on its own thread, and
+ * can also serve them to local scrapers over HTTP.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define METRICS_SHARDS 4           // shards of each counter and histogram, a power of two
+#define METRICS_SUB_BUCKET_BITS 5  // histogram buckets per power of two are 2^this
+#define METRICS_MAX_VALUE_BITS 40  // larger histogram values are counted in the last bucket
+#define METRICS_BUCKETS ( (1 << METRICS_SUB_BUCKET_BITS) * ( METRICS_MAX_VALUE_BITS - METRICS_SUB_BUCKET_BITS + 1 ) )
+#define METRICS_LINE_BYTES 64
+
+typedef enum{
+	MetricsText, // Prometheus text exposition format
+	MetricsJson
+} MetricsFormat;
+
+/* monotonic microseconds, for timing into a histogram.  Never blocks. */
+uint64_t metricsMicroseconds();
+/* MetricsJson if filename ends in ".json", otherwise MetricsText */
+MetricsFormat metricsFormatOf( const char* filename );
+
+/* a count which only goes up, eg. of columns processed */
+class MetricCounter{
+public:
+	void add( uint64_t n = 1 );
+	/* sum of the shards, which may miss adds in progress */
+	uint64_t get() const;
+
+private:
+	friend class MetricsRegistry;
+	MetricCounter();
+	struct Shard{
+		volatile uint64_t value;
+		char pad[METRICS_LINE_BYTES - sizeof(uint64_t)];
+	} __attribute__ ((aligned (METRICS_LINE_BYTES)));
+	Shard shards[METRICS_SHARDS];
+};
+
+/* a value which is set, eg. the number of database entries.  The last set() wins. */
+class MetricGauge{
+public:
+	void set( double value );
+	double get() const;
+
+private:
+	friend class MetricsRegistry;
+	MetricGauge();
+	volatile uint64_t bits; // of the double, so that it is read and written whole
+};
+
+/* merged shards of a histogram */
+struct HistogramSnapshot{
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	std::vector<uint64_t> buckets; // METRICS_BUCKETS counts
+	/* the highest value in the bucket holding the given fraction of the values, at most max; 0 if empty */
+	uint64_t percentile( double fraction ) const;
+};
+
+/* the distribution of a value, eg. microseconds per query */
+class MetricHistogram{
+public:
+	void record( uint64_t value );
+	void getSnapshot( HistogramSnapshot* snapshot ) const;
+	/* the bucket which holds value, and the highest value which that bucket holds */
+	static unsigned int bucketOf( uint64_t value );
+	static uint64_t bucketMax( unsigned int bucket );
+
+private:
+	friend class MetricsRegistry;
+	MetricHistogram();
+	~MetricHistogram();
+	/* per shard: sum, max, then the buckets, padded to whole cache lines */
+	enum{ SUM, MAX, BUCKETS, SHARD_WORDS = ( BUCKETS + METRICS_BUCKETS + 7 ) / 8 * 8 };
+	volatile uint64_t* shards; // METRICS_SHARDS * SHARD_WORDS
+};
+
+/* records the microseconds from construction to destruction into a histogram */
+class MetricTimer{
+public:
+	MetricTimer( MetricHistogram* histogram ) : histogram(histogram), start(metricsMicroseconds()){}
+	~MetricTimer(){ histogram->record( metricsMicroseconds() - start ); }
+private:
+	MetricHistogram* histogram;
+	uint64_t start;
+};
+
+class MetricsRegistry{
+public:
+	/* the process's registry, created on first use and never destroyed */
+	static MetricsRegistry* shared();
+	/**
+	 * Find or register a metric.  Names should follow the Prometheus conventions, eg.
+	 * "fingerprinter_columns_total" or "database_query_us", and help is a short
+	 * description for the snapshot.  These lock, so call them at setup, not per record.
+	 */
+	MetricCounter* counter( const char* name, const char* help );
+	MetricGauge* gauge( const char* name, const char* help );
+	MetricHistogram* histogram( const char* name, const char* help );
+	/* appends a snapshot of every metric, in registration order */
+	void format( std::string& out, MetricsFormat format );
+	/* writes a snapshot to filename, replacing it atomically.  @return false on an I/O error. */
+	bool writeFile( const char* filename, MetricsFormat format );
+
+private:
+	MetricsRegistry();
+	static void createShared(); // for pthread_once
+	typedef enum{ CounterMetric, GaugeMetric, HistogramMetric } MetricType;
+	struct Entry{
+		std::string name;
+		std::string help;
+		MetricType type;
+		void* metric;
+	};
+	static void* newMetric( MetricType type );
+	/* the metric registered as name, registering a new one if there is none */
+	void* find( const char* name, const char* help, MetricType type );
+	pthread_mutex_t lock;
+	std::vector<Entry> entries;
+};
+
+/**
+ * Exports snapshots of a registry from its own thread: to a file every so
+ * often, and on request to HTTP clients on the loopback interface, eg.
+ *   curl http://127.0.0.1:PORT/metrics       (text)
+ *   curl http://127.0.0.1:PORT/metrics.json  (JSON)
+ * Configure it, then start() it.
+ */
+class MetricsReporter{
+public:
+	MetricsReporter( MetricsRegistry* registry = MetricsRegistry::shared() );
+	/* stops, writing a last snapshot */
+	~MetricsReporter();
+	/* writes a snapshot to filename every intervalSeconds, as JSON if it ends in ".json" */
+	void setSnapshotFile( const char* filename, double intervalSeconds );
+	/* serves snapshots on 127.0.0.1:port, or not if port is 0 (the default) */
+	void setScrapePort( unsigned short port );
+	/* @return false if the endpoint could not be opened or the thread started */
+	bool start();
+	/* stops the thread, writing a last snapshot, and closes the endpoint */
+	void stop();
+
+private:
+	static void* threadMain( void* arg );
+	void serve();
+	MetricsRegistry* registry;
+	std::string filename;
+	double interval;
+	unsigned short port;
+	int listenFd;
+	pthread_t thread;
+	volatile bool stopping;
+	bool threadRunning;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,77 @@
+/*
+ *  MotionGate.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "MotionGate.h"
+#include <math.h>
+
+MotionGate::MotionGate() : settles(0){
+	reset();
+}
+
+void MotionGate::reset(){
+	lastTimestamp = -1;
+	power = 0;
+	moving = false;
+	stillSince = 0;
+	movedSeconds = 0;
+}
+
+bool MotionGate::addMotion( const MotionRecord* r ){
+	double t = r->timestamp;
+	double dt = t - lastTimestamp;
+	if( lastTimestamp < 0 || dt > MOTION_MAX_GAP || dt < 0 ){
+		reset();
+		lastTimestamp = t;
+		stillSince = t;
+		return false;
+	}
+	lastTimestamp = t;
+	const float* a = r->userAccel;
+	double p = a[0]*a[0] + a[1]*a[1] + a[2]*a[2];
+	power += ( 1 - exp( -dt / MOTION_TIME_CONSTANT ) ) * ( p - power );
+
+	if( moving ){
+		movedSeconds += dt;
+		if( power < MOTION_STILL_G * MOTION_STILL_G ){
+			moving = false;
+			stillSince = t;
+		}
+		return false;
+	}
+	if( power > MOTION_MOVING_G * MOTION_MOVING_G ){
+		moving = true;
+		return false;
+	}
+	if( movedSeconds > 0 && t - stillSince >= MOTION_SETTLE ){
+		// the movement is over; it counts only if it was long enough to be a walk
+		bool walked = ( movedSeconds >= MOTION_MIN_WALK );
+		movedSeconds = 0;
+		if( walked ){
+			++settles;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool MotionGate::isMoving() const{
+	return moving;
+}
+
+double MotionGate::getStillSeconds() const{
+	return moving? 0 : lastTimestamp - stillSince;
+}
+
+unsigned int MotionGate::getStillColumns( double columnSeconds ) const{
+	unsigned int n = (unsigned int)( getStillSeconds() / columnSeconds );
+	return ( n > 0 )? n : 1;
+}
+
+unsigned int MotionGate::getNumSettles() const{
+	return settles;
+}
@@ -0,0 +1,67 @@
+/*
+ *  MotionGate.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Decides from CoreMotion samples when the user has walked somewhere and
+ * stopped, so that the spectrogram history, which still holds ten seconds of
+ * the room left behind, can be cut down to the audio heard since stopping
+ * (see Spectrogram::forget()).  Without this the fingerprint needs most of a
+ * history to converge on a louder room, since its 5th percentile only rises
+ * once nearly every column in the history is from the new room.
+ *
+ * The power of the user acceleration is smoothed with a time constant of
+ * MOTION_TIME_CONSTANT.  The device is moving while its RMS is above
+ * MOTION_MOVING_G, and still once it falls below MOTION_STILL_G.  Time spent
+ * moving is added up, and once the device has been still for MOTION_SETTLE
+ * seconds after at least MOTION_MIN_WALK seconds of it, addMotion() reports
+ * that the user has settled.  Stillness ends any shorter movement, so picking
+ * up the phone or shifting in a chair never counts.  A gap of more than
+ * MOTION_MAX_GAP between samples, eg. while updates were paused, starts over.
+ *
+ * Samples come from CMDeviceMotion, as in handleMotionData, or from a motion
+ * log replayed by "tester converge".
+ */
+
+#ifndef MOTION_GATE_H
+#define MOTION_GATE_H
+
+#include "SensorLog.h" // for MotionRecord
+
+#define MOTION_TIME_CONSTANT 0.5 // seconds over which the acceleration power is smoothed
+#define MOTION_MOVING_G 0.08     // RMS user acceleration above which the device is moving, in g
+#define MOTION_STILL_G 0.04      // RMS user acceleration below which it is still
+#define MOTION_MIN_WALK 3.0      // seconds of movement which may have taken the user to another room
+#define MOTION_SETTLE 1.0        // seconds still before the walk is taken to be over
+#define MOTION_MAX_GAP 1.0       // seconds between samples beyond which the gate starts over
+
+class MotionGate{
+public:
+	MotionGate();
+	/**
+	 * Adds a sample, which must not be older than the last.
+	 * @return true if the user has just settled after walking.
+	 */
+	bool addMotion( const MotionRecord* record );
+	/* true while the device is moving, as of the last sample */
+	bool isMoving() const;
+	/* seconds the device has been still, as of the last sample */
+	double getStillSeconds() const;
+	/* the number of whole columns of columnSeconds each heard since the device became still, at least one */
+	unsigned int getStillColumns( double columnSeconds ) const;
+	/* number of times addMotion() has returned true */
+	unsigned int getNumSettles() const;
+	/* forgets all samples, as at construction, except the count of settles */
+	void reset();
+
+private:
+	double lastTimestamp; // of the last sample, or negative before the first
+	double power;         // smoothed squared user acceleration, in g^2
+	bool moving;
+	double stillSince;    // timestamp when the device last became still
+	double movedSeconds;  // time spent moving since the device was last settled
+	unsigned int settles;
+};
+
+#endif // MOTION_GATE_H
@@ -0,0 +1,196 @@
+/*
+ *  ParallelPercentiles.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "ParallelPercentiles.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/time.h>
+
+#define CACHE_LINE_FLOATS 16 // 64-byte cache lines
+/* the fewest series worth a thread: below this the handoff costs more than the
+ * update of the partition, see summarybench -j */
+#define MIN_PARTITION_SERIES 1024
+/* polls of the generation by an idle pool thread before it sleeps; a few tens of
+ * microseconds, enough for columns posted back to back */
+#define WORKER_SPINS 20000
+/* polls of a partition's done generation by the caller before it yields the processor,
+ * in case the thread working on the partition has been preempted */
+#define CALLER_SPINS 100000
+/* longest sleep of an idle pool thread, in case the caller's wakeup is lost */
+#define WORKER_SLEEP_USEC 10000
+
+/* tells the processor that this is a spin loop */
+static inline void cpuRelax(){
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+	__asm__ __volatile__( "yield" );
+#endif
+}
+
+ParallelPercentiles::ParallelPercentiles( unsigned int numSeries, unsigned int size, float percentile,
+										  float initVal, bool isLazy, unsigned int numThreads ) :
+lazy(isLazy), generation(0), job(JOB_UPDATE), jobIn(NULL), jobOut(NULL){
+	if( numThreads == 0 ){
+		long processors = sysconf( _SC_NPROCESSORS_ONLN );
+		numThreads = ( processors > 0 )? processors : 1;
+	}
+	numPartitions = numSeries / MIN_PARTITION_SERIES;
+	if( numPartitions > numThreads ) numPartitions = numThreads;
+	if( numPartitions < 1 ) numPartitions = 1;
+
+	// equal partitions, rounded to whole cache lines; the last takes the remainder
+	unsigned int lines = ( numSeries + CACHE_LINE_FLOATS-1 ) / CACHE_LINE_FLOATS;
+	partitions = new Partition[numPartitions];
+	for( unsigned int i=0; i<numPartitions; ++i ){
+		Partition& p = partitions[i];
+		p.owner = this;
+		p.first = lines * i / numPartitions * CACHE_LINE_FLOATS;
+		unsigned int end = ( i+1 == numPartitions )? numSeries : lines * (i+1) / numPartitions * CACHE_LINE_FLOATS;
+		p.percentiles = new SlidingPercentiles( end - p.first, size, percentile, initVal, lazy );
+		p.claimed = 0;
+		p.done = 0;
+		p.sleeping = 0;
+		pthread_mutex_init( &p.sleepMutex, NULL );
+		pthread_cond_init( &p.wake, NULL );
+	}
+
+	// the first partition is the caller's, as are any whose thread could not be started
+	numWorkers = 0;
+	for( unsigned int i=1; i<numPartitions; ++i ){
+		if( pthread_create( &partitions[i].thread, NULL, workerMain, &partitions[i] ) ){
+			printf( "failed to start percentile thread!\n" );
+			break;
+		}
+		++numWorkers;
+	}
+}
+
+ParallelPercentiles::~ParallelPercentiles(){
+	if( numWorkers ){
+		job = JOB_QUIT;
+		__sync_synchronize(); // publish the job before advancing generation
+		++generation;
+		__sync_synchronize();
+		for( unsigned int i=1; i<=numWorkers; ++i ) pthread_cond_signal( &partitions[i].wake );
+		for( unsigned int i=1; i<=numWorkers; ++i ) pthread_join( partitions[i].thread, NULL );
+	}
+	for( unsigned int i=0; i<numPartitions; ++i ){
+		pthread_cond_destroy( &partitions[i].wake );
+		pthread_mutex_destroy( &partitions[i].sleepMutex );
+		delete partitions[i].percentiles;
+	}
+	delete[] partitions;
+}
+
+void ParallelPercentiles::runJob( Partition* p, Job j, const float* in, float* out ){
+	if( j == JOB_UPDATE ) p->percentiles->update( in + p->first );
+	else p->percentiles->getVals( out + p->first );
+}
+
+bool ParallelPercentiles::claimJob( Partition* p, unsigned int gen ){
+	// the partition was claimed for every earlier generation before gen was posted
+	if( !__sync_bool_compare_and_swap( &p->claimed, gen-1, gen ) ) return false;
+	runJob( p, job, jobIn, jobOut );
+	__sync_synchronize(); // finish the job before marking it done
+	p->done = gen;
+	return true;
+}
+
+void* ParallelPercentiles::workerMain( void* arg ){
+	Partition* p = (Partition*)arg;
+	ParallelPercentiles* owner = p->owner;
+	unsigned int seen = 0;
+	while( true ){
+		// wait for the next generation, spinning for a while before sleeping
+		for( unsigned int spins=0; owner->generation == seen; ++spins ){
+			if( spins < WORKER_SPINS ){
+				cpuRelax();
+				continue;
+			}
+			pthread_mutex_lock( &p->sleepMutex );
+			p->sleeping = 1;
+			__sync_synchronize(); // flag the sleep before reading generation, see runAll()
+			if( owner->generation == seen ){
+				struct timeval now;
+				gettimeofday( &now, NULL );
+				long usec = now.tv_usec + WORKER_SLEEP_USEC;
+				struct timespec until;
+				until.tv_sec = now.tv_sec + usec / 1000000;
+				until.tv_nsec = ( usec % 1000000 ) * 1000;
+				pthread_cond_timedwait( &p->wake, &p->sleepMutex, &until );
+			}
+			p->sleeping = 0;
+			pthread_mutex_unlock( &p->sleepMutex );
+		}
+		seen = owner->generation;
+		__sync_synchronize(); // read generation before the job
+		if( owner->job == JOB_QUIT ) break;
+		owner->claimJob( p, seen );
+	}
+	return NULL;
+}
+
+void ParallelPercentiles::runAll( Job j, const float* in, float* out ){
+	unsigned int gen = generation + 1;
+	if( numWorkers ){
+		job = j;
+		jobIn = in;
+		jobOut = out;
+		__sync_synchronize(); // publish the job before advancing generation
+		generation = gen;
+		__sync_synchronize(); // advance generation before reading the sleeping flags, see workerMain()
+		for( unsigned int i=1; i<=numWorkers; ++i ){
+			if( partitions[i].sleeping ) pthread_cond_signal( &partitions[i].wake );
+		}
+	}
+	runJob( &partitions[0], j, in, out );
+	for( unsigned int i=1+numWorkers; i<numPartitions; ++i ) runJob( &partitions[i], j, in, out );
+	if( numWorkers ){
+		// take over the partitions whose threads have not started yet, then wait for the rest
+		for( unsigned int i=1; i<=numWorkers; ++i ) claimJob( &partitions[i], gen );
+		for( unsigned int i=1; i<=numWorkers; ++i ){
+			for( unsigned int spins=0; partitions[i].done != gen; ++spins ){
+				if( spins < CALLER_SPINS ) cpuRelax();
+				else sched_yield();
+			}
+		}
+		__sync_synchronize(); // read the partitions' results after their done flags
+	}
+}
+
+void ParallelPercentiles::update( const float* newVals ){
+	if( numPartitions == 1 ){
+		partitions[0].percentiles->update( newVals );
+	}else if( lazy ){
+		// only copies, not worth the handoff
+		for( unsigned int i=0; i<numPartitions; ++i ) runJob( &partitions[i], JOB_UPDATE, newVals, NULL );
+	}else{
+		runAll( JOB_UPDATE, newVals, NULL );
+	}
+}
+
+void ParallelPercentiles::getVals( float* outBuf ){
+	if( numPartitions == 1 ){
+		partitions[0].percentiles->getVals( outBuf );
+	}else if( !lazy ){
+		// reading one row per group is not worth the handoff
+		for( unsigned int i=0; i<numPartitions; ++i ) runJob( &partitions[i], JOB_GETVALS, NULL, outBuf );
+	}else{
+		runAll( JOB_GETVALS, NULL, outBuf );
+	}
+}
+
+void ParallelPercentiles::forget( unsigned int keep ){
+	for( unsigned int i=0; i<numPartitions; ++i ) partitions[i].percentiles->forget( keep );
+}
+
+unsigned int ParallelPercentiles::getNumPartitions() const{
+	return numPartitions;
+}
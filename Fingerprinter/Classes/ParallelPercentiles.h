@@ -0,0 +1,91 @@
+/*
+ *  ParallelPercentiles.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * SlidingPercentiles split by series range across a small pool of threads, for
+ * spectrograms with thousands of frequency bins, eg. with a specRes of 8192 or
+ * more.  Each partition is a SlidingPercentiles of its own, covering a whole
+ * number of cache lines of the column, so that threads never write the same
+ * line.  The pool threads live as long as the object.  For each column the
+ * caller posts the job by bumping a generation counter, works on the first
+ * partition itself, and waits only for the other partitions to finish; the
+ * workers never wait for each other.
+ *
+ * There are no locks on the way: each partition is claimed for a generation by
+ * compare-and-swap, by its thread or by the caller, which takes over any
+ * partition whose thread has not started on it by the time the caller's own is
+ * done, and the caller spins on the partitions' done generations.  Idle threads
+ * spin on the generation for a while before sleeping on a condition variable of
+ * their own, which the caller signals if they are asleep; a wakeup lost there
+ * only means that the caller does that partition itself.
+ *
+ * Columns smaller than a couple of partitions are not split, and then update()
+ * and getVals() are plain calls on the caller's thread, with no threads created,
+ * so the default 325 bins pay nothing.  In lazy mode the updates are only copies
+ * and stay on the caller's thread; it is the selection in getVals() which is
+ * shared out.
+ */
+
+#ifndef PARALLEL_PERCENTILES_H
+#define PARALLEL_PERCENTILES_H
+
+#include "SlidingPercentiles.h"
+#include <pthread.h>
+
+class ParallelPercentiles{
+public:
+	/**
+	 * @param numSeries, size, percentile, initVal and lazy are as for SlidingPercentiles.
+	 * @param numThreads is the most threads to use, including the caller's; 0 means one
+	 *        per processor.
+	 */
+	ParallelPercentiles( unsigned int numSeries, unsigned int size, float percentile, float initVal,
+						 bool lazy = false, unsigned int numThreads = 1 );
+	~ParallelPercentiles();
+	/* replaces the oldest value of each series with newVals[i] */
+	void update( const float* newVals );
+	/* fills outBuf with the current percentile value of each series */
+	void getVals( float* outBuf );
+	/* as SlidingPercentiles::forget(), on the calling thread */
+	void forget( unsigned int keep );
+	/* the number of partitions, ie. of threads working on each column */
+	unsigned int getNumPartitions() const;
+
+private:
+	struct Partition{
+		ParallelPercentiles* owner;
+		SlidingPercentiles* percentiles;
+		unsigned int first; // first series
+		pthread_t thread;   // if the partition has a pool thread
+		volatile unsigned int claimed;  // the latest generation which a thread has taken on
+		volatile unsigned int done;     // the latest generation finished
+		volatile int sleeping;          // the pool thread is sleeping, or about to, on wake
+		pthread_mutex_t sleepMutex;
+		pthread_cond_t wake;
+		char pad[64];       // keeps the next partition's flags off this cache line
+	};
+	enum Job{ JOB_UPDATE, JOB_GETVALS, JOB_QUIT };
+
+	unsigned int numPartitions;
+	unsigned int numWorkers; // pool threads, running partitions 1 to numWorkers
+	bool lazy;
+	Partition* partitions;
+
+	/* the posted job, written before generation is advanced */
+	volatile unsigned int generation;
+	Job job;
+	const float* jobIn;
+	float* jobOut;
+
+	/* runs the posted job on one partition */
+	void runJob( Partition* p, Job j, const float* in, float* out );
+	/* runs the posted job on p if nobody has claimed it for generation gen yet */
+	bool claimJob( Partition* p, unsigned int gen );
+	/* runs a job on every partition, the first on the calling thread */
+	void runAll( Job j, const float* in, float* out );
+	static void* workerMain( void* arg );
+};
+
+#endif // PARALLEL_PERCENTILES_H
@@ -0,0 +1,231 @@
+/*
+ *  RadioDB.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "RadioDB.h"
+#include <math.h>
+#include <algorithm> // for sort and partial_sort
+
+using std::vector;
+
+// -----------------------------------------------------------------------------
+// HELPER FUNCTIONS
+
+static inline uint64_t packBssid( const uint8_t bssid[6] ){
+	uint64_t key = 0;
+	for( unsigned int i=0; i<6; ++i ) key = (key << 8) | bssid[i];
+	return key;
+}
+
+/* signal strength above the missing value, as used by the cosine metric */
+static inline float radioWeight( int32_t rssi ){
+	float w = rssi - RADIO_MISSING_RSSI;
+	return ( w > 0 )? w : 0;
+}
+
+static bool readingLess( const RadioReading& a, const RadioReading& b ){
+	return a.ap < b.ap;
+}
+
+static bool matchLess( const RadioMatch& a, const RadioMatch& b ){
+	return a.distance < b.distance;
+}
+
+float radioNorm( const RadioReading* r, unsigned int n, RadioMetric metric ){
+	float norm = 0;
+	switch( metric ){
+		case RadioMetricJaccard:
+			return n;
+		case RadioMetricCosine:
+			for( unsigned int i=0; i<n; ++i ){
+				float w = radioWeight( r[i].rssi );
+				norm += w*w;
+			}
+			return sqrtf( norm );
+		case RadioMetricL2:
+			// squared distance from a scan which heard nothing
+			for( unsigned int i=0; i<n; ++i ){
+				float d = r[i].rssi - RADIO_MISSING_RSSI;
+				norm += d*d;
+			}
+			return norm;
+	}
+	return 0;
+}
+
+float radioDistance( const RadioReading* a, unsigned int na, float normA,
+					 const RadioReading* b, unsigned int nb, float normB, RadioMetric metric ){
+	// merge the two sorted lists, visiting only the access points heard by both
+	unsigned int shared = 0;
+	float sum = 0;
+	unsigned int i = 0, j = 0;
+	while( i < na && j < nb ){
+		if( a[i].ap < b[j].ap ) ++i;
+		else if( b[j].ap < a[i].ap ) ++j;
+		else{
+			++shared;
+			if( metric == RadioMetricCosine ){
+				sum += radioWeight( a[i].rssi ) * radioWeight( b[j].rssi );
+			}else if( metric == RadioMetricL2 ){
+				// replace the two terms counted in the norms by the actual difference
+				float da = a[i].rssi - RADIO_MISSING_RSSI;
+				float db = b[j].rssi - RADIO_MISSING_RSSI;
+				float d = a[i].rssi - b[j].rssi;
+				sum += d*d - da*da - db*db;
+			}
+			++i;
+			++j;
+		}
+	}
+	switch( metric ){
+		case RadioMetricJaccard:{
+			unsigned int both = na + nb - shared;
+			return both? 1.0f - (float)shared / both : 0.0f;
+		}
+		case RadioMetricCosine:
+			if( normA == 0 || normB == 0 ) return 1.0f;
+			return 1.0f - sum / ( normA * normB );
+		case RadioMetricL2:{
+			float d2 = normA + normB + sum;
+			return ( d2 > 0 )? sqrtf( d2 ) : 0.0f;
+		}
+	}
+	return 0;
+}
+
+
+// -----------------------------------------------------------------------------
+// DATABASE
+
+RadioDB::RadioDB( RadioMetric myMetric ) : metric(myMetric), lastCandidates(0){
+	start.push_back( 0 );
+}
+
+unsigned int RadioDB::internBssid( const uint8_t bssid[6] ){
+	uint64_t key = packBssid( bssid );
+	std::map<uint64_t,uint32_t>::iterator it = bssids.lower_bound( key );
+	if( it != bssids.end() && it->first == key ) return it->second;
+	uint32_t id = bssids.size();
+	bssids.insert( it, std::make_pair( key, id ) );
+	postings.push_back( vector<uint32_t>() );
+	return id;
+}
+
+int RadioDB::findBssid( const uint8_t bssid[6] ) const{
+	std::map<uint64_t,uint32_t>::const_iterator it = bssids.find( packBssid( bssid ) );
+	return ( it == bssids.end() )? -1 : (int)it->second;
+}
+
+unsigned int RadioDB::getNumAps() const{
+	return bssids.size();
+}
+
+vector<RadioReading> RadioDB::toReadings( const WifiRecord* records, unsigned int n, bool intern ){
+	vector<RadioReading> r;
+	r.reserve( n );
+	for( unsigned int i=0; i<n; ++i ){
+		int ap = intern? (int)internBssid( records[i].bssid ) : findBssid( records[i].bssid );
+		if( ap < 0 ) continue;
+		RadioReading reading = { (uint32_t)ap, records[i].rssi };
+		r.push_back( reading );
+	}
+	std::sort( r.begin(), r.end(), readingLess );
+	// keep the strongest of any duplicates
+	unsigned int out = 0;
+	for( unsigned int i=0; i<r.size(); ++i ){
+		if( out > 0 && r[out-1].ap == r[i].ap ){
+			if( r[i].rssi > r[out-1].rssi ) r[out-1].rssi = r[i].rssi;
+		}else{
+			r[out++] = r[i];
+		}
+	}
+	r.resize( out );
+	return r;
+}
+
+unsigned int RadioDB::addScan( const RadioReading* newReadings, unsigned int n, int label, double timestamp ){
+	unsigned int entry = labels.size();
+	unsigned int first = readings.size();
+	readings.insert( readings.end(), newReadings, newReadings+n );
+	std::sort( readings.begin()+first, readings.end(), readingLess );
+	start.push_back( readings.size() );
+	norms.push_back( radioNorm( &readings[first], n, metric ) );
+	labels.push_back( label );
+	timestamps.push_back( timestamp );
+	sharedCount.push_back( 0 );
+	// entries are added in order, so each posting list stays sorted
+	for( unsigned int i=0; i<n; ++i ){
+		if( newReadings[i].ap >= postings.size() ) postings.resize( newReadings[i].ap+1 );
+		postings[newReadings[i].ap].push_back( entry );
+	}
+	return entry;
+}
+
+unsigned int RadioDB::addScan( const WifiRecord* records, unsigned int n, int label, double timestamp ){
+	vector<RadioReading> r = toReadings( records, n, true );
+	return addScan( r.empty()? NULL : &r[0], r.size(), label, timestamp );
+}
+
+unsigned int RadioDB::size() const{
+	return labels.size();
+}
+
+const RadioReading* RadioDB::getReadings( unsigned int entry, unsigned int* n ) const{
+	*n = start[entry+1] - start[entry];
+	return *n? &readings[start[entry]] : NULL;
+}
+
+int RadioDB::getLabel( unsigned int entry ) const{
+	return labels[entry];
+}
+
+double RadioDB::getTimestamp( unsigned int entry ) const{
+	return timestamps[entry];
+}
+
+unsigned int RadioDB::query( const RadioReading* q, unsigned int n, unsigned int numMatches,
+							 vector<RadioMatch>& result, unsigned int minShared, int exclude ){
+	result.clear();
+	// count shared access points of every entry which heard any of the query's
+	for( unsigned int i=0; i<n; ++i ){
+		if( q[i].ap >= postings.size() ) continue;
+		const vector<uint32_t>& list = postings[q[i].ap];
+		for( unsigned int j=0; j<list.size(); ++j ){
+			if( sharedCount[list[j]]++ == 0 ) touched.push_back( list[j] );
+		}
+	}
+	lastCandidates = 0;
+	if( minShared < 1 ) minShared = 1;
+	float qNorm = radioNorm( q, n, metric );
+	for( unsigned int i=0; i<touched.size(); ++i ){
+		unsigned int e = touched[i];
+		unsigned int shared = sharedCount[e];
+		sharedCount[e] = 0;
+		if( shared < minShared || (int)e == exclude ) continue;
+		++lastCandidates;
+		RadioMatch m;
+		m.entry = e;
+		m.label = labels[e];
+		m.timestamp = timestamps[e];
+		m.shared = shared;
+		m.distance = radioDistance( q, n, qNorm, &readings[start[e]], start[e+1]-start[e], norms[e], metric );
+		result.push_back( m );
+	}
+	touched.clear();
+
+	if( result.size() > numMatches ){
+		std::partial_sort( result.begin(), result.begin()+numMatches, result.end(), matchLess );
+		result.resize( numMatches );
+	}else{
+		std::sort( result.begin(), result.end(), matchLess );
+	}
+	return result.size();
+}
+
+unsigned int RadioDB::getLastCandidates() const{
+	return lastCandidates;
+}
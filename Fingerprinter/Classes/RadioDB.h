@@ -0,0 +1,126 @@
+/*
+ *  RadioDB.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * A database of Wi-Fi scans (radio fingerprints) for matching a new scan
+ * against many stored ones.  A scan is sparse: it hears a few access points
+ * out of the many in the database.  So BSSIDs are interned to small integer
+ * ids, each entry is stored as a list of (id, RSSI) readings sorted by id,
+ * and an inverted index maps each id to the entries which heard it.  A query
+ * walks the index lists of its own access points to find the entries sharing
+ * at least one of them, and only those are scored, by merging the two sorted
+ * reading lists.
+ *
+ * Entries are packed into a few flat arrays rather than one object each, so
+ * that millions of scans fit in memory.
+ */
+
+#ifndef RADIO_DB_H
+#define RADIO_DB_H
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include "SensorLog.h" // for WifiRecord
+
+/* RSSI assumed for an access point which a scan did not hear, in dBm */
+#define RADIO_MISSING_RSSI (-100)
+
+// types of distance used to compare two scans
+typedef enum{
+	RadioMetricJaccard, // one minus the fraction of the union of access points heard by both
+	RadioMetricCosine,  // one minus the cosine of signal strength vectors, in dB above RADIO_MISSING_RSSI
+	RadioMetricL2       // Euclidean distance between RSSIs, taking unheard access points as RADIO_MISSING_RSSI
+} RadioMetric;
+
+/* one access point heard in a scan */
+struct RadioReading{
+	uint32_t ap;  // interned BSSID
+	int32_t rssi; // dBm
+};
+
+/* a stored scan which matched a query */
+struct RadioMatch{
+	unsigned int entry;
+	int label;          // as given to addScan
+	double timestamp;   // as given to addScan
+	unsigned int shared; // number of access points heard by both scans
+	float distance;
+};
+
+/**
+ * Distance between two scans, whose readings must be sorted by ap.
+ * @param normA and normB are the scans' radioNorm()s, used by RadioMetricCosine and RadioMetricL2.
+ */
+float radioDistance( const RadioReading* a, unsigned int na, float normA,
+					 const RadioReading* b, unsigned int nb, float normB, RadioMetric metric );
+/* the per-scan value precomputed for radioDistance */
+float radioNorm( const RadioReading* readings, unsigned int n, RadioMetric metric );
+
+
+class RadioDB{
+public:
+	RadioDB( RadioMetric metric = RadioMetricCosine );
+	/* @return the id of a BSSID, adding it if it is new */
+	unsigned int internBssid( const uint8_t bssid[6] );
+	/* @return the id of a BSSID, or -1 if no scan has heard it */
+	int findBssid( const uint8_t bssid[6] ) const;
+	/* number of distinct access points */
+	unsigned int getNumAps() const;
+
+	/**
+	 * Converts Wi-Fi records to readings, interning their BSSIDs if intern is true and otherwise
+	 * leaving out unknown access points.  Duplicate BSSIDs keep their strongest reading.
+	 * @return the readings, sorted by ap.
+	 */
+	std::vector<RadioReading> toReadings( const WifiRecord* records, unsigned int n, bool intern );
+	/**
+	 * Stores a scan.  readings need not be sorted, but each ap may appear only once and
+	 * must have come from internBssid().
+	 * @param label is any value the caller wants returned with matches, eg. a room or location id.
+	 * @return the new entry's index.
+	 */
+	unsigned int addScan( const RadioReading* readings, unsigned int n, int label, double timestamp );
+	/* As above, from the Wi-Fi records of one scan. */
+	unsigned int addScan( const WifiRecord* records, unsigned int n, int label, double timestamp );
+	/* number of stored scans */
+	unsigned int size() const;
+	/* readings of an entry, sorted by ap */
+	const RadioReading* getReadings( unsigned int entry, unsigned int* n ) const;
+	int getLabel( unsigned int entry ) const;
+	double getTimestamp( unsigned int entry ) const;
+
+	/**
+	 * Finds the stored scans closest to a query scan.  Only entries which share at least
+	 * minShared access points with the query are scored.
+	 * @param readings must be sorted by ap, eg. from toReadings().
+	 * @param result receives up to numMatches matches, closest first.
+	 * @param exclude is an entry to leave out (eg. the query itself), or -1.
+	 * @return the number of matches.
+	 */
+	unsigned int query( const RadioReading* readings, unsigned int n, unsigned int numMatches,
+						std::vector<RadioMatch>& result, unsigned int minShared = 1, int exclude = -1 );
+	/* number of entries scored by the last query */
+	unsigned int getLastCandidates() const;
+
+private:
+	RadioMetric metric;
+	std::map<uint64_t,uint32_t> bssids; // packed BSSID -> ap id
+
+	// entry e's readings are readings[start[e]] to readings[start[e+1]-1]
+	std::vector<uint32_t> start;
+	std::vector<RadioReading> readings;
+	std::vector<float> norms; // radioNorm of each entry
+	std::vector<int> labels;
+	std::vector<double> timestamps;
+	std::vector< std::vector<uint32_t> > postings; // ap id -> entries which heard it, ascending
+
+	// query scratch space, kept between queries to avoid allocation
+	std::vector<uint16_t> sharedCount; // per entry, zero between queries
+	std::vector<uint32_t> touched; // entries with non-zero sharedCount
+	unsigned int lastCandidates;
+};
+
+#endif // RADIO_DB_H
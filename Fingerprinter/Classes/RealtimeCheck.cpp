@@ -0,0 +1,360 @@
+/*
+ *  RealtimeCheck.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * The interposed calls of RealtimeCheck.h, for Linux and glibc.  Definitions
+ * in the executable take precedence over libc's, so every call made through
+ * the dynamic linker, including those from libstdc++ (operator new, ofstream
+ * writes), lands here first; calls internal to libc do not.  Each wrapper
+ * reports the call if the thread is real-time and then forwards it: the
+ * allocator to glibc's __libc_ entry points, everything else to the next
+ * definition found by dlsym.  Build with -U_FORTIFY_SOURCE, so that stdio calls
+ * are not replaced by their checking variants, and link with -rdynamic for
+ * function names in the stack traces.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for RTLD_NEXT
+#endif
+
+#include "RealtimeCheck.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_TRACES 20   // violations printed with a stack trace; later ones are only counted
+#define TRACE_DEPTH 32
+
+static __thread int realtimeDepth = 0; // nested RealtimeScopes on this thread
+static __thread int inCheck = 0;       // set while reporting, so that the report's own calls pass
+static volatile unsigned long violations = 0;
+
+extern "C"{
+	void* __libc_malloc( size_t size );
+	void* __libc_calloc( size_t n, size_t size );
+	void* __libc_realloc( void* p, size_t size );
+	void* __libc_memalign( size_t alignment, size_t size );
+	void __libc_free( void* p );
+}
+
+/* the next definition of name after this one, ie. libc's */
+static void* nextSymbol( const char* name ){
+	inCheck++;
+	void* f = dlsym( RTLD_NEXT, name );
+	inCheck--;
+	if( !f ){
+		fprintf( stderr, "RealtimeCheck: %s not found\n", name );
+		abort();
+	}
+	return f;
+}
+
+/* declares real_name, a pointer to the next definition of name, resolved on first use */
+#define REAL( ret, name, args ) \
+	static ret (*real_##name) args = NULL; \
+	if( !real_##name ) real_##name = ( ret (*) args )nextSymbol( #name )
+
+static ssize_t writeDirect( int fd, const void* buf, size_t n ){
+	REAL( ssize_t, write, ( int, const void*, size_t ) );
+	return real_write( fd, buf, n );
+}
+
+/* prints and counts the call if the thread is real-time */
+static void check( const char* call ){
+	if( realtimeDepth <= 0 || inCheck ) return;
+	inCheck++;
+	unsigned long n = __sync_add_and_fetch( &violations, 1 );
+	if( n <= MAX_TRACES ){
+		char msg[128];
+		int len = snprintf( msg, sizeof(msg), "real-time violation %lu: %s() on a real-time thread\n", n, call );
+		writeDirect( 2, msg, len );
+		void* frames[TRACE_DEPTH];
+		int depth = backtrace( frames, TRACE_DEPTH );
+		backtrace_symbols_fd( frames+1, depth-1, 2 ); // skipping check() itself
+	}else if( n == MAX_TRACES+1 ){
+		const char* msg = "real-time violation: further violations are only counted\n";
+		writeDirect( 2, msg, strlen( msg ) );
+	}
+	inCheck--;
+}
+
+/* loads what backtrace() needs now, since it allocates the first time */
+__attribute__((constructor)) static void prepareTraces(){
+	void* frames[2];
+	inCheck++;
+	backtrace( frames, 2 );
+	inCheck--;
+}
+
+RealtimeScope::RealtimeScope(){
+	++realtimeDepth;
+}
+
+RealtimeScope::~RealtimeScope(){
+	--realtimeDepth;
+}
+
+RealtimeExempt::RealtimeExempt() : savedDepth(realtimeDepth){
+	realtimeDepth = 0;
+}
+
+RealtimeExempt::~RealtimeExempt(){
+	realtimeDepth = savedDepth;
+}
+
+unsigned long realtimeViolations(){
+	return violations;
+}
+
+// -----------------------------------------------------------------------------
+// INTERPOSED CALLS
+
+extern "C"{
+
+// allocation
+void* malloc( size_t size ) throw(){
+	check( "malloc" );
+	return __libc_malloc( size );
+}
+
+void* calloc( size_t n, size_t size ) throw(){
+	check( "calloc" );
+	return __libc_calloc( n, size );
+}
+
+void* realloc( void* p, size_t size ) throw(){
+	check( "realloc" );
+	return __libc_realloc( p, size );
+}
+
+void free( void* p ) throw(){
+	if( p ) check( "free" );
+	__libc_free( p );
+}
+
+int posix_memalign( void** p, size_t alignment, size_t size ) throw(){
+	check( "posix_memalign" );
+	void* q = __libc_memalign( alignment, size );
+	if( !q ) return ENOMEM;
+	*p = q;
+	return 0;
+}
+
+void* aligned_alloc( size_t alignment, size_t size ) throw(){
+	check( "aligned_alloc" );
+	return __libc_memalign( alignment, size );
+}
+
+void* memalign( size_t alignment, size_t size ) throw(){
+	check( "memalign" );
+	return __libc_memalign( alignment, size );
+}
+
+// locks and waits
+int pthread_mutex_lock( pthread_mutex_t* m ) throw(){
+	check( "pthread_mutex_lock" );
+	REAL( int, pthread_mutex_lock, ( pthread_mutex_t* ) );
+	return real_pthread_mutex_lock( m );
+}
+
+int pthread_cond_wait( pthread_cond_t* c, pthread_mutex_t* m ){
+	check( "pthread_cond_wait" );
+	REAL( int, pthread_cond_wait, ( pthread_cond_t*, pthread_mutex_t* ) );
+	return real_pthread_cond_wait( c, m );
+}
+
+int pthread_cond_timedwait( pthread_cond_t* c, pthread_mutex_t* m, const struct timespec* t ){
+	check( "pthread_cond_timedwait" );
+	REAL( int, pthread_cond_timedwait, ( pthread_cond_t*, pthread_mutex_t*, const struct timespec* ) );
+	return real_pthread_cond_timedwait( c, m, t );
+}
+
+int pthread_rwlock_rdlock( pthread_rwlock_t* l ) throw(){
+	check( "pthread_rwlock_rdlock" );
+	REAL( int, pthread_rwlock_rdlock, ( pthread_rwlock_t* ) );
+	return real_pthread_rwlock_rdlock( l );
+}
+
+int pthread_rwlock_wrlock( pthread_rwlock_t* l ) throw(){
+	check( "pthread_rwlock_wrlock" );
+	REAL( int, pthread_rwlock_wrlock, ( pthread_rwlock_t* ) );
+	return real_pthread_rwlock_wrlock( l );
+}
+
+int pthread_join( pthread_t t, void** result ){
+	check( "pthread_join" );
+	REAL( int, pthread_join, ( pthread_t, void** ) );
+	return real_pthread_join( t, result );
+}
+
+int sem_wait( sem_t* s ){
+	check( "sem_wait" );
+	REAL( int, sem_wait, ( sem_t* ) );
+	return real_sem_wait( s );
+}
+
+int usleep( useconds_t us ){
+	check( "usleep" );
+	REAL( int, usleep, ( useconds_t ) );
+	return real_usleep( us );
+}
+
+int nanosleep( const struct timespec* t, struct timespec* remaining ){
+	check( "nanosleep" );
+	REAL( int, nanosleep, ( const struct timespec*, struct timespec* ) );
+	return real_nanosleep( t, remaining );
+}
+
+// file descriptor I/O
+int open( const char* path, int flags, ... ){
+	check( "open" );
+	va_list args;
+	va_start( args, flags );
+	mode_t mode = ( flags & O_CREAT )? va_arg( args, mode_t ) : 0;
+	va_end( args );
+	REAL( int, open, ( const char*, int, ... ) );
+	return real_open( path, flags, mode );
+}
+
+int open64( const char* path, int flags, ... ){
+	check( "open64" );
+	va_list args;
+	va_start( args, flags );
+	mode_t mode = ( flags & O_CREAT )? va_arg( args, mode_t ) : 0;
+	va_end( args );
+	REAL( int, open64, ( const char*, int, ... ) );
+	return real_open64( path, flags, mode );
+}
+
+int close( int fd ){
+	check( "close" );
+	REAL( int, close, ( int ) );
+	return real_close( fd );
+}
+
+ssize_t read( int fd, void* buf, size_t n ){
+	check( "read" );
+	REAL( ssize_t, read, ( int, void*, size_t ) );
+	return real_read( fd, buf, n );
+}
+
+ssize_t write( int fd, const void* buf, size_t n ){
+	check( "write" );
+	return writeDirect( fd, buf, n );
+}
+
+int fsync( int fd ){
+	check( "fsync" );
+	REAL( int, fsync, ( int ) );
+	return real_fsync( fd );
+}
+
+// stdio
+FILE* fopen( const char* path, const char* mode ){
+	check( "fopen" );
+	REAL( FILE*, fopen, ( const char*, const char* ) );
+	return real_fopen( path, mode );
+}
+
+FILE* fopen64( const char* path, const char* mode ){
+	check( "fopen64" );
+	REAL( FILE*, fopen64, ( const char*, const char* ) );
+	return real_fopen64( path, mode );
+}
+
+int fclose( FILE* f ){
+	check( "fclose" );
+	REAL( int, fclose, ( FILE* ) );
+	return real_fclose( f );
+}
+
+size_t fread( void* buf, size_t size, size_t n, FILE* f ){
+	check( "fread" );
+	REAL( size_t, fread, ( void*, size_t, size_t, FILE* ) );
+	return real_fread( buf, size, n, f );
+}
+
+size_t fwrite( const void* buf, size_t size, size_t n, FILE* f ){
+	check( "fwrite" );
+	REAL( size_t, fwrite, ( const void*, size_t, size_t, FILE* ) );
+	return real_fwrite( buf, size, n, f );
+}
+
+int fflush( FILE* f ){
+	check( "fflush" );
+	REAL( int, fflush, ( FILE* ) );
+	return real_fflush( f );
+}
+
+int fputs( const char* s, FILE* f ){
+	check( "fputs" );
+	REAL( int, fputs, ( const char*, FILE* ) );
+	return real_fputs( s, f );
+}
+
+int puts( const char* s ){
+	check( "puts" );
+	REAL( int, puts, ( const char* ) );
+	return real_puts( s );
+}
+
+int fputc( int c, FILE* f ){
+	check( "fputc" );
+	REAL( int, fputc, ( int, FILE* ) );
+	return real_fputc( c, f );
+}
+
+int putchar( int c ){
+	check( "putchar" );
+	REAL( int, putchar, ( int ) );
+	return real_putchar( c );
+}
+
+int vfprintf( FILE* f, const char* format, va_list args ){
+	check( "vfprintf" );
+	REAL( int, vfprintf, ( FILE*, const char*, va_list ) );
+	return real_vfprintf( f, format, args );
+}
+
+int vprintf( const char* format, va_list args ){
+	check( "vprintf" );
+	inCheck++;
+	int r = vfprintf( stdout, format, args );
+	inCheck--;
+	return r;
+}
+
+int fprintf( FILE* f, const char* format, ... ){
+	check( "fprintf" );
+	va_list args;
+	va_start( args, format );
+	inCheck++; // reported once, as fprintf
+	int r = vfprintf( f, format, args );
+	inCheck--;
+	va_end( args );
+	return r;
+}
+
+int printf( const char* format, ... ){
+	check( "printf" );
+	va_list args;
+	va_start( args, format );
+	inCheck++;
+	int r = vfprintf( stdout, format, args );
+	inCheck--;
+	va_end( args );
+	return r;
+}
+
+} // extern "C"
@@ -0,0 +1,63 @@
+/*
+ *  RealtimeCheck.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * A test-mode check that code on the audio thread never allocates, locks or
+ * does blocking I/O.  Code which runs in the render callback marks itself
+ * with REALTIME_SCOPE(), which makes the calling thread real-time until the
+ * end of the enclosing block.  In a build with REALTIME_CHECK=1 linked with
+ * RealtimeCheck.cpp (Linux only), malloc and friends, operator new, the
+ * blocking pthread calls and the stdio and file descriptor I/O calls are
+ * interposed, and a call from a real-time thread is printed to stderr with a
+ * stack trace and counted.  Harnesses fail if realtimeViolations() is not 0
+ * at the end.  REALTIME_EXEMPT() suspends the check to the end of its block,
+ * for harness code called back from the pipeline, eg. a column callback.
+ *
+ * Without REALTIME_CHECK, as in the app, the macros expand to nothing.
+ *   make rtcheck
+ * builds the checked tester and summarybench, runs the benchmark, and replays
+ * generated noise through the tester with and without spectrogram logging.
+ */
+
+#ifndef REALTIME_CHECK_H
+#define REALTIME_CHECK_H
+
+#ifndef REALTIME_CHECK
+#define REALTIME_CHECK 0
+#endif
+
+#if REALTIME_CHECK
+
+/* marks the calling thread real-time for the lifetime of the object; may be nested */
+class RealtimeScope{
+public:
+	RealtimeScope();
+	~RealtimeScope();
+};
+
+/* suspends the real-time check of the calling thread for the lifetime of the object */
+class RealtimeExempt{
+public:
+	RealtimeExempt();
+	~RealtimeExempt();
+private:
+	int savedDepth;
+};
+
+/* number of forbidden calls made on real-time threads so far */
+unsigned long realtimeViolations();
+
+#define REALTIME_SCOPE() RealtimeScope realtimeScope
+#define REALTIME_EXEMPT() RealtimeExempt realtimeExempt
+
+#else
+
+#define REALTIME_SCOPE()
+#define REALTIME_EXEMPT()
+static inline unsigned long realtimeViolations(){ return 0; }
+
+#endif // REALTIME_CHECK
+
+#endif // REALTIME_CHECK_H
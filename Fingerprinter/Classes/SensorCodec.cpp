@@ -0,0 +1,442 @@
+/*
+ *  SensorCodec.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "SensorCodec.h"
+#include "SimdVector.h"
+#include <math.h>
+#include <stddef.h> // for offsetof
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+// RECORD LAYOUTS
+
+typedef enum{
+	ColumnTime,      // the double timestamp
+	ColumnFloat,     // a float, XORed with its previous value
+	ColumnQuantized, // a float, rounded to SENSOR_CODEC_MOTION_STEP and differenced with its previous value
+	ColumnByte       // a uint8_t, differenced with its previous value or with the block's minimum
+} ColumnKind;
+
+struct Column{
+	unsigned int offset; // in the record
+	ColumnKind kind;
+};
+
+#define MAX_COLUMNS (2+SPECTRUM_BINS)
+#define MAX_MICROSECONDS 2147483647.0 // timestamps must fit in 32 bits
+#define MAX_QUANTIZED 2147483647.0    // and so must quantized values
+
+// flag in a byte column's width, set if its residuals are differences from the block's minimum
+#define MINIMUM_FLAG 0x80
+
+/* Encoded data starts with this, and then has one block per SENSOR_CODEC_BLOCK records.  A block
+ * is a width byte per column and a minimum byte per byte column, padded to a multiple of four
+ * bytes, followed by each column's 4*width packed words. */
+struct CodecHeader{
+	uint32_t count;
+	uint32_t numColumns;
+	double firstTimestamp;
+};
+
+/* fills columns with the fields of a record type, returning how many there are or 0 if unsupported */
+static unsigned int getColumns( SensorLogRecordType type, unsigned int recordSize, Column* columns ){
+	unsigned int n = 0;
+	Column time = { 0, ColumnTime };
+	columns[n++] = time;
+	switch( type ){
+		case SensorLogMotion:{
+			if( recordSize != sizeof(MotionRecord) ) return 0;
+			const unsigned int arrays[4] = { offsetof(MotionRecord,userAccel), offsetof(MotionRecord,attitude),
+			                                 offsetof(MotionRecord,rotationRate), offsetof(MotionRecord,gravity) };
+			for( unsigned int a=0; a<4; ++a ){
+				for( unsigned int i=0; i<3; ++i ){
+					Column c = { (unsigned int)(arrays[a] + i*sizeof(float)), ColumnQuantized };
+					columns[n++] = c;
+				}
+			}
+			return n;
+		}
+		case SensorLogSpectrum:
+		case SensorLogFingerprint:{
+			if( recordSize != sizeof(SpectrumRecord) ) return 0;
+			Column offset = { offsetof(SpectrumRecord,offset), ColumnFloat };
+			columns[n++] = offset;
+			for( unsigned int i=0; i<SPECTRUM_BINS; ++i ){
+				Column c = { (unsigned int)(offsetof(SpectrumRecord,level) + i), ColumnByte };
+				columns[n++] = c;
+			}
+			return n;
+		}
+		default:
+			return 0;
+	}
+}
+
+bool sensorCodecSupports( SensorLogRecordType type, unsigned int recordSize ){
+	Column columns[MAX_COLUMNS];
+	return getColumns( type, recordSize, columns ) > 0;
+}
+
+/* size of a column's field */
+static inline unsigned int columnBytes( ColumnKind kind ){
+	switch( kind ){
+		case ColumnTime: return sizeof(double);
+		case ColumnByte: return 1;
+		default: return sizeof(float);
+	}
+}
+
+/* bytes at the start of each block */
+static unsigned int blockHeaderBytes( const Column* columns, unsigned int numColumns ){
+	unsigned int bytes = numColumns;
+	for( unsigned int c=0; c<numColumns; ++c ){
+		if( columns[c].kind == ColumnByte ) ++bytes;
+	}
+	return ( bytes + 3 ) & ~3u;
+}
+
+
+// -----------------------------------------------------------------------------
+// ENCODER
+
+static inline uint32_t zigzag( int32_t x ){
+	return ( (uint32_t)x << 1 ) ^ (uint32_t)( x >> 31 );
+}
+
+/* number of bits needed for the largest of n values */
+static unsigned int bitWidth( const uint32_t* v, unsigned int n ){
+	uint32_t all = 0;
+	for( unsigned int i=0; i<n; ++i ) all |= v[i];
+	unsigned int width = 0;
+	while( all ){
+		++width;
+		all >>= 1;
+	}
+	return width;
+}
+
+/* appends a block of residuals, packed vertically; see unpack() */
+static void pack( const uint32_t* v, unsigned int width, std::vector<unsigned char>& out ){
+	if( width == 0 ) return;
+	uint32_t words[4*32]; // word k of lane l is words[4*k+l]
+	memset( words, 0, sizeof(words) );
+	for( unsigned int lane=0; lane<4; ++lane ){
+		unsigned int bit = 0;
+		for( unsigned int j=0; j<SENSOR_CODEC_BLOCK/4; ++j ){
+			uint32_t x = v[4*j+lane];
+			unsigned int k = bit >> 5, shift = bit & 31;
+			words[4*k+lane] |= x << shift;
+			if( shift + width > 32 ) words[4*(k+1)+lane] |= x >> (32-shift);
+			bit += width;
+		}
+	}
+	unsigned int pos = out.size();
+	out.resize( pos + 16*width );
+	memcpy( &out[pos], words, 16*width );
+}
+
+bool sensorCodecEncode( SensorLogRecordType type, unsigned int recordSize,
+					    const void* records, unsigned int count, std::vector<unsigned char>& out ){
+	Column columns[MAX_COLUMNS];
+	unsigned int numColumns = getColumns( type, recordSize, columns );
+	if( !numColumns ) return false;
+	const unsigned char* r = (const unsigned char*)records;
+
+	CodecHeader header;
+	memset( &header, 0, sizeof(header) );
+	header.count = count;
+	header.numColumns = numColumns;
+	if( count ) memcpy( &header.firstTimestamp, r, sizeof(double) );
+	out.assign( (const unsigned char*)&header, (const unsigned char*)&header + sizeof(header) );
+
+	// each column's previous value, carried between blocks
+	uint32_t prev[MAX_COLUMNS];
+	memset( prev, 0, sizeof(prev) );
+	int64_t prevTicks = 0, prevDelta = 0;
+
+	unsigned int headerBytes = blockHeaderBytes( columns, numColumns );
+	uint32_t residual[SENSOR_CODEC_BLOCK];
+	for( unsigned int first=0; first<count; first+=SENSOR_CODEC_BLOCK ){
+		unsigned int n = count - first;
+		if( n > SENSOR_CODEC_BLOCK ) n = SENSOR_CODEC_BLOCK;
+		unsigned int widthPos = out.size();
+		unsigned int minimumPos = widthPos + numColumns;
+		out.resize( widthPos + headerBytes, 0 );
+		for( unsigned int c=0; c<numColumns; ++c ){
+			const unsigned char* field = r + first*recordSize + columns[c].offset;
+			uint8_t minimum = 0xFF, maximum = 0;
+			for( unsigned int i=0; i<n; ++i, field+=recordSize ){
+				if( columns[c].kind == ColumnTime ){
+					double t;
+					memcpy( &t, field, sizeof(t) );
+					double us = ( t - header.firstTimestamp ) * 1e6;
+					if( !( fabs( us ) < MAX_MICROSECONDS ) ) return false; // includes NaN
+					int64_t ticks = llround( us );
+					int64_t delta = ticks - prevTicks;
+					int64_t dd = delta - prevDelta;
+					if( dd != (int32_t)dd ) return false; // does not fit in 32 bits
+					residual[i] = zigzag( (int32_t)dd );
+					prevTicks = ticks;
+					prevDelta = delta;
+				}else if( columns[c].kind == ColumnFloat ){
+					uint32_t bits;
+					memcpy( &bits, field, sizeof(bits) );
+					residual[i] = bits ^ prev[c];
+					prev[c] = bits;
+				}else if( columns[c].kind == ColumnQuantized ){
+					float x;
+					memcpy( &x, field, sizeof(x) );
+					double q = x / SENSOR_CODEC_MOTION_STEP;
+					if( !( fabs( q ) < MAX_QUANTIZED ) ) return false; // includes NaN and infinities
+					uint32_t v = (uint32_t)(int32_t)lround( q );
+					residual[i] = zigzag( (int32_t)( v - prev[c] ) );
+					prev[c] = v;
+				}else{
+					uint8_t d = (uint8_t)( *field - prev[c] );
+					residual[i] = zigzag( (int8_t)d ) & 0xFF;
+					prev[c] = *field;
+					if( *field < minimum ) minimum = *field;
+					if( *field > maximum ) maximum = *field;
+				}
+			}
+			// a partial last block is padded with zero residuals
+			for( unsigned int i=n; i<SENSOR_CODEC_BLOCK; ++i ) residual[i] = 0;
+			unsigned int width = bitWidth( residual, SENSOR_CODEC_BLOCK );
+			if( columns[c].kind == ColumnByte ){
+				// noisy bytes may take fewer bits as differences from the minimum
+				uint32_t range = maximum - minimum;
+				if( n > 0 && bitWidth( &range, 1 ) < width ){
+					field = r + first*recordSize + columns[c].offset;
+					for( unsigned int i=0; i<n; ++i, field+=recordSize ) residual[i] = *field - minimum;
+					width = bitWidth( &range, 1 );
+					out[widthPos+c] = MINIMUM_FLAG;
+				}
+				out[minimumPos++] = minimum;
+			}
+			out[widthPos+c] |= width;
+			pack( residual, width, out );
+		}
+	}
+	return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// DECODER
+
+/* Unpacks a block of residuals.  Lane l of the four word streams holds residuals l, l+4, l+8...
+ * so each step extracts four consecutive residuals with the same shifts. */
+static inline void unpack( const uint32_t* in, unsigned int width, uint32_t* v ){
+	if( width == 0 ){
+		memset( v, 0, SENSOR_CODEC_BLOCK*sizeof(uint32_t) );
+		return;
+	}
+	Int4 mask = i4_splat( ( width == 32 )? 0xFFFFFFFF : ( 1u << width ) - 1 );
+	Int4 word = i4_load( in );
+	in += 4;
+	unsigned int shift = 0;
+	for( unsigned int j=0; j<SENSOR_CODEC_BLOCK/4; ++j ){
+		Int4 x = i4_shr( word, shift );
+		shift += width;
+		if( shift >= 32 ){
+			shift -= 32;
+			if( j+1 < SENSOR_CODEC_BLOCK/4 ){
+				word = i4_load( in );
+				in += 4;
+				// high bits of a residual which straddles two words
+				if( shift ) x = i4_or( x, i4_shl( word, width - shift ) );
+			}
+		}
+		i4_store( v + 4*j, i4_and( x, mask ) );
+	}
+}
+
+/* inverse of zigzag() */
+static inline Int4 unzigzag( Int4 x ){
+	Int4 sign = i4_sub( i4_splat( 0 ), i4_and( x, i4_splat( 1 ) ) );
+	return i4_xor( i4_shr( x, 1 ), sign );
+}
+
+/* replaces residuals by running XORs, starting from *last, and updates *last */
+static inline void prefixXor( uint32_t* v, uint32_t* last ){
+	Int4 carry = i4_splat( *last );
+	for( unsigned int j=0; j<SENSOR_CODEC_BLOCK; j+=4 ){
+		Int4 x = i4_load( v+j );
+		x = i4_xor( x, i4_lanes_up1( x ) );
+		x = i4_xor( x, i4_lanes_up2( x ) );
+		x = i4_xor( x, carry );
+		i4_store( v+j, x );
+		carry = i4_splat_last( x );
+	}
+	*last = v[SENSOR_CODEC_BLOCK-1];
+}
+
+/* replaces residuals by running sums, starting from *last, and updates *last.
+ * The residuals are zigzag coded if zigzagged is true. */
+static inline void prefixSum( uint32_t* v, uint32_t* last, bool zigzagged ){
+	Int4 carry = i4_splat( *last );
+	for( unsigned int j=0; j<SENSOR_CODEC_BLOCK; j+=4 ){
+		Int4 x = i4_load( v+j );
+		if( zigzagged ) x = unzigzag( x );
+		x = i4_add( x, i4_lanes_up1( x ) );
+		x = i4_add( x, i4_lanes_up2( x ) );
+		x = i4_add( x, carry );
+		i4_store( v+j, x );
+		carry = i4_splat_last( x );
+	}
+	*last = v[SENSOR_CODEC_BLOCK-1];
+}
+
+/* adds k to every residual */
+static inline void addConstant( uint32_t* v, uint32_t k ){
+	Int4 x = i4_splat( k );
+	for( unsigned int j=0; j<SENSOR_CODEC_BLOCK; j+=4 ){
+		i4_store( v+j, i4_add( i4_load( v+j ), x ) );
+	}
+}
+
+/* true if columns c to c+3 are quantized floats stored next to each other, as in MotionRecord */
+static inline bool isQuantizedGroup( const Column* columns, unsigned int numColumns, unsigned int c ){
+	if( c+4 > numColumns ) return false;
+	for( unsigned int k=0; k<4; ++k ){
+		if( columns[c+k].kind != ColumnQuantized ||
+		    columns[c+k].offset != columns[c].offset + k*sizeof(float) ) return false;
+	}
+	return true;
+}
+
+/* decoder state of one block */
+struct BlockReader{
+	const unsigned char* in;      // next packed column
+	const unsigned char* end;     // of the encoded data
+	const unsigned char* widths;  // of the block's columns
+	const unsigned char* minimum; // of the next byte column
+	uint32_t words[4*32];
+};
+
+/* Unpacks column c of the block into v and undoes its deltas, updating its previous value.
+ * Timestamp columns are left as zigzagged delta-of-deltas.  Returns false if data runs out. */
+static bool readColumn( BlockReader& block, const Column* columns, unsigned int c, unsigned int n,
+					    uint32_t* prev, uint32_t* v ){
+	unsigned int width = block.widths[c] & ~MINIMUM_FLAG;
+	if( width > 32 || (unsigned int)(block.end - block.in) < 16*width ) return false;
+	// copied to a word buffer rather than reading the bytes through a uint32_t pointer
+	memcpy( block.words, block.in, 16*width );
+	block.in += 16*width;
+	unpack( block.words, width, v );
+	switch( columns[c].kind ){
+		case ColumnTime:
+			break;
+		case ColumnFloat:
+			prefixXor( v, &prev[c] );
+			break;
+		case ColumnQuantized:
+			prefixSum( v, &prev[c], true );
+			break;
+		case ColumnByte:
+			if( block.widths[c] & MINIMUM_FLAG ){
+				addConstant( v, *block.minimum );
+				prev[c] = v[n-1];
+			}else{
+				prefixSum( v, &prev[c], true );
+			}
+			++block.minimum;
+			break;
+	}
+	return true;
+}
+
+bool sensorCodecDecode( SensorLogRecordType type, unsigned int recordSize,
+					    const void* data, unsigned int bytes, void* records, unsigned int count ){
+	Column columns[MAX_COLUMNS];
+	unsigned int numColumns = getColumns( type, recordSize, columns );
+	CodecHeader header;
+	if( !numColumns || bytes < sizeof(header) ) return false;
+	memcpy( &header, data, sizeof(header) );
+	if( header.count != count || header.numColumns != numColumns ) return false;
+	unsigned char* r = (unsigned char*)records;
+	unsigned int fieldBytes = 0;
+	for( unsigned int c=0; c<numColumns; ++c ) fieldBytes += columnBytes( columns[c].kind );
+	if( fieldBytes < recordSize ) memset( r, 0, count*recordSize ); // struct padding
+
+	uint32_t prev[MAX_COLUMNS];
+	memset( prev, 0, sizeof(prev) );
+	uint32_t prevTicks = 0, prevDelta = 0;
+
+	BlockReader block;
+	block.in = (const unsigned char*)data + sizeof(header);
+	block.end = (const unsigned char*)data + bytes;
+	unsigned int headerBytes = blockHeaderBytes( columns, numColumns );
+	uint32_t v[4][SENSOR_CODEC_BLOCK];
+	for( unsigned int first=0; first<count; first+=SENSOR_CODEC_BLOCK ){
+		unsigned int n = count - first;
+		if( n > SENSOR_CODEC_BLOCK ) n = SENSOR_CODEC_BLOCK;
+		if( (unsigned int)(block.end - block.in) < headerBytes ) return false;
+		block.widths = block.in;
+		block.minimum = block.in + numColumns;
+		block.in += headerBytes;
+		unsigned char* record = r + first*recordSize;
+		for( unsigned int c=0; c<numColumns; ++c ){
+			unsigned char* field = record + columns[c].offset;
+			if( isQuantizedGroup( columns, numColumns, c ) ){
+				// four fields at once: convert to floats and transpose, to store one vector per record
+				for( unsigned int k=0; k<4; ++k ){
+					if( !readColumn( block, columns, c+k, n, prev, v[k] ) ) return false;
+				}
+				Float4 step = f4_splat( SENSOR_CODEC_MOTION_STEP );
+				float tail[4][4];
+				for( unsigned int i=0; i<n; i+=4 ){
+					Float4 x0 = f4_mul( i4_to_f4( i4_load( v[0]+i ) ), step );
+					Float4 x1 = f4_mul( i4_to_f4( i4_load( v[1]+i ) ), step );
+					Float4 x2 = f4_mul( i4_to_f4( i4_load( v[2]+i ) ), step );
+					Float4 x3 = f4_mul( i4_to_f4( i4_load( v[3]+i ) ), step );
+					f4_transpose( x0, x1, x2, x3 );
+					if( i+4 <= n ){
+						f4_store( (float*)( field + i*recordSize ), x0 );
+						f4_store( (float*)( field + (i+1)*recordSize ), x1 );
+						f4_store( (float*)( field + (i+2)*recordSize ), x2 );
+						f4_store( (float*)( field + (i+3)*recordSize ), x3 );
+					}else{
+						// the last records of a partial block
+						f4_store( tail[0], x0 );
+						f4_store( tail[1], x1 );
+						f4_store( tail[2], x2 );
+						f4_store( tail[3], x3 );
+						for( unsigned int k=0; i+k<n; ++k ) memcpy( field + (i+k)*recordSize, tail[k], sizeof(tail[k]) );
+					}
+				}
+				c += 3;
+				continue;
+			}
+
+			if( !readColumn( block, columns, c, n, prev, v[0] ) ) return false;
+			if( columns[c].kind == ColumnTime ){
+				prefixSum( v[0], &prevDelta, true );
+				prefixSum( v[0], &prevTicks, false );
+				for( unsigned int i=0; i<n; ++i, field+=recordSize ){
+					double t = header.firstTimestamp + (int32_t)v[0][i] * 1e-6;
+					memcpy( field, &t, sizeof(t) );
+				}
+			}else if( columns[c].kind == ColumnQuantized ){
+				for( unsigned int i=0; i<n; ++i, field+=recordSize ){
+					float x = (int32_t)v[0][i] * (float)SENSOR_CODEC_MOTION_STEP;
+					memcpy( field, &x, sizeof(x) );
+				}
+			}else if( columns[c].kind == ColumnFloat ){
+				for( unsigned int i=0; i<n; ++i, field+=recordSize ){
+					memcpy( field, &v[0][i], sizeof(uint32_t) );
+				}
+			}else{
+				for( unsigned int i=0; i<n; ++i, field+=recordSize ){
+					*field = (uint8_t)v[0][i];
+				}
+			}
+		}
+	}
+	return block.in == block.end;
+}
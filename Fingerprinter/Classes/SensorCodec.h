@@ -0,0 +1,59 @@
+/*
+ *  SensorCodec.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * A compact encoding for blocks of motion and spectrum records, used for
+ * CaptureFile chunks.  General-purpose compression does poorly on these
+ * streams because consecutive records are similar but not byte-identical.
+ * So each record field is treated as a column and replaced by its change
+ * from the previous record:
+ *   timestamps     delta-of-delta of whole microseconds since the first record,
+ *   motion values  difference of multiples of SENSOR_CODEC_MOTION_STEP,
+ *   other floats   XOR with the previous value (only low mantissa bits differ),
+ *   bytes          difference from the previous value, or from the block's
+ *                  minimum if that is smaller, eg. spectrum levels.
+ * The residuals are zigzag coded where signed and bit-packed in blocks of
+ * SENSOR_CODEC_BLOCK records, each column with its own bit width per block.
+ *
+ * Packing is "vertical": residual i of a block is in lane i%4 of four
+ * interleaved word streams, so that decoding unpacks and undoes the deltas
+ * four values at a time with the Int4 vectors of SimdVector.h.
+ *
+ * Timestamps are rounded to the microsecond and motion values to a step well
+ * under the sensors' noise; everything else is restored exactly, with any
+ * struct padding zeroed.
+ */
+
+#ifndef SENSOR_CODEC_H
+#define SENSOR_CODEC_H
+
+#include <vector>
+#include "SensorLog.h"
+
+/* records per bit-packed block */
+#define SENSOR_CODEC_BLOCK 128
+/* resolution of stored MotionRecord values, in g, radians or radians/second */
+#define SENSOR_CODEC_MOTION_STEP 1e-4
+
+/* true if records of this type and size can be encoded */
+bool sensorCodecSupports( SensorLogRecordType type, unsigned int recordSize );
+
+/**
+ * Encodes count records, each starting with its timestamp.
+ * @param out receives the encoding, replacing its contents.
+ * @return false if the type is not supported or the records cannot be encoded,
+ *   eg. because they span more than half an hour or hold infinite values.
+ */
+bool sensorCodecEncode( SensorLogRecordType type, unsigned int recordSize,
+					    const void* records, unsigned int count, std::vector<unsigned char>& out );
+
+/**
+ * Decodes the output of sensorCodecEncode into count records of recordSize bytes.
+ * @return false if the data is corrupt or was not encoded with this type and count.
+ */
+bool sensorCodecDecode( SensorLogRecordType type, unsigned int recordSize,
+					    const void* data, unsigned int bytes, void* records, unsigned int count );
+
+#endif // SENSOR_CODEC_H
@@ -0,0 +1,403 @@
+/*
+ *  SensorLog.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "SensorLog.h"
+#include "CaptureFile.h"
+#include <stdlib.h> // for posix_memalign
+#include <string.h> // for memcpy
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+// -----------------------------------------------------------------------------
+// CONSTANTS
+const unsigned int SensorLogWriter::flushBytes = 64*1024;
+const double SensorLogService::flushInterval = 1.0;
+#define PAGE_BYTES 4096
+#define FLUSH_POLL_US 20000 // how often the I/O thread checks the rings
+#define READ_BUFFER_BYTES (256*1024)
+#define UNIX_TO_REFERENCE_DATE 978307200.0 // seconds from 1970 to 2001
+
+/* writes all n bytes, continuing after short writes and interruptions.  @return false on an error. */
+static bool writeAll( int fd, const unsigned char* data, size_t n ){
+	while( n > 0 ){
+		ssize_t written = write( fd, data, n );
+		if( written < 0 ){
+			if( errno == EINTR ) continue;
+			return false;
+		}
+		data += written;
+		n -= written;
+	}
+	return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// WRITER
+
+SensorLogWriter::SensorLogWriter( const char* filename, SensorLogRecordType type, unsigned int myRecordSize,
+								  unsigned int ringBytes, double clockOffset ) :
+lastFlush(0), opened(false), capture(NULL), streamId(0), chunk(NULL), recordSize(myRecordSize), ring(NULL), 
+head(0), tail(0), dropped(0), fileBase(0){
+	fd = open( filename, O_RDWR | O_CREAT | O_APPEND, 0644 );
+	if( fd < 0 ){
+		fprintf( stderr, "Error: could not open sensor log %s\n", filename );
+		return;
+	}
+	if( !init( ringBytes ) ){
+		::close( fd );
+		fd = -1;
+		return;
+	}
+
+	SensorLogHeader header;
+	off_t size = lseek( fd, 0, SEEK_END );
+	if( size == 0 ){
+		// a new log
+		memset( &header, 0, sizeof(header) );
+		memcpy( header.magic, SENSOR_LOG_MAGIC, 4 );
+		header.version = SENSOR_LOG_VERSION;
+		header.recordType = type;
+		header.recordSize = recordSize;
+		header.clockOffset = clockOffset;
+		if( !writeAll( fd, (const unsigned char*)&header, sizeof(header) ) ){
+			fprintf( stderr, "Error: could not write sensor log header\n" );
+			::close( fd );
+			fd = -1;
+			return;
+		}
+		size = sizeof(header);
+	}else{
+		// appending, so the records must be of the same kind
+		if( pread( fd, &header, sizeof(header), 0 ) != sizeof(header) ||
+		    memcmp( header.magic, SENSOR_LOG_MAGIC, 4 ) != 0 ||
+		    header.version != SENSOR_LOG_VERSION ||
+		    header.recordType != (uint32_t)type ||
+		    header.recordSize != recordSize ){
+			fprintf( stderr, "Error: %s is not a sensor log of the same records, so it was not appended to\n", filename );
+			::close( fd );
+			fd = -1;
+			return;
+		}
+		// cut off a record left partly written, eg. by a crash, so that new records are aligned
+		off_t whole = sizeof(header) + ( size - sizeof(header) ) / recordSize * recordSize;
+		if( whole != size ){
+			if( ftruncate( fd, whole ) ){
+				fprintf( stderr, "Error: could not truncate sensor log %s\n", filename );
+				::close( fd );
+				fd = -1;
+				return;
+			}
+			size = whole;
+		}
+	}
+	fileBase = size;
+	opened = true;
+}
+
+SensorLogWriter::SensorLogWriter( CaptureWriter* myCapture, unsigned int myStreamId, unsigned int myRecordSize,
+								  unsigned int ringBytes ) :
+lastFlush(0), opened(false), fd(-1), capture(myCapture), streamId(myStreamId), chunk(NULL), recordSize(myRecordSize), 
+ring(NULL), head(0), tail(0), dropped(0), fileBase(0){
+	if( !capture->isOpen() || !init( ringBytes ) ) return;
+	// chunks hold whole records, and are assembled in a separate buffer because records can wrap around the ring
+	chunkBytes = flushBytes - flushBytes % recordSize;
+	chunk = (unsigned char*)malloc( chunkBytes );
+	opened = true;
+}
+
+bool SensorLogWriter::init( unsigned int ringBytes ){
+	// ring size must be a power of two so that the byte counters can wrap around
+	ringSize = 2*flushBytes;
+	while( ringSize < ringBytes ) ringSize *= 2;
+	void* mem;
+	if( posix_memalign( &mem, PAGE_BYTES, ringSize ) ){
+		fprintf( stderr, "Error: could not allocate sensor log buffer\n" );
+		return false;
+	}
+	ring = (unsigned char*)mem;
+
+	MetricsRegistry* metrics = MetricsRegistry::shared();
+	recordCount = metrics->counter( "sensorlog_records_total", "Sensor records written to logs" );
+	byteCount = metrics->counter( "sensorlog_bytes_total", "Bytes of sensor records written to logs" );
+	droppedCount = metrics->counter( "sensorlog_dropped_total", "Sensor records dropped because a ring was full or a write failed" );
+	writeErrors = metrics->counter( "sensorlog_write_errors_total", "Failed writes of sensor logs" );
+	flushTime = metrics->histogram( "sensorlog_flush_us", "Microseconds per write of a sensor log block" );
+	return true;
+}
+
+SensorLogWriter::~SensorLogWriter(){
+	close();
+	free( ring );
+	free( chunk );
+}
+
+bool SensorLogWriter::isOpen(){
+	return opened;
+}
+
+bool SensorLogWriter::push( const void* record ){
+	if( !opened ) return false;
+	unsigned long h = head; // only we write head
+	unsigned long t = tail;
+	__sync_synchronize(); // read tail before overwriting the space it frees
+	if( ringSize - (h - t) < recordSize ){
+		__sync_fetch_and_add( &dropped, 1 );
+		droppedCount->add();
+		return false;
+	}
+	// copy, in two parts if the record wraps around the end of the ring
+	unsigned int pos = h & (ringSize-1);
+	unsigned int firstPart = ringSize - pos;
+	if( firstPart >= recordSize ){
+		memcpy( ring+pos, record, recordSize );
+	}else{
+		memcpy( ring+pos, record, firstPart );
+		memcpy( ring, (const unsigned char*)record+firstPart, recordSize-firstPart );
+	}
+	__sync_synchronize(); // publish the record before advancing head
+	head = h + recordSize;
+	return true;
+}
+
+unsigned long SensorLogWriter::getPendingBytes(){
+	return head - tail;
+}
+
+void SensorLogWriter::flush( bool all ){
+	if( !opened ) return;
+	unsigned long h = head;
+	__sync_synchronize(); // read head before reading the records it covers
+	unsigned long t = tail;
+	unsigned long avail = h - t;
+	if( capture ){
+		// copy whole chunks (and a partial one, if all) out of the ring
+		while( avail >= chunkBytes || ( all && avail > 0 ) ){
+			MetricTimer timer( flushTime );
+			unsigned int bytes = ( avail < chunkBytes )? avail : chunkBytes;
+			unsigned int pos = t & (ringSize-1);
+			unsigned int firstPart = ringSize - pos;
+			if( firstPart >= bytes ){
+				memcpy( chunk, ring+pos, bytes );
+			}else{
+				memcpy( chunk, ring+pos, firstPart );
+				memcpy( chunk+firstPart, ring, bytes-firstPart );
+			}
+			__sync_synchronize(); // finish reading the ring before releasing the space
+			t += bytes;
+			avail -= bytes;
+			tail = t;
+			capture->writeRecords( streamId, chunk, bytes );
+			recordCount->add( bytes / recordSize );
+			byteCount->add( bytes );
+		}
+		return;
+	}
+	if( !all ) avail -= avail % flushBytes; // only whole blocks
+	if( avail == 0 ) return;
+	MetricTimer timer( flushTime );
+
+	// write, in two parts if the data wraps around the end of the ring
+	unsigned int pos = t & (ringSize-1);
+	unsigned long firstPart = ringSize - pos;
+	if( firstPart > avail ) firstPart = avail;
+	unsigned long end = t + avail;
+	if( !writeAll( fd, ring+pos, firstPart ) ||
+	    ( avail > firstPart && !writeAll( fd, ring, avail-firstPart ) ) ){
+		fprintf( stderr, "Error: sensor log write failed\n" );
+		writeErrors->add();
+		end = dropFailedWrite( end );
+	}else{
+		// blocks may split a record, which counts once it is written whole
+		recordCount->add( (t+avail)/recordSize - t/recordSize );
+		byteCount->add( avail );
+	}
+	__sync_synchronize(); // finish reading the ring before releasing the space
+	tail = end;
+}
+
+unsigned long SensorLogWriter::dropFailedWrite( unsigned long end ){
+	// The file ended at ring byte tail, and some of the block may have reached it since.
+	// Keep the whole records, and drop the rest up to the record boundary after end,
+	// which head has passed.
+	off_t size = lseek( fd, 0, SEEK_END );
+	unsigned long kept = tail;
+	if( size >= fileBase + (long long)tail ){
+		kept = ( size - fileBase > (long long)end )? end : (unsigned long)( size - fileBase );
+	}
+	kept -= kept % recordSize;
+	if( ftruncate( fd, fileBase + kept ) ){
+		fprintf( stderr, "Error: could not truncate sensor log\n" );
+	}
+	unsigned long next = ( end + recordSize - 1 ) / recordSize * recordSize;
+	// records which were completed by this block were written; the others were not
+	if( kept > tail ) recordCount->add( kept/recordSize - tail/recordSize );
+	unsigned long lost = ( next - kept ) / recordSize;
+	__sync_fetch_and_add( &dropped, lost );
+	droppedCount->add( lost );
+	// ring byte next is written at the end of the file, which is now fileBase + kept
+	fileBase += (long long)kept - (long long)next;
+	return next;
+}
+
+void SensorLogWriter::close(){
+	if( !opened ) return;
+	flush( true );
+	if( fd >= 0 ) ::close( fd );
+	fd = -1;
+	opened = false;
+	if( dropped ){
+		fprintf( stderr, "sensor log dropped %lu records\n", dropped );
+	}
+}
+
+unsigned long SensorLogWriter::getDroppedCount(){
+	return dropped;
+}
+
+
+// -----------------------------------------------------------------------------
+// SERVICE
+
+SensorLogService::SensorLogService() : stopping(false), threadRunning(false){
+	pthread_mutex_init( &logsLock, NULL );
+	if( pthread_create( &thread, NULL, threadMain, this ) ){
+		fprintf( stderr, "Error: could not start sensor log thread\n" );
+	}else{
+		threadRunning = true;
+	}
+}
+
+SensorLogService::~SensorLogService(){
+	close();
+	pthread_mutex_destroy( &logsLock );
+}
+
+SensorLogWriter* SensorLogService::openLog( const char* filename, SensorLogRecordType type, 
+										    unsigned int recordSize, unsigned int ringBytes ){
+	SensorLogWriter* log = new SensorLogWriter( filename, type, recordSize, ringBytes, 
+												wallClock() - now() );
+	if( !log->isOpen() ){
+		delete log;
+		return NULL;
+	}
+	log->lastFlush = now();
+	pthread_mutex_lock( &logsLock );
+	logs.push_back( log );
+	pthread_mutex_unlock( &logsLock );
+	return log;
+}
+
+SensorLogWriter* SensorLogService::openLog( CaptureWriter* capture, const char* name, SensorLogRecordType type, 
+										    unsigned int recordSize, unsigned int ringBytes, bool compress ){
+	unsigned int streamId = capture->addStream( name, type, recordSize, compress );
+	SensorLogWriter* log = new SensorLogWriter( capture, streamId, recordSize, ringBytes );
+	if( !log->isOpen() ){
+		delete log;
+		return NULL;
+	}
+	log->lastFlush = now();
+	pthread_mutex_lock( &logsLock );
+	logs.push_back( log );
+	pthread_mutex_unlock( &logsLock );
+	return log;
+}
+
+void* SensorLogService::threadMain( void* arg ){
+	SensorLogService* THIS = (SensorLogService*)arg;
+	while( !THIS->stopping ){
+		usleep( FLUSH_POLL_US );
+		double t = now();
+		pthread_mutex_lock( &THIS->logsLock );
+		for( unsigned int i=0; i<THIS->logs.size(); ++i ){
+			SensorLogWriter* log = THIS->logs[i];
+			// write partial blocks too if data has been waiting a while
+			bool all = ( t - log->lastFlush >= flushInterval );
+			if( all || log->getPendingBytes() >= SensorLogWriter::flushBytes ){
+				log->flush( all );
+				log->lastFlush = t;
+			}
+		}
+		pthread_mutex_unlock( &THIS->logsLock );
+	}
+	return NULL;
+}
+
+void SensorLogService::close(){
+	if( threadRunning ){
+		stopping = true;
+		pthread_join( thread, NULL );
+		threadRunning = false;
+	}
+	pthread_mutex_lock( &logsLock );
+	for( unsigned int i=0; i<logs.size(); ++i ){
+		delete logs[i]; // flushes and closes
+	}
+	logs.clear();
+	pthread_mutex_unlock( &logsLock );
+}
+
+double SensorLogService::now(){
+#ifdef __APPLE__
+	static mach_timebase_info_data_t timebase;
+	if( timebase.denom == 0 ) mach_timebase_info( &timebase );
+	return mach_absolute_time() * 1e-9 * timebase.numer / timebase.denom;
+#else
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+#endif
+}
+
+double SensorLogService::wallClock(){
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + 1e-6*tv.tv_usec - UNIX_TO_REFERENCE_DATE;
+}
+
+
+// -----------------------------------------------------------------------------
+// READER
+
+SensorLogReader::SensorLogReader( const char* filename ) : valid(false){
+	file = fopen( filename, "rb" );
+	if( !file ) return;
+	setvbuf( file, NULL, _IOFBF, READ_BUFFER_BYTES );
+	if( fread( &header, sizeof(header), 1, file ) == 1 &&
+	    memcmp( header.magic, SENSOR_LOG_MAGIC, 4 ) == 0 &&
+	    header.version == SENSOR_LOG_VERSION &&
+	    header.recordSize > 0 ){
+		valid = true;
+	}
+}
+
+SensorLogReader::~SensorLogReader(){
+	if( file ) fclose( file );
+}
+
+bool SensorLogReader::isOpen(){
+	return valid;
+}
+
+const SensorLogHeader& SensorLogReader::getHeader(){
+	return header;
+}
+
+bool SensorLogReader::next( void* record ){
+	if( !valid ) return false;
+	return fread( record, header.recordSize, 1, file ) == 1;
+}
@@ -0,0 +1,230 @@
+/*
+ *  SensorLog.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Binary logging of fixed-size sensor records.  A SensorLogService owns one
+ * I/O thread and any number of open logs (SensorLogWriters), one per stream.
+ * Each writer is fed by a single producer thread (eg. the CoreMotion handler),
+ * which just copies each record into a lock-free ring buffer.  The I/O thread
+ * drains every ring to disk in large blocks, so producers never format text or
+ * open files.  SensorLogReader streams the records back; see sensorlog2txt.cpp
+ * for a text export tool.
+ *
+ * All record timestamps are seconds on SensorLogService::now()'s monotonic
+ * clock, which has the same base as CoreMotion timestamps (time since boot).
+ * Each file's header stores the offset which converts them to wall-clock time.
+ * Instead of its own file, a log may also be one stream of a CaptureFile.
+ *
+ * The file format is a SensorLogHeader followed by records of header.recordSize
+ * bytes each, in the byte order of the device that wrote them.
+ */
+
+#ifndef SENSOR_LOG_H
+#define SENSOR_LOG_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "Metrics.h"
+
+class CaptureWriter;
+
+#define SENSOR_LOG_MAGIC "BPSL"
+#define SENSOR_LOG_VERSION 1
+
+// kinds of record which may be stored in a sensor log
+typedef enum{
+	SensorLogMotion = 1, // MotionRecord
+	SensorLogLocation,   // LocationRecord
+	SensorLogWifi,       // WifiRecord
+	SensorLogStill,      // JPEG image, only as a CaptureFile blob
+	SensorLogAudio,      // WAV file, only as a CaptureFile blob
+	SensorLogSpectrum,   // SpectrumRecord of one averaged audio spectrum
+	SensorLogFingerprint // SpectrumRecord of one fingerprint
+} SensorLogRecordType;
+
+/* every sensor log starts with this */
+struct SensorLogHeader{
+	char magic[4]; // SENSOR_LOG_MAGIC, not null-terminated
+	uint32_t version;
+	uint32_t recordType; // a SensorLogRecordType
+	uint32_t recordSize; // bytes per record
+	/* add to a record timestamp to get seconds since the NSDate reference date
+	 * (timeIntervalSinceReferenceDate), as measured when the file was created */
+	double clockOffset;
+};
+
+/* one CoreMotion device motion sample */
+struct MotionRecord{
+	double timestamp;      // monotonic seconds, see above
+	float userAccel[3];    // x,y,z in g
+	float attitude[3];     // roll, pitch, yaw in radians
+	float rotationRate[3]; // x,y,z in radians/second
+	float gravity[3];      // x,y,z in g
+};
+
+/* one CoreLocation update */
+struct LocationRecord{
+	double timestamp;          // monotonic seconds when the fix was made
+	double latitude;           // degrees
+	double longitude;          // degrees
+	double altitude;           // meters
+	float horizontalAccuracy;  // meters, negative if latitude and longitude are invalid
+	float verticalAccuracy;    // meters, negative if altitude is invalid
+	float speed;               // meters/second, negative if invalid
+	float course;              // degrees from north, negative if invalid
+};
+
+#define WIFI_SSID_LENGTH 32
+
+/* one access point seen in a Wi-Fi scan.  All APs in a scan share a timestamp. */
+struct WifiRecord{
+	double timestamp;              // monotonic seconds when the scan finished
+	uint8_t bssid[6];              // MAC address
+	int16_t rssi;                  // dBm
+	uint16_t channel;
+	char ssid[WIFI_SSID_LENGTH+1]; // null-terminated network name
+};
+
+#define SPECTRUM_BINS 325     // Fingerprinter::fpLength
+#define SPECTRUM_DB_STEP 0.5f // quantization step of SpectrumRecord levels
+
+/* one audio spectrum or fingerprint, in dB quantized to one byte per bin.
+ * Bin i is offset + level[i]*SPECTRUM_DB_STEP dB; see SpectrumLog.h. */
+struct SpectrumRecord{
+	double timestamp;              // monotonic seconds at the end of the audio it covers
+	float offset;                  // dB of level 0
+	uint8_t level[SPECTRUM_BINS];
+};
+
+
+class SensorLogWriter{
+public:
+	/**
+	 * Opens the log file for appending.  A new file gets a header.  An existing file is
+	 * only appended to if its header has the same record type and size, and is otherwise
+	 * left alone and the writer not opened; a partial record at its end is cut off.
+	 * Nothing is written to disk until flush() is called, normally by a SensorLogService.
+	 * @param recordSize is the size of every record which will be pushed.
+	 * @param ringBytes is the ring buffer capacity, rounded up to a power of two.
+	 * @param clockOffset is stored in the header; see SensorLogHeader.
+	 */
+	SensorLogWriter( const char* filename, SensorLogRecordType type, unsigned int recordSize,
+					 unsigned int ringBytes, double clockOffset );
+	/* As above, but the records are written to a stream, which must already have been
+	 * added, of a capture file.  The capture must outlive this writer. */
+	SensorLogWriter( CaptureWriter* capture, unsigned int streamId, unsigned int recordSize,
+					 unsigned int ringBytes );
+	/* writes remaining records and closes the file */
+	~SensorLogWriter();
+	/* true if the file was opened successfully and close() has not been called */
+	bool isOpen();
+	/* Copies one record into the ring.  Never blocks or allocates.  If the ring is full the record
+	 * is dropped and false is returned.  Must only be called from one thread at a time. */
+	bool push( const void* record );
+	/* number of bytes waiting in the ring */
+	unsigned long getPendingBytes();
+	/* Writes ring contents to disk.  Only whole flushBytes blocks are written unless all is true.
+	 * If a write fails, the file is cut back to its last whole record and the records which were
+	 * not written are counted as dropped, so that later records stay aligned.
+	 * Must only be called from one thread at a time (the service's I/O thread). */
+	void flush( bool all );
+	/* writes out everything that remains and closes the file.  No flush() may be in progress. */
+	void close();
+	/* number of records dropped because the ring was full or they could not be written */
+	unsigned long getDroppedCount();
+
+	static const unsigned int flushBytes; /* size of the normal block written to disk */
+
+	/* time of the last flush, in SensorLogService::now() seconds, maintained by the service */
+	double lastFlush;
+
+private:
+	/* allocates the ring; returns false on failure */
+	bool init( unsigned int ringBytes );
+	/* after a failed write, cuts the file back to whole records and drops the rest of the
+	 * records in ring bytes [tail,end), returning the new tail */
+	unsigned long dropFailedWrite( unsigned long end );
+
+	bool opened;
+	int fd; // or -1 if writing to a capture
+	CaptureWriter* capture; // or NULL if writing to fd
+	unsigned int streamId;
+	unsigned char* chunk; // capture chunk being assembled
+	unsigned int chunkBytes; // whole records in a capture chunk
+	unsigned int recordSize;
+	unsigned char* ring; // page-aligned
+	unsigned int ringSize; // power of two
+	/* Total bytes ever pushed and flushed.  Only the producer writes head and only
+	 * the flushing thread writes tail; the difference is the ring occupancy. */
+	volatile unsigned long head;
+	volatile unsigned long tail;
+	unsigned long dropped; // added to atomically, by either thread
+	long long fileBase; // file offset of ring byte 0, so that ring byte p is at fileBase + p
+	/* shared by every log; see Metrics.h */
+	MetricCounter* recordCount;
+	MetricCounter* byteCount;
+	MetricCounter* droppedCount;
+	MetricCounter* writeErrors;
+	MetricHistogram* flushTime;
+};
+
+
+class SensorLogService{
+public:
+	/* starts the I/O thread */
+	SensorLogService();
+	/* closes all logs */
+	~SensorLogService();
+	/**
+	 * Opens a log which will be flushed by this service's I/O thread.  The service owns it,
+	 * so the returned pointer is valid until the service is closed.
+	 * @return NULL if the file could not be opened.
+	 */
+	SensorLogWriter* openLog( const char* filename, SensorLogRecordType type, unsigned int recordSize,
+							  unsigned int ringBytes = (1<<20) );
+	/* As above, but adds a new stream to a capture file instead of opening a file.
+	 * Close the service before closing the capture. */
+	SensorLogWriter* openLog( CaptureWriter* capture, const char* name, SensorLogRecordType type,
+							  unsigned int recordSize, unsigned int ringBytes = (1<<20), bool compress = true );
+	/* stops the I/O thread and writes out and closes every log */
+	void close();
+
+	/* seconds on a monotonic clock with the same base as CoreMotion timestamps */
+	static double now();
+	/* seconds since the NSDate reference date (Jan 1 2001 GMT) */
+	static double wallClock();
+
+	static const double flushInterval; /* a partial block is written if data waits this long, in seconds */
+
+private:
+	static void* threadMain( void* service );
+
+	std::vector<SensorLogWriter*> logs;
+	pthread_mutex_t logsLock; // protects logs
+	volatile bool stopping;
+	bool threadRunning;
+	pthread_t thread;
+};
+
+
+class SensorLogReader{
+public:
+	SensorLogReader( const char* filename );
+	~SensorLogReader();
+	/* true if the file was opened and has a valid header */
+	bool isOpen();
+	const SensorLogHeader& getHeader();
+	/* Reads the next record into a buffer of getHeader().recordSize bytes.
+	 * Returns false at the end of the file. */
+	bool next( void* record );
+private:
+	FILE* file;
+	SensorLogHeader header;
+	bool valid;
+};
+
+#endif // SENSOR_LOG_H
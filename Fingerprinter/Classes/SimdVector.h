@@ -0,0 +1,474 @@
+/*
+ *  SimdVector.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * A minimal 4-lane float vector, so that portable kernels can be written once
+ * and compiled to NEON on the device, SSE on the desktop, or plain C elsewhere.
+ * Int4 is its 32-bit unsigned integer counterpart, for bit manipulation.
+ * Everything is inline; there is no .cpp file.
+ */
+
+#ifndef SIMD_VECTOR_H
+#define SIMD_VECTOR_H
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_VECTOR_NEON 1
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define SIMD_VECTOR_SSE 1
+#if defined(__SSE2__)
+#include <emmintrin.h> // integer vectors
+#define SIMD_VECTOR_SSE2 1
+#endif
+#if defined(__SSE4_1__)
+#include <smmintrin.h> // for blends
+#endif
+#endif
+
+#include <stdint.h>
+#include <string.h> // for memcpy
+
+struct Float4{
+#if SIMD_VECTOR_NEON
+	float32x4_t v;
+#elif SIMD_VECTOR_SSE
+	__m128 v;
+#else
+	float v[4];
+#endif
+};
+
+/* unaligned load of four consecutive floats */
+static inline Float4 f4_load( const float* p ){
+	Float4 r;
+#if SIMD_VECTOR_NEON
+	r.v = vld1q_f32( p );
+#elif SIMD_VECTOR_SSE
+	r.v = _mm_loadu_ps( p );
+#else
+	for( int i=0; i<4; i++ ) r.v[i] = p[i];
+#endif
+	return r;
+}
+
+/* unaligned store of four consecutive floats */
+static inline void f4_store( float* p, Float4 a ){
+#if SIMD_VECTOR_NEON
+	vst1q_f32( p, a.v );
+#elif SIMD_VECTOR_SSE
+	_mm_storeu_ps( p, a.v );
+#else
+	for( int i=0; i<4; i++ ) p[i] = a.v[i];
+#endif
+}
+
+/* all four lanes set to x */
+static inline Float4 f4_splat( float x ){
+	Float4 r;
+#if SIMD_VECTOR_NEON
+	r.v = vdupq_n_f32( x );
+#elif SIMD_VECTOR_SSE
+	r.v = _mm_set1_ps( x );
+#else
+	for( int i=0; i<4; i++ ) r.v[i] = x;
+#endif
+	return r;
+}
+
+static inline Float4 f4_zero(){
+	return f4_splat( 0.0f );
+}
+
+static inline Float4 f4_add( Float4 a, Float4 b ){
+#if SIMD_VECTOR_NEON
+	a.v = vaddq_f32( a.v, b.v );
+#elif SIMD_VECTOR_SSE
+	a.v = _mm_add_ps( a.v, b.v );
+#else
+	for( int i=0; i<4; i++ ) a.v[i] += b.v[i];
+#endif
+	return a;
+}
+
+static inline Float4 f4_sub( Float4 a, Float4 b ){
+#if SIMD_VECTOR_NEON
+	a.v = vsubq_f32( a.v, b.v );
+#elif SIMD_VECTOR_SSE
+	a.v = _mm_sub_ps( a.v, b.v );
+#else
+	for( int i=0; i<4; i++ ) a.v[i] -= b.v[i];
+#endif
+	return a;
+}
+
+static inline Float4 f4_mul( Float4 a, Float4 b ){
+#if SIMD_VECTOR_NEON
+	a.v = vmulq_f32( a.v, b.v );
+#elif SIMD_VECTOR_SSE
+	a.v = _mm_mul_ps( a.v, b.v );
+#else
+	for( int i=0; i<4; i++ ) a.v[i] *= b.v[i];
+#endif
+	return a;
+}
+
+/* acc + a*b */
+static inline Float4 f4_madd( Float4 acc, Float4 a, Float4 b ){
+#if SIMD_VECTOR_NEON
+	acc.v = vmlaq_f32( acc.v, a.v, b.v );
+	return acc;
+#else
+	return f4_add( acc, f4_mul( a, b ) );
+#endif
+}
+
+/* 1/a, to within a few ulp on NEON, which refines its estimate twice rather than dividing */
+static inline Float4 f4_recip( Float4 a ){
+#if SIMD_VECTOR_NEON
+	float32x4_t r = vrecpeq_f32( a.v );
+	r = vmulq_f32( r, vrecpsq_f32( a.v, r ) );
+	a.v = vmulq_f32( r, vrecpsq_f32( a.v, r ) );
+#elif SIMD_VECTOR_SSE
+	a.v = _mm_div_ps( _mm_set1_ps( 1.0f ), a.v );
+#else
+	for( int i=0; i<4; i++ ) a.v[i] = 1.0f / a.v[i];
+#endif
+	return a;
+}
+
+static inline Float4 f4_abs( Float4 a ){
+#if SIMD_VECTOR_NEON
+	a.v = vabsq_f32( a.v );
+#elif SIMD_VECTOR_SSE
+	a.v = _mm_andnot_ps( _mm_set1_ps( -0.0f ), a.v ); // clear sign bits
+#else
+	for( int i=0; i<4; i++ ) a.v[i] = ( a.v[i] < 0 )? -a.v[i] : a.v[i];
+#endif
+	return a;
+}
+
+static inline Float4 f4_min( Float4 a, Float4 b ){
+#if SIMD_VECTOR_NEON
+	a.v = vminq_f32( a.v, b.v );
+#elif SIMD_VECTOR_SSE
+	a.v = _mm_min_ps( a.v, b.v );
+#else
+	for( int i=0; i<4; i++ ) a.v[i] = ( b.v[i] < a.v[i] )? b.v[i] : a.v[i];
+#endif
+	return a;
+}
+
+static inline Float4 f4_max( Float4 a, Float4 b ){
+#if SIMD_VECTOR_NEON
+	a.v = vmaxq_f32( a.v, b.v );
+#elif SIMD_VECTOR_SSE
+	a.v = _mm_max_ps( a.v, b.v );
+#else
+	for( int i=0; i<4; i++ ) a.v[i] = ( b.v[i] > a.v[i] )? b.v[i] : a.v[i];
+#endif
+	return a;
+}
+
+/* mask of the lanes where a < b: all bits set where true, clear where false */
+static inline Float4 f4_lt( Float4 a, Float4 b ){
+#if SIMD_VECTOR_NEON
+	a.v = vreinterpretq_f32_u32( vcltq_f32( a.v, b.v ) );
+#elif SIMD_VECTOR_SSE
+	a.v = _mm_cmplt_ps( a.v, b.v );
+#else
+	for( int i=0; i<4; i++ ){
+		uint32_t bits = ( a.v[i] < b.v[i] )? 0xFFFFFFFFu : 0;
+		memcpy( &a.v[i], &bits, 4 );
+	}
+#endif
+	return a;
+}
+
+/* mask of the lanes where a == b, clear where either is NaN */
+static inline Float4 f4_eq( Float4 a, Float4 b ){
+#if SIMD_VECTOR_NEON
+	a.v = vreinterpretq_f32_u32( vceqq_f32( a.v, b.v ) );
+#elif SIMD_VECTOR_SSE
+	a.v = _mm_cmpeq_ps( a.v, b.v );
+#else
+	for( int i=0; i<4; i++ ){
+		uint32_t bits = ( a.v[i] == b.v[i] )? 0xFFFFFFFFu : 0;
+		memcpy( &a.v[i], &bits, 4 );
+	}
+#endif
+	return a;
+}
+
+/* a where mask (from a comparison) is set, otherwise b */
+static inline Float4 f4_select( Float4 mask, Float4 a, Float4 b ){
+#if SIMD_VECTOR_NEON
+	a.v = vbslq_f32( vreinterpretq_u32_f32( mask.v ), a.v, b.v );
+#elif SIMD_VECTOR_SSE && defined(__SSE4_1__)
+	a.v = _mm_blendv_ps( b.v, a.v, mask.v );
+#elif SIMD_VECTOR_SSE
+	a.v = _mm_or_ps( _mm_and_ps( mask.v, a.v ), _mm_andnot_ps( mask.v, b.v ) );
+#else
+	for( int i=0; i<4; i++ ){
+		uint32_t bits;
+		memcpy( &bits, &mask.v[i], 4 );
+		if( !bits ) a.v[i] = b.v[i];
+	}
+#endif
+	return a;
+}
+
+/* horizontal sum of the four lanes */
+static inline float f4_sum( Float4 a ){
+	float tmp[4];
+	f4_store( tmp, a );
+	return (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+}
+
+// -----------------------------------------------------------------------------
+// INTEGER VECTORS
+
+struct Int4{
+#if SIMD_VECTOR_NEON
+	uint32x4_t v;
+#elif SIMD_VECTOR_SSE2
+	__m128i v;
+#else
+	uint32_t v[4];
+#endif
+};
+
+/* unaligned load of four consecutive words */
+static inline Int4 i4_load( const uint32_t* p ){
+	Int4 r;
+#if SIMD_VECTOR_NEON
+	r.v = vld1q_u32( p );
+#elif SIMD_VECTOR_SSE2
+	r.v = _mm_loadu_si128( (const __m128i*)p );
+#else
+	for( int i=0; i<4; i++ ) r.v[i] = p[i];
+#endif
+	return r;
+}
+
+/* unaligned store of four consecutive words */
+static inline void i4_store( uint32_t* p, Int4 a ){
+#if SIMD_VECTOR_NEON
+	vst1q_u32( p, a.v );
+#elif SIMD_VECTOR_SSE2
+	_mm_storeu_si128( (__m128i*)p, a.v );
+#else
+	for( int i=0; i<4; i++ ) p[i] = a.v[i];
+#endif
+}
+
+/* all four lanes set to x */
+static inline Int4 i4_splat( uint32_t x ){
+	Int4 r;
+#if SIMD_VECTOR_NEON
+	r.v = vdupq_n_u32( x );
+#elif SIMD_VECTOR_SSE2
+	r.v = _mm_set1_epi32( (int)x );
+#else
+	for( int i=0; i<4; i++ ) r.v[i] = x;
+#endif
+	return r;
+}
+
+/* wrapping addition */
+static inline Int4 i4_add( Int4 a, Int4 b ){
+#if SIMD_VECTOR_NEON
+	a.v = vaddq_u32( a.v, b.v );
+#elif SIMD_VECTOR_SSE2
+	a.v = _mm_add_epi32( a.v, b.v );
+#else
+	for( int i=0; i<4; i++ ) a.v[i] += b.v[i];
+#endif
+	return a;
+}
+
+/* wrapping subtraction */
+static inline Int4 i4_sub( Int4 a, Int4 b ){
+#if SIMD_VECTOR_NEON
+	a.v = vsubq_u32( a.v, b.v );
+#elif SIMD_VECTOR_SSE2
+	a.v = _mm_sub_epi32( a.v, b.v );
+#else
+	for( int i=0; i<4; i++ ) a.v[i] -= b.v[i];
+#endif
+	return a;
+}
+
+static inline Int4 i4_and( Int4 a, Int4 b ){
+#if SIMD_VECTOR_NEON
+	a.v = vandq_u32( a.v, b.v );
+#elif SIMD_VECTOR_SSE2
+	a.v = _mm_and_si128( a.v, b.v );
+#else
+	for( int i=0; i<4; i++ ) a.v[i] &= b.v[i];
+#endif
+	return a;
+}
+
+static inline Int4 i4_or( Int4 a, Int4 b ){
+#if SIMD_VECTOR_NEON
+	a.v = vorrq_u32( a.v, b.v );
+#elif SIMD_VECTOR_SSE2
+	a.v = _mm_or_si128( a.v, b.v );
+#else
+	for( int i=0; i<4; i++ ) a.v[i] |= b.v[i];
+#endif
+	return a;
+}
+
+static inline Int4 i4_xor( Int4 a, Int4 b ){
+#if SIMD_VECTOR_NEON
+	a.v = veorq_u32( a.v, b.v );
+#elif SIMD_VECTOR_SSE2
+	a.v = _mm_xor_si128( a.v, b.v );
+#else
+	for( int i=0; i<4; i++ ) a.v[i] ^= b.v[i];
+#endif
+	return a;
+}
+
+/* each lane shifted left by n < 32 bits */
+static inline Int4 i4_shl( Int4 a, unsigned int n ){
+#if SIMD_VECTOR_NEON
+	a.v = vshlq_u32( a.v, vdupq_n_s32( (int)n ) );
+#elif SIMD_VECTOR_SSE2
+	a.v = _mm_sll_epi32( a.v, _mm_cvtsi32_si128( (int)n ) );
+#else
+	for( int i=0; i<4; i++ ) a.v[i] <<= n;
+#endif
+	return a;
+}
+
+/* each lane shifted right by n < 32 bits, filling with zeros */
+static inline Int4 i4_shr( Int4 a, unsigned int n ){
+#if SIMD_VECTOR_NEON
+	a.v = vshlq_u32( a.v, vdupq_n_s32( -(int)n ) );
+#elif SIMD_VECTOR_SSE2
+	a.v = _mm_srl_epi32( a.v, _mm_cvtsi32_si128( (int)n ) );
+#else
+	for( int i=0; i<4; i++ ) a.v[i] >>= n;
+#endif
+	return a;
+}
+
+/* lanes moved up by one, (0, a0, a1, a2) */
+static inline Int4 i4_lanes_up1( Int4 a ){
+#if SIMD_VECTOR_NEON
+	a.v = vextq_u32( vdupq_n_u32( 0 ), a.v, 3 );
+#elif SIMD_VECTOR_SSE2
+	a.v = _mm_slli_si128( a.v, 4 );
+#else
+	a.v[3] = a.v[2]; a.v[2] = a.v[1]; a.v[1] = a.v[0]; a.v[0] = 0;
+#endif
+	return a;
+}
+
+/* lanes moved up by two, (0, 0, a0, a1) */
+static inline Int4 i4_lanes_up2( Int4 a ){
+#if SIMD_VECTOR_NEON
+	a.v = vextq_u32( vdupq_n_u32( 0 ), a.v, 2 );
+#elif SIMD_VECTOR_SSE2
+	a.v = _mm_slli_si128( a.v, 8 );
+#else
+	a.v[3] = a.v[1]; a.v[2] = a.v[0]; a.v[1] = 0; a.v[0] = 0;
+#endif
+	return a;
+}
+
+/* all four lanes set to the last lane of a */
+static inline Int4 i4_splat_last( Int4 a ){
+#if SIMD_VECTOR_NEON
+	a.v = vdupq_n_u32( vgetq_lane_u32( a.v, 3 ) );
+#elif SIMD_VECTOR_SSE2
+	a.v = _mm_shuffle_epi32( a.v, 0xFF );
+#else
+	for( int i=0; i<3; i++ ) a.v[i] = a.v[3];
+#endif
+	return a;
+}
+
+/* each lane converted from a signed integer to a float */
+static inline Float4 i4_to_f4( Int4 a ){
+	Float4 r;
+#if SIMD_VECTOR_NEON
+	r.v = vcvtq_f32_s32( vreinterpretq_s32_u32( a.v ) );
+#elif SIMD_VECTOR_SSE2
+	r.v = _mm_cvtepi32_ps( a.v );
+#elif SIMD_VECTOR_SSE
+	for( int i=0; i<4; i++ ) ((float*)&r.v)[i] = (float)(int32_t)a.v[i];
+#else
+	for( int i=0; i<4; i++ ) r.v[i] = (float)(int32_t)a.v[i];
+#endif
+	return r;
+}
+
+/* each lane converted from a float to a signed integer, rounding towards zero.  The
+ * floats must be within the range of int32_t */
+static inline Int4 f4_to_i4( Float4 a ){
+	Int4 r;
+#if SIMD_VECTOR_NEON
+	r.v = vreinterpretq_u32_s32( vcvtq_s32_f32( a.v ) );
+#elif SIMD_VECTOR_SSE2
+	r.v = _mm_cvttps_epi32( a.v );
+#elif SIMD_VECTOR_SSE
+	for( int i=0; i<4; i++ ) r.v[i] = (uint32_t)(int32_t)((const float*)&a.v)[i];
+#else
+	for( int i=0; i<4; i++ ) r.v[i] = (uint32_t)(int32_t)a.v[i];
+#endif
+	return r;
+}
+
+/* the bits of each float lane, unchanged, as an integer */
+static inline Int4 f4_as_i4( Float4 a ){
+	Int4 r;
+#if SIMD_VECTOR_NEON
+	r.v = vreinterpretq_u32_f32( a.v );
+#elif SIMD_VECTOR_SSE2
+	r.v = _mm_castps_si128( a.v );
+#else
+	memcpy( &r.v, &a.v, 16 );
+#endif
+	return r;
+}
+
+/* the bits of each integer lane, unchanged, as a float */
+static inline Float4 i4_as_f4( Int4 a ){
+	Float4 r;
+#if SIMD_VECTOR_NEON
+	r.v = vreinterpretq_f32_u32( a.v );
+#elif SIMD_VECTOR_SSE2
+	r.v = _mm_castsi128_ps( a.v );
+#else
+	memcpy( &r.v, &a.v, 16 );
+#endif
+	return r;
+}
+
+/* transposes the 4x4 matrix whose rows are a, b, c and d */
+static inline void f4_transpose( Float4& a, Float4& b, Float4& c, Float4& d ){
+#if SIMD_VECTOR_NEON
+	float32x4x2_t ab = vtrnq_f32( a.v, b.v );
+	float32x4x2_t cd = vtrnq_f32( c.v, d.v );
+	a.v = vcombine_f32( vget_low_f32( ab.val[0] ), vget_low_f32( cd.val[0] ) );
+	b.v = vcombine_f32( vget_low_f32( ab.val[1] ), vget_low_f32( cd.val[1] ) );
+	c.v = vcombine_f32( vget_high_f32( ab.val[0] ), vget_high_f32( cd.val[0] ) );
+	d.v = vcombine_f32( vget_high_f32( ab.val[1] ), vget_high_f32( cd.val[1] ) );
+#elif SIMD_VECTOR_SSE
+	_MM_TRANSPOSE4_PS( a.v, b.v, c.v, d.v );
+#else
+	float m[4][4];
+	f4_store( m[0], a ); f4_store( m[1], b ); f4_store( m[2], c ); f4_store( m[3], d );
+	for( int i=0; i<4; i++ ){
+		a.v[i] = m[i][0]; b.v[i] = m[i][1]; c.v[i] = m[i][2]; d.v[i] = m[i][3];
+	}
+#endif
+}
+
+#endif // SIMD_VECTOR_H
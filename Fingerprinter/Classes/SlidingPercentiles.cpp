@@ -0,0 +1,201 @@
+/*
+ *  SlidingPercentiles.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "SlidingPercentiles.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm> // for sort
+
+#define LANES 8 // series updated together, as two Float4s
+#define SELECT_BLOCK 16 // groups selected together in lazy mode, 512 bytes of each row
+#define ALIGNMENT 64 // a cache line, so that objects used by different threads never share one
+
+/* allocates memory which starts and ends on cache line boundaries; free it with free() */
+static void* allocAligned( size_t bytes ){
+	bytes = ( bytes + ALIGNMENT-1 ) / ALIGNMENT * ALIGNMENT;
+	void* p = NULL;
+	if( posix_memalign( &p, ALIGNMENT, bytes ) ) p = NULL;
+	return p;
+}
+
+SlidingPercentiles::SlidingPercentiles( unsigned int mySeries, unsigned int mySize, float percentile, float initVal,
+										bool isLazy ) :
+numSeries(mySeries), size(mySize), tail(0), scratch(NULL), lazy(isLazy), cacheValid(false), cache(NULL), best(NULL){
+	stride = ( numSeries + LANES-1 ) / LANES * LANES;
+	// the value SlidingWindow returns is the largest of its ceil(percentile*size) smallest values
+	unsigned int below = ceil( percentile*size );
+	rank = ( below > 0 )? below-1 : 0;
+	history = (float*)allocAligned( sizeof(float)*size*stride );
+	for( unsigned int i=0; i<size*stride; ++i ){
+		history[i] = initVal;
+	}
+	if( lazy ){
+		sorted = NULL;
+		cache = (float*)allocAligned( sizeof(float)*stride );
+		// keep whichever side of the percentile has fewer values
+		selectLargest = ( rank+1 > size-rank );
+		selectCount = selectLargest? size-rank : rank+1;
+		best = (Float4*)allocAligned( sizeof(Float4)*2*selectCount*SELECT_BLOCK );
+		return;
+	}
+	sorted = (float*)allocAligned( sizeof(float)*(size+1)*stride );
+	scratch = (float*)allocAligned( sizeof(float)*size );
+	for( unsigned int b=0; b<stride; b+=LANES ){
+		float* group = sorted + b*(size+1);
+		for( unsigned int i=0; i<size*LANES; ++i ) group[i] = initVal;
+		for( unsigned int i=size*LANES; i<(size+1)*LANES; ++i ) group[i] = INFINITY;
+	}
+}
+
+SlidingPercentiles::~SlidingPercentiles(){
+	free( sorted );
+	free( history );
+	free( cache );
+	free( best );
+	free( scratch );
+}
+
+/* Removes oldVal from and inserts newVal into one sorted column of each lane.
+ * With s the sorted column and a the column after removing oldVal, which is
+ *   a[i] = s[i] < oldVal ? s[i] : s[i+1],
+ * the column after inserting newVal is
+ *   r[i] = max( a[i-1], min( a[i], newVal ) ),
+ * taking a[-1] as -infinity.  The +infinity row below the column makes the
+ * last a[i] +infinity.  r[i] only depends on s[i] and s[i+1], so it can
+ * overwrite s[i] in a single pass down the rows. */
+static inline void replaceSorted( float* column, unsigned int rows,
+								  Float4 oldLo, Float4 oldHi, Float4 newLo, Float4 newHi ){
+	Float4 prevLo = f4_splat( -INFINITY ), prevHi = prevLo;
+	Float4 sLo = f4_load( column ), sHi = f4_load( column+4 );
+	for( unsigned int i=0; i<rows; ++i ){
+		float* row = column + i*LANES;
+		Float4 nextLo = f4_load( row+LANES ), nextHi = f4_load( row+LANES+4 );
+		Float4 aLo = f4_select( f4_lt( sLo, oldLo ), sLo, nextLo );
+		Float4 aHi = f4_select( f4_lt( sHi, oldHi ), sHi, nextHi );
+		f4_store( row, f4_max( prevLo, f4_min( aLo, newLo ) ) );
+		f4_store( row+4, f4_max( prevHi, f4_min( aHi, newHi ) ) );
+		prevLo = aLo;
+		prevHi = aHi;
+		sLo = nextLo;
+		sHi = nextHi;
+	}
+}
+
+void SlidingPercentiles::update( const float* newVals ){
+	float* oldest = history + tail*stride;
+	if( lazy ){
+		memcpy( oldest, newVals, sizeof(float)*numSeries );
+		tail = ( tail+1 ) % size;
+		cacheValid = false;
+		return;
+	}
+	unsigned int full = numSeries / LANES * LANES;
+	for( unsigned int b=0; b<full; b+=LANES ){
+		Float4 oldLo = f4_load( oldest+b ), oldHi = f4_load( oldest+b+4 );
+		Float4 newLo = f4_load( newVals+b ), newHi = f4_load( newVals+b+4 );
+		replaceSorted( sorted + b*(size+1), size, oldLo, oldHi, newLo, newHi );
+		f4_store( oldest+b, newLo );
+		f4_store( oldest+b+4, newHi );
+	}
+	if( full < numSeries ){
+		// the last, partial group; its unused lanes keep their initial values
+		float padded[LANES];
+		memcpy( padded, oldest+full, sizeof(padded) );
+		memcpy( padded, newVals+full, sizeof(float)*(numSeries-full) );
+		Float4 oldLo = f4_load( oldest+full ), oldHi = f4_load( oldest+full+4 );
+		Float4 newLo = f4_load( padded ), newHi = f4_load( padded+4 );
+		replaceSorted( sorted + full*(size+1), size, oldLo, oldHi, newLo, newHi );
+		f4_store( oldest+full, newLo );
+		f4_store( oldest+full+4, newHi );
+	}
+	tail = ( tail+1 ) % size;
+}
+
+/* Streams the values of the windows of a block of adjacent groups through a sorted
+ * list per lane, so that each lane's list[i] ends up as its i-th smallest value (or
+ * largest, if largest is true).  Each value is inserted by swapping it down the list
+ * with min and max.  The groups of a block are interleaved, so that each row of the
+ * window is read in order, a few cache lines at a time. */
+template<bool largest>
+static inline void selectBlock( const float* column, unsigned int groups, unsigned int rows,
+								unsigned int stride, Float4* best, unsigned int count ){
+	Float4 init = f4_splat( largest? -INFINITY : INFINITY );
+	for( unsigned int j=0; j<2*count*groups; ++j ) best[j] = init;
+	for( unsigned int i=0; i<rows; ++i ){
+		for( unsigned int g=0; g<groups; ++g ){
+			const float* vals = column + i*stride + g*LANES;
+			Float4 vLo = f4_load( vals ), vHi = f4_load( vals+4 );
+			Float4* list = best + 2*count*g;
+			for( unsigned int j=0; j<count; ++j ){
+				Float4 bLo = list[2*j], bHi = list[2*j+1];
+				if( largest ){
+					list[2*j] = f4_max( bLo, vLo );
+					list[2*j+1] = f4_max( bHi, vHi );
+					vLo = f4_min( bLo, vLo );
+					vHi = f4_min( bHi, vHi );
+				}else{
+					list[2*j] = f4_min( bLo, vLo );
+					list[2*j+1] = f4_min( bHi, vHi );
+					vLo = f4_max( bLo, vLo );
+					vHi = f4_max( bHi, vHi );
+				}
+			}
+		}
+	}
+}
+
+void SlidingPercentiles::select(){
+	for( unsigned int b=0; b<stride; b+=SELECT_BLOCK*LANES ){
+		unsigned int groups = ( stride-b ) / LANES;
+		if( groups > SELECT_BLOCK ) groups = SELECT_BLOCK;
+		if( selectLargest ) selectBlock<true>( history+b, groups, size, stride, best, selectCount );
+		else selectBlock<false>( history+b, groups, size, stride, best, selectCount );
+		for( unsigned int g=0; g<groups; ++g ){
+			const Float4* last = best + 2*selectCount*g + 2*(selectCount-1);
+			f4_store( cache + b + g*LANES, last[0] );
+			f4_store( cache + b + g*LANES + 4, last[1] );
+		}
+	}
+	cacheValid = true;
+}
+
+void SlidingPercentiles::getVals( float* outBuf ){
+	if( lazy ){
+		if( !cacheValid ) select();
+		memcpy( outBuf, cache, sizeof(float)*numSeries );
+		return;
+	}
+	for( unsigned int b=0; b<numSeries; b+=LANES ){
+		const float* row = sorted + b*(size+1) + rank*LANES;
+		memcpy( outBuf+b, row, sizeof(float)*( ( numSeries-b < LANES )? numSeries-b : LANES ) );
+	}
+}
+
+void SlidingPercentiles::forget( unsigned int keep ){
+	if( keep == 0 || keep >= size ) return;
+	// the newest keep rows end just before tail; copy them, in order, over the older rows
+	unsigned int first = ( tail + size - keep ) % size;
+	for( unsigned int i=0; i<size-keep; ++i ){
+		memcpy( history + ( tail+i ) % size * stride, history + ( first + i%keep ) % size * stride,
+				sizeof(float)*stride );
+	}
+	if( lazy ){
+		cacheValid = false;
+		return;
+	}
+	// sort each lane's window again, padding lanes included, which all hold initVal
+	for( unsigned int b=0; b<stride; b+=LANES ){
+		float* group = sorted + b*(size+1);
+		for( unsigned int lane=0; lane<LANES; ++lane ){
+			for( unsigned int i=0; i<size; ++i ) scratch[i] = history[i*stride + b + lane];
+			std::sort( scratch, scratch+size );
+			for( unsigned int i=0; i<size; ++i ) group[i*LANES + lane] = scratch[i];
+		}
+	}
+}
@@ -0,0 +1,85 @@
+/*
+ *  SlidingPercentiles.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * A sliding-window percentile for many series at once, eg. the frequency bins
+ * of a spectrogram, giving the same values as one SlidingWindow per series.
+ * Rather than two heaps per series, whose updates are all data-dependent
+ * branches, each series keeps its window as a sorted array, and the arrays of
+ * eight series at a time are stored transposed: row i of a group holds the
+ * i-th smallest value of each of its eight series.  Each SIMD lane then owns
+ * one series, and an update is one branch-free pass down a group's rows in
+ * which every lane removes its oldest value and inserts its new one with
+ * compares, selects, min and max.  The percentile is then one row per group.
+ *
+ * An update costs O(size) per series rather than O(log size), but it never
+ * mispredicts a branch and reads memory in order.  For the spectrogram's
+ * windows of 100 it updates 325 bins about 1.3x faster than the heaps on an
+ * SSE2 desktop; selects are a single instruction with SSE4.1 or NEON.
+ *
+ * In lazy mode there are no sorted arrays: an update only writes the new values
+ * into the window, and getVals() selects each percentile from the window's
+ * values when it is called, caching the result until the next update.  The
+ * selection streams each group's window through a small sorted list per lane,
+ * again with min and max only.  A selection costs a few eager updates (about
+ * four for the spectrogram), so lazy mode is cheaper when the values are read
+ * much less often than written, as when they are read once per database query;
+ * see summarybench.cpp for the crossover.
+ */
+
+#ifndef SLIDING_PERCENTILES_H
+#define SLIDING_PERCENTILES_H
+
+#include "SimdVector.h"
+
+class SlidingPercentiles{
+public:
+	/**
+	 * @param numSeries is the number of series, eg. frequency bins.
+	 * @param size is the number of values in each window.
+	 * @param percentile and initVal are as for SlidingWindow.
+	 * @param lazy selects lazy mode, in which the percentiles are only computed when read.
+	 */
+	SlidingPercentiles( unsigned int numSeries, unsigned int size, float percentile, float initVal,
+						bool lazy = false );
+	~SlidingPercentiles();
+	/* replaces the oldest value of each series with newVals[i] */
+	void update( const float* newVals );
+	/* fills outBuf with the current percentile value of each of the numSeries series */
+	void getVals( float* outBuf );
+	/* replaces all but the newest keep values of each window with repeats of those, oldest
+	 * first, so that the percentiles only describe the recent values; eg. after a change of
+	 * room.  Windows refill with new values as usual.  This sorts every window again, so it
+	 * is much slower than an update in eager mode. */
+	void forget( unsigned int keep );
+
+private:
+	unsigned int numSeries;
+	unsigned int stride; // numSeries rounded up to a whole number of eight-lane groups
+	unsigned int size;
+	unsigned int rank;   // row of the percentile value
+	/* for each group of eight series, size+1 rows of eight values: row i holds the i-th
+	 * smallest value of each series' window, and the last row is +infinity, as the
+	 * end marker for insertion */
+	float* sorted;
+	/* size rows of stride values: the windows' values in arrival order */
+	float* history;
+	/* row of history holding the oldest values */
+	unsigned int tail;
+	/* size values, for sorting a window in forget(); eager mode only */
+	float* scratch;
+
+	// lazy mode
+	bool lazy;
+	bool cacheValid; // false if there has been an update since cache was filled
+	float* cache;    // stride values, the percentiles as of the last getVals()
+	Float4* best;    // selection scratch space, lists of selectCount values for each lane
+	unsigned int selectCount; // length of each lane's list: the values below or above the percentile
+	bool selectLargest;       // true if the lists hold the largest values rather than the smallest
+	/* computes every percentile from history into cache */
+	void select();
+};
+
+#endif // SLIDING_PERCENTILES_H
@@ -51,15 +51,6 @@ float SlidingWindow::getVal(){
 
 void SlidingWindow::update( float newVal ){
 	// determine which heaps will be manipulated
-	Heap* destination; // where the new value will be going
-	unsigned int* dest_spaceMap;
-	if( newVal > maxHeap->rootVal() ){
-		destination = minHeap;
-		dest_spaceMap = minKeySpaceToGlobal;
-	}else{
-		destination = maxHeap;
-		dest_spaceMap = maxKeySpaceToGlobal;
-	}
 	Heap* source; // where old value will be removed from
 	unsigned int* src_spaceMap;
 	if( isInMaxHeap[indexTail] ){
@@ -69,6 +60,24 @@ void SlidingWindow::update( float newVal ){
 		source = minHeap;
 		src_spaceMap = minKeySpaceToGlobal;
 	}
+	// The new value belongs in the min heap if it is above the max heap's values once the
+	// old value is gone.  If the old value leaves the max heap, its root may be the old value
+	// itself, so compare with the smallest value which could move into it instead.
+	bool aboveMaxHeap;
+	if( source == maxHeap ){
+		aboveMaxHeap = ( minHeapSize > 0 && newVal > minHeap->rootVal() );
+	}else{
+		aboveMaxHeap = ( newVal > maxHeap->rootVal() );
+	}
+	Heap* destination; // where the new value will be going
+	unsigned int* dest_spaceMap;
+	if( aboveMaxHeap ){
+		destination = minHeap;
+		dest_spaceMap = minKeySpaceToGlobal;
+	}else{
+		destination = maxHeap;
+		dest_spaceMap = maxKeySpaceToGlobal;
+	}
 	
 	// in the simple case, we are removing from and adding to the same heap 
 	if( source == destination ){
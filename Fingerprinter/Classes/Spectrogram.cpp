@@ -8,49 +8,50 @@
  */
 
 #include "Spectrogram.h"
+#include "SensorLog.h"
+#include "SpectrumLog.h"
 #include <algorithm> // for nth_element
 #include <vector>
-#include <time.h>
+#include <stdio.h>
+#include <unistd.h> // for usleep
 using std::vector;
 
 #define PERCENTILE (0.05)
 #define THREAD_SAFE false
+#define LOGGER_WAIT_US 1000 // how often disableLogging() checks whether update() is done with the logger
 
-Spectrogram::Spectrogram(unsigned int freq_bins, unsigned int time_bins): 
+Spectrogram::Spectrogram(unsigned int freq_bins, unsigned int time_bins, bool lazySummary, unsigned int numThreads): 
 freqBins(freq_bins), timeBins(time_bins){
-	this->enableLogging = false;
+	this->logService = NULL;
+	this->logger = NULL;
+	this->loggerUsers = 0;
 
 	// allocate data sliding windows	
-	slidingWindows = new SlidingWindow*[freq_bins];
-	for( unsigned int i=0; i<freq_bins; i++ ){
-		slidingWindows[i] = new SlidingWindow( time_bins, PERCENTILE, 0.0f );
-	}
+	percentiles = new ParallelPercentiles( freq_bins, time_bins, PERCENTILE, 0.0f, lazySummary, numThreads );
+
+	MetricsRegistry* metrics = MetricsRegistry::shared();
+	updateCount = metrics->counter( "spectrogram_updates_total", "Spectra added to spectrograms" );
+	forgetCount = metrics->counter( "spectrogram_forgets_total", "Times a spectrogram history was cut short" );
+	summaryTime = metrics->histogram( "spectrogram_summary_us", "Microseconds to summarize a spectrogram" );
 }
 
 Spectrogram::~Spectrogram(){
-	for( unsigned int i=0; i<freqBins; i++ ){
-		delete slidingWindows[i];
-	}
-	delete[] slidingWindows;
+	delete percentiles;
 	disableLogging(); // to close log file
 }
 
-void Spectrogram::update(float* s){
+void Spectrogram::update(const float* s){
 	if(THREAD_SAFE) pthread_mutex_lock( &lock );
 	// copy into sliding windows
-	for( unsigned int i=0; i<this->freqBins; i++ ){
-		slidingWindows[i]->update( s[i] );
-	}
+	percentiles->update( s );
+	updateCount->add();
 	
-	// log value, if required
-	if( enableLogging ){
-		time_t currentTime;
-		time( &currentTime );
-		logFile << currentTime << '\t';
-		for( unsigned int i=0; i<this->freqBins; i++ ){
-			logFile << s[i] << '\t';
-		}
-		logFile << '\n';
+	// log value, if required.  This only copies it into the log's ring.
+	if( logger ){
+		__sync_fetch_and_add( &loggerUsers, 1 ); // before reading logger again, see disableLogging()
+		SpectrumLogger* l = logger;
+		if( l ) l->addColumn( s, NULL, SensorLogService::now() );
+		__sync_fetch_and_sub( &loggerUsers, 1 );
 	}
 	
 	if(THREAD_SAFE) pthread_mutex_unlock( &lock );
@@ -59,25 +60,43 @@ void Spectrogram::update(float* s){
 void Spectrogram::getSummary(float* outBuf){
 	// just retrieve the 5th percentile values from the sliding windows
 	if(THREAD_SAFE) pthread_mutex_lock( &lock );
-    // iterate through frequency bins
-	for( unsigned int i=0; i<this->freqBins; i++ ){
-		outBuf[i] = slidingWindows[i]->getVal();
-	}
+	MetricTimer timer( summaryTime );
+	percentiles->getVals( outBuf );
+	if(THREAD_SAFE) pthread_mutex_unlock( &lock );
+}
+
+void Spectrogram::forget(unsigned int keepTimeBins){
+	if(THREAD_SAFE) pthread_mutex_lock( &lock );
+	percentiles->forget( keepTimeBins );
+	forgetCount->add();
 	if(THREAD_SAFE) pthread_mutex_unlock( &lock );
 }
 
 void Spectrogram::enableLoggingToFilename( const char* logFilename ){
-	if( !enableLogging ){
-		logFile.open( logFilename );
-		if( !logFile.fail() ){
-			enableLogging = true;
-		}
+	if( logger ) return;
+	if( freqBins != SPECTRUM_BINS ){
+		fprintf( stderr, "Error: spectrum records hold %u bins, not %u\n", SPECTRUM_BINS, freqBins );
+		return;
 	}
+	logService = new SensorLogService();
+	SensorLogWriter* log = logService->openLog( logFilename, SensorLogSpectrum, sizeof(SpectrumRecord) );
+	if( !log ){
+		delete logService;
+		logService = NULL;
+		return;
+	}
+	// every spectrum is stored, none averaged
+	logger = new SpectrumLogger( log, NULL, 1, 1 );
 }
 
 void Spectrogram::disableLogging(){
-	if( enableLogging ){
-		logFile.close();
-		enableLogging = false;
-	}
-}
\ No newline at end of file
+	SpectrumLogger* l = logger;
+	if( !l ) return;
+	logger = NULL;
+	// wait for an update() which may have read logger before it was cleared
+	__sync_synchronize();
+	while( loggerUsers ) usleep( LOGGER_WAIT_US );
+	delete l;
+	delete logService; // writes out the remaining spectra and closes the file
+	logService = NULL;
+}
@@ -7,29 +7,43 @@
  *
  */
 
-#import "SlidingWindow.h"
+#import "ParallelPercentiles.h"
+#include "Metrics.h"
 #include <pthread.h> // for mutex
 
-#include <iostream> // for ofstream
-#include <fstream>
+class SensorLogService;
+class SensorLogWriter;
+class SpectrumLogger;
 
 // Sliding window spectrogram, with our new summary vector function
 class Spectrogram{
 public:
-	/* constructor */
-	Spectrogram(unsigned int freq_bins, unsigned int time_bins);
+	/* constructor.  With lazySummary, update() only stores the spectrum and the summary
+	 * is computed by getSummary().  That is opt-in for callers who read the summary far
+	 * less often than they update (summarybench prints the crossover, a few reads per
+	 * second at 10 columns/s); the Fingerprinter, whose plot reads it for every column,
+	 * keeps the default.  See SlidingPercentiles.  numThreads > 1 (or 0, for one per processor)
+	 * shares the work on each spectrum among threads when freq_bins is in the
+	 * thousands; see ParallelPercentiles. */
+	Spectrogram(unsigned int freq_bins, unsigned int time_bins, bool lazySummary=false, unsigned int numThreads=1);
 	/* copies a new spectrum into the spectrogram and removes the oldest spectrum.  
 	 * float array parameter must be of length freqBins */
-	void update(float* s);
+	void update(const float* s);
 	/* fills the passed buffer with a spectral summary vector of length freqBins.
 	 * Spectral summary is the 5th percentile value (over time) for each frequency bin. */
 	void getSummary(float* outBuf);
+	/* keeps only the newest keepTimeBins spectra, repeated to fill the history, so that the
+	 * summary describes them alone; for a change of room.  See SlidingPercentiles::forget(). */
+	void forget(unsigned int keepTimeBins);
 	/* destructor */
 	~Spectrogram();
 	
 	/* Enable spectrogram logging.  Every time a spectrum is added to the sliding
-	 * window spectrogram it is also time-stamped and appended as a new line in 
-	 * the specified file. */
+	 * window spectrogram it is also time-stamped and appended to the specified
+	 * file, as a SensorLogSpectrum log (see SensorLog.h; read it with sensorlog2txt).
+	 * update() only copies the spectrum into a ring which the log's own thread
+	 * writes out, so logging may be left on in the audio callback.  Spectra must
+	 * have SPECTRUM_BINS bins.  Call these from one thread at a time. */
 	void enableLoggingToFilename( const char* logFilename );
 	void disableLogging();
 	
@@ -38,11 +52,17 @@ public:
 	unsigned int timeBins;
 	
 private:
-	/* the data is sliding windows, one for each frequency bin */
-	SlidingWindow** slidingWindows;	
+	/* the data is a sliding window for each frequency bin */
+	ParallelPercentiles* percentiles;
 	/* lock to prevent retrieval of data while updating */
 	pthread_mutex_t lock;
+	/* shared by every spectrogram; see Metrics.h */
+	MetricCounter*		updateCount;
+	MetricCounter*		forgetCount;
+	MetricHistogram*	summaryTime;
 	
-	bool				enableLogging;
-	std::ofstream			logFile;
+	/* the log, which update() passes spectra to while logger is set */
+	SensorLogService*		logService;
+	SpectrumLogger* volatile	logger;
+	volatile int			loggerUsers; // update() calls using logger, so that it is not freed under them
 };
\ No newline at end of file
@@ -0,0 +1,218 @@
+/*
+ *  SpectrumAnalyzer.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "SpectrumAnalyzer.h"
+#include "FastMath.h"
+#include "RealtimeCheck.h"
+#include <math.h>
+#include <string.h>
+
+using std::vector;
+
+SpectrumAnalyzer::SpectrumAnalyzer() :
+changeDetector( ANALYZER_FP_LENGTH ), hamm( ANALYZER_SPEC_RES ), cosTable( ANALYZER_SPEC_RES/2 ), sinTable( ANALYZER_SPEC_RES/2 ),
+bitReverse( ANALYZER_SPEC_RES ), re( ANALYZER_SPEC_RES ), im( ANALYZER_SPEC_RES ),
+acc( ANALYZER_FP_LENGTH ), fixedPoint( FINGERPRINTER_FIXED_POINT ),
+fixedSpectrum( ANALYZER_SPEC_RES, ANALYZER_FP_LENGTH ){
+	this->spectrogram = NULL;
+	this->publisher = NULL;
+	this->callback = NULL;
+	this->callbackContext = NULL;
+	this->environmentCallback = NULL;
+	this->environmentContext = NULL;
+	changeDetector.setEventCallback( environmentEvent, this );
+	MetricsRegistry* metrics = MetricsRegistry::shared();
+	columnCount = metrics->counter( "fingerprinter_columns_total", "Spectrogram columns computed from the audio" );
+	fingerprintCount = metrics->counter( "fingerprinter_fingerprints_total", "Fingerprints read from the spectrogram" );
+
+	const unsigned int n = ANALYZER_SPEC_RES;
+	for( unsigned int i=0; i<n; ++i ){
+		hamm[i] = 0.54 - 0.46 * cos( 2*M_PI*i / n );
+	}
+	for( unsigned int k=0; k<n/2; ++k ){
+		cosTable[k] = cos( 2*M_PI*k / n );
+		sinTable[k] = -sin( 2*M_PI*k / n );
+	}
+	unsigned int bits = 0;
+	while( (1u<<bits) < n ) ++bits;
+	for( unsigned int i=0; i<n; ++i ){
+		unsigned int r = 0;
+		for( unsigned int b=0; b<bits; ++b ){
+			if( i & (1u<<b) ) r |= 1u << (bits-1-b);
+		}
+		bitReverse[i] = r;
+	}
+	reset();
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer(){
+	delete publisher;
+	delete spectrogram;
+}
+
+void SpectrumAnalyzer::setColumnCallback( SpectrumColumnCallback newCallback, void* context ){
+	this->callback = newCallback;
+	this->callbackContext = context;
+}
+
+void SpectrumAnalyzer::setEnvironmentCallback( EnvironmentEventCallback newCallback, void* context ){
+	this->environmentCallback = newCallback;
+	this->environmentContext = context;
+}
+
+void SpectrumAnalyzer::getEnvironmentStatus( EnvironmentStatus* status ) const{
+	changeDetector.getStatus( status );
+}
+
+void SpectrumAnalyzer::environmentEvent( EnvironmentEvent event, unsigned long long column, void* context ){
+	SpectrumAnalyzer* analyzer = (SpectrumAnalyzer*)context;
+	if( analyzer->environmentCallback ){
+		REALTIME_EXEMPT(); // the caller's code
+		analyzer->environmentCallback( event, column, analyzer->environmentContext );
+	}
+}
+
+void SpectrumAnalyzer::enableSpectrogramLogging( const char* filename ){
+	spectrogram->enableLoggingToFilename( filename );
+}
+
+void SpectrumAnalyzer::forgetHistory( unsigned int keepColumns ){
+	publisher->forgetHistory( keepColumns );
+}
+
+bool SpectrumAnalyzer::addMotion( const MotionRecord* record ){
+	if( !motionGate.addMotion( record ) ) return false;
+	forgetHistory( motionGate.getStillColumns( (double)ANALYZER_COLUMN_SAMPLES / ANALYZER_SAMPLE_RATE ) );
+	return true;
+}
+
+void SpectrumAnalyzer::reset(){
+	// a fresh spectrogram, so that the history starts out as the callback's does
+	delete publisher;
+	delete spectrogram;
+	spectrogram = new Spectrogram( ANALYZER_FP_LENGTH, ANALYZER_HISTORY );
+	publisher = new FingerprintPublisher( spectrogram, &changeDetector );
+	for( unsigned int i=0; i<ANALYZER_FP_LENGTH; ++i ) acc[i] = 0;
+	accCount = 0;
+	fixedSpectrum.clear();
+	changeDetector.reset();
+	motionGate.reset();
+	buffer.clear();
+	fixedBuffer.clear();
+	bufferStart = 0;
+	numColumns = 0;
+}
+
+void SpectrumAnalyzer::addSamples( const float* samples, unsigned int n ){
+	if( fixedPoint ){
+		// the samples are whole numbers, as RemoteIO delivers them, and the
+		// callback buffers them as integers on this path
+		for( unsigned int i=0; i<n; ++i ) fixedBuffer.push_back( (int32_t)lrintf( samples[i] ) );
+	}else{
+		buffer.insert( buffer.end(), samples, samples+n );
+	}
+	unsigned int size = fixedPoint? fixedBuffer.size() : buffer.size();
+	// windows start every ANALYZER_STEP samples from the first
+	unsigned int start = 0;
+	for( ; start + ANALYZER_SPEC_RES <= size; start += ANALYZER_STEP ){
+		bufferStart += ANALYZER_STEP;
+		if( fixedPoint ) analyzeFixedWindow( &fixedBuffer[start] );
+		else analyzeWindow( &buffer[start] );
+	}
+	// keep only the samples which later windows need
+	if( start > size ) start = size;
+	if( fixedPoint ) fixedBuffer.erase( fixedBuffer.begin(), fixedBuffer.begin() + start );
+	else buffer.erase( buffer.begin(), buffer.begin() + start );
+}
+
+void SpectrumAnalyzer::setFixedPoint( bool useFixedPoint ){
+	fixedPoint = useFixedPoint;
+	reset();
+}
+
+bool SpectrumAnalyzer::isFixedPoint() const{
+	return fixedPoint;
+}
+
+void SpectrumAnalyzer::analyzeFixedWindow( const int32_t* window ){
+	REALTIME_SCOPE(); // the callback's work, up to the column callback
+	fixedSpectrum.addWindow( window );
+	if( fixedSpectrum.getCount() < ANALYZER_ACCUMULATION ) return;
+	fixedSpectrum.getDecibels( &acc[0] );
+	addColumn();
+}
+
+void SpectrumAnalyzer::analyzeWindow( const float* window ){
+	REALTIME_SCOPE(); // the callback's work, up to the column callback
+	const unsigned int n = ANALYZER_SPEC_RES;
+	// windowed samples are packed as complex pairs into the first half of the buffer,
+	// in bit-reversed order for the FFT
+	for( unsigned int i=0; i<n; ++i ){
+		re[i] = im[i] = 0;
+	}
+	for( unsigned int i=0; i<n/2; ++i ){
+		unsigned int j = bitReverse[i];
+		re[j] = window[2*i] * hamm[2*i];
+		im[j] = window[2*i+1] * hamm[2*i+1];
+	}
+	fft( &re[0], &im[0] );
+
+	// accumulate the power spectrum's low bins
+	for( unsigned int k=0; k<ANALYZER_FP_LENGTH; ++k ){
+		acc[k] += re[k]*re[k] + im[k]*im[k];
+	}
+	if( ++accCount < ANALYZER_ACCUMULATION ) return;
+
+	// convert to dB relative to the number of summed spectra, as vDSP_vdbcon
+	fastDecibels( &acc[0], &acc[0], ANALYZER_FP_LENGTH, ANALYZER_ACCUMULATION );
+	addColumn();
+	for( unsigned int k=0; k<ANALYZER_FP_LENGTH; ++k ) acc[k] = 0;
+	accCount = 0;
+}
+
+void SpectrumAnalyzer::addColumn(){
+	publisher->addColumn( &acc[0] );
+	++numColumns;
+	columnCount->add();
+	if( callback ){
+		// bufferStart was advanced past this window's start
+		unsigned long long endSample = bufferStart - ANALYZER_STEP + ANALYZER_SPEC_RES;
+		REALTIME_EXEMPT(); // the caller's code, not the callback's
+		callback( &acc[0], endSample, callbackContext );
+	}
+}
+
+void SpectrumAnalyzer::fft( float* xr, float* xi ){
+	// iterative decimation in time; the input is already in bit-reversed order
+	const unsigned int n = ANALYZER_SPEC_RES;
+	for( unsigned int half=1; half<n; half*=2 ){
+		unsigned int stride = n / (2*half); // twiddle table step
+		for( unsigned int base=0; base<n; base+=2*half ){
+			for( unsigned int k=0; k<half; ++k ){
+				float wr = cosTable[k*stride], wi = sinTable[k*stride];
+				unsigned int a = base+k, b = a+half;
+				float tr = wr*xr[b] - wi*xi[b];
+				float ti = wr*xi[b] + wi*xr[b];
+				xr[b] = xr[a] - tr;
+				xi[b] = xi[a] - ti;
+				xr[a] += tr;
+				xi[a] += ti;
+			}
+		}
+	}
+}
+
+bool SpectrumAnalyzer::getFingerprint( float* outBuf ){
+	publisher->getFingerprint( outBuf );
+	fingerprintCount->add();
+	return numColumns >= ANALYZER_HISTORY;
+}
+
+unsigned int SpectrumAnalyzer::getNumColumns() const{
+	return numColumns;
+}
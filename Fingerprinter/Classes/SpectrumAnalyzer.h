@@ -0,0 +1,140 @@
+/*
+ *  SpectrumAnalyzer.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * The signal processing of Fingerprinter's audio callback, for recorded audio
+ * and without Core Audio or vDSP, so that fingerprints can be computed from
+ * WAV files on any machine.  Samples are cut into overlapping Hamming windows,
+ * each window's power spectrum is taken, ANALYZER_ACCUMULATION spectra are
+ * averaged into a spectrogram column in dB, and the fingerprint is the 5th
+ * percentile of each frequency bin over the last ANALYZER_HISTORY columns.
+ *
+ * The callback's FFT is reproduced exactly, quirks included: it transforms
+ * the window's real samples packed as complex pairs, followed by a second
+ * half of the FFT buffer which is never written.  Here that half is zero.
+ *
+ * Columns go to the spectrogram through a FingerprintPublisher, as in the
+ * callback, and getFingerprint() reads the fingerprint it publishes.
+ * Each column is also passed to a ChangeDetector, as in the callback, whose
+ * events can be watched with setEnvironmentCallback().  Motion samples passed
+ * to addMotion() go through a MotionGate, as in Fingerprinter::addMotion().
+ *
+ * Columns and fingerprints are counted in the Fingerprinter's metrics (see
+ * Metrics.h), so the tools report the same numbers as the app.
+ *
+ * With setFixedPoint( true ), the windows go through the integer pipeline of
+ * FixedPointSpectrum instead, as they would on a device built or set to use it.
+ *
+ * Samples are in the callback's units, the 8.24 fixed-point values delivered
+ * by RemoteIO, ie. 16-bit samples times 512.  Spectrogram columns are
+ * produced in order as samples are added, so any length of audio can be
+ * streamed through in blocks of any size.
+ */
+
+#ifndef SPECTRUM_ANALYZER_H
+#define SPECTRUM_ANALYZER_H
+
+#include <vector>
+#include "Spectrogram.h"
+#include "FingerprintPublisher.h"
+#include "FixedPointSpectrum.h"
+#include "ChangeDetector.h"
+#include "MotionGate.h"
+
+/* Fingerprinter's constants, which must be kept in step with Fingerprinter.cpp */
+#define ANALYZER_SAMPLE_RATE 44100
+#define ANALYZER_SPEC_RES 1024     // FFT length
+#define ANALYZER_STEP 441          // samples between windows, windowOffset * sampleRate
+#define ANALYZER_ACCUMULATION 10   // spectra per spectrogram column
+#define ANALYZER_HISTORY 100       // columns summarized by the fingerprint, historyCount
+#define ANALYZER_FP_LENGTH 325     // frequency bins, fpLength
+/* samples per spectrogram column */
+#define ANALYZER_COLUMN_SAMPLES (ANALYZER_STEP * ANALYZER_ACCUMULATION)
+
+/**
+ * Function called for each spectrogram column.
+ * @param column is ANALYZER_FP_LENGTH values in dB.
+ * @param endSample is the number of samples added before the end of the column's last window.
+ */
+typedef void (*SpectrumColumnCallback)( const float* column, unsigned long long endSample, void* context );
+
+
+class SpectrumAnalyzer{
+public:
+	SpectrumAnalyzer();
+	~SpectrumAnalyzer();
+	/* sets a function to be called after each column is added to the spectrogram, or NULL */
+	void setColumnCallback( SpectrumColumnCallback callback, void* context );
+	/* analyzes n more samples, in 8.24 fixed-point units */
+	void addSamples( const float* samples, unsigned int n );
+	/**
+	 * Computes the fingerprint of the latest ANALYZER_HISTORY columns.
+	 * @param outBuf receives ANALYZER_FP_LENGTH values.
+	 * @return true if the history is full, ie. the fingerprint covers no silence from before the first sample.
+	 */
+	bool getFingerprint( float* outBuf );
+	/* sets a function to be called when the environment changes or settles, see ChangeDetector.h,
+	 * or NULL.  Its column is the number of columns produced, including the event's. */
+	void setEnvironmentCallback( EnvironmentEventCallback callback, void* context );
+	void getEnvironmentStatus( EnvironmentStatus* status ) const;
+	/* appends every column to a spectrogram log, as the app does with detailed logging,
+	 * until the next reset(); see Spectrogram::enableLoggingToFilename() */
+	void enableSpectrogramLogging( const char* filename );
+	/* keeps only the newest keepColumns columns in the history, as of the next column;
+	 * see FingerprintPublisher::forgetHistory() */
+	void forgetHistory( unsigned int keepColumns );
+	/* Passes a motion sample to the MotionGate; when it reports that the user has settled
+	 * after walking, the history is cut down to the columns heard since the device stopped.
+	 * Samples should be added as the audio reaches their timestamps.
+	 * @return true if the history was cut. */
+	bool addMotion( const MotionRecord* record );
+	/* number of spectrogram columns produced so far */
+	unsigned int getNumColumns() const;
+	/* forgets all samples and columns, to start on a new recording */
+	void reset();
+	/* chooses the integer signal processing of FixedPointSpectrum, or the float path; this
+	 * resets the analyzer.  The default is FINGERPRINTER_FIXED_POINT. */
+	void setFixedPoint( bool fixedPoint );
+	bool isFixedPoint() const;
+
+private:
+	/* analyzes the window starting at window[0], adding a column every ANALYZER_ACCUMULATION windows */
+	void analyzeWindow( const float* window );
+	/* the same on the fixed-point path, with FixedPointSpectrum */
+	void analyzeFixedWindow( const int32_t* window );
+	/* adds acc, a column in dB, to the publisher and passes it to the callback */
+	void addColumn();
+	/* passes a ChangeDetector event on to environmentCallback */
+	static void environmentEvent( EnvironmentEvent event, unsigned long long column, void* analyzer );
+	/* in-place radix-2 complex FFT of length ANALYZER_SPEC_RES, as vDSP_fft_zip forward */
+	void fft( float* re, float* im );
+
+	Spectrogram* spectrogram;
+	FingerprintPublisher* publisher; // of spectrogram and changeDetector
+	SpectrumColumnCallback callback;
+	void* callbackContext;
+	ChangeDetector changeDetector;
+	MotionGate motionGate;
+	EnvironmentEventCallback environmentCallback;
+	void* environmentContext;
+
+	std::vector<float> hamm;      // Hamming window, as vDSP_hamm_window
+	std::vector<float> cosTable;  // twiddle factors, cos and -sin of 2*pi*k/ANALYZER_SPEC_RES
+	std::vector<float> sinTable;
+	std::vector<unsigned int> bitReverse;
+	std::vector<float> re, im;    // FFT buffer
+	std::vector<float> acc;       // accumulated power spectrum
+	unsigned int accCount;
+	std::vector<float> buffer;    // samples not yet used by every window which covers them
+	unsigned long long bufferStart; // number of samples added before buffer[0]
+	unsigned int numColumns;
+	bool fixedPoint;
+	FixedPointSpectrum fixedSpectrum;
+	std::vector<int32_t> fixedBuffer; // buffer's samples as 8.24 integers, used instead of it on the fixed-point path
+	MetricCounter* columnCount;
+	MetricCounter* fingerprintCount;
+};
+
+#endif // SPECTRUM_ANALYZER_H
@@ -0,0 +1,81 @@
+/*
+ *  SpectrumLog.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "SpectrumLog.h"
+#include <math.h>
+#include <string.h> // for memset
+
+#define MAX_LEVEL 255
+
+void quantizeSpectrum( const float* dB, unsigned int n, SpectrumRecord* record ){
+	// the offset is the lowest finite value, rounded down to a whole step
+	float lowest = HUGE_VALF;
+	for( unsigned int i=0; i<n; ++i ){
+		if( dB[i] < lowest && dB[i] > -HUGE_VALF ) lowest = dB[i];
+	}
+	if( lowest == HUGE_VALF ) lowest = 0; // no finite values
+	record->offset = floorf( lowest / SPECTRUM_DB_STEP ) * SPECTRUM_DB_STEP;
+
+	memset( record->level, 0, sizeof(record->level) );
+	for( unsigned int i=0; i<n; ++i ){
+		float level = ( dB[i] - record->offset ) / SPECTRUM_DB_STEP + 0.5f;
+		if( !( level >= 0 ) ) level = 0; // includes NaN and -inf
+		if( level > MAX_LEVEL ) level = MAX_LEVEL;
+		record->level[i] = (uint8_t)level;
+	}
+}
+
+void dequantizeSpectrum( const SpectrumRecord& record, unsigned int n, float* dB ){
+	for( unsigned int i=0; i<n; ++i ){
+		dB[i] = record.offset + record.level[i] * SPECTRUM_DB_STEP;
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// LOGGER
+
+SpectrumLogger::SpectrumLogger( SensorLogWriter* mySpectrumLog, SensorLogWriter* myFingerprintLog,
+								unsigned int myAverage, unsigned int myFingerprintInterval ) :
+spectrumLog(mySpectrumLog), fingerprintLog(myFingerprintLog), average(myAverage),
+fingerprintInterval(myFingerprintInterval), sumCount(0), columns(0){
+	if( average < 1 ) average = 1;
+	if( fingerprintInterval < 1 ) fingerprintInterval = 1;
+	sum = new float[SPECTRUM_BINS];
+	for( unsigned int i=0; i<SPECTRUM_BINS; ++i ) sum[i] = 0;
+	memset( &record, 0, sizeof(record) );
+}
+
+SpectrumLogger::~SpectrumLogger(){
+	delete[] sum;
+}
+
+void SpectrumLogger::addColumn( const float* spectrum, const float* fingerprint, double timestamp ){
+	if( spectrumLog ){
+		for( unsigned int i=0; i<SPECTRUM_BINS; ++i ) sum[i] += spectrum[i];
+		if( ++sumCount >= average ){
+			// the mean of the columns' dB values
+			for( unsigned int i=0; i<SPECTRUM_BINS; ++i ) sum[i] /= sumCount;
+			record.timestamp = timestamp;
+			quantizeSpectrum( sum, SPECTRUM_BINS, &record );
+			spectrumLog->push( &record );
+			for( unsigned int i=0; i<SPECTRUM_BINS; ++i ) sum[i] = 0;
+			sumCount = 0;
+		}
+	}
+	if( fingerprintLog && ++columns >= fingerprintInterval ){
+		record.timestamp = timestamp;
+		quantizeSpectrum( fingerprint, SPECTRUM_BINS, &record );
+		fingerprintLog->push( &record );
+		columns = 0;
+	}
+}
+
+bool SpectrumLogger::needsFingerprint() const{
+	return fingerprintLog && columns+1 >= fingerprintInterval;
+}
@@ -0,0 +1,62 @@
+/*
+ *  SpectrumLog.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Logs the Fingerprinter's output instead of the raw audio it came from.
+ * Every spectrogram column (an accumulated spectrum in dB) is passed to a
+ * SpectrumLogger from the audio callback.  It averages a few columns into
+ * each stored spectrum, samples the fingerprint at a fixed interval, and
+ * quantizes both to one byte per bin (SpectrumRecord, see SensorLog.h).  At
+ * the defaults used by SensorCapture this is about 1.2 KB per second before
+ * compression, compared with 86 KB per second of 16-bit audio.
+ */
+
+#ifndef SPECTRUM_LOG_H
+#define SPECTRUM_LOG_H
+
+#include "SensorLog.h"
+
+/* Quantizes n <= SPECTRUM_BINS values in dB.  Levels start at the lowest finite value,
+ * and values more than 255 steps above it are clipped. */
+void quantizeSpectrum( const float* dB, unsigned int n, SpectrumRecord* record );
+/* the inverse of quantizeSpectrum, to within SPECTRUM_DB_STEP/2 */
+void dequantizeSpectrum( const SpectrumRecord& record, unsigned int n, float* dB );
+
+
+class SpectrumLogger{
+public:
+	/**
+	 * @param spectrumLog receives averaged spectra, or is NULL.
+	 * @param fingerprintLog receives fingerprints, or is NULL.
+	 * @param average is the number of spectrogram columns averaged into each stored spectrum.
+	 * @param fingerprintInterval is the number of columns between stored fingerprints.
+	 * The logs must outlive this logger.
+	 */
+	SpectrumLogger( SensorLogWriter* spectrumLog, SensorLogWriter* fingerprintLog,
+					unsigned int average, unsigned int fingerprintInterval );
+	~SpectrumLogger();
+	/**
+	 * Adds one spectrogram column.  Never blocks or allocates, so it may be called from
+	 * an audio render callback, but only from one thread at a time.
+	 * @param spectrum and fingerprint are Fingerprinter::fpLength values in dB.
+	 * @param timestamp is the time at the end of the column's audio.
+	 */
+	void addColumn( const float* spectrum, const float* fingerprint, double timestamp );
+	/* true if the next addColumn() will store its fingerprint, so that callers need
+	 * only compute the fingerprint then */
+	bool needsFingerprint() const;
+
+private:
+	SensorLogWriter* spectrumLog;
+	SensorLogWriter* fingerprintLog;
+	unsigned int average;
+	unsigned int fingerprintInterval;
+	float* sum; // of the columns averaged so far
+	unsigned int sumCount; // number of columns in sum
+	unsigned int columns; // since the last stored fingerprint
+	SpectrumRecord record; // being assembled
+};
+
+#endif // SPECTRUM_LOG_H
@@ -0,0 +1,107 @@
+/*
+ *  TimeIndex.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * FingerprintDB's index of database entries by timestamp, in plain C++ so
+ * that the tools and checks run the same code as the app.  Items are kept
+ * sorted by timestamp, with ties in insertion order, so a time range is found
+ * by binary search and the entries older than a given time are always a
+ * prefix.  Items are usually pointers to entries owned elsewhere.
+ */
+
+#ifndef TIME_INDEX_H
+#define TIME_INDEX_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+template<class T>
+class TimeIndex{
+public:
+	typedef std::pair<long long,T> Item;
+
+	unsigned int size() const { return items.size(); }
+	/* the i-th oldest item */
+	const Item& operator[]( unsigned int i ) const { return items[i]; }
+	void clear(){ items.clear(); }
+
+	/* adds an item after any others with the same timestamp */
+	void insert( long long timestamp, T value ){
+		Item item( timestamp, value );
+		items.insert( std::upper_bound( items.begin(), items.end(), item, earlier ), item );
+	}
+	/* for loading many items at once: add each with append(), then call sort() */
+	void append( long long timestamp, T value ){
+		items.push_back( Item( timestamp, value ) );
+	}
+	void sort(){
+		std::stable_sort( items.begin(), items.end(), earlier );
+	}
+	/* removes the item, which must have been added with this timestamp.  @return false if it was not found */
+	bool remove( long long timestamp, T value ){
+		typename std::vector<Item>::iterator it, last;
+		it = std::lower_bound( items.begin(), items.end(), Item( timestamp, value ), earlier );
+		last = std::upper_bound( it, items.end(), Item( timestamp, value ), earlier );
+		for( ; it != last; ++it ){
+			if( it->second == value ){
+				items.erase( it );
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/* appends the items with timestamps from start to end inclusive, oldest first.  @return the number appended */
+	unsigned int range( long long start, long long end, std::vector<T>& result ) const{
+		if( start > end ) return 0;
+		typename std::vector<Item>::const_iterator first, last;
+		first = std::lower_bound( items.begin(), items.end(), Item( start, T() ), earlier );
+		last = std::upper_bound( first, items.end(), Item( end, T() ), earlier );
+		for( typename std::vector<Item>::const_iterator it = first; it != last; ++it ){
+			result.push_back( it->second );
+		}
+		return last - first;
+	}
+
+	/* removes the items older than time, appending them to removed oldest first.  @return the number removed */
+	unsigned int expire( long long time, std::vector<T>& removed ){
+		typename std::vector<Item>::iterator last;
+		last = std::lower_bound( items.begin(), items.end(), Item( time, T() ), earlier );
+		for( typename std::vector<Item>::iterator it = items.begin(); it != last; ++it ){
+			removed.push_back( it->second );
+		}
+		unsigned int n = last - items.begin();
+		items.erase( items.begin(), last );
+		return n;
+	}
+
+	/**
+	 * Appends the newest item of each group, newest first.  Of items with the same
+	 * timestamp, the one added last counts as newest.
+	 * @param groupOf maps an item to its group, less than numGroups.
+	 * @return the number appended
+	 */
+	template<class GroupOf>
+	unsigned int newest( const GroupOf& groupOf, unsigned int numGroups, std::vector<T>& result ) const{
+		std::vector<bool> seen( numGroups, false );
+		unsigned int n = 0;
+		for( typename std::vector<Item>::const_reverse_iterator it = items.rbegin(); it != items.rend() && n < numGroups; ++it ){
+			unsigned int g = groupOf( it->second );
+			if( !seen[g] ){
+				seen[g] = true;
+				result.push_back( it->second );
+				++n;
+			}
+		}
+		return n;
+	}
+
+private:
+	static bool earlier( const Item& a, const Item& b ){ return a.first < b.first; }
+	std::vector<Item> items;
+};
+
+#endif // TIME_INDEX_H
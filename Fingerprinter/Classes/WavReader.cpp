@@ -0,0 +1,107 @@
+/*
+ *  WavReader.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "WavReader.h"
+#include "SpectrumAnalyzer.h" // for ANALYZER_SAMPLE_RATE
+#include "WavWriter.h" // for WavHeader
+#include <stdint.h>
+#include <string.h>
+
+WavReader::WavReader() : file(NULL){}
+
+WavReader::~WavReader(){
+	if( file ) fclose( file );
+}
+
+bool WavReader::open( const char* filename ){
+	file = fopen( filename, "rb" );
+	if( !file ){
+		fprintf( stderr, "Error: cannot open %s\n", filename );
+		return false;
+	}
+	char riff[12];
+	if( fread( riff, 1, 12, file ) != 12 || memcmp( riff, "RIFF", 4 ) || memcmp( riff+8, "WAVE", 4 ) ){
+		fprintf( stderr, "Error: %s is not a WAV file\n", filename );
+		return false;
+	}
+	// walk the chunks up to the samples, reading the format on the way
+	bool haveFormat = false;
+	uint16_t format = 0;
+	char id[4];
+	uint32_t size;
+	while( fread( id, 1, 4, file ) == 4 && fread( &size, 4, 1, file ) == 1 ){
+		if( !memcmp( id, "data", 4 ) ){
+			if( !haveFormat ) break;
+			remaining = size / blockAlign;
+			bool integer = ( format == 1 && ( bits == 16 || bits == 24 || bits == 32 ) );
+			bool floating = ( format == 3 && bits == 32 );
+			if( !integer && !floating ){
+				fprintf( stderr, "Error: %s has unsupported sample format %u with %u bits\n", filename, format, bits );
+				return false;
+			}
+			if( sampleRate != ANALYZER_SAMPLE_RATE ){
+				fprintf( stderr, "Error: %s is sampled at %u Hz, not %u\n", filename, sampleRate, ANALYZER_SAMPLE_RATE );
+				return false;
+			}
+			// scale to 8.24 fixed point, averaging the channels
+			isFloat = floating;
+			scale = ( floating? (float)(1<<24) : (float)(1 << 24) / (1u << (bits-1)) ) / channels;
+			raw.resize( WAV_READ_FRAMES * blockAlign );
+			return true;
+		}
+		if( !memcmp( id, "fmt ", 4 ) && size >= 16 ){
+			WavHeader h;
+			if( fread( &h.format, 1, 16, file ) != 16 ) break;
+			format = h.format;
+			channels = h.channels;
+			sampleRate = h.sampleRate;
+			blockAlign = h.blockAlign;
+			bits = h.bitsPerSample;
+			if( format == 0xFFFE && size >= 26 ){
+				// WAVE_FORMAT_EXTENSIBLE: the real format starts the subformat GUID
+				char ext[10];
+				if( fread( ext, 1, 10, file ) != 10 ) break;
+				memcpy( &format, ext+8, 2 );
+				size -= 10;
+			}
+			size -= 16;
+			haveFormat = ( channels > 0 && blockAlign >= channels * bits/8 && bits > 0 );
+		}
+		// chunks are padded to an even size
+		if( fseek( file, size + (size&1), SEEK_CUR ) ) break;
+	}
+	fprintf( stderr, "Error: %s has no samples\n", filename );
+	return false;
+}
+
+unsigned int WavReader::read( float* out ){
+	unsigned int frames = ( remaining < WAV_READ_FRAMES )? remaining : WAV_READ_FRAMES;
+	frames = fread( &raw[0], blockAlign, frames, file );
+	remaining -= frames;
+	unsigned int bytes = bits / 8;
+	for( unsigned int i=0; i<frames; ++i ){
+		const unsigned char* frame = &raw[i*blockAlign];
+		float sum = 0;
+		for( unsigned int c=0; c<channels; ++c ){
+			const unsigned char* s = frame + c*bytes;
+			if( isFloat ){
+				float f;
+				memcpy( &f, s, 4 );
+				sum += f;
+			}else if( bytes == 2 ){
+				sum += (int16_t)( s[0] | s[1]<<8 );
+			}else if( bytes == 3 ){
+				sum += (int32_t)( s[0]<<8 | s[1]<<16 | (uint32_t)s[2]<<24 ) >> 8;
+			}else{
+				sum += (int32_t)( s[0] | s[1]<<8 | s[2]<<16 | (uint32_t)s[3]<<24 );
+			}
+		}
+		out[i] = sum * scale;
+	}
+	return frames;
+}
@@ -0,0 +1,39 @@
+/*
+ *  WavReader.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Reads the samples of a WAV file in blocks, converted to the 8.24 fixed-point
+ * units of SpectrumAnalyzer, for the command-line tools.  Files must be sampled
+ * at ANALYZER_SAMPLE_RATE, as 16, 24 or 32-bit integers or 32-bit floats, and
+ * their channels are averaged.  See WavWriter.h for writing them.
+ */
+
+#ifndef WAV_READER_H
+#define WAV_READER_H
+
+#include <stdio.h>
+#include <vector>
+
+#define WAV_READ_FRAMES 16384 // frames read at a time
+
+class WavReader{
+public:
+	WavReader();
+	~WavReader();
+	/* opens a file and finds its samples, printing an error if it cannot be used */
+	bool open( const char* filename );
+	/* Reads up to WAV_READ_FRAMES frames.  @return the number read, 0 at the end of the samples. */
+	unsigned int read( float* out );
+
+private:
+	FILE* file;
+	unsigned int channels, sampleRate, blockAlign, bits;
+	bool isFloat;
+	float scale;
+	unsigned int remaining; // frames
+	std::vector<unsigned char> raw;
+};
+
+#endif // WAV_READER_H
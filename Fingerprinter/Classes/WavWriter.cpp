@@ -0,0 +1,236 @@
+/*
+ *  WavWriter.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ */
+
+#include "WavWriter.h"
+#include <stdio.h>
+#include <stddef.h> // for offsetof
+#include <stdlib.h> // for posix_memalign
+#include <string.h> // for memcpy
+#include <fcntl.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------
+// CONSTANTS
+const unsigned int SegmentedWavWriter::blockBytes = 64*1024;
+#define PAGE_BYTES 4096
+#define FLUSH_POLL_US 20000 // how often the writer thread checks the ring
+#define BYTES_PER_FRAME 2 // mono 16-bit
+
+static const int16_t silence[SegmentedWavWriter::blockBytes/BYTES_PER_FRAME] = {0};
+
+
+// -----------------------------------------------------------------------------
+// WRITER
+
+SegmentedWavWriter::SegmentedWavWriter( const char* myDirectory, unsigned int mySampleRate,
+									    unsigned int mySegmentFrames, double myClockOffset, unsigned int ringBytes ) :
+directory(myDirectory), sampleRate(mySampleRate), segmentFrames(mySegmentFrames), clockOffset(myClockOffset),
+callback(NULL), callbackContext(NULL), opened(false), ring(NULL), head(0), tail(0), dropped(0), droppedWritten(0),
+startTime(0), started(false), fd(-1), segmentStart(0), segmentPos(0), framesWritten(0),
+stopping(false), threadRunning(false){
+	// ring size must be a power of two so that the byte counters can wrap around
+	ringSize = 2*blockBytes;
+	while( ringSize < ringBytes ) ringSize *= 2;
+	void* mem;
+	if( posix_memalign( &mem, PAGE_BYTES, ringSize ) ){
+		fprintf( stderr, "Error: could not allocate audio buffer\n" );
+		return;
+	}
+	ring = (unsigned char*)mem;
+	opened = true;
+}
+
+SegmentedWavWriter::~SegmentedWavWriter(){
+	close();
+	free( ring );
+}
+
+void SegmentedWavWriter::setSegmentCallback( WavSegmentCallback myCallback, void* context ){
+	callback = myCallback;
+	callbackContext = context;
+}
+
+bool SegmentedWavWriter::isOpen(){
+	return opened;
+}
+
+bool SegmentedWavWriter::start(){
+	if( !opened || threadRunning ) return false;
+	stopping = false;
+	if( pthread_create( &thread, NULL, threadMain, this ) ){
+		fprintf( stderr, "Error: could not start audio writer thread\n" );
+		return false;
+	}
+	threadRunning = true;
+	return true;
+}
+
+bool SegmentedWavWriter::push( const int16_t* samples, unsigned int frames, double timestamp ){
+	if( !opened ) return false;
+	if( !started ){
+		startTime = timestamp;
+		__sync_synchronize(); // publish startTime before started
+		started = true;
+	}
+	unsigned long h = head; // only we write head
+	unsigned long t = tail;
+	__sync_synchronize(); // read tail before overwriting the space it frees
+	unsigned int bytes = frames * BYTES_PER_FRAME;
+	if( ringSize - (h - t) < bytes ){
+		dropped += frames;
+		return false;
+	}
+	// copy, in two parts if the samples wrap around the end of the ring
+	unsigned int pos = h & (ringSize-1);
+	unsigned int firstPart = ringSize - pos;
+	if( firstPart >= bytes ){
+		memcpy( ring+pos, samples, bytes );
+	}else{
+		memcpy( ring+pos, samples, firstPart );
+		memcpy( ring, (const unsigned char*)samples+firstPart, bytes-firstPart );
+	}
+	__sync_synchronize(); // publish the samples before advancing head
+	head = h + bytes;
+	return true;
+}
+
+void SegmentedWavWriter::flush( bool all ){
+	if( !opened ) return;
+	unsigned long h = head;
+	__sync_synchronize(); // read head before reading the samples it covers
+	unsigned long d = dropped;
+	unsigned long t = tail;
+	unsigned long avail = h - t;
+
+	while( avail > 0 ){
+		// write up to the end of the segment, the end of the ring, or one block
+		unsigned long bytes = (unsigned long)( segmentFrames - segmentPos ) * BYTES_PER_FRAME;
+		unsigned int pos = t & (ringSize-1);
+		if( bytes > ringSize - pos ) bytes = ringSize - pos;
+		if( bytes > blockBytes ) bytes = blockBytes;
+		if( bytes > avail ){
+			// a partial block waits for more samples, unless it ends the segment
+			if( !all ) break;
+			bytes = avail;
+		}
+		writeFrames( (const int16_t*)(ring+pos), bytes / BYTES_PER_FRAME );
+		__sync_synchronize(); // finish reading the ring before releasing the space
+		t += bytes;
+		avail -= bytes;
+		tail = t;
+	}
+
+	// Replace samples dropped since the last flush by silence.  The ring was full when they were
+	// dropped, so they came after (nearly) all of the samples just written.
+	if( d > droppedWritten ){
+		writeFrames( NULL, d - droppedWritten );
+		droppedWritten = d;
+	}
+}
+
+void SegmentedWavWriter::writeFrames( const int16_t* samples, unsigned long frames ){
+	while( frames > 0 ){
+		if( fd < 0 && !openSegment() ) return;
+		unsigned long n = segmentFrames - segmentPos;
+		if( n > frames ) n = frames;
+		if( !samples && n > blockBytes/BYTES_PER_FRAME ) n = blockBytes/BYTES_PER_FRAME;
+		ssize_t bytes = n * BYTES_PER_FRAME;
+		if( write( fd, samples? samples : silence, bytes ) != bytes ){
+			fprintf( stderr, "Error: audio write failed\n" );
+		}
+		if( samples ) samples += n;
+		frames -= n;
+		segmentPos += n;
+		framesWritten += n;
+		if( segmentPos == segmentFrames ) finishSegment();
+	}
+}
+
+bool SegmentedWavWriter::openSegment(){
+	__sync_synchronize(); // read started before startTime
+	if( !started ) return false;
+	segmentStart = startTime + (double)framesWritten / sampleRate;
+	char name[64];
+	snprintf( name, sizeof(name), "/%.2f.wav", segmentStart + clockOffset );
+	filename = directory + name;
+	fd = open( filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if( fd < 0 ){
+		fprintf( stderr, "Error: could not open %s\n", filename.c_str() );
+		return false;
+	}
+
+	// The header gives the size of a full segment, so a file cut short by a crash still plays.
+	// finishSegment() corrects it.
+	WavHeader header;
+	memcpy( header.riff, "RIFF", 4 );
+	memcpy( header.wave, "WAVE", 4 );
+	memcpy( header.fmt, "fmt ", 4 );
+	header.fmtSize = 16;
+	header.format = 1;
+	header.channels = 1;
+	header.sampleRate = sampleRate;
+	header.blockAlign = BYTES_PER_FRAME;
+	header.byteRate = sampleRate * BYTES_PER_FRAME;
+	header.bitsPerSample = 8 * BYTES_PER_FRAME;
+	memcpy( header.data, "data", 4 );
+	header.dataSize = segmentFrames * BYTES_PER_FRAME;
+	header.riffSize = sizeof(header) - 8 + header.dataSize;
+	if( write( fd, &header, sizeof(header) ) != sizeof(header) ){
+		fprintf( stderr, "Error: could not write WAV header\n" );
+	}
+	return true;
+}
+
+void SegmentedWavWriter::finishSegment(){
+	if( fd < 0 ) return;
+	if( segmentPos != segmentFrames ){
+		// fix up the sizes in the header
+		uint32_t dataSize = segmentPos * BYTES_PER_FRAME;
+		uint32_t riffSize = sizeof(WavHeader) - 8 + dataSize;
+		if( pwrite( fd, &riffSize, 4, offsetof(WavHeader, riffSize) ) != 4 ||
+		    pwrite( fd, &dataSize, 4, offsetof(WavHeader, dataSize) ) != 4 ){
+			fprintf( stderr, "Error: could not fix up WAV header\n" );
+		}
+	}
+	::close( fd );
+	fd = -1;
+	if( callback ) callback( filename.c_str(), segmentStart, segmentPos, callbackContext );
+	segmentPos = 0;
+}
+
+void* SegmentedWavWriter::threadMain( void* arg ){
+	SegmentedWavWriter* THIS = (SegmentedWavWriter*)arg;
+	while( !THIS->stopping ){
+		usleep( FLUSH_POLL_US );
+		THIS->flush( false );
+	}
+	return NULL;
+}
+
+void SegmentedWavWriter::close(){
+	if( !opened ) return;
+	if( threadRunning ){
+		stopping = true;
+		pthread_join( thread, NULL );
+		threadRunning = false;
+	}
+	flush( true );
+	finishSegment();
+	opened = false;
+	if( dropped ){
+		fprintf( stderr, "audio writer dropped %lu samples\n", (unsigned long)dropped );
+	}
+}
+
+unsigned long long SegmentedWavWriter::getFramesWritten(){
+	return framesWritten;
+}
+
+unsigned long SegmentedWavWriter::getDroppedFrames(){
+	return dropped;
+}
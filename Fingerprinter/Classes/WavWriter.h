@@ -0,0 +1,130 @@
+/*
+ *  WavWriter.h
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Records one continuous stream of mono 16-bit samples as a series of WAV
+ * files of exactly segmentFrames samples each, so that consecutive segments
+ * join without a gap or overlap.  The audio thread only copies samples into a
+ * lock-free ring (as in SensorLog.h); the writer's own thread drains the ring
+ * to disk in large blocks and rolls to the next file at the exact sample where
+ * a segment ends.  Each file gets its header when it is created, with sizes
+ * for a full segment, and the sizes are fixed up when the file is finished.
+ *
+ * Segment files are named by the wall-clock time of their first sample, as
+ * %.2f.wav in seconds since the NSDate reference date.  Sample times are
+ * counted from the first pushed sample, so segment start times do not drift.
+ */
+
+#ifndef WAV_WRITER_H
+#define WAV_WRITER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+/* canonical 44-byte header of a PCM WAV file, in little-endian byte order */
+struct WavHeader{
+	char riff[4];           // "RIFF"
+	uint32_t riffSize;      // bytes which follow this field
+	char wave[4];           // "WAVE"
+	char fmt[4];            // "fmt "
+	uint32_t fmtSize;       // 16
+	uint16_t format;        // 1 for PCM
+	uint16_t channels;
+	uint32_t sampleRate;
+	uint32_t byteRate;      // sampleRate * blockAlign
+	uint16_t blockAlign;    // bytes per frame
+	uint16_t bitsPerSample;
+	char data[4];           // "data"
+	uint32_t dataSize;      // bytes of samples which follow
+};
+
+/* function called on the writer thread after each segment file has been finished */
+typedef void (*WavSegmentCallback)( const char* filename, double startTime, unsigned int frames, void* context );
+
+
+class SegmentedWavWriter{
+public:
+	/**
+	 * Allocates the ring.  No file is created until samples arrive.
+	 * @param directory is where segment files are created.
+	 * @param segmentFrames is the number of samples in each file (the last may be shorter).
+	 * @param clockOffset is added to sample timestamps to get the wall-clock times used
+	 *   in filenames; see SensorLogHeader.
+	 * @param ringBytes is the ring buffer capacity, rounded up to a power of two.
+	 */
+	SegmentedWavWriter( const char* directory, unsigned int sampleRate, unsigned int segmentFrames,
+						double clockOffset, unsigned int ringBytes = (1<<20) );
+	/* stops the thread and finishes the last file */
+	~SegmentedWavWriter();
+	/* true if the ring was allocated and close() has not been called */
+	bool isOpen();
+	/* Sets a function to be called when each segment is finished, eg. to move it
+	 * elsewhere.  Must be called before start(). */
+	void setSegmentCallback( WavSegmentCallback callback, void* context );
+	/* starts the writer thread; returns false if it could not be started */
+	bool start();
+	/**
+	 * Copies samples into the ring.  Never blocks, allocates or touches the disk, so it may
+	 * be called from an audio render callback.  Must only be called from one thread at a time.
+	 * If the ring is full the samples are dropped and replaced by silence in the file, so that
+	 * later samples keep their times.
+	 * @param timestamp is the time of the first sample, in SensorLogService::now() seconds.
+	 *   Only the first call's timestamp is used; later times are counted in samples.
+	 * @return false if the samples were dropped.
+	 */
+	bool push( const int16_t* samples, unsigned int frames, double timestamp );
+	/* Writes ring contents to disk.  Only whole blockBytes blocks are written, except at the
+	 * end of a segment, unless all is true.  Called by the writer thread. */
+	void flush( bool all );
+	/* Stops the thread, writes everything that remains and finishes the last file.  No push()
+	 * may be in progress. */
+	void close();
+	/* samples written to finished and current files, including silence for dropped samples */
+	unsigned long long getFramesWritten();
+	/* number of samples dropped because the ring was full */
+	unsigned long getDroppedFrames();
+
+	static const unsigned int blockBytes; /* size of the normal block written to disk */
+
+private:
+	static void* threadMain( void* writer );
+	/* writes samples (or silence, if samples is NULL) to the current segment,
+	 * starting and finishing segment files as needed */
+	void writeFrames( const int16_t* samples, unsigned long frames );
+	bool openSegment();
+	void finishSegment();
+
+	std::string directory;
+	unsigned int sampleRate;
+	unsigned int segmentFrames;
+	double clockOffset;
+	WavSegmentCallback callback;
+	void* callbackContext;
+
+	bool opened;
+	unsigned char* ring; // page-aligned
+	unsigned int ringSize; // power of two
+	/* Total bytes ever pushed and flushed.  Only the producer writes head and only
+	 * the writer thread writes tail; the difference is the ring occupancy. */
+	volatile unsigned long head;
+	volatile unsigned long tail;
+	volatile unsigned long dropped; // frames, written only by the producer
+	unsigned long droppedWritten; // dropped frames already replaced by silence
+	volatile double startTime; // of the first sample, set by the first push
+	volatile bool started; // true once startTime is set
+
+	int fd; // current segment, or -1
+	std::string filename; // of the current segment
+	double segmentStart; // time of the current segment's first sample
+	unsigned int segmentPos; // frames written to the current segment
+	unsigned long long framesWritten;
+
+	volatile bool stopping;
+	bool threadRunning;
+	pthread_t thread;
+};
+
+#endif // WAV_WRITER_H
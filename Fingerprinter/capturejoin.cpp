@@ -0,0 +1,360 @@
+/*
+ *  capturejoin.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Joins the streams of a capture file (see Classes/CaptureFile.h) by time,
+ * printing one tab-separated row per time step with a column for each value of
+ * each requested stream, eg.
+ *   build/capturejoin -i 0.1 capture.bpc motion location:previous wifi
+ *   build/capturejoin -i 0.5 -b 0,63 capture.bpc motion spectra:nearest fingerprints
+ * Each stream is read through its own cursor, one chunk at a time, so memory
+ * use does not depend on the length of the session.
+ *
+ * Options:
+ *   -i SECONDS  time between rows (default 1).  With 0, streams are k-way
+ *               merged and a row is printed at every sample of any stream.
+ *   -g SECONDS  ignore samples further than this from the row time; a value is
+ *               blank if none remain (default unlimited)
+ *   -s TIME, -e TIME  limit output to this range, in seconds since the NSDate
+ *               reference date (default: the whole session)
+ *   -b FIRST,LAST  print only these frequency bins of spectrum and fingerprint
+ *               streams (default all SPECTRUM_BINS)
+ *
+ * A stream may be followed by the strategy used to compute its values at each
+ * row time:
+ *   linear    interpolate between the samples before and after (default for
+ *             motion and location)
+ *   nearest   use the closest sample
+ *   previous  use the latest sample at or before the row time (default for wifi,
+ *             spectrum and fingerprint streams)
+ * Wi-Fi scans are summarized by the number of access points seen and their
+ * strongest and mean RSSI.  Spectrum and fingerprint records (see
+ * Classes/SpectrumLog.h) have a column per frequency bin, in dB as
+ * dequantized; a record describes the audio up to its timestamp, so the
+ * previous strategy gives the latest spectrum or fingerprint heard by the row
+ * time.
+ */
+
+#include "CaptureFile.h"
+#include "SpectrumLog.h"
+#include "Heap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+#define MAX_COLUMNS SPECTRUM_BINS // of one stream, the most being a spectrum's bins
+#define OUTPUT_BUFFER_BYTES (1<<20)
+
+typedef enum{
+	JoinLinear,
+	JoinNearest,
+	JoinPrevious
+} JoinStrategy;
+
+/* the values of one stream at one time */
+struct Sample{
+	double t;
+	double v[MAX_COLUMNS];
+};
+
+/* Produces a stream's samples in time order.  Each record is a sample, except
+ * that all Wi-Fi records of one scan are combined into one sample.  Of spectrum
+ * and fingerprint records, only bins firstBin to lastBin are sampled. */
+class StreamSampler{
+public:
+	StreamSampler( CaptureReader* reader, unsigned int streamId, double start,
+				   unsigned int myFirstBin, unsigned int myLastBin ) :
+	cursor( reader, streamId, start ), type( (SensorLogRecordType)reader->getStream( streamId ).recordType ),
+	havePending(false), firstBin(myFirstBin), lastBin(myLastBin){}
+
+	/* number of values per sample, and their names appended to names */
+	static unsigned int columns( SensorLogRecordType type, unsigned int firstBin, unsigned int lastBin,
+								 vector<string>& names ){
+		static const char* motion[] = { "accel.x", "accel.y", "accel.z", "roll", "pitch", "yaw",
+		                                "rot.x", "rot.y", "rot.z", "grav.x", "grav.y", "grav.z" };
+		static const char* location[] = { "lat", "lon", "alt", "hacc", "vacc", "speed", "course" };
+		static const char* wifi[] = { "aps", "max_rssi", "mean_rssi" };
+		switch( type ){
+			case SensorLogMotion: names.insert( names.end(), motion, motion+12 ); return 12;
+			case SensorLogLocation: names.insert( names.end(), location, location+7 ); return 7;
+			case SensorLogWifi: names.insert( names.end(), wifi, wifi+3 ); return 3;
+			case SensorLogSpectrum:
+			case SensorLogFingerprint:
+				for( unsigned int i=firstBin; i<=lastBin; ++i ){
+					char name[16];
+					snprintf( name, sizeof(name), "bin%u", i );
+					names.push_back( name );
+				}
+				return lastBin - firstBin + 1;
+			default: return 0;
+		}
+	}
+
+	/* reads the next sample, returning false at the end of the stream */
+	bool next( Sample* s ){
+		const void* data;
+		unsigned int length;
+		double t;
+		switch( type ){
+			case SensorLogMotion:{
+				if( !cursor.next( &data, &length, &t ) ) return false;
+				const MotionRecord* r = (const MotionRecord*)data;
+				s->t = t;
+				for( unsigned int i=0; i<3; ++i ){
+					s->v[i] = r->userAccel[i];
+					s->v[3+i] = r->attitude[i];
+					s->v[6+i] = r->rotationRate[i];
+					s->v[9+i] = r->gravity[i];
+				}
+				return true;
+			}
+			case SensorLogLocation:{
+				if( !cursor.next( &data, &length, &t ) ) return false;
+				const LocationRecord* r = (const LocationRecord*)data;
+				s->t = t;
+				s->v[0] = r->latitude;
+				s->v[1] = r->longitude;
+				s->v[2] = r->altitude;
+				s->v[3] = r->horizontalAccuracy;
+				s->v[4] = r->verticalAccuracy;
+				s->v[5] = r->speed;
+				s->v[6] = r->course;
+				return true;
+			}
+			case SensorLogWifi:{
+				// combine the records of one scan, reading ahead one record
+				if( !havePending ){
+					if( !cursor.next( &data, &length, &t ) ) return false;
+					memcpy( &pending, data, sizeof(pending) );
+				}
+				unsigned int aps = 0;
+				double maxRssi = -DBL_MAX, sumRssi = 0;
+				s->t = pending.timestamp;
+				do{
+					++aps;
+					sumRssi += pending.rssi;
+					if( pending.rssi > maxRssi ) maxRssi = pending.rssi;
+					havePending = cursor.next( &data, &length, &t );
+					if( havePending ) memcpy( &pending, data, sizeof(pending) );
+				}while( havePending && pending.timestamp == s->t );
+				s->v[0] = aps;
+				s->v[1] = maxRssi;
+				s->v[2] = sumRssi / aps;
+				return true;
+			}
+			case SensorLogSpectrum:
+			case SensorLogFingerprint:{
+				if( !cursor.next( &data, &length, &t ) ) return false;
+				float dB[SPECTRUM_BINS];
+				dequantizeSpectrum( *(const SpectrumRecord*)data, SPECTRUM_BINS, dB );
+				s->t = t;
+				for( unsigned int i=firstBin; i<=lastBin; ++i ) s->v[i-firstBin] = dB[i];
+				return true;
+			}
+			default:
+				return false;
+		}
+	}
+
+private:
+	CaptureCursor cursor;
+	SensorLogRecordType type;
+	WifiRecord pending; // first record of the next scan
+	bool havePending;
+	unsigned int firstBin, lastBin; // of spectrum records
+};
+
+/* a stream's samples on either side of the current row time */
+struct JoinStream{
+	StreamSampler* sampler;
+	JoinStrategy strategy;
+	unsigned int numColumns;
+	Sample prev, next;
+	bool havePrev, haveNext;
+
+	/* moves forward so that prev is at or before t and next is after t */
+	void advance( double t ){
+		while( haveNext && next.t <= t ){
+			prev = next;
+			havePrev = true;
+			haveNext = sampler->next( &next );
+		}
+	}
+
+	/* prints this stream's columns for row time t */
+	void print( double t, double maxGap ){
+		const Sample* a = ( havePrev && t - prev.t <= maxGap )? &prev : NULL;
+		const Sample* b = ( haveNext && next.t - t <= maxGap )? &next : NULL;
+		if( strategy == JoinPrevious ) b = NULL;
+		if( strategy == JoinNearest && a && b ){
+			if( next.t - t < t - prev.t ) a = NULL;
+			else b = NULL;
+		}
+		for( unsigned int i=0; i<numColumns; ++i ){
+			if( a && b ){
+				// linear interpolation
+				double w = ( next.t > prev.t )? ( t - prev.t ) / ( next.t - prev.t ) : 0;
+				printf( "\t%g", a->v[i] + w*( b->v[i] - a->v[i] ) );
+			}else if( a || b ){
+				printf( "\t%g", (a? a : b)->v[i] );
+			}else{
+				printf( "\t" );
+			}
+		}
+	}
+};
+
+void usage( const char* name ){
+	fprintf( stderr, "usage: %s [-i INTERVAL] [-g MAXGAP] [-s START] [-e END] [-b FIRST,LAST] CAPTUREFILE "
+			         "STREAM[:linear|nearest|previous]...\n", name );
+}
+
+int main( int argc, char** argv ){
+	double interval = 1, maxGap = DBL_MAX;
+	double start = -DBL_MAX, end = DBL_MAX;
+	unsigned int firstBin = 0, lastBin = SPECTRUM_BINS-1;
+	int c;
+	while( ( c = getopt( argc, argv, "i:g:s:e:b:" ) ) != -1 ){
+		switch( c ){
+			case 'i': interval = atof( optarg ); break;
+			case 'g': maxGap = atof( optarg ); break;
+			case 's': start = atof( optarg ); break;
+			case 'e': end = atof( optarg ); break;
+			case 'b':
+				if( sscanf( optarg, "%u,%u", &firstBin, &lastBin ) != 2 ){
+					usage( argv[0] );
+					return 1;
+				}
+				break;
+			default: usage( argv[0] ); return 1;
+		}
+	}
+	if( argc - optind < 2 || interval < 0 || firstBin > lastBin || lastBin >= SPECTRUM_BINS ){
+		usage( argv[0] );
+		return 1;
+	}
+	CaptureReader capture( argv[optind] );
+	if( !capture.isOpen() ){
+		fprintf( stderr, "Error: %s is not a capture file\n", argv[optind] );
+		return 1;
+	}
+	// convert the time range to the capture's clock
+	if( start != -DBL_MAX ) start -= capture.getClockOffset();
+	if( end != DBL_MAX ) end -= capture.getClockOffset();
+
+	// open streams
+	vector<JoinStream> streams;
+	vector<string> names;
+	double first = DBL_MAX, last = -DBL_MAX; // time span of the selected streams
+	for( int a=optind+1; a<argc; ++a ){
+		char* name = argv[a];
+		char* colon = strchr( name, ':' );
+		if( colon ) *colon = '\0';
+		int id = capture.findStream( name );
+		if( id < 0 ){
+			fprintf( stderr, "Error: no stream named %s\n", name );
+			return 1;
+		}
+		JoinStream s;
+		SensorLogRecordType type = (SensorLogRecordType)capture.getStream( id ).recordType;
+		s.numColumns = StreamSampler::columns( type, firstBin, lastBin, names );
+		if( s.numColumns == 0 ){
+			fprintf( stderr, "Error: stream %s cannot be joined\n", name );
+			return 1;
+		}
+		s.strategy = ( type == SensorLogMotion || type == SensorLogLocation )? JoinLinear : JoinPrevious;
+		if( colon ){
+			if( !strcmp( colon+1, "linear" ) ) s.strategy = JoinLinear;
+			else if( !strcmp( colon+1, "nearest" ) ) s.strategy = JoinNearest;
+			else if( !strcmp( colon+1, "previous" ) ) s.strategy = JoinPrevious;
+			else{
+				fprintf( stderr, "Error: unknown strategy %s\n", colon+1 );
+				return 1;
+			}
+		}
+		// Start the cursor early enough that the first rows have a previous sample: at the last
+		// record of the last chunk which ends before start, but no more than maxGap before start.
+		double cursorStart = -DBL_MAX;
+		const vector<CaptureIndexEntry>& index = capture.getIndex();
+		for( unsigned int i=0; i<index.size(); ++i ){
+			if( index[i].streamId != (unsigned int)id ) continue;
+			if( index[i].startTime < first ) first = index[i].startTime;
+			if( index[i].endTime > last ) last = index[i].endTime;
+			if( index[i].endTime < start && index[i].endTime > cursorStart ) cursorStart = index[i].endTime;
+		}
+		if( maxGap != DBL_MAX && start != -DBL_MAX && cursorStart < start - maxGap ) cursorStart = start - maxGap;
+		s.sampler = new StreamSampler( &capture, id, cursorStart, firstBin, lastBin );
+		s.havePrev = false;
+		s.haveNext = s.sampler->next( &s.next );
+		streams.push_back( s );
+		if( colon ) *colon = ':';
+	}
+	if( start < first ) start = first;
+	if( end > last ) end = last;
+
+	// header row
+	setvbuf( stdout, NULL, _IOFBF, OUTPUT_BUFFER_BYTES );
+	printf( "time" );
+	unsigned int col = 0;
+	for( int a=optind+1; a<argc; ++a ){
+		char* colon = strchr( argv[a], ':' );
+		if( colon ) *colon = '\0';
+		for( unsigned int i=0; i<streams[a-optind-1].numColumns; ++i ){
+			printf( "\t%s.%s", argv[a], names[col++].c_str() );
+		}
+	}
+	printf( "\n" );
+
+	if( interval > 0 ){
+		// one row per time step, computed from the row number to avoid accumulating error
+		for( unsigned long row=0; ; ++row ){
+			double t = start + row*interval;
+			if( t > end ) break;
+			printf( "%.3f", t + capture.getClockOffset() );
+			for( unsigned int s=0; s<streams.size(); ++s ){
+				streams[s].advance( t );
+				streams[s].print( t, maxGap );
+			}
+			printf( "\n" );
+		}
+	}else{
+		// k-way merge: a heap keyed on each stream's next sample time, relative to start so
+		// that float keys keep sub-millisecond precision over long sessions
+		Heap heap( streams.size(), FLT_MAX, false );
+		for( unsigned int s=0; s<streams.size(); ++s ){
+			JoinStream& js = streams[s];
+			// skip samples before start, keeping the last one as prev
+			while( js.haveNext && js.next.t < start ){
+				js.prev = js.next;
+				js.havePrev = true;
+				js.haveNext = js.sampler->next( &js.next );
+			}
+			if( js.haveNext ) heap.replace( s, js.next.t - start );
+		}
+		while( heap.rootVal() != FLT_MAX ){
+			JoinStream& js = streams[heap.rootKey()];
+			double t = js.next.t;
+			if( t > end ) break;
+			printf( "%.3f", t + capture.getClockOffset() );
+			for( unsigned int s=0; s<streams.size(); ++s ){
+				streams[s].advance( t );
+				streams[s].print( t, maxGap );
+				heap.replace( s, streams[s].haveNext? streams[s].next.t - start : FLT_MAX );
+			}
+			printf( "\n" );
+		}
+	}
+
+	for( unsigned int s=0; s<streams.size(); ++s ) delete streams[s].sampler;
+	return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ *  codecbench.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Measures how well the record streams of capture files compress, comparing
+ * zlib alone with the delta encoding of Classes/SensorCodec.h, eg.
+ *   build/codecbench monday.bpc tuesday.bpc
+ * Every record stream's records are split into chunks as SensorLogWriter
+ * would write them, and each chunk is compressed with zlib, encoded, and
+ * encoded then compressed.  For each stream and method this prints the
+ * total size, the compression ratio and the decoding throughput in MB of
+ * records per second, best of several runs.  Decoded records are
+ * checked against the originals.  For meaningful timings, build everything
+ * with optimization, eg.
+ *   make clean; make CFLAGS=-O2 build/codecbench
+ *
+ * Options:
+ *   -r N   decoding runs to time (default 5)
+ */
+
+#include "CaptureFile.h"
+#include "SensorCodec.h"
+#include <float.h>
+#include <math.h>
+#include <stddef.h> // for offsetof
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <zlib.h>
+#include <vector>
+
+using std::vector;
+
+#define COMPRESSION_LEVEL 1 // as in CaptureFile.cpp
+
+/* wall-clock seconds, for timing */
+double elapsed(){
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* a chunk of records in one of the stored forms */
+struct Chunk{
+	unsigned int count;
+	unsigned int encodedBytes; // before compression, 0 if not encoded
+	vector<unsigned char> data;
+};
+
+/* totals for one method over a stream */
+struct Result{
+	const char* name;
+	unsigned long bytes;
+	double seconds; // to decode everything once, best of the runs
+	bool ok;        // decoded records match
+};
+
+bool compressChunk( const unsigned char* in, unsigned int bytes, vector<unsigned char>& out ){
+	uLongf size = compressBound( bytes );
+	out.resize( size );
+	if( compress2( &out[0], &size, in, bytes, COMPRESSION_LEVEL ) != Z_OK ) return false;
+	out.resize( size );
+	return true;
+}
+
+/* true if decoded records equal the originals, allowing the codec's rounding */
+bool sameRecords( const unsigned char* a, const unsigned char* b, unsigned int count, const CaptureStreamInfo& info ){
+	unsigned int recordSize = info.recordSize;
+	for( unsigned int i=0; i<count; ++i, a+=recordSize, b+=recordSize ){
+		double ta, tb;
+		memcpy( &ta, a, sizeof(ta) );
+		memcpy( &tb, b, sizeof(tb) );
+		if( !( fabs( ta - tb ) <= 0.5e-6 ) ) return false;
+		if( info.recordType == SensorLogMotion && recordSize == sizeof(MotionRecord) ){
+			// the twelve floats which follow the timestamp
+			float fa[12], fb[12];
+			memcpy( fa, a + offsetof(MotionRecord,userAccel), sizeof(fa) );
+			memcpy( fb, b + offsetof(MotionRecord,userAccel), sizeof(fb) );
+			for( unsigned int j=0; j<12; ++j ){
+				if( !( fabs( fa[j] - fb[j] ) <= SENSOR_CODEC_MOTION_STEP/2 + fabs( fa[j] )*FLT_EPSILON ) ) return false;
+			}
+		}else if( memcmp( a+sizeof(double), b+sizeof(double), recordSize-sizeof(double) ) != 0 ){
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Decodes every chunk runs times, timing the fastest run and checking the output of the last.
+ * Chunks are zlib compressed if compressed is true, and encoded if their encodedBytes is non-zero. */
+Result decodeAll( const char* name, const vector<Chunk>& chunks, bool compressed, const CaptureStreamInfo& info,
+				  const vector<unsigned char>& records, unsigned int runs ){
+	Result result;
+	result.name = name;
+	result.bytes = 0;
+	result.seconds = HUGE_VAL;
+	result.ok = true;
+	for( unsigned int c=0; c<chunks.size(); ++c ) result.bytes += chunks[c].data.size();
+
+	unsigned int maxBytes = SensorLogWriter::flushBytes;
+	vector<unsigned char> raw( maxBytes ), out( maxBytes );
+	for( unsigned int run=0; run<runs; ++run ){
+		unsigned int pos = 0;
+		double t0 = elapsed();
+		for( unsigned int c=0; c<chunks.size(); ++c ){
+			const Chunk& chunk = chunks[c];
+			unsigned int outBytes = chunk.count * info.recordSize;
+			const unsigned char* data = &chunk.data[0];
+			unsigned int bytes = chunk.data.size();
+			if( compressed ){
+				uLongf rawBytes = chunk.encodedBytes? chunk.encodedBytes : outBytes;
+				if( rawBytes > raw.size() ) raw.resize( rawBytes );
+				if( uncompress( &raw[0], &rawBytes, data, bytes ) != Z_OK ) result.ok = false;
+				data = &raw[0];
+				bytes = rawBytes;
+			}
+			if( chunk.encodedBytes ){
+				if( !sensorCodecDecode( (SensorLogRecordType)info.recordType, info.recordSize,
+									    data, bytes, &out[0], chunk.count ) ) result.ok = false;
+				data = &out[0];
+			}
+			if( run == runs-1 && !sameRecords( data, &records[pos], chunk.count, info ) ){
+				result.ok = false;
+			}
+			pos += outBytes;
+		}
+		double t = elapsed() - t0;
+		if( t < result.seconds ) result.seconds = t;
+	}
+	return result;
+}
+
+void printResult( const Result& r, unsigned long rawBytes ){
+	printf( "  %-12s %10lu bytes %6.2fx %8.1f MB/s%s\n", r.name, r.bytes,
+		   r.bytes? (double)rawBytes / r.bytes : 0.0,
+		   r.seconds > 0? rawBytes / r.seconds / 1e6 : 0.0, r.ok? "" : "  MISMATCH" );
+}
+
+void benchStream( CaptureReader& capture, unsigned int streamId, unsigned int runs ){
+	const CaptureStreamInfo& info = capture.getStream( streamId );
+	SensorLogRecordType type = (SensorLogRecordType)info.recordType;
+
+	// all of the stream's records, in file order
+	vector<unsigned char> records;
+	CaptureCursor cursor( &capture, streamId, -1e300 );
+	const void* data;
+	unsigned int length;
+	double t;
+	while( cursor.next( &data, &length, &t ) ){
+		records.insert( records.end(), (const unsigned char*)data, (const unsigned char*)data + length );
+	}
+	unsigned int count = records.size() / info.recordSize;
+	printf( "%s: %u records of %u bytes, %.1f MB\n", info.name, count, info.recordSize, records.size() / 1e6 );
+	if( count == 0 ) return;
+
+	// the chunks SensorLogWriter would write
+	unsigned int perChunk = SensorLogWriter::flushBytes / info.recordSize;
+	bool encodable = sensorCodecSupports( type, info.recordSize );
+	vector<Chunk> zlib, coded, both;
+	for( unsigned int first=0; first<count; first+=perChunk ){
+		unsigned int n = ( count - first < perChunk )? count - first : perChunk;
+		const unsigned char* r = &records[first * info.recordSize];
+		Chunk chunk;
+		chunk.count = n;
+		chunk.encodedBytes = 0;
+		compressChunk( r, n*info.recordSize, chunk.data );
+		zlib.push_back( chunk );
+		if( encodable ){
+			if( !sensorCodecEncode( type, info.recordSize, r, n, chunk.data ) ){
+				// the writer would store such a chunk as it is
+				encodable = false;
+				continue;
+			}
+			chunk.encodedBytes = chunk.data.size();
+			coded.push_back( chunk );
+			vector<unsigned char> encoded = chunk.data;
+			compressChunk( &encoded[0], encoded.size(), chunk.data );
+			both.push_back( chunk );
+		}
+	}
+
+	printf( "  %-12s %10lu bytes\n", "raw", (unsigned long)records.size() );
+	printResult( decodeAll( "zlib", zlib, true, info, records, runs ), records.size() );
+	if( encodable ){
+		printResult( decodeAll( "delta", coded, false, info, records, runs ), records.size() );
+		printResult( decodeAll( "delta+zlib", both, true, info, records, runs ), records.size() );
+	}else if( sensorCodecSupports( type, info.recordSize ) ){
+		printf( "  delta        not possible for every chunk\n" );
+	}
+}
+
+int main( int argc, char** argv ){
+	unsigned int runs = 5;
+	int c;
+	while( ( c = getopt( argc, argv, "r:" ) ) != -1 ){
+		switch( c ){
+			case 'r': runs = atoi( optarg ); break;
+			default:
+				fprintf( stderr, "usage: %s [-r RUNS] CAPTURE...\n", argv[0] );
+				return 1;
+		}
+	}
+	if( optind >= argc || runs < 1 ){
+		fprintf( stderr, "usage: %s [-r RUNS] CAPTURE...\n", argv[0] );
+		return 1;
+	}
+	for( int a=optind; a<argc; ++a ){
+		CaptureReader capture( argv[a] );
+		if( !capture.isOpen() ){
+			fprintf( stderr, "Error: %s is not a capture file\n", argv[a] );
+			return 1;
+		}
+		printf( "%s\n", argv[a] );
+		for( unsigned int s=0; s<capture.getNumStreams(); ++s ){
+			if( capture.getStream( s ).recordSize > 0 ) benchStream( capture, s, runs );
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,574 @@
+/*
+ *  convergebench.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Measures how many seconds it takes, after the sound changes from one room
+ * to another, for the fingerprint and for the top database match to settle,
+ * eg.
+ *   build/convergebench -s 50,100,200 -p 0.05,0.1 office.wav hall.wav lab.wav
+ *   build/convergebench -S 6
+ * For every ordered pair of rooms A and B, the spectrogram columns of the
+ * first -a seconds of A are followed by those of the first -b seconds of B,
+ * and fed to a percentile tracker as Spectrogram would be.  The fingerprint
+ * is read after every column, and the database is queried every -q seconds,
+ * as MatchViewController's timer does.  The database holds one fingerprint
+ * per room, summarized from the last columns of its audio, so a room's
+ * recording should be longer than -b plus the history to keep the two apart.
+ * For each pair this finds:
+ *   time to stable: from the splice to the first column from which the
+ *     fingerprint stays within -d dB (a mean over the bins) of its value at
+ *     the end of B;
+ *   time to top-1: from the splice to the first query from which B is the
+ *     closest room in the database (L2 distance) to the end of B.
+ * A pair which never settles counts as the length of B, and is also counted as
+ * missed.  Each combination of history length (-s), percentile (-p) and engine
+ * (-e) is printed as a row of averages over the pairs, with the engine's time
+ * per column; the heaps, eager and lazy engines are those of summarybench and
+ * should give the same latencies.  Since the fingerprint is read after every
+ * column, the lazy engine's time is its worst case; see summarybench for the
+ * cost at the app's read rates.
+ *
+ * Each room's audio is analyzed once (Classes/SpectrumAnalyzer.h), so splices
+ * fall on column boundaries.  Rooms are WAV files, as for build/tester, or with
+ * -S, synthetic rooms: white noise through a few resonances, with mains hum and
+ * a tone or two, each room with its own levels and frequencies from a fixed
+ * seed, so that runs are repeatable.
+ *
+ * Options:
+ *   -s LIST   history lengths in columns (default 100, as Fingerprinter's)
+ *   -p LIST   percentiles (default 0.05)
+ *   -e LIST   engines: heaps, eager, lazy (default eager, as Fingerprinter's)
+ *   -a SECS   seconds of room A before the splice (default 20, which must fill the history)
+ *   -b SECS   seconds of room B after the splice (default 30)
+ *   -q SECS   seconds between queries (default 2)
+ *   -k N      ensemble the last N queries' fingerprints, as MatchViewController
+ *             does with 5 (default 1)
+ *   -d DB     tolerance of a stable fingerprint (default 1)
+ *   -c        react to changes of environment as MatchViewController does: a
+ *             ChangeDetector watches the columns, a change empties the
+ *             ensemble, and while the environment is stable queries are made
+ *             only at its stable events (the 30 s refresh aside).  The number of
+ *             splices which raised no change event is printed to stderr.
+ *   -f N      with -c, also cut the history to the newest N columns at each
+ *             change, as MatchViewController asks Fingerprinter to
+ *   -S N      use N synthetic rooms instead of WAV files
+ *   -l SECS   length of each synthetic room (default 60)
+ *   -v        also print each pair's times
+ */
+
+#include "SpectrumAnalyzer.h"
+#include "ChangeDetector.h"
+#include "SlidingPercentiles.h"
+#include "SlidingWindow.h"
+#include "DistanceMetrics.h"
+#include "WavReader.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+#define INIT_VALUE 0.0f // Spectrogram's initial history value
+#define SYNTH_RESONANCES 4
+#define SYNTH_BLOCK 4096 // synthetic samples analyzed at a time
+
+/* wall-clock seconds, for timing */
+double elapsed(){
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* seconds of audio in n columns */
+double columnsToSeconds( double n ){
+	return n * ANALYZER_COLUMN_SAMPLES / ANALYZER_SAMPLE_RATE;
+}
+
+unsigned int secondsToColumns( double seconds ){
+	return (unsigned int)( seconds * ANALYZER_SAMPLE_RATE / ANALYZER_COLUMN_SAMPLES + 0.5 );
+}
+
+// -----------------------------------------------------------------------------
+// ROOMS
+
+struct Room{
+	string name;
+	vector<float> columns; // ANALYZER_FP_LENGTH values per column
+	unsigned int numColumns() const { return columns.size() / ANALYZER_FP_LENGTH; }
+	const float* column( unsigned int i ) const { return &columns[(size_t)i*ANALYZER_FP_LENGTH]; }
+};
+
+void saveColumn( const float* column, unsigned long long endSample, void* context ){
+	Room* room = (Room*)context;
+	room->columns.insert( room->columns.end(), column, column + ANALYZER_FP_LENGTH );
+}
+
+bool loadRoom( const char* filename, SpectrumAnalyzer& analyzer, Room& room ){
+	WavReader wav;
+	if( !wav.open( filename ) ) return false;
+	room.name = filename;
+	analyzer.reset();
+	analyzer.setColumnCallback( saveColumn, &room );
+	vector<float> samples( WAV_READ_FRAMES );
+	unsigned int n;
+	while( ( n = wav.read( &samples[0] ) ) > 0 ) analyzer.addSamples( &samples[0], n );
+	return true;
+}
+
+/* uniform in [0,1), from the synthetic rooms' own generator so that rooms do not depend on the C library */
+double uniform( unsigned long long* state ){
+	*state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return ( *state >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+double gaussian( unsigned long long* state ){
+	double u = uniform( state ), v = uniform( state );
+	return sqrt( -2 * log( 1 - u ) ) * cos( 2*M_PI*v );
+}
+
+/* Synthesizes a room: noise through SYNTH_RESONANCES two-pole resonators, plus hum at 50 or
+ * 60 Hz and its harmonics, and one or two steady tones, in 16-bit sample units. */
+void synthesizeRoom( unsigned int index, double seconds, SpectrumAnalyzer& analyzer, Room& room ){
+	char name[32];
+	snprintf( name, sizeof(name), "synthetic%u", index );
+	room.name = name;
+	unsigned long long state = 1 + index * 7919ULL;
+	for( unsigned int i=0; i<4; ++i ) uniform( &state );
+
+	double a1[SYNTH_RESONANCES], a2[SYNTH_RESONANCES], gain[SYNTH_RESONANCES];
+	double y1[SYNTH_RESONANCES] = { 0 }, y2[SYNTH_RESONANCES] = { 0 };
+	for( unsigned int r=0; r<SYNTH_RESONANCES; ++r ){
+		double f = 100 * pow( 80.0, uniform( &state ) ); // 100 Hz to 8 kHz
+		double radius = 0.99 - 0.1 * uniform( &state );
+		a1[r] = 2 * radius * cos( 2*M_PI*f / ANALYZER_SAMPLE_RATE );
+		a2[r] = -radius * radius;
+		gain[r] = ( 1 - radius ) * 4000 * pow( 10.0, -1.5 * uniform( &state ) );
+	}
+	double noiseLevel = 30 * pow( 10.0, uniform( &state ) ); // broadband level
+	double hum = ( uniform( &state ) < 0.5 )? 50 : 60;
+	double humLevel = 500 * uniform( &state );
+	unsigned int numTones = 1 + ( uniform( &state ) < 0.5 );
+	double toneFreq[2], toneLevel[2];
+	for( unsigned int t=0; t<2; ++t ){
+		toneFreq[t] = 200 + 6000 * uniform( &state );
+		toneLevel[t] = 300 * uniform( &state );
+	}
+
+	analyzer.reset();
+	analyzer.setColumnCallback( saveColumn, &room );
+	unsigned long long total = (unsigned long long)( seconds * ANALYZER_SAMPLE_RATE );
+	vector<float> samples( SYNTH_BLOCK );
+	for( unsigned long long start=0; start<total; start+=SYNTH_BLOCK ){
+		unsigned int n = ( total-start < SYNTH_BLOCK )? total-start : SYNTH_BLOCK;
+		for( unsigned int i=0; i<n; ++i ){
+			double t = (double)( start+i ) / ANALYZER_SAMPLE_RATE;
+			double x = gaussian( &state );
+			double v = noiseLevel * x;
+			for( unsigned int r=0; r<SYNTH_RESONANCES; ++r ){
+				double y = gain[r] * x + a1[r] * y1[r] + a2[r] * y2[r];
+				y2[r] = y1[r];
+				y1[r] = y;
+				v += y;
+			}
+			for( unsigned int h=1; h<=3; ++h ) v += humLevel / h * sin( 2*M_PI*hum*h*t );
+			for( unsigned int k=0; k<numTones; ++k ) v += toneLevel[k] * sin( 2*M_PI*toneFreq[k]*t );
+			samples[i] = v * 512; // 16-bit units to 8.24, as RemoteIO delivers
+		}
+		analyzer.addSamples( &samples[0], n );
+	}
+}
+
+// -----------------------------------------------------------------------------
+// TRACKERS
+
+/* a percentile tracker over the history, as Spectrogram keeps */
+class Tracker{
+public:
+	virtual ~Tracker(){}
+	virtual void update( const float* column ) = 0;
+	virtual void read( float* out ) = 0;
+	/* keeps only the newest keep columns, as SlidingPercentiles::forget() */
+	virtual void forget( unsigned int keep ) = 0;
+};
+
+/* one SlidingWindow (two heaps) per bin */
+class HeapTracker : public Tracker{
+public:
+	HeapTracker( unsigned int size, float percentile ) :
+	windows( ANALYZER_FP_LENGTH ), history( (size_t)size*ANALYZER_FP_LENGTH, INIT_VALUE ), size(size), tail(0){
+		for( unsigned int k=0; k<ANALYZER_FP_LENGTH; ++k ) windows[k] = new SlidingWindow( size, percentile, INIT_VALUE );
+	}
+	~HeapTracker(){
+		for( unsigned int k=0; k<ANALYZER_FP_LENGTH; ++k ) delete windows[k];
+	}
+	void update( const float* column ){
+		for( unsigned int k=0; k<ANALYZER_FP_LENGTH; ++k ) windows[k]->update( column[k] );
+		memcpy( &history[(size_t)tail*ANALYZER_FP_LENGTH], column, sizeof(float)*ANALYZER_FP_LENGTH );
+		tail = ( tail+1 ) % size;
+	}
+	void read( float* out ){
+		for( unsigned int k=0; k<ANALYZER_FP_LENGTH; ++k ) out[k] = windows[k]->getVal();
+	}
+	/* the heaps cannot drop values, so the whole window is added again: repeats of the
+	 * newest keep columns, then those columns themselves */
+	void forget( unsigned int keep ){
+		if( keep == 0 || keep >= size ) return;
+		vector<float> recent( (size_t)keep*ANALYZER_FP_LENGTH );
+		for( unsigned int i=0; i<keep; ++i ){
+			memcpy( &recent[(size_t)i*ANALYZER_FP_LENGTH], &history[(size_t)( ( tail + size - keep + i ) % size )*ANALYZER_FP_LENGTH],
+					sizeof(float)*ANALYZER_FP_LENGTH );
+		}
+		for( unsigned int i=0; i<size; ++i ){
+			unsigned int r = ( i < size-keep )? i%keep : i-(size-keep);
+			update( &recent[(size_t)r*ANALYZER_FP_LENGTH] );
+		}
+	}
+private:
+	vector<SlidingWindow*> windows;
+	vector<float> history; // the last size columns, for forget()
+	unsigned int size;
+	unsigned int tail;     // the oldest column of history
+};
+
+class PercentilesTracker : public Tracker{
+public:
+	PercentilesTracker( unsigned int size, float percentile, bool lazy ) :
+	percentiles( ANALYZER_FP_LENGTH, size, percentile, INIT_VALUE, lazy ){}
+	void update( const float* column ){ percentiles.update( column ); }
+	void read( float* out ){ percentiles.getVals( out ); }
+	void forget( unsigned int keep ){ percentiles.forget( keep ); }
+private:
+	SlidingPercentiles percentiles;
+};
+
+#define NUM_ENGINES 3
+const char* engineNames[NUM_ENGINES] = { "heaps", "eager", "lazy" };
+
+Tracker* newTracker( unsigned int engine, unsigned int size, float percentile ){
+	if( engine == 0 ) return new HeapTracker( size, percentile );
+	return new PercentilesTracker( size, percentile, engine == 2 );
+}
+
+// -----------------------------------------------------------------------------
+// MEASUREMENT
+
+struct Settings{
+	unsigned int leadColumns;  // of room A
+	unsigned int tailColumns;  // of room B
+	unsigned int queryColumns; // between queries
+	unsigned int ensemble;     // fingerprints per query
+	double tolerance;          // dB
+	bool changes;              // react to environment events
+	unsigned int forgetKeep;   // columns kept at a change, or 0 to keep the history
+	bool verbose;
+};
+
+/* one combination of history length, percentile and engine */
+struct Config{
+	unsigned int size;
+	float percentile;
+	unsigned int engine;
+};
+
+struct Result{
+	unsigned int pairs;
+	double stableSum, stableMax, top1Sum, top1Max;
+	unsigned int stableMissed, top1Missed;
+	unsigned int undetected; // with -c, splices which raised no change event
+	double trackerSeconds; // spent updating and reading the tracker
+	unsigned long long trackerColumns;
+};
+
+/* the environment events of the last column */
+struct Events{
+	bool changed, settled;
+};
+
+void recordEvent( EnvironmentEvent event, unsigned long long column, void* context ){
+	Events* events = (Events*)context;
+	if( event == ENVIRONMENT_CHANGED ) events->changed = true;
+	else events->settled = true;
+}
+
+/* the room closest to the mean distance from the observations */
+unsigned int topMatch( const vector<float>& database, unsigned int numRooms, const float* const* observations,
+					   unsigned int numObservations ){
+	unsigned int best = 0;
+	float bestDistance = FLT_MAX;
+	for( unsigned int r=0; r<numRooms; ++r ){
+		float sum = 0;
+		for( unsigned int o=0; o<numObservations; ++o ){
+			sum += acousticDistance( AcousticMetricL2, ANALYZER_FP_LENGTH, NULL,
+									 observations[o], &database[(size_t)r*ANALYZER_FP_LENGTH] );
+		}
+		if( sum < bestDistance ){
+			bestDistance = sum;
+			best = r;
+		}
+	}
+	return best;
+}
+
+/* the mean absolute difference between two fingerprints, in dB */
+double meanDifference( const float* a, const float* b ){
+	double sum = 0;
+	for( unsigned int k=0; k<ANALYZER_FP_LENGTH; ++k ) sum += fabs( a[k] - b[k] );
+	return sum / ANALYZER_FP_LENGTH;
+}
+
+/* Runs every pair of rooms through one configuration. */
+void measure( const vector<Room>& rooms, const Config& config, const Settings& set, Result& result ){
+	memset( &result, 0, sizeof(result) );
+	unsigned int numRooms = rooms.size();
+	unsigned int n = set.leadColumns + set.tailColumns;
+
+	// enroll each room from the last columns of its audio
+	vector<float> database( (size_t)numRooms * ANALYZER_FP_LENGTH );
+	for( unsigned int r=0; r<numRooms; ++r ){
+		Tracker* tracker = newTracker( config.engine, config.size, config.percentile );
+		unsigned int last = rooms[r].numColumns();
+		unsigned int first = ( last > config.size )? last - config.size : 0;
+		for( unsigned int c=first; c<last; ++c ) tracker->update( rooms[r].column( c ) );
+		tracker->read( &database[(size_t)r*ANALYZER_FP_LENGTH] );
+		delete tracker;
+	}
+
+	vector<float> fingerprints( (size_t)n * ANALYZER_FP_LENGTH );
+	vector<const float*> observations( set.ensemble );
+	vector<unsigned int> queries, ensembleStart;
+	ChangeDetector detector( ANALYZER_FP_LENGTH );
+	Events events;
+	detector.setEventCallback( recordEvent, &events );
+	for( unsigned int a=0; a<numRooms; ++a ){
+		for( unsigned int b=0; b<numRooms; ++b ){
+			if( a == b ) continue;
+			// the splice, with the fingerprint after every column, and the columns queried.  Each query
+			// ensembles the queries since ensembleStart, the first after the last change.
+			Tracker* tracker = newTracker( config.engine, config.size, config.percentile );
+			detector.reset();
+			queries.clear();
+			ensembleStart.clear();
+			unsigned int firstSinceChange = 0;
+			bool steady = false, forget = false, detected = false;
+			double trackerSeconds = 0;
+			for( unsigned int c=0; c<n; ++c ){
+				const float* column = ( c < set.leadColumns )? rooms[a].column( c ) : rooms[b].column( c - set.leadColumns );
+				double t0 = elapsed();
+				// a change seen after the last column is acted on before this one, as by the app's next plot update
+				if( forget ) tracker->forget( set.forgetKeep );
+				tracker->update( column );
+				tracker->read( &fingerprints[(size_t)c*ANALYZER_FP_LENGTH] );
+				trackerSeconds += elapsed() - t0;
+				forget = false;
+				bool timed = ( c+1 ) % set.queryColumns == 0;
+				if( set.changes ){
+					events.changed = events.settled = false;
+					detector.addColumn( column );
+					if( events.changed ){
+						firstSinceChange = queries.size();
+						if( c >= set.leadColumns ) detected = true;
+						forget = ( set.forgetKeep > 0 );
+						steady = false;
+					}
+					if( events.settled ) steady = true;
+					if( !events.settled && ( !timed || steady ) ) continue;
+				}else if( !timed ){
+					continue;
+				}
+				queries.push_back( c );
+				ensembleStart.push_back( firstSinceChange );
+			}
+			result.trackerSeconds += trackerSeconds;
+			result.trackerColumns += n;
+			delete tracker;
+
+			// the first column from which the fingerprint stays near its final value
+			const float* last = &fingerprints[(size_t)(n-1)*ANALYZER_FP_LENGTH];
+			unsigned int stable = set.leadColumns;
+			for( unsigned int c=set.leadColumns; c<n; ++c ){
+				if( !( meanDifference( &fingerprints[(size_t)c*ANALYZER_FP_LENGTH], last ) <= set.tolerance ) ) stable = c+1;
+			}
+			// the first query from which B stays on top
+			unsigned int top1 = n;
+			bool settled = false;
+			for( unsigned int q=0; q<queries.size(); ++q ){
+				unsigned int c = queries[q];
+				unsigned int numObservations = 0;
+				for( unsigned int o=0; o<set.ensemble && o <= q - ensembleStart[q]; ++o ){
+					observations[numObservations++] = &fingerprints[(size_t)queries[q-o]*ANALYZER_FP_LENGTH];
+				}
+				bool correct = ( topMatch( database, numRooms, &observations[0], numObservations ) == b );
+				if( c < set.leadColumns ) continue;
+				if( correct && !settled ){
+					top1 = c;
+					settled = true;
+				}else if( !correct ){
+					settled = false;
+					top1 = n;
+				}
+			}
+
+			// times from the splice to the end of the settling column
+			double stableSeconds = columnsToSeconds( stable + 1.0 - set.leadColumns );
+			double top1Seconds = columnsToSeconds( top1 + 1.0 - set.leadColumns );
+			if( stable >= n ){
+				stableSeconds = columnsToSeconds( set.tailColumns );
+				++result.stableMissed;
+			}
+			if( top1 >= n ){
+				top1Seconds = columnsToSeconds( set.tailColumns );
+				++result.top1Missed;
+			}
+			if( set.verbose ){
+				printf( "#\t%u\t%g\t%s\t%s\t%s\t%.1f%s\t%.1f%s\n", config.size, config.percentile, engineNames[config.engine],
+						rooms[a].name.c_str(), rooms[b].name.c_str(), stableSeconds, ( stable >= n )? "+" : "",
+						top1Seconds, ( top1 >= n )? "+" : "" );
+			}
+			if( set.changes && !detected ) ++result.undetected;
+			++result.pairs;
+			result.stableSum += stableSeconds;
+			result.top1Sum += top1Seconds;
+			if( stableSeconds > result.stableMax ) result.stableMax = stableSeconds;
+			if( top1Seconds > result.top1Max ) result.top1Max = top1Seconds;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+// MAIN
+
+int usage( const char* name ){
+	fprintf( stderr, "usage: %s [-s SIZES] [-p PERCENTILES] [-e ENGINES] [-a SECS] [-b SECS] [-q SECS] [-k N]\n"
+					 "       [-d DB] [-c [-f N]] [-v] ( WAV WAV... | -S N [-l SECS] )\n", name );
+	return 1;
+}
+
+/* splits a comma-separated list; @return false if it is empty */
+bool splitList( const char* list, vector<string>& items ){
+	items.clear();
+	string s( list );
+	size_t start = 0;
+	while( start <= s.size() ){
+		size_t end = s.find( ',', start );
+		if( end == string::npos ) end = s.size();
+		if( end > start ) items.push_back( s.substr( start, end-start ) );
+		start = end+1;
+	}
+	return !items.empty();
+}
+
+int main( int argc, char** argv ){
+	vector<unsigned int> sizes( 1, ANALYZER_HISTORY );
+	vector<float> percentiles( 1, 0.05f );
+	vector<unsigned int> engines( 1, 1 );
+	double leadSeconds = 20, tailSeconds = 30, querySeconds = 2, synthSeconds = 60;
+	unsigned int numSynthetic = 0;
+	Settings set;
+	set.ensemble = 1;
+	set.tolerance = 1;
+	set.changes = false;
+	set.forgetKeep = 0;
+	set.verbose = false;
+	vector<string> items;
+	int c;
+	while( ( c = getopt( argc, argv, "s:p:e:a:b:q:k:d:cf:S:l:v" ) ) != -1 ){
+		switch( c ){
+			case 's':
+				if( !splitList( optarg, items ) ) return usage( argv[0] );
+				sizes.clear();
+				for( unsigned int i=0; i<items.size(); ++i ){
+					int s = atoi( items[i].c_str() );
+					if( s < 1 ) return usage( argv[0] );
+					sizes.push_back( s );
+				}
+				break;
+			case 'p':
+				if( !splitList( optarg, items ) ) return usage( argv[0] );
+				percentiles.clear();
+				for( unsigned int i=0; i<items.size(); ++i ){
+					float p = atof( items[i].c_str() );
+					if( !( p > 0 && p <= 1 ) ) return usage( argv[0] );
+					percentiles.push_back( p );
+				}
+				break;
+			case 'e':
+				if( !splitList( optarg, items ) ) return usage( argv[0] );
+				engines.clear();
+				for( unsigned int i=0; i<items.size(); ++i ){
+					unsigned int e = 0;
+					while( e < NUM_ENGINES && items[i] != engineNames[e] ) ++e;
+					if( e == NUM_ENGINES ) return usage( argv[0] );
+					engines.push_back( e );
+				}
+				break;
+			case 'a': leadSeconds = atof( optarg ); break;
+			case 'b': tailSeconds = atof( optarg ); break;
+			case 'q': querySeconds = atof( optarg ); break;
+			case 'k': set.ensemble = atoi( optarg ); break;
+			case 'd': set.tolerance = atof( optarg ); break;
+			case 'c': set.changes = true; break;
+			case 'f': set.forgetKeep = atoi( optarg ); break;
+			case 'S': numSynthetic = atoi( optarg ); break;
+			case 'l': synthSeconds = atof( optarg ); break;
+			case 'v': set.verbose = true; break;
+			default: return usage( argv[0] );
+		}
+	}
+	set.leadColumns = secondsToColumns( leadSeconds );
+	set.tailColumns = secondsToColumns( tailSeconds );
+	set.queryColumns = secondsToColumns( querySeconds );
+	if( set.leadColumns < 1 || set.tailColumns < 1 || set.queryColumns < 1 || set.ensemble < 1
+		|| !( set.tolerance > 0 ) || ( set.forgetKeep && !set.changes ) ) return usage( argv[0] );
+	unsigned int numRooms = numSynthetic? numSynthetic : argc - optind;
+	if( numRooms < 2 || ( numSynthetic && optind < argc ) ) return usage( argv[0] );
+
+	// analyze the rooms
+	double t0 = elapsed();
+	SpectrumAnalyzer analyzer;
+	vector<Room> rooms( numRooms );
+	for( unsigned int r=0; r<numRooms; ++r ){
+		if( numSynthetic ) synthesizeRoom( r, synthSeconds, analyzer, rooms[r] );
+		else if( !loadRoom( argv[optind+r], analyzer, rooms[r] ) ) return 1;
+		unsigned int needed = ( set.leadColumns > set.tailColumns )? set.leadColumns : set.tailColumns;
+		if( rooms[r].numColumns() < needed ){
+			fprintf( stderr, "Error: %s has %.1f s of audio, less than the %.1f s spliced\n", rooms[r].name.c_str(),
+					 columnsToSeconds( rooms[r].numColumns() ), columnsToSeconds( needed ) );
+			return 1;
+		}
+	}
+	fprintf( stderr, "%u rooms analyzed in %.2f s; %u pairs, %.1f s of A then %.1f s of B, queries every %.1f s\n",
+			 numRooms, elapsed()-t0, numRooms*(numRooms-1), columnsToSeconds( set.leadColumns ),
+			 columnsToSeconds( set.tailColumns ), columnsToSeconds( set.queryColumns ) );
+	for( unsigned int i=0; i<sizes.size(); ++i ){
+		if( sizes[i] > set.leadColumns ){
+			fprintf( stderr, "Warning: a history of %u columns is longer than room A, so it starts with silence\n", sizes[i] );
+		}
+	}
+
+	if( set.verbose ) printf( "#\tsize\tpercentile\tengine\tA\tB\tstable s\ttop-1 s\n" );
+	printf( "size\tpercentile\tengine\tstable s\tmax\tmissed\ttop-1 s\tmax\tmissed\tus/column\n" );
+	for( unsigned int i=0; i<sizes.size(); ++i ){
+		for( unsigned int j=0; j<percentiles.size(); ++j ){
+			for( unsigned int e=0; e<engines.size(); ++e ){
+				Config config = { sizes[i], percentiles[j], engines[e] };
+				Result r;
+				measure( rooms, config, set, r );
+				printf( "%u\t%g\t%s\t%.2f\t%.1f\t%u\t%.2f\t%.1f\t%u\t%.2f\n", config.size, config.percentile,
+						engineNames[config.engine], r.stableSum / r.pairs, r.stableMax, r.stableMissed,
+						r.top1Sum / r.pairs, r.top1Max, r.top1Missed, 1e6 * r.trackerSeconds / r.trackerColumns );
+				if( set.changes ) fprintf( stderr, "%u of %u splices raised no change event\n", r.undetected, r.pairs );
+				fflush( stdout );
+			}
+		}
+	}
+	return 0;
+}
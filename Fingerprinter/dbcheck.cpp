@@ -0,0 +1,449 @@
+/*
+ *  dbcheck.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * A check of the database's time index, expiry and coalescing, run by
+ *   make dbcheck
+ * First FingerprintDB's time index (Classes/TimeIndex.h) is filled with
+ * entries of known timestamps and rooms, including ties, and its range,
+ * newest-per-room, removal and expiry results are compared with those found
+ * by brute force.  Then a database file of the same entries is written, and
+ *   tester expire -t TIME DB
+ * is run at two times: the first must record the time in the expiry file
+ * and leave the database file alone, and the second, which expires most of
+ * the entries, must compact it.  After each, "tester list" must list just the
+ * live entries, in time order, and "tester list -n" the newest of each room.
+ * Last, a database of tight clusters of fingerprints, some of them already
+ * coalesced, is written and merged with
+ *   tester coalesce -e COALESCE_EPSILON -c DB
+ * Each room's cluster must leave one entry in the saved file: the oldest
+ * member's, with the sum of the counts, the newest timestamp and the
+ * count-weighted mean fingerprint.  Clusters of different rooms with the same
+ * fingerprints must not be merged, and a second run must leave the file alone.
+ * The first mismatch is printed, and the exit status is 1 if there was one.
+ *
+ * usage: build/dbcheck [TESTER]
+ * TESTER is the tool to check (default build/tester).
+ */
+
+#include "FingerprintFile.h"
+#include "TimeIndex.h"
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+#define DB_FILENAME "build/dbcheck.txt"
+#define NUM_ENTRIES 60
+#define NUM_ROOMS 7
+#define START_TIME 1300000000LL
+#define FIRST_EXPIRY ( START_TIME + 20*60 ) // expires a third of the entries
+#define SECOND_EXPIRY ( START_TIME + 45*60 ) // expires three quarters of them
+#define LINE_BYTES 4096
+// the coalescing database: clusters of similar fingerprints in each room, far apart
+#define COALESCE_ROOMS 3
+#define COALESCE_CLUSTERS 2
+#define COALESCE_MEMBERS 4
+#define COALESCE_LENGTH 6
+#define COALESCE_EPSILON 12.0
+#define COALESCE_TOLERANCE 0.02 // the file keeps 4 significant digits
+
+struct CheckEntry{
+	long long timestamp;
+	unsigned int room;
+};
+
+/* entries a minute apart, with pairs of ties, in an order which is not their time order */
+void makeEntries( vector<CheckEntry>& entries ){
+	entries.resize( NUM_ENTRIES );
+	for( unsigned int i=0; i<NUM_ENTRIES; ++i ){
+		unsigned int k = ( i*37 ) % NUM_ENTRIES; // a permutation, as 37 and 60 are coprime
+		entries[i].timestamp = START_TIME + 60*( k - k%2 );
+		entries[i].room = ( i*3 ) % NUM_ROOMS;
+	}
+}
+
+/* the entries from start to end inclusive, in time order and ties in insertion order */
+vector<unsigned int> bruteRange( const vector<CheckEntry>& entries, const vector<bool>& live,
+								 long long start, long long end ){
+	vector<unsigned int> result;
+	for( long long t=start; t<=end && t<=START_TIME + 60*NUM_ENTRIES; ++t ){
+		for( unsigned int i=0; i<entries.size(); ++i ){
+			if( live[i] && entries[i].timestamp == t ) result.push_back( i );
+		}
+	}
+	return result;
+}
+
+/* the newest live entry of each room, newest first, of ties the last inserted */
+vector<unsigned int> bruteNewest( const vector<CheckEntry>& entries, const vector<bool>& live ){
+	vector<unsigned int> inOrder = bruteRange( entries, live, START_TIME, START_TIME + 60*NUM_ENTRIES );
+	vector<unsigned int> result;
+	vector<bool> seen( NUM_ROOMS, false );
+	for( unsigned int j=inOrder.size(); j-- > 0; ){
+		unsigned int i = inOrder[j];
+		if( !seen[entries[i].room] ){
+			seen[entries[i].room] = true;
+			result.push_back( i );
+		}
+	}
+	return result;
+}
+
+bool same( const char* what, const vector<unsigned int>& got, const vector<unsigned int>& expected ){
+	for( unsigned int j=0; j<got.size() || j<expected.size(); ++j ){
+		if( j >= got.size() || j >= expected.size() || got[j] != expected[j] ){
+			fprintf( stderr, "%s: item %u is %d, expected %d\n", what, j,
+					 j < got.size()? (int)got[j] : -1, j < expected.size()? (int)expected[j] : -1 );
+			return false;
+		}
+	}
+	return true;
+}
+
+struct EntryRoom{
+	EntryRoom( const vector<CheckEntry>& e ) : entries(e){}
+	inline unsigned int operator()( unsigned int i ) const { return entries[i].room; }
+	const vector<CheckEntry>& entries;
+};
+
+bool checkIndex( const vector<CheckEntry>& entries ){
+	TimeIndex<unsigned int> index;
+	vector<bool> live( entries.size(), true );
+	// half inserted one at a time, half loaded in bulk
+	for( unsigned int i=0; i<entries.size()/2; ++i ) index.insert( entries[i].timestamp, i );
+	for( unsigned int i=entries.size()/2; i<entries.size(); ++i ) index.append( entries[i].timestamp, i );
+	index.sort();
+	// the bulk-loaded entries came after the inserted ones, so ties are still in insertion order
+	vector<unsigned int> got;
+	index.range( LLONG_MIN, LLONG_MAX, got );
+	if( !same( "whole range", got, bruteRange( entries, live, START_TIME, LLONG_MAX ) ) ) return false;
+	const long long ranges[][2] = { { START_TIME + 60*10, START_TIME + 60*20 }, { START_TIME + 61, START_TIME + 119 },
+									{ START_TIME - 60, START_TIME }, { START_TIME + 60*30, START_TIME + 60*29 } };
+	for( unsigned int r=0; r<sizeof(ranges)/sizeof(ranges[0]); ++r ){
+		got.clear();
+		index.range( ranges[r][0], ranges[r][1], got );
+		if( !same( "range", got, bruteRange( entries, live, ranges[r][0], ranges[r][1] ) ) ) return false;
+	}
+	got.clear();
+	index.newest( EntryRoom( entries ), NUM_ROOMS, got );
+	if( !same( "newest", got, bruteNewest( entries, live ) ) ) return false;
+
+	// remove every fifth entry, then expire a prefix
+	for( unsigned int i=0; i<entries.size(); i+=5 ){
+		if( !index.remove( entries[i].timestamp, i ) ){
+			fprintf( stderr, "remove: entry %u not found\n", i );
+			return false;
+		}
+		live[i] = false;
+	}
+	if( index.remove( entries[0].timestamp, 0 ) ){
+		fprintf( stderr, "remove: entry 0 removed twice\n" );
+		return false;
+	}
+	vector<unsigned int> expired;
+	index.expire( FIRST_EXPIRY, expired );
+	if( !same( "expire", expired, bruteRange( entries, live, START_TIME, FIRST_EXPIRY-1 ) ) ) return false;
+	for( unsigned int j=0; j<expired.size(); ++j ) live[expired[j]] = false;
+	got.clear();
+	index.range( LLONG_MIN, LLONG_MAX, got );
+	if( !same( "range after expiry", got, bruteRange( entries, live, START_TIME, LLONG_MAX ) ) ) return false;
+	if( index.size() != got.size() ){
+		fprintf( stderr, "size: %u, expected %u\n", index.size(), (unsigned int)got.size() );
+		return false;
+	}
+	got.clear();
+	index.newest( EntryRoom( entries ), NUM_ROOMS, got );
+	if( !same( "newest after expiry", got, bruteNewest( entries, live ) ) ) return false;
+	fprintf( stderr, "time index: ranges, removal, expiry and newest per room as expected\n" );
+	return true;
+}
+
+string uuidOf( unsigned int i ){
+	char buf[64];
+	snprintf( buf, sizeof(buf), "00000000-0000-4000-8000-%012u", i );
+	return buf;
+}
+
+string roomOf( unsigned int room ){
+	char buf[32];
+	snprintf( buf, sizeof(buf), "room %u", room );
+	return buf;
+}
+
+bool writeDatabase( const vector<CheckEntry>& entries ){
+	FILE* file = fopen( DB_FILENAME, "w" );
+	if( !file ) return false;
+	FingerprintEntry e;
+	e.latitude = e.longitude = e.altitude = 0;
+	e.horizontalAccuracy = e.verticalAccuracy = -1;
+	e.building = "check";
+	e.count = 1;
+	e.fingerprint.assign( 4, 50.0f );
+	for( unsigned int i=0; i<entries.size(); ++i ){
+		e.uuid = uuidOf( i );
+		e.timestamp = entries[i].timestamp;
+		e.room = roomOf( entries[i].room );
+		if( !writeFingerprintEntry( file, e ) ){
+			fclose( file );
+			return false;
+		}
+	}
+	return fclose( file ) == 0;
+}
+
+/* runs a command, collecting its output lines.  @return false if it failed */
+bool run( const string& command, vector<string>* lines ){
+	FILE* out = popen( command.c_str(), "r" );
+	if( !out ){
+		fprintf( stderr, "Error: could not run %s\n", command.c_str() );
+		return false;
+	}
+	char line[LINE_BYTES];
+	while( fgets( line, sizeof(line), out ) ){
+		line[strcspn( line, "\n" )] = '\0';
+		if( lines ) lines->push_back( line );
+	}
+	if( pclose( out ) != 0 ){
+		fprintf( stderr, "Error: %s failed\n", command.c_str() );
+		return false;
+	}
+	return true;
+}
+
+/* compares the output of "tester list" with the entries it should list */
+bool checkList( const string& tester, const char* options, const vector<CheckEntry>& entries,
+				const vector<unsigned int>& expected ){
+	vector<string> lines;
+	if( !run( tester + " list " + options + " " DB_FILENAME " 2>/dev/null", &lines ) ) return false;
+	for( unsigned int j=0; j<lines.size() || j<expected.size(); ++j ){
+		string want;
+		if( j < expected.size() ){
+			unsigned int i = expected[j];
+			char buf[256];
+			snprintf( buf, sizeof(buf), "%s\t%lld\tcheck\t%s", uuidOf( i ).c_str(), entries[i].timestamp, roomOf( entries[i].room ).c_str() );
+			want = buf;
+		}
+		if( j >= lines.size() || j >= expected.size() || lines[j] != want ){
+			fprintf( stderr, "list %s line %u: got\n%s\nexpected\n%s\n", options, j+1,
+					 j < lines.size()? lines[j].c_str() : "(end of output)",
+					 j < expected.size()? want.c_str() : "(end of output)" );
+			return false;
+		}
+	}
+	return true;
+}
+
+unsigned int countLines( const char* filename ){
+	FILE* file = fopen( filename, "r" );
+	if( !file ) return 0;
+	unsigned int n = 0;
+	int c;
+	while( ( c = fgetc( file ) ) != EOF ) if( c == '\n' ) ++n;
+	fclose( file );
+	return n;
+}
+
+bool checkExpiry( const string& tester, const vector<CheckEntry>& entries ){
+	string expiryFile = expiryFilename( DB_FILENAME );
+	unlink( expiryFile.c_str() );
+	if( !writeDatabase( entries ) ){
+		fprintf( stderr, "Error: could not write %s\n", DB_FILENAME );
+		return false;
+	}
+	vector<bool> live( entries.size(), true );
+	const long long times[] = { FIRST_EXPIRY, SECOND_EXPIRY };
+	for( unsigned int k=0; k<2; ++k ){
+		char command[1024];
+		snprintf( command, sizeof(command), "%s expire -t %lld %s 2>/dev/null", tester.c_str(), times[k], DB_FILENAME );
+		if( !run( command, NULL ) ) return false;
+		if( readExpiryTime( expiryFile.c_str() ) != times[k] ){
+			fprintf( stderr, "expire -t %lld: %s holds %lld\n", times[k], expiryFile.c_str(), readExpiryTime( expiryFile.c_str() ) );
+			return false;
+		}
+		unsigned int numLive = 0;
+		for( unsigned int i=0; i<entries.size(); ++i ){
+			if( entries[i].timestamp < times[k] ) live[i] = false;
+			if( live[i] ) ++numLive;
+		}
+		// the file is only rewritten once expired entries outnumber live ones
+		unsigned int expectedLines = ( entries.size() - numLive > numLive )? numLive : entries.size();
+		if( countLines( DB_FILENAME ) != expectedLines ){
+			fprintf( stderr, "expire -t %lld: %s has %u lines, expected %u\n", times[k], DB_FILENAME,
+					 countLines( DB_FILENAME ), expectedLines );
+			return false;
+		}
+		if( !checkList( tester, "", entries, bruteRange( entries, live, START_TIME, LLONG_MAX ) ) ||
+		    !checkList( tester, "-n", entries, bruteNewest( entries, live ) ) ) return false;
+	}
+	// an earlier time does not bring entries back
+	char command[1024];
+	snprintf( command, sizeof(command), "%s expire -t %lld %s 2>/dev/null", tester.c_str(), (long long)START_TIME, DB_FILENAME );
+	if( !run( command, NULL ) ) return false;
+	if( readExpiryTime( expiryFile.c_str() ) != SECOND_EXPIRY ){
+		fprintf( stderr, "expire -t %lld: the expiry time moved back\n", (long long)START_TIME );
+		return false;
+	}
+	fprintf( stderr, "tester expire: expiry file, compaction and listed entries as expected\n" );
+	return true;
+}
+
+struct ClusterEntry{
+	FingerprintEntry entry;
+	unsigned int cluster; // over all rooms
+};
+
+/* the members of every cluster, in a shuffled file order, with one more entry alone in its cluster */
+void makeClusters( vector<ClusterEntry>& entries ){
+	unsigned int numClustered = COALESCE_ROOMS * COALESCE_CLUSTERS * COALESCE_MEMBERS;
+	entries.resize( numClustered + 1 );
+	for( unsigned int j=0; j<entries.size(); ++j ){
+		unsigned int i = ( j*7 ) % entries.size(); // a permutation, as 7 and 25 are coprime
+		FingerprintEntry& e = entries[j].entry;
+		e.uuid = uuidOf( 1000+j );
+		e.timestamp = START_TIME + 60*i;
+		e.latitude = e.longitude = e.altitude = 0;
+		e.horizontalAccuracy = e.verticalAccuracy = -1;
+		e.building = "merge";
+		e.fingerprint.resize( COALESCE_LENGTH );
+		if( i == numClustered ){
+			e.room = roomOf( 0 );
+			e.count = 1;
+			e.fingerprint.assign( COALESCE_LENGTH, 100.0f );
+			entries[j].cluster = COALESCE_ROOMS * COALESCE_CLUSTERS;
+			continue;
+		}
+		unsigned int room = i % COALESCE_ROOMS, cluster = ( i / COALESCE_ROOMS ) % COALESCE_CLUSTERS;
+		unsigned int member = i / ( COALESCE_ROOMS * COALESCE_CLUSTERS );
+		e.room = roomOf( room );
+		e.count = ( member % 2 == 0 )? 3 : 1;
+		// every room has the same clusters, 30 dB apart, members within 4 dB of each other
+		for( unsigned int k=0; k<COALESCE_LENGTH; ++k ) e.fingerprint[k] = 40 + 30*cluster + 2.0f*( ( member+k ) % 3 );
+		entries[j].cluster = room * COALESCE_CLUSTERS + cluster;
+	}
+}
+
+/* each cluster merged, in the file order of its oldest member */
+vector<FingerprintEntry> expectedClusters( const vector<ClusterEntry>& entries ){
+	unsigned int numClusters = COALESCE_ROOMS * COALESCE_CLUSTERS + 1;
+	vector<int> oldest( numClusters, -1 );
+	for( unsigned int j=0; j<entries.size(); ++j ){
+		int& o = oldest[entries[j].cluster];
+		if( o < 0 || entries[j].entry.timestamp < entries[o].entry.timestamp ) o = j;
+	}
+	vector<FingerprintEntry> result;
+	for( unsigned int j=0; j<entries.size(); ++j ){
+		unsigned int cluster = entries[j].cluster;
+		if( oldest[cluster] != (int)j ) continue;
+		FingerprintEntry merged = entries[j].entry;
+		merged.count = 0;
+		merged.fingerprint.assign( COALESCE_LENGTH, 0.0f );
+		for( unsigned int m=0; m<entries.size(); ++m ){
+			const FingerprintEntry& e = entries[m].entry;
+			if( entries[m].cluster != cluster ) continue;
+			merged.count += e.count;
+			if( e.timestamp > merged.timestamp ) merged.timestamp = e.timestamp;
+			for( unsigned int k=0; k<COALESCE_LENGTH; ++k ) merged.fingerprint[k] += e.count * e.fingerprint[k];
+		}
+		for( unsigned int k=0; k<COALESCE_LENGTH; ++k ) merged.fingerprint[k] /= merged.count;
+		result.push_back( merged );
+	}
+	return result;
+}
+
+string readFile( const char* filename ){
+	string content;
+	FILE* file = fopen( filename, "r" );
+	if( !file ) return content;
+	char buf[LINE_BYTES];
+	size_t n;
+	while( ( n = fread( buf, 1, sizeof(buf), file ) ) > 0 ) content.append( buf, n );
+	fclose( file );
+	return content;
+}
+
+bool checkCoalesce( const string& tester ){
+	unlink( expiryFilename( DB_FILENAME ).c_str() );
+	vector<ClusterEntry> entries;
+	makeClusters( entries );
+	FILE* file = fopen( DB_FILENAME, "w" );
+	bool written = file;
+	for( unsigned int j=0; j<entries.size() && written; ++j ) written = writeFingerprintEntry( file, entries[j].entry );
+	if( !file || fclose( file ) || !written ){
+		fprintf( stderr, "Error: could not write %s\n", DB_FILENAME );
+		return false;
+	}
+	char command[1024];
+	snprintf( command, sizeof(command), "%s coalesce -e %g -c %s 2>/dev/null", tester.c_str(), COALESCE_EPSILON, DB_FILENAME );
+	if( !run( command, NULL ) ) return false;
+
+	vector<FingerprintEntry> expected = expectedClusters( entries );
+	file = fopen( DB_FILENAME, "r" );
+	if( !file ){
+		fprintf( stderr, "Error: could not read %s\n", DB_FILENAME );
+		return false;
+	}
+	FingerprintFileReader reader( file );
+	FingerprintEntry e;
+	unsigned int n = 0;
+	bool ok = true;
+	while( ok && reader.next( e ) ){
+		if( n >= expected.size() ){
+			fprintf( stderr, "coalesce: entry %u %s was not expected\n", n+1, e.uuid.c_str() );
+			ok = false;
+			break;
+		}
+		const FingerprintEntry& x = expected[n++];
+		if( e.uuid != x.uuid || e.room != x.room || e.count != x.count || e.timestamp != x.timestamp ||
+		    e.fingerprint.size() != x.fingerprint.size() ){
+			fprintf( stderr, "coalesce: entry %u is %s of %s, count %u, time %lld; expected %s of %s, count %u, time %lld\n", n,
+					 e.uuid.c_str(), e.room.c_str(), e.count, e.timestamp, x.uuid.c_str(), x.room.c_str(), x.count, x.timestamp );
+			ok = false;
+			break;
+		}
+		for( unsigned int k=0; k<x.fingerprint.size(); ++k ){
+			if( fabs( e.fingerprint[k] - x.fingerprint[k] ) > COALESCE_TOLERANCE ){
+				fprintf( stderr, "coalesce: entry %u value %u is %g, expected the weighted mean %g\n",
+						 n, k, e.fingerprint[k], x.fingerprint[k] );
+				ok = false;
+				break;
+			}
+		}
+	}
+	fclose( file );
+	if( ok && n != expected.size() ){
+		fprintf( stderr, "coalesce: %u entries saved, expected %u\n", n, (unsigned int)expected.size() );
+		ok = false;
+	}
+	if( !ok ) return false;
+
+	// nothing is left within epsilon, so a second pass must not rewrite the file
+	string before = readFile( DB_FILENAME );
+	if( !run( command, NULL ) ) return false;
+	if( readFile( DB_FILENAME ) != before ){
+		fprintf( stderr, "coalesce: a second pass changed %s\n", DB_FILENAME );
+		return false;
+	}
+	fprintf( stderr, "tester coalesce: %u entries merged into %u as expected\n",
+			 (unsigned int)entries.size(), (unsigned int)expected.size() );
+	return true;
+}
+
+int main( int argc, char** argv ){
+	string tester = ( argc > 1 )? argv[1] : "build/tester";
+	vector<CheckEntry> entries;
+	makeEntries( entries );
+	if( !checkIndex( entries ) ) return 1;
+	if( !checkExpiry( tester, entries ) ) return 1;
+	if( !checkCoalesce( tester ) ) return 1;
+	return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ *  joincheck.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * A round-trip check of capturejoin's spectrum and fingerprint streams, run by
+ *   make joincheck
+ * It writes a capture file (Classes/CaptureFile.h) with "spectra" and
+ * "fingerprints" streams of known SpectrumRecords, in several compressed and
+ * encoded chunks as SensorCapture writes them, joins it with
+ *   capturejoin -i JOIN_INTERVAL -b JOIN_FIRST_BIN,JOIN_LAST_BIN FILE spectra:nearest fingerprints
+ * and compares every line with the table expected from the records.  The
+ * first mismatch is printed, and the exit status is 1 if there was one.
+ *
+ * usage: build/joincheck [CAPTUREJOIN]
+ * CAPTUREJOIN is the tool to check (default build/capturejoin).
+ */
+
+#include "CaptureFile.h"
+#include "SpectrumLog.h"
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+#define CAPTURE_FILENAME "build/joincheck.bpc"
+#define CLOCK_OFFSET 1000.0
+#define START_TIME 10.0
+#define NUM_SPECTRA 50
+#define SPECTRUM_PERIOD 0.1
+#define NUM_FINGERPRINTS 5
+#define FINGERPRINT_PERIOD 1.0
+#define CHUNK_RECORDS 16 // spectra per chunk, so that the cursor crosses chunks
+#define JOIN_INTERVAL 0.25
+#define JOIN_FIRST_BIN 2
+#define JOIN_LAST_BIN 5
+#define LINE_BYTES 4096
+
+/* the known records.  Spectra fall between the rows' times so that none is equally near two. */
+void makeRecords( vector<SpectrumRecord>& spectra, vector<SpectrumRecord>& fingerprints ){
+	spectra.resize( NUM_SPECTRA );
+	for( unsigned int k=0; k<NUM_SPECTRA; ++k ){
+		SpectrumRecord& r = spectra[k];
+		memset( &r, 0, sizeof(r) );
+		r.timestamp = START_TIME + k*SPECTRUM_PERIOD + 0.03;
+		r.offset = -20.0f - k;
+		for( unsigned int i=0; i<SPECTRUM_BINS; ++i ) r.level[i] = (uint8_t)( k*7 + i*3 );
+	}
+	fingerprints.resize( NUM_FINGERPRINTS );
+	for( unsigned int j=0; j<NUM_FINGERPRINTS; ++j ){
+		SpectrumRecord& r = fingerprints[j];
+		memset( &r, 0, sizeof(r) );
+		r.timestamp = START_TIME + j*FINGERPRINT_PERIOD + 0.5;
+		r.offset = 60.0f + j;
+		for( unsigned int i=0; i<SPECTRUM_BINS; ++i ) r.level[i] = (uint8_t)( j*11 + i );
+	}
+}
+
+bool writeCapture( const vector<SpectrumRecord>& spectra, const vector<SpectrumRecord>& fingerprints ){
+	CaptureWriter capture( CAPTURE_FILENAME, CLOCK_OFFSET );
+	if( !capture.isOpen() ) return false;
+	unsigned int spectraId = capture.addStream( "spectra", SensorLogSpectrum, sizeof(SpectrumRecord), true );
+	unsigned int fingerprintsId = capture.addStream( "fingerprints", SensorLogFingerprint, sizeof(SpectrumRecord), true );
+	for( unsigned int k=0; k<spectra.size(); k+=CHUNK_RECORDS ){
+		unsigned int n = ( spectra.size() - k < CHUNK_RECORDS )? spectra.size() - k : CHUNK_RECORDS;
+		capture.writeRecords( spectraId, &spectra[k], n * sizeof(SpectrumRecord) );
+	}
+	capture.writeRecords( fingerprintsId, &fingerprints[0], fingerprints.size() * sizeof(SpectrumRecord) );
+	capture.close();
+	return true;
+}
+
+/* appends the selected bins of a record, or blanks if it is NULL, as capturejoin prints them */
+void appendBins( string& line, const SpectrumRecord* r ){
+	float dB[SPECTRUM_BINS];
+	if( r ) dequantizeSpectrum( *r, SPECTRUM_BINS, dB );
+	for( unsigned int i=JOIN_FIRST_BIN; i<=JOIN_LAST_BIN; ++i ){
+		char buf[64];
+		if( r ) snprintf( buf, sizeof(buf), "\t%g", (double)dB[i] );
+		else snprintf( buf, sizeof(buf), "\t" );
+		line += buf;
+	}
+}
+
+/* the latest record at or before t, or NULL */
+const SpectrumRecord* previous( const vector<SpectrumRecord>& records, double t ){
+	const SpectrumRecord* found = NULL;
+	for( unsigned int i=0; i<records.size() && records[i].timestamp <= t; ++i ) found = &records[i];
+	return found;
+}
+
+/* the closest record to t, the earlier one on a tie */
+const SpectrumRecord* nearest( const vector<SpectrumRecord>& records, double t ){
+	const SpectrumRecord* prev = previous( records, t );
+	const SpectrumRecord* next = prev? prev+1 : &records[0];
+	if( next == &records[0] + records.size() ) return prev;
+	if( !prev ) return next;
+	return ( next->timestamp - t < t - prev->timestamp )? next : prev;
+}
+
+void expectedTable( const vector<SpectrumRecord>& spectra, const vector<SpectrumRecord>& fingerprints,
+					vector<string>& lines ){
+	string header = "time";
+	for( unsigned int i=JOIN_FIRST_BIN; i<=JOIN_LAST_BIN; ++i ){
+		char buf[64];
+		snprintf( buf, sizeof(buf), "\tspectra.bin%u", i );
+		header += buf;
+	}
+	for( unsigned int i=JOIN_FIRST_BIN; i<=JOIN_LAST_BIN; ++i ){
+		char buf[64];
+		snprintf( buf, sizeof(buf), "\tfingerprints.bin%u", i );
+		header += buf;
+	}
+	lines.push_back( header );
+	// rows span the streams, from the first record of either to the last
+	double start = spectra[0].timestamp < fingerprints[0].timestamp? spectra[0].timestamp : fingerprints[0].timestamp;
+	double end = spectra.back().timestamp > fingerprints.back().timestamp? spectra.back().timestamp : fingerprints.back().timestamp;
+	for( unsigned long row=0; ; ++row ){
+		double t = start + row*JOIN_INTERVAL;
+		if( t > end ) break;
+		char buf[64];
+		snprintf( buf, sizeof(buf), "%.3f", t + CLOCK_OFFSET );
+		string line = buf;
+		appendBins( line, nearest( spectra, t ) );
+		appendBins( line, previous( fingerprints, t ) );
+		lines.push_back( line );
+	}
+}
+
+int main( int argc, char** argv ){
+	const char* capturejoin = ( argc > 1 )? argv[1] : "build/capturejoin";
+	vector<SpectrumRecord> spectra, fingerprints;
+	makeRecords( spectra, fingerprints );
+	if( !writeCapture( spectra, fingerprints ) ){
+		fprintf( stderr, "Error: could not write %s\n", CAPTURE_FILENAME );
+		return 1;
+	}
+	vector<string> expected;
+	expectedTable( spectra, fingerprints, expected );
+
+	char command[1024];
+	snprintf( command, sizeof(command), "%s -i %g -b %u,%u %s spectra:nearest fingerprints",
+			  capturejoin, JOIN_INTERVAL, JOIN_FIRST_BIN, JOIN_LAST_BIN, CAPTURE_FILENAME );
+	FILE* out = popen( command, "r" );
+	if( !out ){
+		fprintf( stderr, "Error: could not run %s\n", command );
+		return 1;
+	}
+	char line[LINE_BYTES];
+	unsigned int n = 0;
+	bool ok = true;
+	while( ok && fgets( line, sizeof(line), out ) ){
+		line[strcspn( line, "\n" )] = '\0';
+		if( n >= expected.size() || expected[n] != line ){
+			fprintf( stderr, "line %u: got\n%s\nexpected\n%s\n", n+1, line,
+					 n < expected.size()? expected[n].c_str() : "(end of output)" );
+			ok = false;
+		}
+		++n;
+	}
+	if( pclose( out ) != 0 ){
+		fprintf( stderr, "Error: %s failed\n", command );
+		return 1;
+	}
+	if( ok && n != expected.size() ){
+		fprintf( stderr, "got %u lines, expected %u\n", n, (unsigned int)expected.size() );
+		ok = false;
+	}
+	if( !ok ) return 1;
+	fprintf( stderr, "capturejoin: %u rows of spectra and fingerprints joined as expected\n", n-1 );
+	return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ *  mathbench.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Checks the approximations of Classes/FastMath.h against double precision
+ * libm and times them against the float libm calls they replace, eg.
+ *   build/mathbench
+ * Each function is evaluated at evenly spaced points of its range, on a log
+ * scale where the inputs span many octaves, plus the special values.  The
+ * largest error of each is printed with its documented bound, and the program
+ * fails if any bound is exceeded or a special value is wrong.  The dB check
+ * covers powers from 1e-30 to 1e30, well beyond the 8.24 fixed-point
+ * spectrogram's range.  For meaningful timings, build with optimization, eg.
+ *   make clean; make CFLAGS=-O2 build/mathbench
+ *
+ * Options:
+ *   -n N   points checked per function (default 4000000)
+ *   -r N   runs to time, keeping the best (default 5)
+ */
+
+#include "FastMath.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <vector>
+
+using std::vector;
+
+/* wall-clock seconds, for timing */
+double elapsed(){
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* n points from lo to hi, evenly spaced, or evenly spaced in log if logScale */
+void makePoints( vector<float>& x, unsigned int n, double lo, double hi, bool logScale ){
+	x.resize( n );
+	for( unsigned int i=0; i<n; ++i ){
+		double t = (double)i / ( n-1 );
+		x[i] = logScale? (float)exp( log( lo ) + t * ( log( hi ) - log( lo ) ) ) : (float)( lo + t * ( hi - lo ) );
+	}
+}
+
+/* applies a vector function to x, four at a time; the length is a multiple of 4 */
+template <Float4 (*F)( Float4 )>
+void apply( const vector<float>& x, vector<float>& y ){
+	y.resize( x.size() );
+	for( size_t i=0; i+4 <= x.size(); i+=4 ) f4_store( &y[i], F( f4_load( &x[i] ) ) );
+}
+
+enum ErrorKind{ ABSOLUTE, RELATIVE, LOGARITHM };
+
+/* largest error of y against f(x): absolute, relative, or for logarithms absolute within
+ * [-1,1] and relative beyond */
+double largestError( const vector<float>& x, const vector<float>& y, double (*f)( double ), ErrorKind kind ){
+	double worst = 0;
+	for( size_t i=0; i<x.size(); ++i ){
+		double exact = f( x[i] );
+		double err = fabs( y[i] - exact );
+		if( kind == RELATIVE ) err /= fabs( exact );
+		else if( kind == LOGARITHM && fabs( exact ) > 1 ) err /= fabs( exact );
+		if( err > worst ) worst = err;
+	}
+	return worst;
+}
+
+double exp2d( double x ){ return pow( 2.0, x ); }
+double log2d( double x ){ return log( x ) / log( 2.0 ); }
+double decibels( double x ){ return 10 * log10( x ); }
+Float4 pow075( Float4 x ){ return f4_pow( x, f4_splat( 0.75f ) ); }
+double pow075d( double x ){ return pow( x, 0.75 ); }
+
+bool report( const char* name, double err, double bound ){
+	bool ok = err <= bound;
+	printf( "  %-14s %12.3g %12.3g %s\n", name, err, bound, ok? "" : "FAILED" );
+	return ok;
+}
+
+/* compares a single value with the expected one, which may be infinite or NaN */
+bool checkSpecial( const char* name, float x, float y, float expected ){
+	bool ok = ( isnan( expected ) && isnan( y ) ) || y == expected;
+	if( !ok ) printf( "  %s(%g) is %g, not %g  FAILED\n", name, x, y, expected );
+	return ok;
+}
+
+bool checkSpecials(){
+	const float in[] = { 0.0f, -1.0f, INFINITY, -INFINITY, NAN, 1.0f, 1e-40f };
+	const float log2Want[] = { -INFINITY, NAN, INFINITY, NAN, NAN, 0.0f }; // the denormal is checked below
+	const float exp2Want[] = { 1.0f, 0.5f, INFINITY, 0.0f, NAN, 2.0f, 1.0f };
+	bool ok = true;
+	for( unsigned int i=0; i<sizeof(in)/sizeof(in[0]); ++i ){
+		float l[4], e[4];
+		f4_store( l, f4_log2( f4_splat( in[i] ) ) );
+		f4_store( e, f4_exp2( f4_splat( in[i] ) ) );
+		if( i+1 < sizeof(in)/sizeof(in[0]) ){
+			ok = checkSpecial( "log2", in[i], l[0], log2Want[i] ) && ok;
+		}else if( !( fabs( l[0] - log2( 1e-40 ) ) < 1e-4 || l[0] == -INFINITY ) ){
+			// a denormal: exact, or zero if the FPU flushes denormals
+			printf( "  log2(%g) is %g  FAILED\n", in[i], l[0] );
+			ok = false;
+		}
+		ok = checkSpecial( "exp2", in[i], e[0], exp2Want[i] ) && ok;
+	}
+	return ok;
+}
+
+/* best time of several runs of fn over x, in ns per value */
+double timeRuns( void (*fn)( const vector<float>&, vector<float>& ), const vector<float>& x, vector<float>& y,
+				 unsigned int runs ){
+	double best = DBL_MAX;
+	for( unsigned int r=0; r<runs; ++r ){
+		double start = elapsed();
+		fn( x, y );
+		double t = elapsed() - start;
+		if( t < best ) best = t;
+	}
+	return best * 1e9 / x.size();
+}
+
+void libmDecibels( const vector<float>& x, vector<float>& y ){
+	y.resize( x.size() );
+	for( size_t i=0; i<x.size(); ++i ) y[i] = 10 * log10f( x[i] / 10.0f );
+}
+void fastDecibelsAll( const vector<float>& x, vector<float>& y ){
+	y.resize( x.size() );
+	fastDecibels( &x[0], &y[0], x.size(), 10.0f );
+}
+void libmExp2( const vector<float>& x, vector<float>& y ){
+	y.resize( x.size() );
+	for( size_t i=0; i<x.size(); ++i ) y[i] = exp2f( x[i] );
+}
+void fastExp2All( const vector<float>& x, vector<float>& y ){ apply<f4_exp2>( x, y ); }
+
+void usage( const char* name ){
+	fprintf( stderr, "usage: %s [-n POINTS] [-r RUNS]\n", name );
+}
+
+int main( int argc, char** argv ){
+	unsigned int n = 4000000;
+	unsigned int runs = 5;
+	int c;
+	while( ( c = getopt( argc, argv, "n:r:" ) ) != -1 ){
+		switch( c ){
+			case 'n': n = atoi( optarg ); break;
+			case 'r': runs = atoi( optarg ); break;
+			default:
+				usage( argv[0] );
+				return 1;
+		}
+	}
+	if( optind != argc || n < 8 || runs == 0 ){
+		usage( argv[0] );
+		return 1;
+	}
+	n &= ~3u;
+
+	bool ok = true;
+	vector<float> x, y;
+	printf( "%u points per function\n", n );
+	printf( "  %-14s %12s %12s\n", "function", "max error", "bound" );
+
+	makePoints( x, n, FLT_MIN, FLT_MAX, true );
+	apply<f4_log2>( x, y );
+	ok = report( "log2", largestError( x, y, log2d, LOGARITHM ), FAST_LOG2_ERROR ) && ok;
+	apply<f4_log10>( x, y );
+	ok = report( "log10", largestError( x, y, log10, LOGARITHM ), FAST_LOG10_ERROR ) && ok;
+	makePoints( x, n, 0.5, 2.0, false ); // near 1, where the result is small
+	apply<f4_log2>( x, y );
+	ok = report( "log2 [0.5,2]", largestError( x, y, log2d, LOGARITHM ), FAST_LOG2_ERROR ) && ok;
+
+	makePoints( x, n, 1e-30, 1e30, true );
+	vector<float> db;
+	fastDecibelsAll( x, db );
+	for( size_t i=0; i<x.size(); ++i ) x[i] /= 10.0f; // the reference
+	ok = report( "decibels", largestError( x, db, decibels, ABSOLUTE ), FAST_DECIBELS_ERROR ) && ok;
+
+	makePoints( x, n, -126, 127, false );
+	apply<f4_exp2>( x, y );
+	ok = report( "exp2", largestError( x, y, exp2d, RELATIVE ), FAST_EXP2_ERROR ) && ok;
+	makePoints( x, n, log( 1e-30 ), log( 1e30 ), false );
+	apply<f4_exp>( x, y );
+	ok = report( "exp", largestError( x, y, exp, RELATIVE ), FAST_EXP_ERROR ) && ok;
+	makePoints( x, n, 1e-30, 1e30, true );
+	apply<pow075>( x, y );
+	ok = report( "pow(x,0.75)", largestError( x, y, pow075d, RELATIVE ), FAST_EXP_ERROR ) && ok;
+
+	// fastFromDecibels undoes fastDecibels
+	makePoints( x, n, 1e-30, 1e30, true );
+	fastDecibelsAll( x, db );
+	fastFromDecibels( &db[0], &y[0], n, 10.0f );
+	double worst = 0;
+	for( size_t i=0; i<x.size(); ++i ) worst = fmax( worst, fabs( y[i] / x[i] - 1 ) );
+	ok = report( "round trip", worst, FAST_EXP_ERROR ) && ok;
+
+	ok = checkSpecials() && ok;
+
+	// timings, on the spectrogram's range of powers
+	makePoints( x, n, 1e-2, 1e20, true );
+	printf( "\nns per value    %10s %10s\n", "libm", "fast" );
+	printf( "  %-12s %10.2f %10.2f\n", "decibels", timeRuns( libmDecibels, x, y, runs ),
+			timeRuns( fastDecibelsAll, x, y, runs ) );
+	makePoints( x, n, -60, 60, false );
+	printf( "  %-12s %10.2f %10.2f\n", "exp2", timeRuns( libmExp2, x, y, runs ), timeRuns( fastExp2All, x, y, runs ) );
+
+	if( !ok ){
+		fprintf( stderr, "Error: an approximation is outside its documented bound\n" );
+		return 1;
+	}
+	return 0;
+}
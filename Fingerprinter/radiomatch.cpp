@@ -0,0 +1,162 @@
+/*
+ *  radiomatch.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Matches Wi-Fi scans against a database of scans (see Classes/RadioDB.h)
+ * built from the "wifi" streams of capture files, eg.
+ *   build/radiomatch -k 3 today.bpc monday.bpc tuesday.bpc
+ * For each scan in the first file, prints its time followed by the k closest
+ * scans in the other files, as file number (1 for the first database file),
+ * time and distance.  Times are seconds since the NSDate reference date.
+ * If the query file is also given as a database file, each scan's own entry is
+ * left out of its matches.  Build and query statistics go to stderr.
+ *
+ * Options:
+ *   -m METRIC   jaccard, cosine (default) or l2; see RadioMetric
+ *   -k N        number of matches to print (default 1)
+ *   -s N        only score scans which share at least N access points (default 1)
+ */
+
+#include "CaptureFile.h"
+#include "RadioDB.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <vector>
+
+using std::vector;
+
+#define OUTPUT_BUFFER_BYTES (1<<20)
+
+/* wall-clock seconds, for timing */
+double elapsed(){
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* Reads the scans of a capture's wifi stream, calling addScan( records, n, timestamp ) for each. */
+template<class Visitor>
+bool readScans( const char* filename, Visitor& visitor ){
+	CaptureReader capture( filename );
+	if( !capture.isOpen() ){
+		fprintf( stderr, "Error: %s is not a capture file\n", filename );
+		return false;
+	}
+	int stream = capture.findStream( "wifi" );
+	if( stream < 0 || capture.getStream( stream ).recordSize != sizeof(WifiRecord) ){
+		fprintf( stderr, "Error: %s has no wifi stream\n", filename );
+		return false;
+	}
+	visitor.clockOffset = capture.getClockOffset();
+	CaptureCursor cursor( &capture, stream, -1e300 );
+	vector<WifiRecord> scan;
+	const void* data;
+	unsigned int length;
+	double t;
+	while( cursor.next( &data, &length, &t ) ){
+		// records of one scan share a timestamp
+		if( !scan.empty() && t != scan[0].timestamp ){
+			visitor.addScan( &scan[0], scan.size(), scan[0].timestamp );
+			scan.clear();
+		}
+		scan.push_back( *(const WifiRecord*)data );
+	}
+	if( !scan.empty() ) visitor.addScan( &scan[0], scan.size(), scan[0].timestamp );
+	return true;
+}
+
+/* adds each scan to the database */
+struct DBBuilder{
+	RadioDB* db;
+	int label;
+	double clockOffset;
+	void addScan( const WifiRecord* records, unsigned int n, double timestamp ){
+		db->addScan( records, n, label, timestamp + clockOffset );
+	}
+};
+
+/* queries the database with each scan and prints the matches */
+struct Matcher{
+	RadioDB* db;
+	unsigned int numMatches;
+	unsigned int minShared;
+	int selfEntry; // the DB entry of the next query scan, if the query file is in the DB, or -1
+	double clockOffset;
+	unsigned int queries;
+	unsigned long candidates;
+	vector<RadioMatch> result;
+	void addScan( const WifiRecord* records, unsigned int n, double timestamp ){
+		vector<RadioReading> r = db->toReadings( records, n, false );
+		db->query( r.empty()? NULL : &r[0], r.size(), numMatches, result, minShared, selfEntry );
+		candidates += db->getLastCandidates();
+		++queries;
+		if( selfEntry >= 0 ) ++selfEntry;
+		printf( "%.2f", timestamp + clockOffset );
+		for( unsigned int i=0; i<result.size(); ++i ){
+			printf( "\t%d\t%.2f\t%.4f", result[i].label, result[i].timestamp, result[i].distance );
+		}
+		printf( "\n" );
+	}
+};
+
+void usage( const char* name ){
+	fprintf( stderr, "usage: %s [-m jaccard|cosine|l2] [-k N] [-s MINSHARED] QUERYCAPTURE DBCAPTURE...\n", name );
+}
+
+int main( int argc, char** argv ){
+	RadioMetric metric = RadioMetricCosine;
+	unsigned int numMatches = 1, minShared = 1;
+	int c;
+	while( ( c = getopt( argc, argv, "m:k:s:" ) ) != -1 ){
+		switch( c ){
+			case 'm':
+				if( !strcmp( optarg, "jaccard" ) ) metric = RadioMetricJaccard;
+				else if( !strcmp( optarg, "cosine" ) ) metric = RadioMetricCosine;
+				else if( !strcmp( optarg, "l2" ) ) metric = RadioMetricL2;
+				else{ usage( argv[0] ); return 1; }
+				break;
+			case 'k': numMatches = atoi( optarg ); break;
+			case 's': minShared = atoi( optarg ); break;
+			default: usage( argv[0] ); return 1;
+		}
+	}
+	if( argc - optind < 2 || numMatches < 1 ){
+		usage( argv[0] );
+		return 1;
+	}
+
+	// build the database
+	double t0 = elapsed();
+	RadioDB db( metric );
+	int selfEntry = -1;
+	for( int a=optind+1; a<argc; ++a ){
+		// the query file's scans will be added in the same order as they are queried
+		if( selfEntry < 0 && !strcmp( argv[a], argv[optind] ) ) selfEntry = db.size();
+		DBBuilder builder;
+		builder.db = &db;
+		builder.label = a - optind;
+		if( !readScans( argv[a], builder ) ) return 1;
+	}
+	double t1 = elapsed();
+	fprintf( stderr, "database: %u scans, %u access points, built in %.2f s\n", db.size(), db.getNumAps(), t1-t0 );
+
+	// query
+	setvbuf( stdout, NULL, _IOFBF, OUTPUT_BUFFER_BYTES );
+	Matcher matcher;
+	matcher.db = &db;
+	matcher.numMatches = numMatches;
+	matcher.minShared = minShared;
+	matcher.selfEntry = selfEntry;
+	matcher.queries = 0;
+	matcher.candidates = 0;
+	if( !readScans( argv[optind], matcher ) ) return 1;
+	double t2 = elapsed();
+	fprintf( stderr, "queries: %u in %.2f s, %.1f candidates scored per query\n", matcher.queries, t2-t1,
+			 matcher.queries? (double)matcher.candidates / matcher.queries : 0.0 );
+	return 0;
+}
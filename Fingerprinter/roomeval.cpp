@@ -0,0 +1,297 @@
+/*
+ *  roomeval.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Measures room identification accuracy and query cost over a database file
+ * (FingerprintDB's db.txt format, see Classes/FingerprintFile.h), eg.
+ *   build/roomeval -k 3 db.txt
+ * By default every entry is queried against all of the others (leave-one-out).
+ * With -t, the earliest entries by timestamp form the database and the later
+ * ones are queried against it (time split).  Rooms are ranked as
+ * FingerprintDB's queryCacheForMatches ranks them, by the distance to each
+ * room's closest entry, using the same scan engine (Classes/FingerprintScan.h).
+ * A query is correct at k if its own building and room is among the k best.
+ *
+ * Prints the top-1 to top-k accuracy, queries per second and distance
+ * computations per query.  Queries are scored in batches, each in one pass
+ * over the database, and the batches are shared out among threads.
+ *
+ * Options:
+ *   -m METRIC     l2 (default), l1, cosine or correlation; see DistanceMetrics.h
+ *   -k N          largest number of ranked rooms to check (default 3)
+ *   -l N          use only the first N fingerprint values, as a lower frequency cutoff would
+ *   -t FRACTION   query the latest 1-FRACTION of the entries against the earliest FRACTION
+ *   -j N          threads (default: one per processor)
+ *   -b N          queries per scan (default 32)
+ */
+
+#include "FingerprintFile.h"
+#include "FingerprintScan.h"
+#include <float.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::map;
+using std::pair;
+using std::string;
+using std::vector;
+
+/* wall-clock seconds, for timing */
+double elapsed(){
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* The database, flattened for the scan engine. */
+struct Database{
+	unsigned int length; // fingerprint values per entry
+	vector<float> fingerprints; // length values per entry
+	vector<FingerprintStats> stats;
+	vector<unsigned int> rooms; // room id of each entry
+	vector<long long> timestamps;
+	unsigned int numRooms;
+};
+
+/* Reads a database file, keeping the first length values of each fingerprint, or as many
+ * as the first entry has if length is 0.  Entries with fewer values are skipped. */
+bool loadDatabase( const char* filename, unsigned int length, Database& db ){
+	FILE* file = fopen( filename, "r" );
+	if( !file ){
+		fprintf( stderr, "Error: cannot open %s\n", filename );
+		return false;
+	}
+	FingerprintFileReader reader( file );
+	FingerprintEntry entry;
+	map< pair<string,string>, unsigned int > roomIds; // (building, room) -> room id
+	unsigned int numShort = 0;
+	db.length = length;
+	while( reader.next( entry ) ){
+		if( db.length == 0 ) db.length = entry.fingerprint.size();
+		if( db.length == 0 || entry.fingerprint.size() < db.length ){
+			++numShort;
+			continue;
+		}
+		db.fingerprints.insert( db.fingerprints.end(), entry.fingerprint.begin(), entry.fingerprint.begin() + db.length );
+		pair<string,string> room( entry.building, entry.room );
+		map< pair<string,string>, unsigned int >::iterator it = roomIds.find( room );
+		if( it == roomIds.end() ) it = roomIds.insert( make_pair( room, (unsigned int)roomIds.size() ) ).first;
+		db.rooms.push_back( it->second );
+		db.timestamps.push_back( entry.timestamp );
+	}
+	fclose( file );
+	db.numRooms = roomIds.size();
+	unsigned int n = db.rooms.size();
+	db.stats.resize( n );
+	for( unsigned int i=0; i<n; ++i ){
+		db.stats[i].compute( &db.fingerprints[i*db.length], db.length );
+	}
+	if( numShort || reader.getNumMalformed() ){
+		fprintf( stderr, "Warning: skipped %u entries with fewer than %u fingerprint values and %u malformed lines\n",
+				 numShort, db.length, reader.getNumMalformed() );
+	}
+	return true;
+}
+
+/* one evaluation run, shared by the worker threads */
+struct Evaluation{
+	// inputs
+	AcousticMetric metric;
+	unsigned int length;
+	unsigned int numMatches;
+	unsigned int batchSize;
+	vector<const float*> rows;
+	vector<const FingerprintStats*> rowStats;
+	vector<unsigned int> rowRooms;
+	vector<const float*> queries;
+	vector<FingerprintStats> queryStats;
+	vector<unsigned int> queryRooms;
+	vector<unsigned int> queryRows; // for leave-one-out, or empty
+	unsigned int numRooms;
+	// work distribution
+	pthread_mutex_t lock;
+	unsigned int nextQuery; // first query of the next batch to be scanned
+	// outputs
+	vector<unsigned int> ranks; // of each query's room, numMatches if not in the top numMatches
+	unsigned long evaluations;
+};
+
+/* worker thread: scans batches of queries until there are none left */
+void* evaluate( void* arg ){
+	Evaluation* e = (Evaluation*)arg;
+	unsigned int numRows = e->rows.size();
+	unsigned int numQueries = e->queries.size();
+	vector<float> roomScores, roomBest;
+	vector<unsigned int> roomBestRow( e->numRooms );
+	vector<float> scores( e->numRooms );
+	vector<unsigned int> ranking( e->numMatches );
+	unsigned long evaluations = 0;
+	while( true ){
+		pthread_mutex_lock( &e->lock );
+		unsigned int first = e->nextQuery;
+		e->nextQuery += e->batchSize;
+		pthread_mutex_unlock( &e->lock );
+		if( first >= numQueries ) break;
+		unsigned int n = ( numQueries - first < e->batchSize )? numQueries - first : e->batchSize;
+
+		roomScores.assign( e->numRooms * n, FLT_MAX );
+		roomBest.assign( e->numRooms, FLT_MAX );
+		GroupScan scan;
+		scan.queries = &e->queries[first];
+		scan.numQueries = n;
+		scan.rows = &e->rows[0];
+		scan.groups = &e->rowRooms[0];
+		scan.numRows = numRows;
+		scan.queryStats = &e->queryStats[first];
+		scan.rowStats = &e->rowStats[0];
+		scan.queryRows = e->queryRows.empty()? NULL : &e->queryRows[first];
+		scan.groupScores = &roomScores[0];
+		scan.groupBestScore = &roomBest[0];
+		scan.groupBestRow = &roomBestRow[0];
+		evaluations += scanGroupMinima( e->metric, e->length, NULL, IdentityScore(), scan );
+
+		for( unsigned int j=0; j<n; ++j ){
+			for( unsigned int r=0; r<e->numRooms; ++r ) scores[r] = roomScores[r*n+j];
+			unsigned int k = selectTopK( &scores[0], e->numRooms, e->numMatches, &ranking[0] );
+			unsigned int rank = e->numMatches;
+			for( unsigned int i=0; i<k; ++i ){
+				// rooms with no entry scored (eg. only the query itself) are not matches
+				if( scores[ranking[i]] == FLT_MAX ) break;
+				if( ranking[i] == e->queryRooms[first+j] ){
+					rank = i;
+					break;
+				}
+			}
+			e->ranks[first+j] = rank;
+		}
+	}
+	pthread_mutex_lock( &e->lock );
+	e->evaluations += evaluations;
+	pthread_mutex_unlock( &e->lock );
+	return NULL;
+}
+
+/* orders entry indices by timestamp */
+struct EarlierEntry{
+	const Database* db;
+	bool operator()( unsigned int a, unsigned int b ) const { return db->timestamps[a] < db->timestamps[b]; }
+};
+
+void usage( const char* name ){
+	fprintf( stderr, "usage: %s [-m l2|l1|cosine|correlation] [-k N] [-l LENGTH] [-t FRACTION] [-j THREADS] [-b BATCH] DB\n", name );
+}
+
+int main( int argc, char** argv ){
+	Evaluation e;
+	e.metric = AcousticMetricL2;
+	e.numMatches = 3;
+	e.batchSize = 32;
+	unsigned int length = 0;
+	double split = 0; // 0 for leave-one-out
+	long numThreads = sysconf( _SC_NPROCESSORS_ONLN );
+	int c;
+	while( ( c = getopt( argc, argv, "m:k:l:t:j:b:" ) ) != -1 ){
+		switch( c ){
+			case 'm':
+				if( !parseAcousticMetric( optarg, &e.metric ) ){ usage( argv[0] ); return 1; }
+				break;
+			case 'k': e.numMatches = atoi( optarg ); break;
+			case 'l': length = atoi( optarg ); break;
+			case 't': split = atof( optarg ); break;
+			case 'j': numThreads = atoi( optarg ); break;
+			case 'b': e.batchSize = atoi( optarg ); break;
+			default: usage( argv[0] ); return 1;
+		}
+	}
+	if( argc - optind != 1 || e.numMatches < 1 || e.batchSize < 1 || split < 0 || split >= 1 ){
+		usage( argv[0] );
+		return 1;
+	}
+	if( numThreads < 1 ) numThreads = 1;
+
+	double t0 = elapsed();
+	Database db;
+	if( !loadDatabase( argv[optind], length, db ) ) return 1;
+	unsigned int numEntries = db.rooms.size();
+	double t1 = elapsed();
+	printf( "database: %u entries, %u rooms, %u values per fingerprint, loaded in %.2f s\n",
+		    numEntries, db.numRooms, db.length, t1-t0 );
+	if( numEntries == 0 ) return 1;
+	e.length = db.length;
+	e.numRooms = db.numRooms;
+
+	// choose the rows and queries
+	vector<unsigned int> order( numEntries );
+	for( unsigned int i=0; i<numEntries; ++i ) order[i] = i;
+	unsigned int numRows = numEntries;
+	if( split > 0 ){
+		EarlierEntry earlier;
+		earlier.db = &db;
+		std::stable_sort( order.begin(), order.end(), earlier );
+		numRows = (unsigned int)( split * numEntries );
+		if( numRows == 0 || numRows == numEntries ){
+			fprintf( stderr, "Error: a split of %g leaves no database or no queries\n", split );
+			return 1;
+		}
+	}
+	for( unsigned int i=0; i<numRows; ++i ){
+		e.rows.push_back( &db.fingerprints[order[i]*db.length] );
+		e.rowStats.push_back( &db.stats[order[i]] );
+		e.rowRooms.push_back( db.rooms[order[i]] );
+	}
+	for( unsigned int i=( split > 0 )? numRows : 0; i<numEntries; ++i ){
+		e.queries.push_back( &db.fingerprints[order[i]*db.length] );
+		e.queryStats.push_back( db.stats[order[i]] );
+		e.queryRooms.push_back( db.rooms[order[i]] );
+		if( split == 0 ) e.queryRows.push_back( i );
+	}
+	unsigned int numQueries = e.queries.size();
+	// queries whose room has no entry among the rows can only miss
+	vector<unsigned int> roomRows( db.numRooms, 0 );
+	for( unsigned int i=0; i<numRows; ++i ) ++roomRows[e.rowRooms[i]];
+	unsigned int numUnmatchable = 0;
+	for( unsigned int j=0; j<numQueries; ++j ){
+		if( roomRows[e.queryRooms[j]] <= ( split > 0? 0u : 1u ) ) ++numUnmatchable;
+	}
+
+	// run the queries
+	e.ranks.resize( numQueries );
+	e.nextQuery = 0;
+	e.evaluations = 0;
+	pthread_mutex_init( &e.lock, NULL );
+	vector<pthread_t> threads( numThreads );
+	for( long t=0; t<numThreads; ++t ){
+		if( pthread_create( &threads[t], NULL, evaluate, &e ) ){
+			fprintf( stderr, "Error: cannot start thread\n" );
+			return 1;
+		}
+	}
+	for( long t=0; t<numThreads; ++t ) pthread_join( threads[t], NULL );
+	pthread_mutex_destroy( &e.lock );
+	double t2 = elapsed();
+
+	printf( "queries: %u %s, against %u entries; %u have no other entry of their room\n", numQueries,
+		    split > 0? "later entries" : "leave-one-out", numRows, numUnmatchable );
+	vector<unsigned int> hits( e.numMatches+1, 0 );
+	for( unsigned int j=0; j<numQueries; ++j ) ++hits[e.ranks[j]];
+	unsigned int correct = 0;
+	for( unsigned int k=0; k<e.numMatches; ++k ){
+		correct += hits[k];
+		printf( "top-%u accuracy: %.4f\n", k+1, (double)correct / numQueries );
+	}
+	printf( "throughput: %.0f queries/s on %ld threads, %.1f distances per query (%.1f%% of entries)\n",
+		    numQueries / ( t2-t1 ), numThreads, (double)e.evaluations / numQueries,
+		    100.0 * e.evaluations / numQueries / numRows );
+	return 0;
+}
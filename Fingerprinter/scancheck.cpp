@@ -0,0 +1,142 @@
+/*
+ *  scancheck.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * A check that pruning in the scan engine (Classes/FingerprintScan.h) never
+ * changes a query's results under the combined metric, run by
+ *   make scancheck
+ * Rooms of random fingerprints are scanned with FingerprintDB's combined
+ * score, once with every distance computed and once with the rows' lower
+ * bounds, as FingerprintDB does it.  Some rows have a smallest element of
+ * zero or below, for which the combined scale is infinite or negative and the
+ * score does not grow with the distance; those rows must not be pruned.  Every
+ * room's score for every query must come out the same both ways.  The
+ * exit status is 1 if one differs.
+ */
+
+#include "FingerprintScan.h"
+#include <float.h>
+#include <stdio.h>
+#include <vector>
+
+using std::vector;
+
+#define LENGTH 325       // fpLength
+#define NUM_ROWS 400
+#define NUM_ROOMS 20
+#define NUM_QUERIES 8
+#define NUM_DEGENERATE 40 // rows with a smallest element of zero or below
+// FingerprintDB's combined metric
+#define COMBINATION_K 0.5f
+#define MIN_SIG_DIST 0.0f
+#define MIN_PHYS_DIST 0.0f
+#define MAX_PHYS_DIST 100.0f
+
+/* FingerprintDB's CombinedScore */
+struct CombinedScore{
+	CombinedScore( const float* physicalDistances, const float* signalScales )
+	: physDist(physicalDistances), sigScale(signalScales){}
+	inline float operator()( unsigned int row, float sigDist ) const {
+		return COMBINATION_K * (sigDist-MIN_SIG_DIST) * sigScale[row] +
+				(1-COMBINATION_K) * (physDist[row]-MIN_PHYS_DIST)/(MAX_PHYS_DIST-MIN_PHYS_DIST);
+	}
+	const float* physDist;
+	const float* sigScale;
+};
+
+/* a repeatable uniform value in [0,1) */
+static unsigned int seed = 12345;
+float uniform(){
+	seed = seed * 1103515245 + 12345;
+	return ( ( seed >> 8 ) & 0xFFFF ) / 65536.0f;
+}
+
+/* scans the rows, pruning with rowStats if it is not NULL, and returns the room scores */
+vector<float> scan( const vector<const float*>& queries, const vector<FingerprintStats>& queryStats,
+					const vector<const float*>& rows, const vector<unsigned int>& rooms,
+					const FingerprintStats* const* rowStats, const CombinedScore& score, unsigned int* evaluations ){
+	vector<float> roomScores( NUM_ROOMS*NUM_QUERIES, FLT_MAX );
+	vector<float> roomBest( NUM_ROOMS, FLT_MAX );
+	vector<unsigned int> roomBestRow( NUM_ROOMS, 0 );
+	GroupScan s;
+	s.queries = &queries[0];
+	s.numQueries = NUM_QUERIES;
+	s.rows = &rows[0];
+	s.groups = &rooms[0];
+	s.numRows = NUM_ROWS;
+	s.queryStats = rowStats? &queryStats[0] : NULL;
+	s.rowStats = rowStats;
+	s.queryRows = NULL;
+	s.groupScores = &roomScores[0];
+	s.groupBestScore = &roomBest[0];
+	s.groupBestRow = &roomBestRow[0];
+	*evaluations = scanGroupMinima( L2Distance( LENGTH ), score, s );
+	return roomScores;
+}
+
+int main(){
+	// fingerprints in dB, each room around its own level
+	vector<float> data( (NUM_ROWS+NUM_QUERIES) * LENGTH );
+	vector<const float*> rows( NUM_ROWS ), queries( NUM_QUERIES );
+	vector<unsigned int> rooms( NUM_ROWS );
+	vector<float> physDist( NUM_ROWS );
+	for( unsigned int i=0; i<NUM_ROWS+NUM_QUERIES; ++i ){
+		float* fp = &data[i*LENGTH];
+		float level = 20 + 40*uniform();
+		for( unsigned int k=0; k<LENGTH; ++k ) fp[k] = level + 10*uniform();
+		if( i < NUM_ROWS ){
+			rows[i] = fp;
+			rooms[i] = i % NUM_ROOMS;
+			physDist[i] = MAX_PHYS_DIST * uniform();
+		}else{
+			queries[i-NUM_ROWS] = fp;
+		}
+	}
+	// the later rows of some rooms have a smallest element of zero or below, so that they
+	// come after a row which sets their room's best score
+	for( unsigned int d=0; d<NUM_DEGENERATE; ++d ){
+		unsigned int i = NUM_ROWS - 1 - d;
+		float* fp = &data[i*LENGTH];
+		fp[(d*7) % LENGTH] = ( d % 2 == 0 )? 0.0f : -5.0f*(1+d);
+	}
+
+	vector<FingerprintStats> stats( NUM_ROWS ), queryStats( NUM_QUERIES );
+	vector<float> sigScale( NUM_ROWS );
+	vector<const FingerprintStats*> rowStats( NUM_ROWS );
+	unsigned int numDegenerate = 0;
+	for( unsigned int i=0; i<NUM_ROWS; ++i ){
+		stats[i].compute( rows[i], LENGTH );
+		sigScale[i] = combinedSignalScale( stats[i], MIN_SIG_DIST );
+		rowStats[i] = combinedScaleIsMonotonic( stats[i], MIN_SIG_DIST )? &stats[i] : NULL;
+		if( !rowStats[i] ) ++numDegenerate;
+	}
+	for( unsigned int j=0; j<NUM_QUERIES; ++j ) queryStats[j].compute( queries[j], LENGTH );
+	if( numDegenerate != NUM_DEGENERATE ){
+		fprintf( stderr, "Error: %u rows have a scale which is not positive, expected %u\n", numDegenerate, NUM_DEGENERATE );
+		return 1;
+	}
+
+	CombinedScore score( &physDist[0], &sigScale[0] );
+	unsigned int fullEvaluations, prunedEvaluations;
+	vector<float> full = scan( queries, queryStats, rows, rooms, NULL, score, &fullEvaluations );
+	vector<float> pruned = scan( queries, queryStats, rows, rooms, &rowStats[0], score, &prunedEvaluations );
+	unsigned int mismatches = 0;
+	for( unsigned int i=0; i<full.size(); ++i ){
+		// NaN, from a zero distance times an infinite scale, never wins a room
+		if( full[i] != pruned[i] && !( full[i] != full[i] && pruned[i] != pruned[i] ) ){
+			if( mismatches++ == 0 ){
+				fprintf( stderr, "room %u query %u: %g with pruning, %g without\n",
+						 i / NUM_QUERIES, i % NUM_QUERIES, pruned[i], full[i] );
+			}
+		}
+	}
+	if( mismatches ){
+		fprintf( stderr, "Error: %u room scores changed by pruning\n", mismatches );
+		return 1;
+	}
+	fprintf( stderr, "combined scan: %u room scores unchanged by pruning, %u of %u distances computed, %u rows with a zero or negative minimum\n",
+			 (unsigned int)full.size(), prunedEvaluations, fullEvaluations, numDegenerate );
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ *  sensorlog2txt.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Converts a binary sensor log (see Classes/SensorLog.h) to the tab-separated
+ * text format that the capture apps used to write directly, eg.
+ *   build/sensorlog2txt motion.bin > motion.txt
+ * Timestamps are printed as seconds since the NSDate reference date.
+ *
+ * Streams of a capture file (see Classes/CaptureFile.h) are exported the same
+ * way, optionally limited to a time range in the same units:
+ *   build/sensorlog2txt capture.bpc             lists the streams
+ *   build/sensorlog2txt capture.bpc motion      prints all motion records
+ *   build/sensorlog2txt capture.bpc location 325000000 325000060
+ * Blob streams (stills and audio) are written to files named by timestamp
+ * in the current directory, as the capture app used to write them.  Spectra
+ * and fingerprints are printed as one line of dB values per record.
+ */
+
+#include "SensorLog.h"
+#include "CaptureFile.h"
+#include "SpectrumLog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+void printMotionRecord( const MotionRecord& r, double clockOffset ){
+	printf( "%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\n",
+		   r.timestamp+clockOffset, r.userAccel[0], r.userAccel[1], r.userAccel[2],
+		   r.attitude[0], r.attitude[1], r.attitude[2],
+		   r.rotationRate[0], r.rotationRate[1], r.rotationRate[2],
+		   r.gravity[0], r.gravity[1], r.gravity[2] );
+}
+
+void printLocationRecord( const LocationRecord& r, double clockOffset ){
+	printf( "%f\t%.8f\t%.8f\t%f\t%f\t%f\t%f\t%f\n",
+		   r.timestamp+clockOffset, r.latitude, r.longitude, r.altitude,
+		   r.horizontalAccuracy, r.verticalAccuracy, r.speed, r.course );
+}
+
+/* Scans are printed as a timestamp line followed by one indented line per AP */
+void printWifiRecord( const WifiRecord& r, double clockOffset, double* lastScan ){
+	if( r.timestamp != *lastScan ){
+		printf( "%.2f\n", r.timestamp+clockOffset );
+		*lastScan = r.timestamp;
+	}
+	printf( "\t%02x:%02x:%02x:%02x:%02x:%02x\t%d\t%u\t%s\n",
+		   r.bssid[0], r.bssid[1], r.bssid[2], r.bssid[3], r.bssid[4], r.bssid[5],
+		   r.rssi, r.channel, r.ssid );
+}
+
+/* Spectra and fingerprints are printed as a timestamp followed by each bin in dB */
+void printSpectrumRecord( const SpectrumRecord& r, double clockOffset ){
+	float dB[SPECTRUM_BINS];
+	dequantizeSpectrum( r, SPECTRUM_BINS, dB );
+	printf( "%f", r.timestamp+clockOffset );
+	for( unsigned int i=0; i<SPECTRUM_BINS; ++i ) printf( "\t%.1f", dB[i] );
+	printf( "\n" );
+}
+
+/* checks that the log's records are the size we expect */
+bool checkRecordSize( const SensorLogHeader& header, unsigned int size ){
+	if( header.recordSize != size ){
+		fprintf( stderr, "Error: unexpected record size %u\n", header.recordSize );
+		return false;
+	}
+	return true;
+}
+
+/* state for captureCallback */
+struct CaptureExport{
+	SensorLogRecordType type;
+	double clockOffset;
+	double lastScan;
+};
+
+void captureCallback( double timestamp, const void* data, unsigned int length, void* context ){
+	CaptureExport* ex = (CaptureExport*)context;
+	switch( ex->type ){
+		case SensorLogMotion:
+			printMotionRecord( *(const MotionRecord*)data, ex->clockOffset ); break;
+		case SensorLogLocation:
+			printLocationRecord( *(const LocationRecord*)data, ex->clockOffset ); break;
+		case SensorLogWifi:
+			printWifiRecord( *(const WifiRecord*)data, ex->clockOffset, &ex->lastScan ); break;
+		case SensorLogSpectrum:
+		case SensorLogFingerprint:
+			printSpectrumRecord( *(const SpectrumRecord*)data, ex->clockOffset ); break;
+		case SensorLogStill:
+		case SensorLogAudio:{
+			char filename[64];
+			snprintf( filename, sizeof(filename), "%.2f.%s", timestamp+ex->clockOffset, 
+					  (ex->type == SensorLogStill)? "jpg" : "wav" );
+			FILE* f = fopen( filename, "wb" );
+			if( !f || fwrite( data, 1, length, f ) != length ){
+				fprintf( stderr, "Error: could not write %s\n", filename );
+			}else{
+				printf( "%s\n", filename );
+			}
+			if( f ) fclose( f );
+			break;
+		}
+	}
+}
+
+int exportCapture( CaptureReader& capture, int argc, char** argv ){
+	if( argc == 2 ){
+		// list streams
+		const std::vector<CaptureIndexEntry>& index = capture.getIndex();
+		for( unsigned int s=0; s<capture.getNumStreams(); ++s ){
+			unsigned int chunks = 0, records = 0;
+			double start = DBL_MAX, end = -DBL_MAX;
+			for( unsigned int i=0; i<index.size(); ++i ){
+				if( index[i].streamId != s ) continue;
+				++chunks;
+				records += index[i].recordCount;
+				if( index[i].startTime < start ) start = index[i].startTime;
+				if( index[i].endTime > end ) end = index[i].endTime;
+			}
+			printf( "%s\t%u records\t%u chunks", capture.getStream(s).name, records, chunks );
+			if( chunks ) printf( "\t%.2f to %.2f", start+capture.getClockOffset(), end+capture.getClockOffset() );
+			printf( "\n" );
+		}
+		return 0;
+	}
+	int stream = capture.findStream( argv[2] );
+	if( stream < 0 ){
+		fprintf( stderr, "Error: no stream named %s\n", argv[2] );
+		return 1;
+	}
+	CaptureExport ex;
+	ex.type = (SensorLogRecordType)capture.getStream( stream ).recordType;
+	ex.clockOffset = capture.getClockOffset();
+	ex.lastScan = -1;
+	const unsigned int expectedSize[] = { 0, sizeof(MotionRecord), sizeof(LocationRecord), sizeof(WifiRecord), 0, 0,
+										  sizeof(SpectrumRecord), sizeof(SpectrumRecord) };
+	if( ex.type < SensorLogMotion || ex.type > SensorLogFingerprint ||
+	    capture.getStream( stream ).recordSize != expectedSize[ex.type] ){
+		fprintf( stderr, "Error: unexpected record type %u\n", ex.type );
+		return 1;
+	}
+	// time range is given in wall-clock time
+	double start = -DBL_MAX, end = DBL_MAX;
+	if( argc == 5 ){
+		start = atof( argv[3] ) - ex.clockOffset;
+		end = atof( argv[4] ) - ex.clockOffset;
+	}
+	capture.read( stream, start, end, captureCallback, &ex );
+	return 0;
+}
+
+int main( int argc, char** argv ){
+	if( argc != 2 && argc != 3 && argc != 5 ){
+		fprintf( stderr, "usage: %s LOGFILE\n"
+				         "       %s CAPTUREFILE [STREAM [START END]]\n", argv[0], argv[0] );
+		return 1;
+	}
+	CaptureReader capture( argv[1] );
+	if( capture.isOpen() ) return exportCapture( capture, argc, argv );
+	if( argc != 2 ){
+		fprintf( stderr, "Error: %s is not a capture file\n", argv[1] );
+		return 1;
+	}
+	SensorLogReader log( argv[1] );
+	if( !log.isOpen() ){
+		fprintf( stderr, "Error: %s is not a sensor log\n", argv[1] );
+		return 1;
+	}
+	const SensorLogHeader& header = log.getHeader();
+	switch( header.recordType ){
+		case SensorLogMotion:{
+			if( !checkRecordSize( header, sizeof(MotionRecord) ) ) return 1;
+			MotionRecord r;
+			while( log.next( &r ) ) printMotionRecord( r, header.clockOffset );
+			break;
+		}
+		case SensorLogLocation:{
+			if( !checkRecordSize( header, sizeof(LocationRecord) ) ) return 1;
+			LocationRecord r;
+			while( log.next( &r ) ) printLocationRecord( r, header.clockOffset );
+			break;
+		}
+		case SensorLogWifi:{
+			if( !checkRecordSize( header, sizeof(WifiRecord) ) ) return 1;
+			WifiRecord r;
+			double lastScan = -1;
+			while( log.next( &r ) ) printWifiRecord( r, header.clockOffset, &lastScan );
+			break;
+		}
+		case SensorLogSpectrum:
+		case SensorLogFingerprint:{
+			if( !checkRecordSize( header, sizeof(SpectrumRecord) ) ) return 1;
+			SpectrumRecord r;
+			while( log.next( &r ) ) printSpectrumRecord( r, header.clockOffset );
+			break;
+		}
+		default:
+			fprintf( stderr, "Error: unknown record type %u\n", header.recordType );
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,303 @@
+/*
+ *  summarybench.cpp
+ *  Fingerprinter
+ *
+ *  Copyright 2010 Northwestern University. All rights reserved.
+ *
+ * Compares the ways a Spectrogram can keep its percentile summary, eg.
+ *   build/summarybench -w 10
+ * which are one SlidingWindow (two heaps) per bin, the eager SlidingPercentiles
+ * which keeps every bin's window sorted, and the lazy SlidingPercentiles which
+ * only selects the percentiles when they are read.  Columns are written at the
+ * spectrogram's rate and the summary is read at some lower rate, eg. once per
+ * database query, so the cost that matters is CPU time per second of audio:
+ *   writes/s * write cost + reads/s * read cost.
+ * This times each engine's write and read on synthetic spectrogram columns,
+ * prints that cost for a range of read rates, and the read rate above which
+ * the eager engine becomes cheaper than the lazy one.  Lazy reads cost nothing
+ * when there has been no write since the last, so at most one read per write
+ * is counted.  Every engine's summaries are checked against the heaps'.
+ * With -j, the eager and lazy engines share each column among threads (see
+ * Classes/ParallelPercentiles.h), and the times are wall-clock time.  Then a
+ * second table shows how they scale, with a row for each thread count from 1
+ * up to -j, doubling, eg. for
+ *   build/summarybench -n 8192 -j 4
+ * For meaningful timings, build everything with optimization, eg.
+ *   make clean; make CFLAGS=-O2 build/summarybench
+ * build/summarybench-rtcheck also fails if a check's write or read
+ * allocates, locks or does I/O (see Classes/RealtimeCheck.h), with any
+ * number of threads.
+ *
+ * Options:
+ *   -w N   columns written per second (default 10, as Fingerprinter's)
+ *   -n N   frequency bins (default 325)
+ *   -s N   window size in columns (default 100)
+ *   -p P   percentile, above 0 (default 0.05)
+ *   -c N   columns to time (default 2000)
+ *   -r N   runs to time, keeping the best (default 3)
+ *   -j N   threads for the eager and lazy engines (default 1; 0 is one per processor)
+ */
+
+#include "ParallelPercentiles.h"
+#include "RealtimeCheck.h"
+#include "SlidingWindow.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <vector>
+
+using std::vector;
+
+/* wall-clock seconds, for timing */
+double elapsed(){
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+struct Settings{
+	unsigned int bins;
+	unsigned int size;
+	float percentile;
+	unsigned int columns;
+	unsigned int threads;
+};
+
+/* Spectrogram-like columns in dB: each bin wanders around its own level, with
+ * occasional loud transients, so that the windows are neither sorted nor constant. */
+void makeColumns( const Settings& set, vector<float>& columns ){
+	columns.resize( (size_t)set.columns * set.bins );
+	vector<float> level( set.bins );
+	srandom( 1 );
+	for( unsigned int k=0; k<set.bins; ++k ) level[k] = -40 + 30.0f * random() / RAND_MAX;
+	for( unsigned int c=0; c<set.columns; ++c ){
+		for( unsigned int k=0; k<set.bins; ++k ){
+			level[k] += 0.5f * ( (float)random() / RAND_MAX - 0.5f );
+			float v = level[k] + 6.0f * ( (float)random() / RAND_MAX - 0.5f );
+			if( random() % 50 == 0 ) v += 25;
+			columns[(size_t)c*set.bins + k] = v;
+		}
+	}
+}
+
+/* An engine, wrapped so that all three are timed the same way. */
+class Engine{
+public:
+	virtual ~Engine(){}
+	virtual void update( const float* column ) = 0;
+	virtual void read( float* out ) = 0;
+};
+
+class HeapEngine : public Engine{
+public:
+	HeapEngine( const Settings& set ) : windows( set.bins ){
+		for( unsigned int k=0; k<set.bins; ++k ) windows[k] = new SlidingWindow( set.size, set.percentile, -FLT_MAX );
+	}
+	~HeapEngine(){
+		for( unsigned int k=0; k<windows.size(); ++k ) delete windows[k];
+	}
+	void update( const float* column ){
+		for( unsigned int k=0; k<windows.size(); ++k ) windows[k]->update( column[k] );
+	}
+	void read( float* out ){
+		for( unsigned int k=0; k<windows.size(); ++k ) out[k] = windows[k]->getVal();
+	}
+private:
+	vector<SlidingWindow*> windows;
+};
+
+class PercentilesEngine : public Engine{
+public:
+	PercentilesEngine( const Settings& set, bool lazy ) :
+	percentiles( set.bins, set.size, set.percentile, -FLT_MAX, lazy, set.threads ){}
+	void update( const float* column ){ percentiles.update( column ); }
+	void read( float* out ){ percentiles.getVals( out ); }
+	unsigned int getNumPartitions() const{ return percentiles.getNumPartitions(); }
+private:
+	ParallelPercentiles percentiles;
+};
+
+Engine* newEngine( unsigned int e, const Settings& set ){
+	if( e == 0 ) return new HeapEngine( set );
+	return new PercentilesEngine( set, e == 2 );
+}
+
+const char* engineNames[] = { "heaps", "eager", "lazy" };
+#define NUM_ENGINES 3
+
+/* Times, in seconds per column, writing every column, and writing and then
+ * reading every column; the best of runs. */
+void timeEngine( unsigned int e, const Settings& set, const vector<float>& columns, unsigned int runs,
+				 double* writeTime, double* writeReadTime ){
+	vector<float> out( set.bins );
+	*writeTime = *writeReadTime = DBL_MAX;
+	for( unsigned int r=0; r<runs; ++r ){
+		Engine* engine = newEngine( e, set );
+		double start = elapsed();
+		for( unsigned int c=0; c<set.columns; ++c ) engine->update( &columns[(size_t)c*set.bins] );
+		double t = ( elapsed() - start ) / set.columns;
+		if( t < *writeTime ) *writeTime = t;
+		delete engine;
+
+		engine = newEngine( e, set );
+		start = elapsed();
+		for( unsigned int c=0; c<set.columns; ++c ){
+			engine->update( &columns[(size_t)c*set.bins] );
+			engine->read( &out[0] );
+		}
+		t = ( elapsed() - start ) / set.columns;
+		if( t < *writeReadTime ) *writeReadTime = t;
+		delete engine;
+	}
+}
+
+/* Checks every engine's summary against the heaps' after every column; returns the
+ * number of differing values. */
+unsigned long checkEngines( const Settings& set, const vector<float>& columns ){
+	Engine* engines[NUM_ENGINES];
+	for( unsigned int e=0; e<NUM_ENGINES; ++e ) engines[e] = newEngine( e, set );
+	vector<float> expected( set.bins ), out( set.bins );
+	unsigned long mismatches = 0;
+	for( unsigned int c=0; c<set.columns; ++c ){
+		REALTIME_SCOPE(); // the spectrogram is written and read on the audio thread
+		for( unsigned int e=0; e<NUM_ENGINES; ++e ) engines[e]->update( &columns[(size_t)c*set.bins] );
+		engines[0]->read( &expected[0] );
+		for( unsigned int e=1; e<NUM_ENGINES; ++e ){
+			engines[e]->read( &out[0] );
+			for( unsigned int k=0; k<set.bins; ++k ){
+				if( out[k] != expected[k] ) ++mismatches;
+			}
+		}
+	}
+	for( unsigned int e=0; e<NUM_ENGINES; ++e ) delete engines[e];
+	return mismatches;
+}
+
+void usage( const char* name ){
+	fprintf( stderr, "usage: %s [-w WRITES/S] [-n BINS] [-s SIZE] [-p PERCENTILE] [-c COLUMNS] [-r RUNS] [-j THREADS]\n", name );
+}
+
+int main( int argc, char** argv ){
+	Settings set;
+	set.bins = 325;
+	set.size = 100;
+	set.percentile = 0.05;
+	set.columns = 2000;
+	set.threads = 1;
+	double writeRate = 10;
+	unsigned int runs = 3;
+	int c;
+	while( ( c = getopt( argc, argv, "w:n:s:p:c:r:j:" ) ) != -1 ){
+		switch( c ){
+			case 'w': writeRate = atof( optarg ); break;
+			case 'n': set.bins = atoi( optarg ); break;
+			case 's': set.size = atoi( optarg ); break;
+			case 'p': set.percentile = atof( optarg ); break;
+			case 'c': set.columns = atoi( optarg ); break;
+			case 'r': runs = atoi( optarg ); break;
+			case 'j': set.threads = atoi( optarg ); break;
+			default:
+				usage( argv[0] );
+				return 1;
+		}
+	}
+	if( optind != argc || writeRate <= 0 || set.bins == 0 || set.size == 0 || set.columns == 0 || runs == 0
+	    || set.percentile <= 0 || set.percentile > 1 ){
+		usage( argv[0] );
+		return 1;
+	}
+
+	vector<float> columns;
+	makeColumns( set, columns );
+	unsigned long mismatches = checkEngines( set, columns );
+	if( mismatches ){
+		fprintf( stderr, "Error: %lu summary values differ from the heaps'\n", mismatches );
+		return 1;
+	}
+	if( realtimeViolations() ){
+		fprintf( stderr, "Error: %lu calls which may block on the audio thread\n", realtimeViolations() );
+		return 1;
+	}
+
+	// per-column costs, in microseconds
+	double writeCost[NUM_ENGINES], readCost[NUM_ENGINES];
+	PercentilesEngine partitioned( set, false );
+	printf( "%u bins, windows of %u, percentile %g, %u columns, %u partitions\n",
+			set.bins, set.size, set.percentile, set.columns, partitioned.getNumPartitions() );
+	printf( "  %-6s %10s %10s\n", "engine", "write us", "read us" );
+	for( unsigned int e=0; e<NUM_ENGINES; ++e ){
+		double w, wr;
+		timeEngine( e, set, columns, runs, &w, &wr );
+		writeCost[e] = w * 1e6;
+		readCost[e] = ( wr > w )? ( wr - w ) * 1e6 : 0;
+		printf( "  %-6s %10.2f %10.2f\n", engineNames[e], writeCost[e], readCost[e] );
+	}
+
+	// eager writes and lazy reads, which are shared among threads, at each thread count up to -j
+	unsigned int maxThreads = set.threads;
+	if( maxThreads == 0 ){
+		long processors = sysconf( _SC_NPROCESSORS_ONLN );
+		maxThreads = ( processors > 0 )? processors : 1;
+	}
+	if( maxThreads > 1 ){
+		printf( "\nscaling with threads\n" );
+		printf( "  %-8s %10s %10s %8s %10s %8s\n", "threads", "partitions", "write us", "speedup", "read us", "speedup" );
+		double baseWrite = 0, baseRead = 0;
+		unsigned int lastPartitions = 0;
+		for( unsigned int threads=1; ; threads*=2 ){
+			if( threads > maxThreads ) threads = maxThreads;
+			Settings scaled = set;
+			scaled.threads = threads;
+			unsigned int numPartitions = PercentilesEngine( scaled, false ).getNumPartitions();
+			if( numPartitions != lastPartitions ){
+				double w, wr, lazyW, lazyWR;
+				timeEngine( 1, scaled, columns, runs, &w, &wr );
+				timeEngine( 2, scaled, columns, runs, &lazyW, &lazyWR );
+				double write = w * 1e6;
+				double read = ( lazyWR > lazyW )? ( lazyWR - lazyW ) * 1e6 : 0;
+				if( threads == 1 ){
+					baseWrite = write;
+					baseRead = read;
+				}
+				printf( "  %-8u %10u %10.2f %7.2fx %10.2f %7.2fx\n", threads, numPartitions,
+						write, baseWrite / write, read, ( read > 0 )? baseRead / read : 0 );
+				lastPartitions = numPartitions;
+			}
+			if( threads == maxThreads ) break;
+		}
+	}
+
+	// time per second of audio at a range of read rates
+	printf( "\nus per second at %g writes/s\n", writeRate );
+	printf( "  %-8s", "reads/s" );
+	for( unsigned int e=0; e<NUM_ENGINES; ++e ) printf( " %10s", engineNames[e] );
+	printf( "\n" );
+	const double readRates[] = { 0.1, 0.25, 0.5, 1, 2, 5, 10, 20 };
+	for( unsigned int i=0; i<sizeof(readRates)/sizeof(readRates[0]); ++i ){
+		double reads = readRates[i];
+		printf( "  %-8g", reads );
+		for( unsigned int e=0; e<NUM_ENGINES; ++e ){
+			// the lazy engine only selects on the first read after a write
+			double counted = ( e == 2 && reads > writeRate )? writeRate : reads;
+			printf( " %10.1f", writeRate * writeCost[e] + counted * readCost[e] );
+		}
+		printf( "\n" );
+	}
+
+	// eager and lazy cost the same at reads/s = writes/s * (eager write - lazy write) / (lazy read - eager read)
+	double readDiff = readCost[2] - readCost[1];
+	double crossover = ( readDiff > 0 )? writeRate * ( writeCost[1] - writeCost[2] ) / readDiff : DBL_MAX;
+	if( crossover <= 0 ){
+		printf( "\neager is cheaper than lazy at every read rate\n" );
+	}else if( crossover >= writeRate ){
+		printf( "\nlazy is cheaper than eager at every read rate\n" );
+	}else{
+		printf( "\nlazy is cheaper than eager below %.2f reads/s (one read per %.1f writes)\n",
+				crossover, writeRate / crossover );
+	}
+	return 0;
+}
@@ -1,61 +1,1163 @@
 /*
- *  tester.c
+ *  tester.cpp
  *  Fingerprinter
  *
  *  Created by Stephen Tarzia on 9/23/10.
  *  Copyright 2010 Northwestern University. All rights reserved.
  *
- * Compile this on the command line using "make"
+ * Command-line fingerprinting and database queries for recorded audio, built
+ * on the portable core (Classes/SpectrumAnalyzer.h and FingerprintFile.h)
+ * rather than the audio unit, so it runs anywhere and as fast as the files
+ * can be read.  Compile this on the command line using "make".
+ *
+ *   build/tester fingerprint [-x] [-i SECONDS] WAV...
+ *     prints each file's fingerprint at its end, or every SECONDS of audio, as
+ *     filename, time in seconds and the fingerprint values.
+ *   build/tester query [-x] [-k N] [-m METRIC] DB WAV...
+ *     prints each file's name followed by the k closest rooms in the database
+ *     file DB, as building, room and distance.  METRIC is l2 (default), l1,
+ *     cosine or correlation; see DistanceMetrics.h.
+ *   build/tester insert [-x] -b BUILDING -r ROOM [-l LAT,LON] DB WAV...
+ *     appends each file's fingerprint to DB as a new entry, printing its uuid.
+ *   build/tester delete [-u UUID] [-b BUILDING] [-r ROOM] DB
+ *     removes the entries matching all of the given fields.
+ *   build/tester expire -t TIME | -d DAYS DB
+ *     expires the entries older than TIME (seconds since 1970), or than DAYS
+ *     days ago, as FingerprintDB does: the time is recorded in DB's expiry file
+ *     (see FingerprintFile.h), and DB is only rewritten once its expired entries
+ *     outnumber the others.
+ *   build/tester coalesce -e EPSILON [-m METRIC] [-c] DB
+ *     merges near-duplicate entries as FingerprintDB's coalesceEntriesWithin:
+ *     does (Classes/Coalesce.h): within each room, oldest first, an entry within
+ *     EPSILON of a representative is folded into it, leaving the count-weighted
+ *     mean fingerprint, the sum of the counts and the newer timestamp, and DB is
+ *     rewritten.  METRIC is as for query.  -c also re-runs a sample of the old
+ *     fingerprints as queries before and after, and reports how many kept their
+ *     best room and the mean overlap of their top COALESCE_TOP_K rooms.
+ *   build/tester list [-n] [-s START] [-e END] DB
+ *     prints the entries with timestamps from START to END (seconds since 1970,
+ *     default all), oldest first, or with -n only the newest of each room,
+ *     newest first, as uuid, timestamp, building and room.  Entries are found
+ *     with FingerprintDB's time index (Classes/TimeIndex.h).
+ *   build/tester compare WAV...
+ *     analyzes each file with both the float and the fixed-point signal
+ *     processing, and prints the largest differences between their spectrogram
+ *     columns and fingerprints, in dB, and the time each took.  Fails if a
+ *     fingerprint differs by more than FIXED_POINT_TOLERANCE_DB.
+ *   build/tester events [-x] WAV...
+ *     prints the environment changes found in each file (Classes/ChangeDetector.h)
+ *     as filename, time in seconds and "changed" or "stable", then the number of
+ *     database queries the app's timer would have made, against the number made
+ *     when queries follow the events, as in MatchViewController.
+ *   build/tester converge [-x] [-d DB] [-o SECONDS] MOTIONLOG WAV
+ *     replays a recorded session, audio with the motion log recorded alongside
+ *     it (see SensorLog.h), and measures how quickly the fingerprint converges
+ *     after each walk, with the history left alone and with it cut when the
+ *     MotionGate finds the user has settled (Classes/MotionGate.h).  Each stay
+ *     between walks is printed as filename, arrival time, seconds until the gate
+ *     fired, seconds stayed, then the seconds after arrival from which the
+ *     fingerprint stays within DB dB (default CONVERGE_TOLERANCE_DB, as a mean over
+ *     the bins) of the 5th percentile of the whole stay, without and with gating,
+ *     or "-" if it never does.  SECONDS is the log's timestamp of the first sample,
+ *     by default that of its first record.
+ * -x uses the fixed-point signal processing (Classes/FixedPointSpectrum.h);
+ * by default, the path chosen at build time is used, which is normally float.
+ *
+ *   build/tester -M FILE COMMAND ...
+ * runs any command, then writes a snapshot of the metrics (Classes/Metrics.h)
+ * which the pipeline and the database recorded to FILE, as JSON if its name
+ * ends in ".json", otherwise in the Prometheus text format.
+ *
+ *   build/tester -L FILE COMMAND ...
+ * also logs every spectrogram column to FILE, as the app does with detailed
+ * logging (see Spectrogram.h; read it with sensorlog2txt).  -M and -L may both
+ * be given.
+ *
+ * WAV files must be sampled at 44.1 kHz, as 16, 24 or 32-bit integers or
+ * 32-bit floats.  Channels are averaged.  Fingerprints summarize the last
+ * ten seconds of each file, so shorter files give a warning.  Files are read
+ * in blocks and the database one entry at a time, so neither is held in
+ * memory, except by list.  Every command skips the entries expired in DB's
+ * expiry file.  Timings of each stage go to stderr.
+ *
+ * build/tester-rtcheck is the same tester, checking that the work of the audio
+ * callback never allocates, locks or does I/O (see Classes/RealtimeCheck.h);
+ * a command fails if it did.
  */
 
-
-#import "Fingerprinter.h"
-#import <iostream>
+#include "SpectrumAnalyzer.h"
+#include "FingerprintFile.h"
+#include "FingerprintScan.h"
+#include "Coalesce.h"
+#include "Metrics.h"
+#include "RealtimeCheck.h"
+#include "SensorLog.h"
+#include "TimeIndex.h"
+#include "WavReader.h"
+#include <float.h>
+#include <limits.h> // for LLONG_MIN and LLONG_MAX
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> // for strcasecmp
+#include <time.h>
 #include <unistd.h>
+#include <sys/time.h>
+#include <algorithm> // for nth_element and find
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::map;
+using std::pair;
+using std::string;
+using std::vector;
+
+#define OUTPUT_BUFFER_BYTES (1<<20)
+#define SCAN_ROWS 4096    // database entries scanned at a time
+
+/* MatchViewController's query schedule, for the events command */
+#define QUERY_INTERVAL 2.0   // seconds between timed queries
+#define QUERY_REFRESH 30.0   // seconds between timed queries while the environment is stable
+
+/* the coalesce command's ranking comparison, as in FingerprintDB */
+#define COALESCE_PROBES 200 // most fingerprints re-run as queries
+#define COALESCE_TOP_K 5    // rooms compared per query
+
+/* the converge command */
+#define CONVERGE_TOLERANCE_DB 1.0 // default mean difference from the stay's fingerprint which counts as converged
+#define CONVERGE_PERCENTILE 0.05  // Spectrogram's, for the stay's fingerprint
+
+/* wall-clock seconds, for timing */
+double elapsed(){
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* the spectrogram log of every analyzed file, or NULL; see -L */
+const char* spectrogramLogFilename = NULL;
+
+/* timings and totals for the fingerprinting stage */
+struct AudioStats{
+	unsigned int files;
+	unsigned long long frames;
+	double readSeconds, analysisSeconds;
+};
+
+/* prints a fingerprint every interval columns, for the fingerprint command */
+struct IntervalPrinter{
+	SpectrumAnalyzer* analyzer;
+	const char* filename;
+	unsigned int interval;
+	vector<float> fingerprint;
+};
+
+void printFingerprint( const char* filename, double seconds, const float* fingerprint ){
+	printf( "%s\t%.2f", filename, seconds );
+	for( unsigned int i=0; i<ANALYZER_FP_LENGTH; ++i ) printf( "\t%.4g", fingerprint[i] );
+	printf( "\n" );
+}
+
+void printAtInterval( const float* column, unsigned long long endSample, void* context ){
+	IntervalPrinter* p = (IntervalPrinter*)context;
+	if( p->analyzer->getNumColumns() % p->interval == 0 ){
+		p->analyzer->getFingerprint( &p->fingerprint[0] );
+		printFingerprint( p->filename, (double)endSample / ANALYZER_SAMPLE_RATE, &p->fingerprint[0] );
+	}
+}
+
+/**
+ * Streams a WAV file through the analyzer, which is reset first.
+ * @param fingerprint if not NULL, receives the fingerprint at the end of the file.
+ * @return false if the file cannot be read.
+ */
+bool analyzeFile( const char* filename, SpectrumAnalyzer& analyzer, float* fingerprint, AudioStats& stats ){
+	WavReader wav;
+	if( !wav.open( filename ) ) return false;
+	analyzer.reset();
+	if( spectrogramLogFilename ) analyzer.enableSpectrogramLogging( spectrogramLogFilename );
+	vector<float> samples( WAV_READ_FRAMES );
+	unsigned long long frames = 0;
+	while( true ){
+		double t0 = elapsed();
+		unsigned int n = wav.read( &samples[0] );
+		double t1 = elapsed();
+		stats.readSeconds += t1-t0;
+		if( n == 0 ) break;
+		analyzer.addSamples( &samples[0], n );
+		stats.analysisSeconds += elapsed()-t1;
+		frames += n;
+	}
+	stats.frames += frames;
+	++stats.files;
+	if( fingerprint && !analyzer.getFingerprint( fingerprint ) ){
+		fprintf( stderr, "Warning: %s has only %.1f s of audio, so its fingerprint includes silence\n",
+				 filename, (double)frames / ANALYZER_SAMPLE_RATE );
+	}
+	return true;
+}
+
+void printAudioStats( const AudioStats& stats ){
+	double seconds = (double)stats.frames / ANALYZER_SAMPLE_RATE;
+	double total = stats.readSeconds + stats.analysisSeconds;
+	fprintf( stderr, "audio: %u files, %.1f s, read in %.2f s, analyzed in %.2f s (%.0fx real time)\n",
+			 stats.files, seconds, stats.readSeconds, stats.analysisSeconds, total > 0? seconds / total : 0.0 );
+}
+
+/* Fingerprints each file.  @return false if any could not be read. */
+bool fingerprintFiles( char** filenames, unsigned int n, vector<float>& fingerprints, bool fixedPoint ){
+	SpectrumAnalyzer analyzer;
+	if( fixedPoint ) analyzer.setFixedPoint( true );
+	AudioStats stats = { 0, 0, 0, 0 };
+	fingerprints.resize( n * ANALYZER_FP_LENGTH );
+	for( unsigned int i=0; i<n; ++i ){
+		if( !analyzeFile( filenames[i], analyzer, &fingerprints[i*ANALYZER_FP_LENGTH], stats ) ) return false;
+	}
+	printAudioStats( stats );
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+// COMMANDS
+
+int usage( const char* name ){
+	fprintf( stderr, "usage: %s fingerprint [-x] [-i SECONDS] WAV...\n"
+					 "       %s query [-x] [-k N] [-m l2|l1|cosine|correlation] DB WAV...\n"
+					 "       %s insert [-x] -b BUILDING -r ROOM [-l LAT,LON] DB WAV...\n"
+					 "       %s delete [-u UUID] [-b BUILDING] [-r ROOM] DB\n"
+					 "       %s expire -t TIME | -d DAYS DB\n"
+					 "       %s coalesce -e EPSILON [-m l2|l1|cosine|correlation] [-c] DB\n"
+					 "       %s list [-n] [-s START] [-e END] DB\n"
+					 "       %s compare WAV...\n"
+					 "       %s events [-x] WAV...\n"
+					 "       %s converge [-x] [-d DB] [-o SECONDS] MOTIONLOG WAV\n"
+					 "-M FILE before the command writes its metrics to FILE\n"
+					 "-L FILE before the command logs the spectrogram to FILE\n",
+			 name, name, name, name, name, name, name, name, name, name );
+	return 1;
+}
+
+int fingerprintCommand( int argc, char** argv ){
+	double interval = 0;
+	bool fixedPoint = false;
+	int c;
+	while( ( c = getopt( argc, argv, "xi:" ) ) != -1 ){
+		switch( c ){
+			case 'x': fixedPoint = true; break;
+			case 'i': interval = atof( optarg ); break;
+			default: return usage( argv[-1] );
+		}
+	}
+	if( optind >= argc || interval < 0 ) return usage( argv[-1] );
+
+	SpectrumAnalyzer analyzer;
+	if( fixedPoint ) analyzer.setFixedPoint( true );
+	AudioStats stats = { 0, 0, 0, 0 };
+	IntervalPrinter printer;
+	printer.analyzer = &analyzer;
+	printer.interval = (unsigned int)( interval * ANALYZER_SAMPLE_RATE / ANALYZER_COLUMN_SAMPLES + 0.5 );
+	printer.fingerprint.resize( ANALYZER_FP_LENGTH );
+	if( interval > 0 ){
+		if( printer.interval < 1 ) printer.interval = 1;
+		analyzer.setColumnCallback( printAtInterval, &printer );
+	}
+	for( int a=optind; a<argc; ++a ){
+		printer.filename = argv[a];
+		unsigned long long before = stats.frames;
+		if( !analyzeFile( argv[a], analyzer, interval > 0? NULL : &printer.fingerprint[0], stats ) ) return 1;
+		if( interval == 0 ){
+			printFingerprint( argv[a], (double)( stats.frames - before ) / ANALYZER_SAMPLE_RATE, &printer.fingerprint[0] );
+		}
+	}
+	printAudioStats( stats );
+	return 0;
+}
+
+int queryCommand( int argc, char** argv ){
+	unsigned int numMatches = 1;
+	AcousticMetric metric = AcousticMetricL2;
+	bool fixedPoint = false;
+	int c;
+	while( ( c = getopt( argc, argv, "xk:m:" ) ) != -1 ){
+		switch( c ){
+			case 'x': fixedPoint = true; break;
+			case 'k': numMatches = atoi( optarg ); break;
+			case 'm': if( !parseAcousticMetric( optarg, &metric ) ) return usage( argv[-1] ); break;
+			default: return usage( argv[-1] );
+		}
+	}
+	if( argc - optind < 2 || numMatches < 1 ) return usage( argv[-1] );
+	const char* dbFilename = argv[optind];
+	char** wavs = argv + optind + 1;
+	unsigned int numQueries = argc - optind - 1;
 
-using namespace std;
-
-void printFingerprint( Fingerprint fingerprint ){
-	for( unsigned int i=0; i<Fingerprinter::fpLength; ++i ){
-		cout << fingerprint[i] << ' ';
-	}
-	cout << endl;
-}
-
-int main(){
-	Fingerprinter fp;
-	// start recording fingerprints
-	fp.startRecording();
-	cout << "Wait ten seconds to gather enough data for a fingerprint" << endl;
-	sleep(11);
-	
-	// get the latest fingerprint 
-	Fingerprint observed = new float[Fingerprinter::fpLength];
-	// getFingerprint fills in the passed array
-	fp.getFingerprint(observed);
-
-	cout << "Newly observed fingerprint:" <<endl;
-	printFingerprint(observed);
-	
-	
-	// query for a list of matches
-	cout << endl << "DB Matches:" <<endl;
-	int NUM_MATCHES = 3;
-	QueryResult* qr = fp.queryMatches( observed, NUM_MATCHES );
-	for( int i=0; i<NUM_MATCHES; i++ ){
-		cout << "match #" << i << '\t'
-		     << "uid=" << (*qr)[i].uid << '\t' 
-		     << "name=" << fp.queryName( (*qr)[i].uid ) << '\t' 
-		     << "confidence=" << (*qr)[i].confidence << '\t'
-		     << "fingerprint= ";
-		// query fingerprint saves the query result in observed
-		fp.queryFingerprint( (*qr)[i].uid, observed );
-		printFingerprint( observed );
-	}
-	
-	// assuming that we were not satisfied with any of the results, add this as a new room
-	fp.insertFingerprint( observed, string( "newRoom" ) );
-						 
-	delete[] observed;
-	delete qr;
+	vector<float> fingerprints;
+	if( !fingerprintFiles( wavs, numQueries, fingerprints, fixedPoint ) ) return 1;
+	vector<const float*> queries( numQueries );
+	vector<FingerprintStats> queryStats( numQueries );
+	for( unsigned int j=0; j<numQueries; ++j ){
+		queries[j] = &fingerprints[j*ANALYZER_FP_LENGTH];
+		queryStats[j].compute( queries[j], ANALYZER_FP_LENGTH );
+	}
+
+	MetricsRegistry* metrics = MetricsRegistry::shared();
+	metrics->counter( "database_queries_total", "Fingerprints matched against the database" )->add( numQueries );
+
+	// one pass over the database, scoring a batch of entries against every query at a time
+	double t0 = elapsed();
+	FILE* dbFile = fopen( dbFilename, "r" );
+	if( !dbFile ){
+		fprintf( stderr, "Error: cannot open %s\n", dbFilename );
+		return 1;
+	}
+	FingerprintFileReader reader( dbFile );
+	reader.setExpiryTime( readExpiryTime( expiryFilename( dbFilename ).c_str() ) );
+	map< pair<string,string>, unsigned int > roomIds; // (building, room) -> room id
+	vector< pair<string,string> > rooms;
+	vector<float> roomScores, roomBest; // see GroupScan
+	vector<unsigned int> roomBestRow;
+	vector<float> batch( SCAN_ROWS * ANALYZER_FP_LENGTH );
+	vector<const float*> rows( SCAN_ROWS );
+	vector<FingerprintStats> batchStats( SCAN_ROWS );
+	vector<const FingerprintStats*> rowStats( SCAN_ROWS );
+	vector<unsigned int> rowRooms( SCAN_ROWS );
+	unsigned int numEntries = 0, numWrongLength = 0;
+	unsigned long evaluations = 0;
+	FingerprintEntry entry;
+	bool more = true;
+	while( more ){
+		unsigned int numRows = 0;
+		while( numRows < SCAN_ROWS && ( more = reader.next( entry ) ) ){
+			if( entry.fingerprint.size() != ANALYZER_FP_LENGTH ){
+				++numWrongLength;
+				continue;
+			}
+			float* row = &batch[numRows*ANALYZER_FP_LENGTH];
+			memcpy( row, &entry.fingerprint[0], sizeof(float)*ANALYZER_FP_LENGTH );
+			rows[numRows] = row;
+			batchStats[numRows].compute( row, ANALYZER_FP_LENGTH );
+			rowStats[numRows] = &batchStats[numRows];
+			// find this entry's room id, assigning a new one if the room has not been seen yet
+			pair<string,string> room( entry.building, entry.room );
+			map< pair<string,string>, unsigned int >::iterator it = roomIds.find( room );
+			if( it == roomIds.end() ){
+				it = roomIds.insert( make_pair( room, (unsigned int)rooms.size() ) ).first;
+				rooms.push_back( room );
+			}
+			rowRooms[numRows++] = it->second;
+		}
+		if( numRows == 0 ) continue;
+		numEntries += numRows;
+		// new rooms start with no match
+		roomScores.resize( rooms.size() * numQueries, FLT_MAX );
+		roomBest.resize( rooms.size(), FLT_MAX );
+		roomBestRow.resize( rooms.size(), 0 );
+		GroupScan scan;
+		scan.queries = &queries[0];
+		scan.numQueries = numQueries;
+		scan.rows = &rows[0];
+		scan.groups = &rowRooms[0];
+		scan.numRows = numRows;
+		scan.queryStats = &queryStats[0];
+		scan.rowStats = &rowStats[0];
+		scan.queryRows = NULL;
+		scan.groupScores = &roomScores[0];
+		scan.groupBestScore = &roomBest[0];
+		scan.groupBestRow = &roomBestRow[0];
+		evaluations += scanGroupMinima( metric, ANALYZER_FP_LENGTH, NULL, IdentityScore(), scan );
+	}
+	fclose( dbFile );
+	double t1 = elapsed();
+	metrics->histogram( "database_scan_us", "Microseconds per pass over a database file" )->record( (uint64_t)( (t1-t0)*1e6 ) );
+	metrics->gauge( "database_entries", "Entries in the database" )->set( numEntries );
+	fprintf( stderr, "database: %u entries, %zu rooms, scanned in %.2f s, %.1f distances per entry and query\n",
+			 numEntries, rooms.size(), t1-t0,
+			 numEntries? (double)evaluations / numEntries / numQueries : 0.0 );
+	if( numWrongLength || reader.getNumMalformed() ){
+		fprintf( stderr, "Warning: skipped %u entries without %u fingerprint values and %u malformed lines\n",
+				 numWrongLength, ANALYZER_FP_LENGTH, reader.getNumMalformed() );
+	}
+
+	// rank the rooms for each query
+	setvbuf( stdout, NULL, _IOFBF, OUTPUT_BUFFER_BYTES );
+	unsigned int numRooms = rooms.size();
+	vector<float> scores( numRooms );
+	vector<unsigned int> ranking( numMatches < numRooms? numMatches : numRooms );
+	for( unsigned int j=0; j<numQueries; ++j ){
+		for( unsigned int r=0; r<numRooms; ++r ) scores[r] = roomScores[r*numQueries+j];
+		unsigned int k = selectTopK( numRooms? &scores[0] : NULL, numRooms, ranking.size(), ranking.empty()? NULL : &ranking[0] );
+		printf( "%s", wavs[j] );
+		for( unsigned int i=0; i<k; ++i ){
+			const pair<string,string>& room = rooms[ranking[i]];
+			printf( "\t%s\t%s\t%.4f", room.first.c_str(), room.second.c_str(), scores[ranking[i]] );
+		}
+		printf( "\n" );
+	}
+	return 0;
+}
+
+int insertCommand( int argc, char** argv ){
+	FingerprintEntry entry;
+	entry.latitude = entry.longitude = entry.altitude = 0;
+	entry.horizontalAccuracy = entry.verticalAccuracy = -1; // unknown, as CLLocation marks it
+	entry.count = 1;
+	bool haveBuilding = false, haveRoom = false;
+	bool fixedPoint = false;
+	int c;
+	while( ( c = getopt( argc, argv, "xb:r:l:" ) ) != -1 ){
+		switch( c ){
+			case 'x': fixedPoint = true; break;
+			case 'b': entry.building = optarg; haveBuilding = true; break;
+			case 'r': entry.room = optarg; haveRoom = true; break;
+			case 'l':
+				if( sscanf( optarg, "%lf,%lf", &entry.latitude, &entry.longitude ) != 2 ) return usage( argv[-1] );
+				entry.horizontalAccuracy = 0;
+				break;
+			default: return usage( argv[-1] );
+		}
+	}
+	if( argc - optind < 2 || !haveBuilding || !haveRoom ) return usage( argv[-1] );
+	if( strchr( entry.building.c_str(), '\t' ) || strchr( entry.room.c_str(), '\t' ) ){
+		fprintf( stderr, "Error: building and room names may not contain tabs\n" );
+		return 1;
+	}
+	const char* dbFilename = argv[optind];
+	char** wavs = argv + optind + 1;
+	unsigned int n = argc - optind - 1;
+
+	vector<float> fingerprints;
+	if( !fingerprintFiles( wavs, n, fingerprints, fixedPoint ) ) return 1;
+	double t0 = elapsed();
+	FILE* dbFile = fopen( dbFilename, "a" );
+	if( !dbFile ){
+		fprintf( stderr, "Error: cannot open %s\n", dbFilename );
+		return 1;
+	}
+	entry.timestamp = time( NULL );
+	for( unsigned int i=0; i<n; ++i ){
+		entry.uuid = newUUIDString();
+		entry.fingerprint.assign( &fingerprints[i*ANALYZER_FP_LENGTH], &fingerprints[(i+1)*ANALYZER_FP_LENGTH] );
+		if( !writeFingerprintEntry( dbFile, entry ) ){
+			fprintf( stderr, "Error: cannot write to %s\n", dbFilename );
+			fclose( dbFile );
+			return 1;
+		}
+		printf( "%s\t%s\n", wavs[i], entry.uuid.c_str() );
+	}
+	if( fclose( dbFile ) ){
+		fprintf( stderr, "Error: cannot write to %s\n", dbFilename );
+		return 1;
+	}
+	MetricsRegistry::shared()->counter( "database_inserts_total", "Fingerprints inserted into the database" )->add( n );
+	fprintf( stderr, "database: %u entries inserted in %.2f s\n", n, elapsed()-t0 );
+	return 0;
+}
+
+int deleteCommand( int argc, char** argv ){
+	const char* uuid = NULL;
+	const char* building = NULL;
+	const char* room = NULL;
+	int c;
+	while( ( c = getopt( argc, argv, "u:b:r:" ) ) != -1 ){
+		switch( c ){
+			case 'u': uuid = optarg; break;
+			case 'b': building = optarg; break;
+			case 'r': room = optarg; break;
+			default: return usage( argv[-1] );
+		}
+	}
+	if( argc - optind != 1 || !( uuid || building || room ) ) return usage( argv[-1] );
+	const char* dbFilename = argv[optind];
+
+	// copy the entries to keep into a new file, which then replaces the old one
+	double t0 = elapsed();
+	FILE* in = fopen( dbFilename, "r" );
+	if( !in ){
+		fprintf( stderr, "Error: cannot open %s\n", dbFilename );
+		return 1;
+	}
+	string tmpFilename = string( dbFilename ) + ".tmp";
+	FILE* out = fopen( tmpFilename.c_str(), "w" );
+	if( !out ){
+		fprintf( stderr, "Error: cannot create %s\n", tmpFilename.c_str() );
+		fclose( in );
+		return 1;
+	}
+	FingerprintFileReader reader( in );
+	reader.setExpiryTime( readExpiryTime( expiryFilename( dbFilename ).c_str() ) );
+	FingerprintEntry entry;
+	string line;
+	unsigned int kept = 0, deleted = 0;
+	while( reader.next( entry, &line ) ){
+		if( ( !uuid || !strcasecmp( entry.uuid.c_str(), uuid ) ) &&
+		    ( !building || entry.building == building ) &&
+		    ( !room || entry.room == room ) ){
+			++deleted;
+			continue;
+		}
+		// kept lines are copied as they were
+		fwrite( line.data(), 1, line.size(), out );
+		fputc( '\n', out );
+		++kept;
+	}
+	fclose( in );
+	if( fclose( out ) || rename( tmpFilename.c_str(), dbFilename ) ){
+		fprintf( stderr, "Error: cannot replace %s\n", dbFilename );
+		unlink( tmpFilename.c_str() );
+		return 1;
+	}
+	fprintf( stderr, "database: %u entries deleted, %u kept, %u expired dropped, in %.2f s\n",
+			 deleted, kept, reader.getNumExpired(), elapsed()-t0 );
+	if( reader.getNumMalformed() ){
+		fprintf( stderr, "Warning: dropped %u malformed lines\n", reader.getNumMalformed() );
+	}
+	return 0;
+}
+
+/* copies the live entries of a database file over it, dropping the expired ones.  @return false on an error. */
+bool compactDatabase( const char* dbFilename, long long expiryTime ){
+	FILE* in = fopen( dbFilename, "r" );
+	if( !in ){
+		fprintf( stderr, "Error: cannot open %s\n", dbFilename );
+		return false;
+	}
+	string tmpFilename = string( dbFilename ) + ".tmp";
+	FILE* out = fopen( tmpFilename.c_str(), "w" );
+	if( !out ){
+		fprintf( stderr, "Error: cannot create %s\n", tmpFilename.c_str() );
+		fclose( in );
+		return false;
+	}
+	FingerprintFileReader reader( in );
+	reader.setExpiryTime( expiryTime );
+	FingerprintEntry entry;
+	string line;
+	while( reader.next( entry, &line ) ){
+		fwrite( line.data(), 1, line.size(), out );
+		fputc( '\n', out );
+	}
+	fclose( in );
+	if( fclose( out ) || rename( tmpFilename.c_str(), dbFilename ) ){
+		fprintf( stderr, "Error: cannot replace %s\n", dbFilename );
+		unlink( tmpFilename.c_str() );
+		return false;
+	}
+	return true;
+}
+
+int expireCommand( int argc, char** argv ){
+	long long expiryTime = LLONG_MIN;
+	int c;
+	while( ( c = getopt( argc, argv, "t:d:" ) ) != -1 ){
+		switch( c ){
+			case 't': expiryTime = atoll( optarg ); break;
+			case 'd': expiryTime = time( NULL ) - (long long)( atof( optarg ) * 24*60*60 ); break;
+			default: return usage( argv[-1] );
+		}
+	}
+	if( argc - optind != 1 || expiryTime == LLONG_MIN ) return usage( argv[-1] );
+	const char* dbFilename = argv[optind];
+	string expiryFile = expiryFilename( dbFilename );
+
+	// as FingerprintDB's expireEntriesOlderThan, the expiry time only moves forward
+	double t0 = elapsed();
+	long long oldExpiryTime = readExpiryTime( expiryFile.c_str() );
+	if( expiryTime < oldExpiryTime ) expiryTime = oldExpiryTime;
+	FILE* dbFile = fopen( dbFilename, "r" );
+	if( !dbFile ){
+		fprintf( stderr, "Error: cannot open %s\n", dbFilename );
+		return 1;
+	}
+	FingerprintFileReader reader( dbFile );
+	reader.setExpiryTime( expiryTime );
+	FingerprintEntry entry;
+	unsigned int live = 0;
+	while( reader.next( entry ) ) ++live;
+	fclose( dbFile );
+	if( expiryTime > oldExpiryTime && !writeExpiryTime( expiryFile.c_str(), expiryTime ) ){
+		fprintf( stderr, "Error: cannot write %s\n", expiryFile.c_str() );
+		return 1;
+	}
+	// compact the file once it is mostly dead entries
+	bool compacted = reader.getNumExpired() > live;
+	if( compacted && !compactDatabase( dbFilename, expiryTime ) ) return 1;
+	fprintf( stderr, "database: %u entries expired before %lld, %u kept, %s in %.2f s\n",
+			 reader.getNumExpired(), expiryTime, live, compacted? "compacted" : "not rewritten", elapsed()-t0 );
+	return 0;
+}
+
+/* distance between two database entries, and merge of one into another, for coalesceGroups */
+struct EntryDistance{
+	EntryDistance( AcousticMetric m, const vector<FingerprintEntry>& e, const vector<unsigned int>& i )
+	: metric(m), entries(e), items(i){}
+	inline float operator()( unsigned int a, unsigned int b ) const {
+		const vector<float>& fa = entries[items[a]].fingerprint;
+		return acousticDistance( metric, fa.size(), NULL, &fa[0], &entries[items[b]].fingerprint[0] );
+	}
+	AcousticMetric metric;
+	const vector<FingerprintEntry>& entries;
+	const vector<unsigned int>& items; // entry of each item
+};
+
+struct EntryMerge{
+	EntryMerge( vector<FingerprintEntry>& e, const vector<unsigned int>& i, vector<bool>& m )
+	: entries(e), items(i), merged(m){}
+	inline void operator()( unsigned int item, unsigned int representative ){
+		FingerprintEntry& e = entries[items[item]];
+		FingerprintEntry& rep = entries[items[representative]];
+		mergeFingerprints( &rep.fingerprint[0], rep.count, &e.fingerprint[0], e.count, rep.fingerprint.size() );
+		rep.count += e.count;
+		if( e.timestamp > rep.timestamp ) rep.timestamp = e.timestamp;
+		merged[items[item]] = true;
+	}
+	vector<FingerprintEntry>& entries;
+	const vector<unsigned int>& items;
+	vector<bool>& merged;
+};
+
+/* the best rooms for a fingerprint among the entries which have not been merged away, best first */
+vector<unsigned int> rankRooms( const float* query, const vector<FingerprintEntry>& entries, const vector<unsigned int>& items,
+								const vector<unsigned int>& itemRooms, const vector<bool>& merged, unsigned int numRooms,
+								AcousticMetric metric ){
+	vector<const float*> rows;
+	vector<unsigned int> rowRooms;
+	for( unsigned int i=0; i<items.size(); ++i ){
+		if( merged[items[i]] ) continue;
+		rows.push_back( &entries[items[i]].fingerprint[0] );
+		rowRooms.push_back( itemRooms[i] );
+	}
+	vector<float> roomScores( numRooms, FLT_MAX ), roomBest( numRooms, FLT_MAX );
+	vector<unsigned int> roomBestRow( numRooms, 0 );
+	GroupScan scan;
+	scan.queries = &query;
+	scan.numQueries = 1;
+	scan.rows = rows.empty()? NULL : &rows[0];
+	scan.groups = rowRooms.empty()? NULL : &rowRooms[0];
+	scan.numRows = rows.size();
+	scan.queryStats = NULL;
+	scan.rowStats = NULL;
+	scan.queryRows = NULL;
+	scan.groupScores = &roomScores[0];
+	scan.groupBestScore = &roomBest[0];
+	scan.groupBestRow = &roomBestRow[0];
+	scanGroupMinima( metric, entries[items[0]].fingerprint.size(), NULL, IdentityScore(), scan );
+	vector<unsigned int> ranking( COALESCE_TOP_K < numRooms? COALESCE_TOP_K : numRooms );
+	ranking.resize( selectTopK( &roomScores[0], numRooms, ranking.size(), ranking.empty()? NULL : &ranking[0] ) );
+	return ranking;
+}
+
+int coalesceCommand( int argc, char** argv ){
+	float epsilon = -1;
+	AcousticMetric metric = AcousticMetricL2;
+	bool compareRankings = false;
+	int c;
+	while( ( c = getopt( argc, argv, "e:m:c" ) ) != -1 ){
+		switch( c ){
+			case 'e': epsilon = atof( optarg ); break;
+			case 'm': if( !parseAcousticMetric( optarg, &metric ) ) return usage( argv[-1] ); break;
+			case 'c': compareRankings = true; break;
+			default: return usage( argv[-1] );
+		}
+	}
+	if( argc - optind != 1 || epsilon < 0 ) return usage( argv[-1] );
+	const char* dbFilename = argv[optind];
+
+	double t0 = elapsed();
+	FILE* dbFile = fopen( dbFilename, "r" );
+	if( !dbFile ){
+		fprintf( stderr, "Error: cannot open %s\n", dbFilename );
+		return 1;
+	}
+	FingerprintFileReader reader( dbFile );
+	reader.setExpiryTime( readExpiryTime( expiryFilename( dbFilename ).c_str() ) );
+	vector<FingerprintEntry> entries;
+	FingerprintEntry entry;
+	while( reader.next( entry ) ) entries.push_back( entry );
+	fclose( dbFile );
+
+	// entries with the length of the first are clustered oldest first, as the time index orders them
+	TimeIndex<unsigned int> timeIndex;
+	unsigned int numWrongLength = 0;
+	for( unsigned int i=0; i<entries.size(); ++i ){
+		if( entries[i].fingerprint.size() == entries[0].fingerprint.size() ) timeIndex.append( entries[i].timestamp, i );
+		else ++numWrongLength;
+	}
+	timeIndex.sort();
+	vector<unsigned int> items;
+	timeIndex.range( LLONG_MIN, LLONG_MAX, items );
+	map< pair<string,string>, unsigned int > roomIds; // (building, room) -> room id
+	vector<unsigned int> itemRooms( items.size() );
+	for( unsigned int i=0; i<items.size(); ++i ){
+		pair<string,string> room( entries[items[i]].building, entries[items[i]].room );
+		map< pair<string,string>, unsigned int >::iterator it = roomIds.find( room );
+		if( it == roomIds.end() ) it = roomIds.insert( make_pair( room, (unsigned int)roomIds.size() ) ).first;
+		itemRooms[i] = it->second;
+	}
+	vector<bool> merged( entries.size(), false );
+
+	// before merging, save a sample of fingerprints to probe with, and their ranked rooms
+	vector< vector<float> > probes;
+	vector< vector<unsigned int> > rankingsBefore;
+	if( compareRankings && !items.empty() ){
+		unsigned int step = ( items.size() + COALESCE_PROBES - 1 ) / COALESCE_PROBES;
+		for( unsigned int i=0; i<items.size(); i+=step ){
+			probes.push_back( entries[items[i]].fingerprint );
+			rankingsBefore.push_back( rankRooms( &probes.back()[0], entries, items, itemRooms, merged, roomIds.size(), metric ) );
+		}
+	}
+
+	EntryMerge merge( entries, items, merged );
+	unsigned int numMerged = coalesceGroups( items.size(), items.empty()? NULL : &itemRooms[0], roomIds.size(),
+											 epsilon, EntryDistance( metric, entries, items ), merge );
+	double t1 = elapsed();
+
+	// rewrite the file with the remaining entries, in their old order
+	if( numMerged > 0 ){
+		string tmpFilename = string( dbFilename ) + ".tmp";
+		FILE* out = fopen( tmpFilename.c_str(), "w" );
+		if( !out ){
+			fprintf( stderr, "Error: cannot create %s\n", tmpFilename.c_str() );
+			return 1;
+		}
+		bool ok = true;
+		for( unsigned int i=0; i<entries.size() && ok; ++i ){
+			if( !merged[i] ) ok = writeFingerprintEntry( out, entries[i] );
+		}
+		if( fclose( out ) || !ok || rename( tmpFilename.c_str(), dbFilename ) ){
+			fprintf( stderr, "Error: cannot replace %s\n", dbFilename );
+			unlink( tmpFilename.c_str() );
+			return 1;
+		}
+	}
+	fprintf( stderr, "database: coalesced %zu entries into %zu in %.2f s, %s\n",
+			 entries.size(), entries.size() - numMerged, t1-t0, numMerged? "rewritten" : "unchanged" );
+	if( numWrongLength || reader.getNumMalformed() ){
+		fprintf( stderr, "Warning: left alone %u entries of another fingerprint length, dropped %u malformed lines\n",
+				 numWrongLength, reader.getNumMalformed() );
+	}
+
+	// re-run the probes and compare with the old rankings
+	if( !probes.empty() ){
+		unsigned int top1Unchanged = 0;
+		double meanOverlap = 0;
+		for( unsigned int p=0; p<probes.size(); ++p ){
+			vector<unsigned int> after = rankRooms( &probes[p][0], entries, items, itemRooms, merged, roomIds.size(), metric );
+			const vector<unsigned int>& before = rankingsBefore[p];
+			if( !before.empty() && !after.empty() && before[0] == after[0] ) ++top1Unchanged;
+			unsigned int shared = 0;
+			for( unsigned int i=0; i<after.size(); ++i ){
+				if( std::find( before.begin(), before.end(), after[i] ) != before.end() ) ++shared;
+			}
+			unsigned int listLen = before.size() > after.size()? before.size() : after.size();
+			meanOverlap += listLen? (double)shared / listLen : 1.0;
+		}
+		meanOverlap /= probes.size();
+		fprintf( stderr, "rankings: top-1 unchanged for %u of %zu probes, mean top-%u overlap %.3f\n",
+				 top1Unchanged, probes.size(), COALESCE_TOP_K, meanOverlap );
+	}
+	return 0;
+}
+
+/* the room of an entry in the list command, for TimeIndex::newest */
+struct ListedRoom{
+	ListedRoom( const vector<unsigned int>& r ) : rooms(r){}
+	inline unsigned int operator()( unsigned int entry ) const { return rooms[entry]; }
+	const vector<unsigned int>& rooms;
+};
+
+int listCommand( int argc, char** argv ){
+	bool newest = false;
+	long long start = LLONG_MIN, end = LLONG_MAX;
+	int c;
+	while( ( c = getopt( argc, argv, "ns:e:" ) ) != -1 ){
+		switch( c ){
+			case 'n': newest = true; break;
+			case 's': start = atoll( optarg ); break;
+			case 'e': end = atoll( optarg ); break;
+			default: return usage( argv[-1] );
+		}
+	}
+	if( argc - optind != 1 ) return usage( argv[-1] );
+	const char* dbFilename = argv[optind];
+
+	double t0 = elapsed();
+	FILE* dbFile = fopen( dbFilename, "r" );
+	if( !dbFile ){
+		fprintf( stderr, "Error: cannot open %s\n", dbFilename );
+		return 1;
+	}
+	FingerprintFileReader reader( dbFile );
+	reader.setExpiryTime( readExpiryTime( expiryFilename( dbFilename ).c_str() ) );
+	vector<FingerprintEntry> entries;
+	map< pair<string,string>, unsigned int > roomIds; // (building, room) -> room id
+	vector<unsigned int> entryRooms;
+	TimeIndex<unsigned int> timeIndex;
+	FingerprintEntry entry;
+	while( reader.next( entry ) ){
+		entry.fingerprint.clear(); // not listed
+		pair<string,string> room( entry.building, entry.room );
+		map< pair<string,string>, unsigned int >::iterator it = roomIds.find( room );
+		if( it == roomIds.end() ) it = roomIds.insert( make_pair( room, (unsigned int)roomIds.size() ) ).first;
+		entryRooms.push_back( it->second );
+		timeIndex.append( entry.timestamp, entries.size() );
+		entries.push_back( entry );
+	}
+	fclose( dbFile );
+	timeIndex.sort();
+
+	vector<unsigned int> listed;
+	if( newest ) timeIndex.newest( ListedRoom( entryRooms ), roomIds.size(), listed );
+	else timeIndex.range( start, end, listed );
+	setvbuf( stdout, NULL, _IOFBF, OUTPUT_BUFFER_BYTES );
+	for( unsigned int i=0; i<listed.size(); ++i ){
+		const FingerprintEntry& e = entries[listed[i]];
+		printf( "%s\t%lld\t%s\t%s\n", e.uuid.c_str(), e.timestamp, e.building.c_str(), e.room.c_str() );
+	}
+	fprintf( stderr, "database: %u of %zu entries listed, %u expired, in %.2f s\n",
+			 (unsigned int)listed.size(), entries.size(), reader.getNumExpired(), elapsed()-t0 );
+	return 0;
+}
+
+/* collects every spectrogram column, for the compare command */
+void saveColumn( const float* column, unsigned long long endSample, void* context ){
+	vector<float>* columns = (vector<float>*)context;
+	columns->insert( columns->end(), column, column + ANALYZER_FP_LENGTH );
+}
+
+/* largest difference between a and b, counting equal infinities as no difference */
+float largestDifference( const float* a, const float* b, unsigned int n ){
+	float largest = 0;
+	for( unsigned int i=0; i<n; ++i ){
+		float d = ( a[i] == b[i] )? 0 : fabsf( a[i] - b[i] );
+		if( !( d <= largest ) ) largest = d; // NaN counts as the largest
+	}
+	return largest;
+}
+
+int compareCommand( int argc, char** argv ){
+	if( getopt( argc, argv, "" ) != -1 || optind >= argc ) return usage( argv[-1] );
+
+	SpectrumAnalyzer floatAnalyzer, fixedAnalyzer;
+	floatAnalyzer.setFixedPoint( false );
+	fixedAnalyzer.setFixedPoint( true );
+	vector<float> floatColumns, fixedColumns;
+	floatAnalyzer.setColumnCallback( saveColumn, &floatColumns );
+	fixedAnalyzer.setColumnCallback( saveColumn, &fixedColumns );
+	AudioStats floatStats = { 0, 0, 0, 0 }, fixedStats = { 0, 0, 0, 0 };
+	vector<float> floatPrint( ANALYZER_FP_LENGTH ), fixedPrint( ANALYZER_FP_LENGTH );
+	float worst = 0;
+	printf( "file\tcolumns\tcolumn dB\tfingerprint dB\n" );
+	for( int a=optind; a<argc; ++a ){
+		floatColumns.clear();
+		fixedColumns.clear();
+		if( !analyzeFile( argv[a], floatAnalyzer, &floatPrint[0], floatStats ) ) return 1;
+		if( !analyzeFile( argv[a], fixedAnalyzer, &fixedPrint[0], fixedStats ) ) return 1;
+		float columnDiff = largestDifference( &floatColumns[0], &fixedColumns[0], floatColumns.size() );
+		float printDiff = largestDifference( &floatPrint[0], &fixedPrint[0], ANALYZER_FP_LENGTH );
+		printf( "%s\t%lu\t%.5f\t%.5f\n", argv[a], (unsigned long)( floatColumns.size() / ANALYZER_FP_LENGTH ),
+				columnDiff, printDiff );
+		if( !( printDiff <= worst ) ) worst = printDiff;
+	}
+	fprintf( stderr, "float: " );
+	printAudioStats( floatStats );
+	fprintf( stderr, "fixed: " );
+	printAudioStats( fixedStats );
+	if( !( worst <= FIXED_POINT_TOLERANCE_DB ) ){
+		fprintf( stderr, "Error: fingerprints differ by up to %.5f dB, more than the tolerance of %g dB\n",
+				 worst, FIXED_POINT_TOLERANCE_DB );
+		return 1;
+	}
+	return 0;
+}
+
+/* the environment events of one file, for the events command */
+struct EventLog{
+	const char* filename;
+	vector< pair<EnvironmentEvent,unsigned long long> > events; // with the column of each
+};
+
+void logEvent( EnvironmentEvent event, unsigned long long column, void* context ){
+	EventLog* log = (EventLog*)context;
+	log->events.push_back( std::make_pair( event, column ) );
+	printf( "%s\t%.2f\t%s\n", log->filename, (double)( column * ANALYZER_COLUMN_SAMPLES ) / ANALYZER_SAMPLE_RATE,
+			( event == ENVIRONMENT_CHANGED )? "changed" : "stable" );
+}
+
+/**
+ * Counts the queries of MatchViewController's schedule over numColumns columns with the
+ * given events: one as each stable event arrives, and on every QUERY_INTERVAL timer tick
+ * while the environment is unstable or once QUERY_REFRESH has passed since the last query.
+ */
+unsigned int eventQueries( const EventLog& log, unsigned long long numColumns ){
+	const double columnSeconds = (double)ANALYZER_COLUMN_SAMPLES / ANALYZER_SAMPLE_RATE;
+	unsigned int queries = 0;
+	bool stable = false; // as the detector starts out
+	double lastQuery = -QUERY_REFRESH;
+	unsigned int next = 0; // next event
+	for( unsigned int tick=1; tick * QUERY_INTERVAL <= numColumns * columnSeconds + 1e-9; ++tick ){
+		double now = tick * QUERY_INTERVAL;
+		// the events before this tick, which the plot timer would have seen first
+		for( ; next < log.events.size() && log.events[next].second * columnSeconds <= now + 1e-9; ++next ){
+			stable = ( log.events[next].first == ENVIRONMENT_STABLE );
+			if( stable ){
+				++queries;
+				lastQuery = log.events[next].second * columnSeconds;
+			}
+		}
+		if( !stable || now - lastQuery >= QUERY_REFRESH - 1e-9 ){
+			++queries;
+			lastQuery = now;
+		}
+	}
+	return queries;
+}
+
+int eventsCommand( int argc, char** argv ){
+	bool fixedPoint = false;
+	int c;
+	while( ( c = getopt( argc, argv, "x" ) ) != -1 ){
+		switch( c ){
+			case 'x': fixedPoint = true; break;
+			default: return usage( argv[-1] );
+		}
+	}
+	if( optind >= argc ) return usage( argv[-1] );
+
+	SpectrumAnalyzer analyzer;
+	if( fixedPoint ) analyzer.setFixedPoint( true );
+	AudioStats stats = { 0, 0, 0, 0 };
+	EventLog log;
+	unsigned int timedQueries = 0, scheduledQueries = 0;
+	for( int a=optind; a<argc; ++a ){
+		log.filename = argv[a];
+		log.events.clear();
+		log.events.reserve( 1024 ); // so that the callback seldom allocates on the audio path
+		analyzer.setEnvironmentCallback( logEvent, &log );
+		if( !analyzeFile( argv[a], analyzer, NULL, stats ) ) return 1;
+		unsigned long long numColumns = analyzer.getNumColumns();
+		timedQueries += (unsigned int)( numColumns * ANALYZER_COLUMN_SAMPLES / ( QUERY_INTERVAL * ANALYZER_SAMPLE_RATE ) + 1e-9 );
+		scheduledQueries += eventQueries( log, numColumns );
+	}
+	printAudioStats( stats );
+	fprintf( stderr, "queries: %u every %g s, %u following the events (%.0f%%)\n", timedQueries, QUERY_INTERVAL,
+			 scheduledQueries, timedQueries? 100.0 * scheduledQueries / timedQueries : 0.0 );
+	return 0;
+}
+
+/* a stay in one place between walks, in seconds of audio, for the converge command */
+struct Stay{
+	double arrival;   // when the device became still
+	double settled;   // when the MotionGate fired
+	double departure; // when the device next moved, or the end of the audio
+};
+
+/* one pass of the converge command through a session */
+struct ConvergePass{
+	SpectrumAnalyzer* analyzer;
+	const vector<MotionRecord>* motion;
+	double motionOffset;  // motion timestamp of the first sample
+	unsigned int next;    // next motion record to add
+	bool gated;           // pass the motion on to the analyzer
+	MotionGate gate;      // finds the stays, fed the same samples as the analyzer's
+	vector<Stay> stays;
+	vector<double> times; // end of each column, in seconds
+	vector<float> columns, fingerprints; // every column, and the fingerprint after it
+};
+
+/* adds the motion heard up to the end of each column, as the motion handler would have meanwhile */
+void convergeColumn( const float* column, unsigned long long endSample, void* context ){
+	ConvergePass* p = (ConvergePass*)context;
+	double now = (double)endSample / ANALYZER_SAMPLE_RATE;
+	for( ; p->next < p->motion->size() && (*p->motion)[p->next].timestamp - p->motionOffset <= now; ++p->next ){
+		const MotionRecord* r = &(*p->motion)[p->next];
+		double t = r->timestamp - p->motionOffset;
+		bool wasMoving = p->gate.isMoving();
+		if( p->gate.addMotion( r ) ){
+			Stay stay = { t - p->gate.getStillSeconds(), t, -1 };
+			p->stays.push_back( stay );
+		}
+		if( p->gated ) p->analyzer->addMotion( r );
+		if( !wasMoving && p->gate.isMoving() && !p->stays.empty() && p->stays.back().departure < 0 ){
+			p->stays.back().departure = t;
+		}
+	}
+	p->times.push_back( now );
+	p->columns.insert( p->columns.end(), column, column + ANALYZER_FP_LENGTH );
+	p->fingerprints.resize( p->fingerprints.size() + ANALYZER_FP_LENGTH );
+	p->analyzer->getFingerprint( &p->fingerprints[p->fingerprints.size() - ANALYZER_FP_LENGTH] );
+}
+
+/* Streams the session through the analyzer.  @return false if the audio cannot be read. */
+bool convergePass( const char* filename, ConvergePass& p, bool fixedPoint, AudioStats& stats ){
+	SpectrumAnalyzer analyzer;
+	if( fixedPoint ) analyzer.setFixedPoint( true );
+	p.analyzer = &analyzer;
+	p.next = 0;
+	analyzer.setColumnCallback( convergeColumn, &p );
+	if( !analyzeFile( filename, analyzer, NULL, stats ) ) return false;
+	p.analyzer = NULL;
+	double end = p.times.empty()? 0 : p.times.back();
+	for( unsigned int i=0; i<p.stays.size(); ++i ){
+		if( p.stays[i].departure < 0 ) p.stays[i].departure = end;
+	}
+	return true;
+}
+
+/* the 5th percentile of each bin over columns [first,last), as Spectrogram would give if they filled its history */
+void stayFingerprint( const vector<float>& columns, unsigned int first, unsigned int last, float* out ){
+	unsigned int n = last - first;
+	unsigned int below = ceil( CONVERGE_PERCENTILE * n );
+	unsigned int rank = ( below > 0 )? below-1 : 0;
+	vector<float> values( n );
+	for( unsigned int k=0; k<ANALYZER_FP_LENGTH; ++k ){
+		for( unsigned int i=0; i<n; ++i ) values[i] = columns[(first+i)*ANALYZER_FP_LENGTH + k];
+		std::nth_element( values.begin(), values.begin() + rank, values.end() );
+		out[k] = values[rank];
+	}
+}
+
+/**
+ * Finds the first of columns [first,last) from which every fingerprint is within tolerance of reference.
+ * @return its index, or last if the last fingerprint is not.
+ */
+unsigned int convergedColumn( const vector<float>& fingerprints, unsigned int first, unsigned int last,
+							  const float* reference, double tolerance ){
+	unsigned int converged = first;
+	for( unsigned int i=first; i<last; ++i ){
+		const float* fp = &fingerprints[i*ANALYZER_FP_LENGTH];
+		double sum = 0;
+		for( unsigned int k=0; k<ANALYZER_FP_LENGTH; ++k ) sum += fabs( fp[k] - reference[k] );
+		if( !( sum / ANALYZER_FP_LENGTH <= tolerance ) ) converged = i+1;
+	}
+	return converged;
+}
+
+int convergeCommand( int argc, char** argv ){
+	bool fixedPoint = false;
+	double tolerance = CONVERGE_TOLERANCE_DB;
+	double offset = 0;
+	bool haveOffset = false;
+	int c;
+	while( ( c = getopt( argc, argv, "xd:o:" ) ) != -1 ){
+		switch( c ){
+			case 'x': fixedPoint = true; break;
+			case 'd': tolerance = atof( optarg ); break;
+			case 'o': offset = atof( optarg ); haveOffset = true; break;
+			default: return usage( argv[-1] );
+		}
+	}
+	if( argc - optind != 2 || !( tolerance > 0 ) ) return usage( argv[-1] );
+	const char* motionFilename = argv[optind];
+	const char* wavFilename = argv[optind+1];
+
+	// the motion log is small enough to hold
+	SensorLogReader log( motionFilename );
+	if( !log.isOpen() || log.getHeader().recordType != SensorLogMotion
+		|| log.getHeader().recordSize != sizeof(MotionRecord) ){
+		fprintf( stderr, "Error: %s is not a motion log\n", motionFilename );
+		return 1;
+	}
+	vector<MotionRecord> motion;
+	MotionRecord record;
+	while( log.next( &record ) ) motion.push_back( record );
+	if( motion.empty() ){
+		fprintf( stderr, "Error: %s has no records\n", motionFilename );
+		return 1;
+	}
+	if( !haveOffset ) offset = motion[0].timestamp;
+
+	// the same session with the history left alone, then cut by the gate
+	AudioStats stats = { 0, 0, 0, 0 };
+	ConvergePass plain, gated;
+	plain.motion = gated.motion = &motion;
+	plain.motionOffset = gated.motionOffset = offset;
+	plain.gated = false;
+	gated.gated = true;
+	if( !convergePass( wavFilename, plain, fixedPoint, stats ) ) return 1;
+	if( !convergePass( wavFilename, gated, fixedPoint, stats ) ) return 1;
+
+	printf( "file\tarrival\tsettle\tstay\tplain\tgated\n" );
+	const vector<double>& times = plain.times;
+	vector<float> reference( ANALYZER_FP_LENGTH );
+	unsigned int measured = 0, plainMissed = 0, gatedMissed = 0;
+	double plainSum = 0, gatedSum = 0;
+	for( unsigned int i=0; i<plain.stays.size(); ++i ){
+		const Stay& stay = plain.stays[i];
+		// the columns heard wholly within the stay
+		unsigned int first = std::lower_bound( times.begin(), times.end(),
+											   stay.arrival + (double)ANALYZER_SPEC_RES / ANALYZER_SAMPLE_RATE ) - times.begin();
+		unsigned int last = std::upper_bound( times.begin(), times.end(), stay.departure ) - times.begin();
+		if( last <= first ) continue;
+		stayFingerprint( plain.columns, first, last, &reference[0] );
+		unsigned int p = convergedColumn( plain.fingerprints, first, last, &reference[0], tolerance );
+		unsigned int g = convergedColumn( gated.fingerprints, first, last, &reference[0], tolerance );
+		printf( "%s\t%.2f\t%.2f\t%.2f", wavFilename, stay.arrival, stay.settled - stay.arrival, stay.departure - stay.arrival );
+		if( p < last ) printf( "\t%.2f", times[p] - stay.arrival );
+		else printf( "\t-" );
+		if( g < last ) printf( "\t%.2f\n", times[g] - stay.arrival );
+		else printf( "\t-\n" );
+		++measured;
+		// a stay which never converges counts as its whole length
+		plainSum += ( ( p < last )? times[p] : stay.departure ) - stay.arrival;
+		gatedSum += ( ( g < last )? times[g] : stay.departure ) - stay.arrival;
+		if( p == last ) ++plainMissed;
+		if( g == last ) ++gatedMissed;
+	}
+	printAudioStats( stats );
+	fprintf( stderr, "motion: %lu records, %lu stays after walking\n", (unsigned long)motion.size(),
+			 (unsigned long)plain.stays.size() );
+	if( measured ){
+		fprintf( stderr, "convergence to within %g dB: %.2f s on average without gating (%u never), "
+				 "%.2f s with it (%u never)\n", tolerance, plainSum / measured, plainMissed, gatedSum / measured, gatedMissed );
+	}
+	return 0;
+}
+
+/* runs a command, then fails it if the audio thread's work made a blocking call, which is
+ * only checked in build/tester-rtcheck */
+int runCommand( int (*command)( int, char** ), int argc, char** argv ){
+	int result = command( argc, argv );
+	if( realtimeViolations() ){
+		fprintf( stderr, "Error: %lu calls which may block on the audio thread\n", realtimeViolations() );
+		return 1;
+	}
+	return result;
+}
+
+/* runs the command named by argv[1] */
+int dispatch( int argc, char** argv ){
+	// commands parse their own options, with the command name as argv[0]
+	const char* command = argv[1];
+	if( !strcmp( command, "fingerprint" ) ) return runCommand( fingerprintCommand, argc-1, argv+1 );
+	if( !strcmp( command, "query" ) ) return runCommand( queryCommand, argc-1, argv+1 );
+	if( !strcmp( command, "insert" ) ) return runCommand( insertCommand, argc-1, argv+1 );
+	if( !strcmp( command, "delete" ) ) return deleteCommand( argc-1, argv+1 );
+	if( !strcmp( command, "expire" ) ) return expireCommand( argc-1, argv+1 );
+	if( !strcmp( command, "list" ) ) return listCommand( argc-1, argv+1 );
+	if( !strcmp( command, "coalesce" ) ) return coalesceCommand( argc-1, argv+1 );
+	if( !strcmp( command, "compare" ) ) return runCommand( compareCommand, argc-1, argv+1 );
+	if( !strcmp( command, "events" ) ) return runCommand( eventsCommand, argc-1, argv+1 );
+	if( !strcmp( command, "converge" ) ) return runCommand( convergeCommand, argc-1, argv+1 );
+	return usage( argv[0] );
+}
+
+int main( int argc, char** argv ){
+	const char* metricsFilename = NULL;
+	while( argc >= 3 && ( !strcmp( argv[1], "-M" ) || !strcmp( argv[1], "-L" ) ) ){
+		if( argv[1][1] == 'M' ) metricsFilename = argv[2];
+		else spectrogramLogFilename = argv[2];
+		argv[2] = argv[0];
+		argc -= 2;
+		argv += 2;
+	}
+	if( argc < 2 ) return usage( argv[0] );
+	int result = dispatch( argc, argv );
+	if( metricsFilename && !MetricsRegistry::shared()->writeFile( metricsFilename, metricsFormatOf( metricsFilename ) ) ){
+		return 1;
+	}
+	return result;
 }
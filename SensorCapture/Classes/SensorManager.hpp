@@ -6,16 +6,15 @@
 //  Copyright 2011 __MyCompanyName__. All rights reserved.
 //
 
-// for data motion file writing
-#import <iostream>
-#import <fstream>
-
-
 #import <Foundation/Foundation.h>
 #import <AVFoundation/AVFoundation.h>
 #import <CoreLocation/CoreLocation.h>
 #import <CoreMotion/CoreMotion.h>
 #import "SOLStumbler.h"
+#import "SensorLog.h"
+#import "CaptureFile.h"
+#import "Fingerprinter.h"
+#import "WavWriter.h"
 
 
 @interface SensorManager : NSObject <CLLocationManagerDelegate> {
@@ -25,17 +24,24 @@
     AVCaptureDeviceInput *videoInput;
     AVCaptureStillImageOutput *stillImageOutput;
 	NSTimer* stillTimer;
-	NSTimer* audioTimer;
 	NSTimer* scanTimer;
-	AVAudioRecorder* recorder;
+	Fingerprinter* fingerprinter; // audio input
+	SegmentedWavWriter* audioWriter; // records the audio input in segments, or NULL
+	SpectrumLogger* spectrumLogger; // logs the audio's spectra and fingerprints, or NULL
+	unsigned int audioSegments; // number of audio segments finished so far
 	
 	CLLocationManager *locationManager; 	// data for SkyHook/GPS localization
 	CMMotionManager* motionManager;
 	NSOperationQueue *opq; // operation queue for motion updates
-	NSTimeInterval bootTime; // used to convert timestamps
 	SOLStumbler *networksManager;
 	UIView *view; // view on top of which to flash when photo is taken. Can be null
-	std::ofstream *motionFile; // log file for motion data
+	CaptureWriter *capture; // file holding all of the session's data
+	SensorLogService *logService; // writes all of the logs below on one I/O thread
+	SensorLogWriter *motionLog; // capture stream for motion data
+	SensorLogWriter *locationLog; // capture stream for location updates
+	SensorLogWriter *wifiLog; // capture stream for Wi-Fi scans
+	unsigned int stillsStream; // capture stream for JPEG stills
+	unsigned int audioStream; // capture stream for WAV segments
 }
 
 @property (nonatomic,retain) NSString* storagePath;
@@ -44,20 +50,25 @@
 @property (nonatomic,retain) AVCaptureDeviceInput *videoInput;
 @property (nonatomic,retain) AVCaptureStillImageOutput *stillImageOutput;
 @property (nonatomic,retain) NSTimer* stillTimer;
-@property (nonatomic,retain) NSTimer* audioTimer;
 @property (nonatomic,retain) NSTimer* scanTimer;
-@property (nonatomic,retain) AVAudioRecorder* recorder;
+@property (nonatomic) Fingerprinter* fingerprinter;
+@property (nonatomic) SegmentedWavWriter* audioWriter;
+@property (nonatomic) SpectrumLogger* spectrumLogger;
 @property (nonatomic,retain) CLLocationManager *locationManager;
 @property (nonatomic,retain) CMMotionManager* motionManager;
 @property (nonatomic,retain) NSOperationQueue* opq;
-@property (nonatomic) NSTimeInterval bootTime;
 @property (nonatomic,retain) SOLStumbler *networksManager;
 @property (nonatomic,retain) UIView *view;
-@property (nonatomic) std::ofstream *motionFile;
+@property (nonatomic) CaptureWriter *capture;
+@property (nonatomic) SensorLogService *logService;
+@property (nonatomic) SensorLogWriter *motionLog;
+@property (nonatomic) SensorLogWriter *locationLog;
+@property (nonatomic) SensorLogWriter *wifiLog;
 
 -(id)initWithStoragePath:(NSString*)path view:(UIView*)view;
 -(CLLocation*)getLocation; // return the current GPSLocation from locationManager
 -(void) handleMotionData:(CMDeviceMotion*) motionData;
 -(void) scanWiFi;
+-(void) archiveAudio:(const char*)filename start:(NSTimeInterval)startTime; // moves a finished audio segment into the capture file, or deletes it
 
 @end
@@ -16,58 +16,60 @@
 @synthesize videoInput;
 @synthesize stillImageOutput;
 @synthesize stillTimer;
-@synthesize audioTimer;
 @synthesize scanTimer;
-@synthesize recorder;
+@synthesize fingerprinter;
+@synthesize audioWriter;
+@synthesize spectrumLogger;
 @synthesize locationManager;
 @synthesize motionManager;
 @synthesize opq;
-@synthesize bootTime;
 @synthesize networksManager;
 @synthesize view;
-@synthesize motionFile;
+@synthesize capture;
+@synthesize logService;
+@synthesize motionLog;
+@synthesize locationLog;
+@synthesize wifiLog;
 
 
--(void)stopAudio{
-	if( self.recorder != nil ){
-		[self.recorder stop];
-	}
-	
-}
+/* If FINGERPRINT_AUDIO is 1, the audio is passed through the Fingerprinter and only its spectra and
+ * fingerprints are stored, plus a short raw snippet now and then for verification.  This takes about
+ * 1.5 KB per second before compression, instead of 86 KB per second for storing all of the raw audio. */
+#define FINGERPRINT_AUDIO 1
+#define SPECTRUM_AVERAGE 4 // spectrogram columns (0.1 s each) averaged into each stored spectrum
+#define FINGERPRINT_INTERVAL 10 // spectrogram columns between stored fingerprints
+#define SNIPPET_SECONDS 2 // length of each raw audio snippet
+#define SNIPPET_INTERVAL 600 // seconds between the starts of raw audio snippets, or 0 for none
 
+#if FINGERPRINT_AUDIO
+#define AUDIO_SEGMENT_SECONDS SNIPPET_SECONDS
+#else
+#define AUDIO_SEGMENT_SECONDS 10
+#endif
 
--(void)restartAudio{
-	// build filename
-	NSDate *now = [NSDate date];
-	NSString *wavFile = [NSString stringWithFormat:@"%@/%.2f.wav",
-						 self.storagePath,[now timeIntervalSinceReferenceDate]];
-	NSURL *wavFileURL = [NSURL fileURLWithPath:wavFile];
-	
-	NSDictionary *recordSettings = [NSDictionary 
-									dictionaryWithObjectsAndKeys:
-									[NSNumber numberWithInt:kAudioFormatLinearPCM], 
-									AVFormatIDKey,
-									[NSNumber numberWithInt: 16], 
-									AVLinearPCMBitDepthKey,
-									[NSNumber numberWithInt: 1], 
-									AVNumberOfChannelsKey,
-									[NSNumber numberWithFloat:44100.0], 
-									AVSampleRateKey,
-									nil];
+// called on the audio writer's thread whenever a segment file is finished
+static void audioSegmentFinished( const char* filename, double startTime, unsigned int frames, void* context ){
+	NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+	[(SensorManager*)context archiveAudio:filename start:startTime];
+	[pool release];
+}
 
-	AVAudioRecorder* audioRecorder = [[AVAudioRecorder alloc] initWithURL:wavFileURL
-																 settings:recordSettings
-																	error:nil];
-	[audioRecorder prepareToRecord];
-	
-	// stop previous recorder, if any
-	[self stopAudio];
-	
-	// start new recorder
-	[audioRecorder record];
-	///NSLog(@"started recording to: %@", wavFile);
-	self.recorder = audioRecorder;
-	[audioRecorder release];
+-(void)archiveAudio:(const char*)filename start:(NSTimeInterval)startTime{
+	NSString* file = [NSString stringWithUTF8String:filename];
+#if FINGERPRINT_AUDIO && SNIPPET_INTERVAL > 0
+	// keep only the first segment of each snippet interval
+	bool keep = ( audioSegments++ % (SNIPPET_INTERVAL/SNIPPET_SECONDS) == 0 );
+#else
+	bool keep = true;
+#endif
+	if( keep ){
+		NSData* wav = [[NSData alloc] initWithContentsOfFile:file];
+		if( wav ){
+			self.capture->writeBlob( audioStream, startTime, [wav bytes], [wav length] );
+		}
+		[wav release];
+	}
+	[[NSFileManager defaultManager] removeItemAtPath:file error:nil];
 }
 
 
@@ -75,11 +77,23 @@
 	self = [super init];
 	if( self != nil ){
 		self.storagePath = path;
-		self.recorder = nil;
-		self.bootTime= -1.0; // set this when first motion event happens
 		self.networksManager = [[[SOLStumbler alloc] init] autorelease];
 		self.view = flashView;
-		self.motionFile = new std::ofstream();
+		// open the capture file, with a stream for each sensor.
+		// All of them share the timestamp base of CoreMotion, see SensorLog.h
+		NSString* filename = [NSString stringWithFormat:@"%@/%.2f.bpc", 
+							  path, [[NSDate date] timeIntervalSinceReferenceDate]];
+		self.capture = new CaptureWriter( [filename UTF8String], 
+										  SensorLogService::wallClock() - SensorLogService::now() );
+		self.logService = new SensorLogService();
+		self.motionLog = self.logService->openLog( self.capture, "motion", SensorLogMotion, sizeof(MotionRecord) );
+		self.locationLog = self.logService->openLog( self.capture, "location", SensorLogLocation, 
+													 sizeof(LocationRecord), 16*1024 );
+		self.wifiLog = self.logService->openLog( self.capture, "wifi", SensorLogWifi, 
+												 sizeof(WifiRecord), 64*1024 );
+		// JPEG and WAV data would not compress much
+		stillsStream = self.capture->addStream( "stills", SensorLogStill, 0, false );
+		audioStream = self.capture->addStream( "audio", SensorLogAudio, 0, false );
 		
 		// SET UP VIDEO DEVICE.  See code in AVCamDemo for dealing w/ device conection and disconnection
 		// find the correct video device
@@ -139,13 +153,30 @@
 														 userInfo:nil
 														  repeats:YES];
 		
-		// SET TIMER FOR AUDIO
-		[self restartAudio]; // get started immediately
-		self.audioTimer = [NSTimer scheduledTimerWithTimeInterval:10
-														   target:self
-														 selector:@selector(restartAudio)
-														 userInfo:nil
-														  repeats:YES];
+		// START AUDIO.  Raw audio is recorded continuously and cut into segments at exact sample
+		// boundaries, each of which is moved into the capture (or dropped) once it is finished.
+		// In FINGERPRINT_AUDIO mode the Fingerprinter's output is logged as well.
+		self.fingerprinter = new Fingerprinter();
+		self.audioWriter = NULL;
+		self.spectrumLogger = NULL;
+		audioSegments = 0;
+		if( !FINGERPRINT_AUDIO || SNIPPET_INTERVAL > 0 ){
+			self.audioWriter = new SegmentedWavWriter( [path UTF8String], Fingerprinter::sampleRate,
+													   AUDIO_SEGMENT_SECONDS*Fingerprinter::sampleRate,
+													   SensorLogService::wallClock() - SensorLogService::now() );
+			self.audioWriter->setSegmentCallback( audioSegmentFinished, self );
+			self.audioWriter->start();
+			self.fingerprinter->setRecorder( self.audioWriter );
+		}
+		if( FINGERPRINT_AUDIO ){
+			SensorLogWriter* spectrumLog = self.logService->openLog( self.capture, "spectra", SensorLogSpectrum,
+																	 sizeof(SpectrumRecord), 64*1024 );
+			SensorLogWriter* fingerprintLog = self.logService->openLog( self.capture, "fingerprints", SensorLogFingerprint,
+																		sizeof(SpectrumRecord), 16*1024 );
+			self.spectrumLogger = new SpectrumLogger( spectrumLog, fingerprintLog, SPECTRUM_AVERAGE, FINGERPRINT_INTERVAL );
+			self.fingerprinter->setSpectrumLogger( self.spectrumLogger );
+		}
+		self.fingerprinter->startRecording();
 		
 		// SET TIMER FOR WIFI SCAN
 		self.scanTimer = [NSTimer scheduledTimerWithTimeInterval:1
@@ -177,8 +208,10 @@
 			[self handleMotionData:motionData];
 		};
 		
-		// start receiving updates
+		// start receiving updates.
+		// The queue must be serial because motionLog accepts records from only one thread at a time.
 		self.opq = [[[NSOperationQueue alloc] init] autorelease];
+		self.opq.maxConcurrentOperationCount = 1;
 		[self.motionManager startDeviceMotionUpdatesToQueue:self.opq
 												withHandler:motionHandler];
 	}
@@ -210,12 +243,9 @@
                                                              if (imageDataSampleBuffer != NULL) {
                                                                  NSData *imageData = [AVCaptureStillImageOutput jpegStillImageNSDataRepresentation:imageDataSampleBuffer];
 																 
-																 // build filename
-																 NSDate *now = [NSDate date];
-																 NSString *jpgFile = [NSString stringWithFormat:@"%@/%.2f.jpg",
-																					  self.storagePath,[now timeIntervalSinceReferenceDate]];
-																 ///NSLog(@"wrote to file: %@",jpgFile);
-																 [imageData writeToFile:jpgFile atomically:YES];
+																 // save in the capture file
+																 self.capture->writeBlob( stillsStream, SensorLogService::now(),
+																						  [imageData bytes], [imageData length] );
 																 
 																 // flash screen
 																 if( self.view != nil ){
@@ -242,9 +272,15 @@
 }
 
 -(void)dealloc{
-	self.motionFile->close();
-	delete self.motionFile;
-	[self stopAudio];
+	[self.motionManager stopDeviceMotionUpdates];
+	[self.opq waitUntilAllOperationsAreFinished];
+	[self.locationManager stopUpdatingLocation];
+	self.fingerprinter->stopRecording();
+	delete self.audioWriter; // finishes and archives the last segment
+	delete self.spectrumLogger;
+	delete self.fingerprinter;
+	delete self.logService; // flushes and closes all logs
+	delete self.capture; // writes the index
 	[super dealloc];
 }
 
@@ -255,24 +291,22 @@
 -(void) scanWiFi{
 	[self.networksManager scanNetworks];
 	NSDictionary* networks = [[self.networksManager networks] retain];
-	// open data file for appending
-	NSString* filename = [NSString stringWithFormat:@"%@/scans.txt", self.storagePath];
-	std::ofstream dFile;
-	dFile.open([filename UTF8String], std::ios::out | std::ios::app);
-	NSTimeInterval now = [[NSDate date] timeIntervalSinceReferenceDate];
-	NSMutableString* newEntry = [[NSMutableString alloc] initWithFormat:@"%.2f\n",now];
-	// scan through each AP
-	for (id key in [self.networksManager networks]){
-		// save new line in data file
-		[newEntry appendFormat:@"\t%@\t%@\t%@\t%@\n",
-					key, //Station BBSID (MAC Address)
-					[[networks objectForKey: key] objectForKey:@"RSSI"], //Signal Strength
-					[[networks objectForKey: key] objectForKey:@"CHANNEL"],  //Operating Channel
-					[[networks objectForKey: key] objectForKey:@"SSID_STR"] //Station Name
-		 ];
+	// save one record per AP, all with the time of the scan
+	WifiRecord r;
+	r.timestamp = SensorLogService::now();
+	for (id key in networks){
+		NSDictionary* ap = [networks objectForKey: key];
+		unsigned int mac[6] = {0,0,0,0,0,0};
+		sscanf( [key UTF8String], "%x:%x:%x:%x:%x:%x", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5] );
+		for( int i=0; i<6; ++i ) r.bssid[i] = mac[i]; //Station BBSID (MAC Address)
+		r.rssi = [[ap objectForKey:@"RSSI"] intValue]; //Signal Strength
+		r.channel = [[ap objectForKey:@"CHANNEL"] intValue]; //Operating Channel
+		NSString* ssid = [ap objectForKey:@"SSID_STR"]; //Station Name
+		if( !ssid || ![ssid getCString:r.ssid maxLength:sizeof(r.ssid) encoding:NSUTF8StringEncoding] ){
+			r.ssid[0] = '\0';
+		}
+		if( self.wifiLog ) self.wifiLog->push( &r );
 	}
-	dFile << [newEntry UTF8String]; // append the new entry
-	dFile.close();
 	[networks release];
 }
 
@@ -284,18 +318,17 @@
     didUpdateToLocation:(CLLocation *)newLocation
            fromLocation:(CLLocation *)oldLocation 
 {
-	// convert userAcceleration to world frame
-	///multiplyVecByMat( &userAccel, motionData.attitude.rotationMatrix );
-	// save new line in data file
-	NSString* line = [newLocation description];
-	
-	// open data file for appending
-	NSString* filename = [NSString stringWithFormat:@"%@/location.txt", self.storagePath];
-	std::ofstream dFile;
-	dFile.open([filename UTF8String], std::ios::out | std::ios::app);
-	dFile.precision(13); // high precision for timestamp
-	dFile << [[NSDate date] timeIntervalSinceReferenceDate] << '\t' << [line UTF8String] << '\n'; // append the new entry
-	dFile.close();
+	// save new record in the log, with the fix's age converted to our clock
+	LocationRecord r;
+	r.timestamp = SensorLogService::now() + [newLocation.timestamp timeIntervalSinceNow];
+	r.latitude = newLocation.coordinate.latitude;
+	r.longitude = newLocation.coordinate.longitude;
+	r.altitude = newLocation.altitude;
+	r.horizontalAccuracy = newLocation.horizontalAccuracy;
+	r.verticalAccuracy = newLocation.verticalAccuracy;
+	r.speed = newLocation.speed;
+	r.course = newLocation.course;
+	if( self.locationLog ) self.locationLog->push( &r );
 }
 
 - (void)locationManager:(CLLocationManager *)manager
@@ -318,32 +351,20 @@ void multiplyVecByMat( CMAcceleration* a, CMRotationMatrix m ){
 
 
 -(void) handleMotionData:(CMDeviceMotion*) motionData{
-	// motionData timestamp is time since the device was booted.
-	// first set the timestamp offset, if needed
-	if( self.bootTime < 0 ){
-		NSTimeInterval currTime = [[NSDate date] timeIntervalSinceReferenceDate];
-		self.bootTime = currTime - motionData.timestamp;
-	}
 	CMAttitude* att = motionData.attitude;
 	CMAcceleration userAccel = motionData.userAcceleration;
 	CMAcceleration grav = motionData.gravity;
 	CMRotationRate rot = motionData.rotationRate;
 	// convert userAcceleration to world frame
 	///multiplyVecByMat( &userAccel, motionData.attitude.rotationMatrix );
-	// save new line in data file
-	NSString* line = [[NSString alloc] initWithFormat:@"%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\n", 
-					  motionData.timestamp+self.bootTime, userAccel.x, userAccel.y, userAccel.z,
-					  att.roll, att.pitch, att.yaw, rot.x, rot.y, rot.z, grav.x, grav.y, grav.z
-					  ]; 
-	
-	// if necessary, open data file for appending
-	if( !self.motionFile->is_open() ){
-		NSString* filename = [NSString stringWithFormat:@"%@/motion.txt", self.storagePath];
-		self.motionFile->open([filename UTF8String], std::ios::out | std::ios::app);
-	}
-	self.motionFile->precision(13); // high precision for timestamp
-	*(self.motionFile) << [line UTF8String]; // append the new entry
-	[line release];
+	// save new record in the log.  It is written to disk in the background; use sensorlog2txt to read it.
+	MotionRecord r;
+	r.timestamp = motionData.timestamp; // time since boot, the same clock as SensorLogService::now()
+	r.userAccel[0] = userAccel.x; r.userAccel[1] = userAccel.y; r.userAccel[2] = userAccel.z;
+	r.attitude[0] = att.roll; r.attitude[1] = att.pitch; r.attitude[2] = att.yaw;
+	r.rotationRate[0] = rot.x; r.rotationRate[1] = rot.y; r.rotationRate[2] = rot.z;
+	r.gravity[0] = grav.x; r.gravity[1] = grav.y; r.gravity[2] = grav.z;
+	if( self.motionLog ) self.motionLog->push( &r );
 }
 
 @end
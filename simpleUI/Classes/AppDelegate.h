@@ -10,6 +10,8 @@
 #import "Fingerprinter.h"
 #import "FingerprintDB.h"
 #import "RobustDictionary.h"
+#import "SensorLog.h"
+#import "Metrics.h"
 #import <vector>
 #import <CoreLocation/CoreLocation.h>
 #import <CoreMotion/CoreMotion.h>
@@ -36,9 +38,13 @@ using std::vector;
 	Fingerprinter* fp;
 	CLLocationManager *locationManager; 	// data for SkyHook/GPS localization
 	CMMotionManager* motionManager;
+	SensorLogService* logService; // writes sensor logs on its own thread, used only with detailedLogging
+	SensorLogWriter* motionLog; // binary log for motion data
+	MetricsReporter* metricsReporter; // exports the pipeline and database metrics, see Metrics.h
 	FingerprintDB* database;
 	RobustDictionary* options;
 	bool detailedLogging; // log fine-grained sensor data (for testing only!)
+	bool motionGating; // cut the fingerprint history when the user stops after walking, see MotionGate.h
 	NSTimer  *watchdogTimer; // periodic timer to reset audio if it's not working
 }
 
@@ -54,8 +60,12 @@ using std::vector;
 @property (nonatomic, retain) FingerprintDB* database;
 @property (nonatomic, retain) CLLocationManager *locationManager;  
 @property (nonatomic, retain) CMMotionManager* motionManager;
+@property (nonatomic) SensorLogService* logService;
+@property (nonatomic) SensorLogWriter* motionLog;
+@property (nonatomic) MetricsReporter* metricsReporter;
 @property (nonatomic, retain) RobustDictionary* options;
 @property (nonatomic) bool detailedLogging;
+@property (nonatomic) bool motionGating;
 @property (nonatomic, retain) NSTimer  *watchdogTimer;
 
 // member functions
@@ -63,7 +73,14 @@ using std::vector;
 -(CLLocation*)getLocation; // return the current GPSLocation from locationManager
 -(NSString*)getMotionDataFilename;
 -(NSString*)getSpectrogramFilename;
+-(NSString*)getMetricsFilename;
 -(void)checkAudio; // tests that audio is working, if not reset.
+// starts or stops the motion sensors as detailedLogging and motionGating need them
+-(void) updateMotionUpdates;
+// sets motionGating, saves it in the options and starts or stops the motion sensors
+-(void) setMotionGatingOption:(bool)enabled;
+// sets the database's acousticMetric and saves it in the options
+-(void) setAcousticMetricOption:(AcousticMetric)metric;
 
 // show details of a room
 -(void) showRoom:(NSString*)room inBuilding:(NSString*)building;
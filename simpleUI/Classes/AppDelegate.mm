@@ -21,6 +21,9 @@
 
 using namespace std;
 
+#define METRICS_SNAPSHOT_INTERVAL 60 // seconds between snapshots of the metrics in the documents folder
+#define METRICS_SCRAPE_PORT 9100     // local HTTP port serving the metrics, only with detailedLogging
+
 
 @implementation AppDelegate
 
@@ -35,8 +38,12 @@ using namespace std;
 @synthesize database;
 @synthesize locationManager;
 @synthesize motionManager;
+@synthesize logService;
+@synthesize motionLog;
+@synthesize metricsReporter;
 @synthesize options;
 @synthesize detailedLogging;
+@synthesize motionGating;
 @synthesize watchdogTimer;
 
 - (void) printFingerprint: (Fingerprint) fingerprint{
@@ -188,13 +195,22 @@ void multiplyVecByMat( CMAcceleration* a, CMRotationMatrix m ){
 	a->z = old_a.x * m.m31 + old_a.y * m.m32 + old_a.z * m.m33;	
 }
 
+-(NSString*)getMetricsFilename{
+	// get the documents directory:
+	NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
+	NSString *documentsDirectory = [paths objectAtIndex:0];
+	
+	// build the full filename
+	return [NSString stringWithFormat:@"%@/%@", documentsDirectory, @"metrics.json"];
+}
+
 -(NSString*)getMotionDataFilename{
 	// get the documents directory:
 	NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
 	NSString *documentsDirectory = [paths objectAtIndex:0];
 	
 	// build the full filename
-	return [NSString stringWithFormat:@"%@/%@", documentsDirectory, @"motion.txt"];
+	return [NSString stringWithFormat:@"%@/%@", documentsDirectory, @"motion.bin"];
 }
 
 -(NSString*)getSpectrogramFilename{
@@ -203,29 +219,61 @@ void multiplyVecByMat( CMAcceleration* a, CMRotationMatrix m ){
 	NSString *documentsDirectory = [paths objectAtIndex:0];
 	
 	// build the full filename
-	return [NSString stringWithFormat:@"%@/%@", documentsDirectory, @"spectrogram.txt"];
+	return [NSString stringWithFormat:@"%@/%@", documentsDirectory, @"spectrogram.bin"];
 }
 
 -(void) handleMotionData:(CMDeviceMotion*) motionData{
 	CMAttitude* att = motionData.attitude;
 	CMAcceleration userAccel = motionData.userAcceleration;
+	CMAcceleration grav = motionData.gravity;
+	CMRotationRate rot = motionData.rotationRate;
 	// convert userAcceleration to world frame
 	///multiplyVecByMat( &userAccel, motionData.attitude.rotationMatrix );
-	// save new line in data file
-	NSString* line = [[NSString alloc] initWithFormat:@"%f\t%f\t%f\t%f\t%f\t%f\t%f\n", 
-					  motionData.timestamp, userAccel.x, userAccel.y, userAccel.z,
-					  att.roll, att.pitch, att.yaw
-					  ]; 
-		
-	// open data file for appending
-	NSString* filename = [[self getMotionDataFilename] retain];
-	std::ofstream dFile;
-	dFile.open([filename UTF8String], std::ios::out | std::ios::app);
-	dFile << [line UTF8String]; // append the new entry
-	dFile.close();
-	[filename release];
+	// save new record in the log.  It is written to disk in the background; use sensorlog2txt to read it.
+	MotionRecord r;
+	r.timestamp = motionData.timestamp;
+	r.userAccel[0] = userAccel.x; r.userAccel[1] = userAccel.y; r.userAccel[2] = userAccel.z;
+	r.attitude[0] = att.roll; r.attitude[1] = att.pitch; r.attitude[2] = att.yaw;
+	r.rotationRate[0] = rot.x; r.rotationRate[1] = rot.y; r.rotationRate[2] = rot.z;
+	r.gravity[0] = grav.x; r.gravity[1] = grav.y; r.gravity[2] = grav.z;
+	if( self.motionLog ) self.motionLog->push( &r );
+	// let the fingerprinter know when the user has walked somewhere and stopped
+	if( self.motionGating ) self.fp->addMotion( &r );
+}
+
+-(void) updateMotionUpdates{
+	[self.motionManager stopDeviceMotionUpdates];
+	if( !self.detailedLogging && !self.motionGating ) return; // leave the sensors off
+	
+	if( !self.motionManager ){
+		self.motionManager = [[[CMMotionManager alloc] init] autorelease];
+		if(!motionManager.deviceMotionAvailable){
+			NSLog(@"ERROR: device motion not available!");
+		}
+	}
+	if( self.detailedLogging ){
+		self.motionManager.deviceMotionUpdateInterval = 0.001; //in seconds.  If a very small value is chosen, then the minimum HW sampling period is used instead
+	}else{
+		self.motionManager.deviceMotionUpdateInterval = 0.02; // 50 Hz is plenty to tell walking from standing
+	}
 	
-	[line release];
+	// block for motion data callback
+	CMDeviceMotionHandler motionHandler = ^ (CMDeviceMotion *motionData, NSError *error) {
+		[self handleMotionData:motionData];
+	};
+	[self.motionManager startDeviceMotionUpdatesToQueue:[NSOperationQueue mainQueue]
+											withHandler:motionHandler];
+}
+
+-(void) setMotionGatingOption:(bool)enabled{
+	self.motionGating = enabled;
+	[self.options setObject:[NSNumber numberWithBool:enabled] forKey:@"motionGating"];
+	[self updateMotionUpdates];
+}
+
+-(void) setAcousticMetricOption:(AcousticMetric)metric{
+	self.database.acousticMetric = metric;
+	[self.options setObject:[NSString stringWithUTF8String:acousticMetricName( metric )] forKey:@"acousticMetric"];
 }
 
 #pragma mark -
@@ -264,32 +312,54 @@ void multiplyVecByMat( CMAcceleration* a, CMRotationMatrix m ){
 		self.options = dict;
 		[dict release];
 	}
+	// motion gating is off unless the user turns it on, since it keeps the motion sensors running
+	self.motionGating = [[self.options objectForKey:@"motionGating"] boolValue];
 		
 	window.backgroundColor = [UIColor groupTableViewBackgroundColor]; // set striped BG
 	
+	// export the metrics of the fingerprinter, database and logs, as the command-line tools do
+	self.metricsReporter = new MetricsReporter();
+	self.metricsReporter->setSnapshotFile( [[self getMetricsFilename] UTF8String], METRICS_SNAPSHOT_INTERVAL );
+	if( self.detailedLogging ) self.metricsReporter->setScrapePort( METRICS_SCRAPE_PORT );
+	self.metricsReporter->start();
+	
 	// set up fingerprinter
 	self.fp = new Fingerprinter();
 	self.database = [[[FingerprintDB alloc] initWithFPLength:Fingerprinter::fpLength] autorelease];
+	// the distance used to compare fingerprints, from the "acousticMetric" option; see DistanceMetrics.h
+	NSString* metricName = [self.options objectForKey:@"acousticMetric"];
+	AcousticMetric metric;
+	if( metricName && parseAcousticMetric( [metricName UTF8String], &metric ) ){
+		self.database.acousticMetric = metric;
+	}
+	// drop location tags older than the "expiryDays" option, if it is set, since rooms change
+	double expiryDays = [[self.options objectForKey:@"expiryDays"] doubleValue];
+	if( expiryDays > 0 ){
+		long long expiryTime = [[NSDate date] timeIntervalSince1970] - expiryDays*24*60*60;
+		unsigned int numExpired = [self.database expireEntriesOlderThan:expiryTime];
+		if( numExpired > 0 ) NSLog(@"expired %u database entries older than %g days", numExpired, expiryDays);
+	}
+	// with the "coalesceDistance" option set, near-duplicate location tags are merged as they are
+	// inserted, and the tags saved before it was set are merged now
+	float coalesceDistance = [[self.options objectForKey:@"coalesceDistance"] floatValue];
+	if( coalesceDistance > 0 ){
+		self.database.coalesceDistance = coalesceDistance;
+		CoalesceReport report;
+		[self.database coalesceEntriesWithin:coalesceDistance report:&report compareRankings:self.detailedLogging];
+	}
 		
-	// set up motion and spectrogram logging
+	// set up motion updates, for logging and for the fingerprinter's motion gating.
+	// They are handled on the main queue, which is serial, as motionLog and
+	// Fingerprinter::addMotion() require.
+	if( self.detailedLogging ){
+		self.logService = new SensorLogService();
+		self.motionLog = self.logService->openLog( [[self getMotionDataFilename] UTF8String], 
+												   SensorLogMotion, sizeof(MotionRecord) );
+	}
+	[self updateMotionUpdates];
+	
+	// set up logging of spectrogram
 	if( self.detailedLogging ){
-		self.motionManager = [[[CMMotionManager alloc] init] autorelease];
-		self.motionManager.deviceMotionUpdateInterval = 0.001; //in seconds.  If a very small value is chosen, then the minimum HW sampling period is used instead
-
-		if(!motionManager.deviceMotionAvailable){
-			NSLog(@"ERROR: device motion not available!");
-		}
-			
-		// block for motion data callback
-		CMDeviceMotionHandler motionHandler = ^ (CMDeviceMotion *motionData, NSError *error) {
-			[self handleMotionData:motionData];
-		};
-		
-		// start receiving updates
-		[self.motionManager startDeviceMotionUpdatesToQueue:[NSOperationQueue currentQueue]
-												withHandler:motionHandler];
-		
-		// set up logging of spectrogram
 		self.fp->spectrogram.enableLoggingToFilename( [[self getSpectrogramFilename] UTF8String] );
 	}
 		
@@ -339,6 +409,9 @@ void multiplyVecByMat( CMAcceleration* a, CMRotationMatrix m ){
      If your application supports background execution, called instead of applicationWillTerminate: when the user quits.
      */
 	self.fp->stopRecording();
+	// we may be killed without applicationWillTerminate, so save coalesced inserts and the metrics now
+	[self.database saveIfDirty];
+	MetricsRegistry::shared()->writeFile( [[self getMetricsFilename] UTF8String], MetricsJson );
 }
 
 
@@ -365,6 +438,10 @@ void multiplyVecByMat( CMAcceleration* a, CMRotationMatrix m ){
      */
 	self.fp->stopRecording();
 	[self.motionManager stopDeviceMotionUpdates]; // turn off sensors.
+	if( self.logService ) self.logService->close(); // write out buffered sensor data
+	self.motionLog = NULL; // closed by the service
+	if( self.metricsReporter ) self.metricsReporter->stop(); // writes a last snapshot
+	[self.database saveIfDirty];
 }
 
 
@@ -390,6 +467,7 @@ void multiplyVecByMat( CMAcceleration* a, CMRotationMatrix m ){
 	[self.database release];
     [self.locationManager release];
 	[self.motionManager release];
+	delete self.logService;
     
 	[super dealloc];
 }
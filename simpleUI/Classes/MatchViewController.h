@@ -20,8 +20,14 @@ using std::vector;
 	AppDelegate *app;
 	PlotView *plot;            // live fingerprint plot
 	Fingerprint newFingerprint;
+	bool haveFingerprint; // newFingerprint has held real data, rather than the blank fingerprint
+	Fingerprint* recentFingerprints; // ring of fingerprints seen at recent queries, for ensemble queries
+	unsigned int recentCount; // number of valid fingerprints in recentFingerprints
+	unsigned int recentNext; // ring index where the next fingerprint will be stored
 	NSTimer  *plotTimer; // periodic timer to update the plot
 	NSTimer  *queryTimer; // periodic timer to query the DB for matches
+	EnvironmentStatus environment; // Fingerprinter's environment status at the last plot update
+	NSTimeInterval lastQueryTime; // when query was last called, since the reference date
 	UITableView *matchTable; // UI table of DB matches
 	NSMutableArray* matches; // array of query result matches
     DistanceMetric distanceMetric; // acoustic vs physical distance for DB match query
@@ -46,6 +52,7 @@ using std::vector;
 - (id)initWithApp:(AppDelegate *)theApp;
 
 -(void) query;
+-(void) timedQuery;
 -(void) updatePlot;
 
 @end
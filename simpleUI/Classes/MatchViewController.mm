@@ -28,6 +28,10 @@
 
 // CONSTANTS
 static const int numCandidates = 10;
+static const unsigned int numRecentFingerprints = 5; // how many queries' fingerprints are combined in each query
+static const NSTimeInterval queryInterval = 2; // seconds between timed queries while the environment is changing
+static const NSTimeInterval queryRefreshInterval = 30; // seconds between timed queries while it is stable
+static const unsigned int changeKeepColumns = 3; // spectrogram columns kept at a change, about those which showed it
 
 #pragma mark -
 #pragma mark UIViewController inherited
@@ -68,6 +72,19 @@ static const int numCandidates = 10;
 		// blank fingerprint
 		self.newFingerprint[i] = 0;
 	}
+	haveFingerprint = false;
+	// allocate history of fingerprints used in ensemble queries
+	recentFingerprints = new Fingerprint[numRecentFingerprints];
+	for( unsigned int i=0; i<numRecentFingerprints; ++i ){
+		recentFingerprints[i] = new float[Fingerprinter::fpLength];
+	}
+	recentCount = 0;
+	recentNext = 0;
+	// no environment events seen yet, so that any which came before are acted on
+	environment.stable = false;
+	environment.changes = 0;
+	environment.stabilizations = 0;
+	lastQueryTime = 0;
 	
     // create label for plot
     UILabel* label = [[UILabel alloc] initWithFrame:CGRectMake(90, self.topPadding + 7, 210, 20)];
@@ -179,9 +196,9 @@ static const int numCandidates = 10;
 	}
 	if( !queryTimer ){
 		// create timer to continuously query
-		self.queryTimer = [NSTimer scheduledTimerWithTimeInterval:2
+		self.queryTimer = [NSTimer scheduledTimerWithTimeInterval:queryInterval
 														   target:self
-														 selector:@selector(query)
+														 selector:@selector(timedQuery)
 														 userInfo:nil
 														  repeats:YES];
 	}
@@ -201,15 +218,46 @@ static const int numCandidates = 10;
 #pragma mark -
 #pragma mark app events
 
+/* called by timer.  While the environment is stable, queries follow its events instead, see updatePlot */
+-(void) timedQuery{
+	if( !environment.stable
+	    || [NSDate timeIntervalSinceReferenceDate] - lastQueryTime >= queryRefreshInterval ){
+		[self query];
+	}
+}
+
 -(void) query{
+	lastQueryTime = [NSDate timeIntervalSinceReferenceDate];
+	// remember the current fingerprint, overwriting the oldest one.  Blank fingerprints (no data yet)
+	// and repeats (eg. when query is triggered by a tab change) are skipped.
+	unsigned int last = (recentNext+numRecentFingerprints-1) % numRecentFingerprints;
+	if( haveFingerprint && ( recentCount == 0 || 
+	    memcmp( recentFingerprints[last], self.newFingerprint, sizeof(float)*Fingerprinter::fpLength ) ) ){
+		memcpy( recentFingerprints[recentNext], self.newFingerprint, sizeof(float)*Fingerprinter::fpLength );
+		recentNext = (recentNext+1) % numRecentFingerprints;
+		if( recentCount < numRecentFingerprints ) ++recentCount;
+	}
+	// list the remembered fingerprints, oldest first
+	const float* observations[numRecentFingerprints];
+	unsigned int numObservations = recentCount;
+	for( unsigned int i=0; i<recentCount; ++i ){
+		observations[i] = recentFingerprints[(recentNext+numRecentFingerprints-recentCount+i) % numRecentFingerprints];
+	}
+	if( numObservations == 0 ){
+		observations[0] = self.newFingerprint;
+		numObservations = 1;
+	}
+	
 	// query for matches
 	[matches removeAllObjects]; // clear previous results
-	[app.database startQueryWithObservation:self.newFingerprint
-								 numMatches:numCandidates
-								   location:[app getLocation]
-							 distanceMetric:distanceMetric
-							   resultTarget:self
-								   selector:@selector(updateMatches:)];
+	[app.database startQueryWithObservations:observations
+							 numObservations:numObservations
+								  numMatches:numCandidates
+									location:[app getLocation]
+							  distanceMetric:distanceMetric
+								 aggregation:EnsembleAggregationMean
+								resultTarget:self
+									selector:@selector(updateMatches:)];
 
 	// UNRELATED TO QUERY... but it's convenient to update the map at the same time
 	// update map with current CoreLocation location
@@ -236,12 +284,36 @@ static const int numCandidates = 10;
 		// if successful, then redraw
 		[self.plot setNeedsDisplay];
 		
+		// until the first spectrogram column arrives the fingerprint is still blank, all zeros.
+		// Any bin may be zero or below in a real one, so all of them are checked.
+		for( int i=0; !haveFingerprint && i<Fingerprinter::fpLength; ++i ){
+			if( self.newFingerprint[i] != 0 ) haveFingerprint = true;
+		}
 		// if fingerprint is newly available, then dismiss alert
-		if( alert.visible && self.newFingerprint[0]>0 ){
+		if( alert.visible && haveFingerprint ){
 			[alert dismissWithClickedButtonIndex:0 animated:YES];
 			[self.plot autoRange]; // set plot range
 		}
 	}
+
+	// act on the environment events since the last update
+	EnvironmentStatus status;
+	app.fp->getEnvironmentStatus( &status );
+	if( status.changes != environment.changes ){
+		// a new room: forget the fingerprints of the old one, so that they are not in the ensemble
+		recentCount = 0;
+		recentNext = 0;
+		// and its spectrogram columns, so that the query at the stable event describes the new room
+		// (see convergebench -c -f).  A change which has already settled, eg. one from before the
+		// view loaded, has new columns worth keeping.
+		if( !status.stable ) app.fp->forgetHistory( changeKeepColumns );
+	}
+	bool settled = status.stable && status.stabilizations != environment.stabilizations;
+	environment = status;
+	if( settled ){
+		// query the new environment right away, rather than at the next timed query
+		[self query];
+	}
 }
 
 
@@ -362,6 +434,10 @@ static const int numCandidates = 10;
 	[plotTimer release];
 	[queryTimer release];
 	delete[] newFingerprint;
+	for( unsigned int i=0; i<numRecentFingerprints; ++i ){
+		delete[] recentFingerprints[i];
+	}
+	delete[] recentFingerprints;
 	[matchTable release];
 	[alert release];
 	[tabBar release];
@@ -92,10 +92,17 @@
 -(void) viewWillAppear:(BOOL)animated{
 	[super viewWillAppear:animated];
 	if( [currentBuilding isEqualToString:@""] ){
-		// by default set building picker to <new>
+		// by default set building picker to the building tagged most recently, or else <new>
 		// Note that we call pickerView:numberOfRowsInComponent: to build buildingCache
-		[roomPicker selectRow:[self pickerView:roomPicker numberOfRowsInComponent:0]-1
-				  inComponent:0 animated:NO];
+		NSInteger row = [self pickerView:roomPicker numberOfRowsInComponent:0]-1;
+		vector<DBEntry*> newest;
+		if( [app.database getNewestEntries:newest] ){
+			for( unsigned int i=0; i<buildingsCache.size(); ++i ){
+				if( [buildingsCache[i] isEqualToString:newest[0].building] ) row = i;
+			}
+		}
+		[roomPicker selectRow:row inComponent:0 animated:NO];
+		[self pickerView:roomPicker didSelectRow:row inComponent:0];
 	}
     // update picker to reflect possible database changes (new/deleted rooms)
     [roomPicker reloadAllComponents];
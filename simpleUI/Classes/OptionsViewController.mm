@@ -73,7 +73,7 @@
     if( section == 0 ){
 		return 2;
 	}else if( section == 1 ){
-		return 3;
+		return 5;
 	}else if( section == 2 ){
 		return 2;
 	}else{
@@ -93,6 +93,7 @@
     }
 	
 	cell.accessoryView = nil;
+	cell.selectionStyle = UITableViewCellSelectionStyleBlue;
 
 	// Configure the cell...
 	if( indexPath.section == 0 ){
@@ -108,6 +109,25 @@
 			cell.textLabel.text = @"Load database";
 		}else if(indexPath.row == 2){
 			cell.textLabel.text = @"Clear database";
+		}else if(indexPath.row == 3){
+			// cut the fingerprint history when the user stops after walking, see MotionGate.h
+			cell.textLabel.text = @"Motion gating";
+			cell.selectionStyle = UITableViewCellSelectionStyleNone;
+			UISwitch* toggle = [[[UISwitch alloc] init] autorelease];
+			toggle.on = self.app.motionGating;
+			[toggle addTarget:self action:@selector(motionGatingChanged:) 
+			 forControlEvents:UIControlEventValueChanged];
+			cell.accessoryView = toggle;
+		}else if(indexPath.row == 4){
+			// how fingerprints are compared in queries, see DistanceMetrics.h
+			cell.textLabel.text = @"Distance";
+			cell.selectionStyle = UITableViewCellSelectionStyleNone;
+			UISegmentedControl* metrics = [[[UISegmentedControl alloc] initWithItems:
+				[NSArray arrayWithObjects:@"L2", @"L1", @"Cosine", @"Corr.", nil]] autorelease];
+			metrics.selectedSegmentIndex = [self segmentOfMetric:self.app.database.acousticMetric];
+			[metrics addTarget:self action:@selector(acousticMetricChanged:) 
+			  forControlEvents:UIControlEventValueChanged];
+			cell.accessoryView = metrics;
 		}
 	}else if( indexPath.section == 2 ){
 		if( indexPath.row == 0 ){
@@ -124,6 +144,27 @@
 #pragma mark -
 #pragma mark Table view delegate
 
+// motion gating switch
+- (void)motionGatingChanged:(UISwitch*)toggle{
+	[self.app setMotionGatingOption:toggle.on];
+}
+
+// the metrics offered by the distance control, in the order of its segments
+static const AcousticMetric segmentMetrics[] = 
+	{ AcousticMetricL2, AcousticMetricL1, AcousticMetricCosine, AcousticMetricCorrelation };
+
+- (NSInteger)segmentOfMetric:(AcousticMetric)metric{
+	for( NSInteger i=0; i<(NSInteger)(sizeof(segmentMetrics)/sizeof(segmentMetrics[0])); ++i ){
+		if( segmentMetrics[i] == metric ) return i;
+	}
+	return 0;
+}
+
+// distance metric control
+- (void)acousticMetricChanged:(UISegmentedControl*)metrics{
+	[self.app setAcousticMetricOption:segmentMetrics[metrics.selectedSegmentIndex]];
+}
+
 - (void)tableView:(UITableView *)tableView didSelectRowAtIndexPath:(NSIndexPath *)indexPath {
 	// Email DB or feedback
 	if( indexPath.row == 0 ){
@@ -149,9 +190,10 @@
 				[mailer addAttachmentData:[NSData dataWithContentsOfFile:[app getMotionDataFilename]] 
 								 mimeType:@"text/plain" 
 								 fileName:@"motion.txt"];
+				// a binary sensor log of spectra, like the motion log; read it with sensorlog2txt
 				[mailer addAttachmentData:[NSData dataWithContentsOfFile:[app getSpectrogramFilename]] 
-								 mimeType:@"text/plain" 
-								 fileName:@"spectrogram.txt"];
+								 mimeType:@"application/octet-stream" 
+								 fileName:@"spectrogram.bin"];
 			}else if(indexPath.section == 0 ){
 				// email feedback
 				[mailer setSubject:[NSString stringWithFormat:@"[Batphone feedback v%@]",